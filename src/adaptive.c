@@ -0,0 +1,102 @@
+#include "adaptive.h"
+
+#define ADAPTIVE_BACKOFF 0.7
+#define ADAPTIVE_MAX_ERROR_RATE 0.05
+
+void adaptive_init(adaptive_t *a, int initial, int min, int max, double target_ms) {
+    pthread_mutex_init(&a->lock, NULL);
+    a->min = min < 1 ? 1 : min;
+    a->max = max < a->min ? a->min : max;
+    a->limit = initial < a->min ? a->min : initial > a->max ? a->max : initial;
+    a->target_ms = target_ms;
+    a->max_error_rate = ADAPTIVE_MAX_ERROR_RATE;
+    a->backoff = ADAPTIVE_BACKOFF;
+    a->slow_start = 1;
+    a->best_ms = 0;
+    a->last_mean_ms = 0;
+    a->round_erases = a->round_errors = a->round_samples = 0;
+    a->round_sum_ms = 0;
+    a->round_backed_off = 0;
+    a->increases = a->decreases = 0;
+}
+
+static void new_round_locked(adaptive_t *a) {
+    a->round_erases = 0;
+    a->round_errors = 0;
+    a->round_samples = 0;
+    a->round_sum_ms = 0;
+    a->round_backed_off = 0;
+}
+
+static void back_off_locked(adaptive_t *a) {
+    int limit = (int)(a->limit * a->backoff);
+    a->limit = limit < a->min ? a->min : limit;
+    a->slow_start = 0;
+    a->decreases++;
+    new_round_locked(a);
+    a->round_backed_off = 1;
+}
+
+adaptive_change_t adaptive_observe(adaptive_t *a, double handshake_ms, int error, int *limit) {
+    adaptive_change_t change = ADAPTIVE_HOLD;
+    pthread_mutex_lock(&a->lock);
+    int before = a->limit;
+    a->round_erases++;
+    if (error) {
+        a->round_errors++;
+    }
+    if (handshake_ms >= 0) {
+        a->round_samples++;
+        a->round_sum_ms += handshake_ms;
+    }
+    if (error && !a->round_backed_off) {
+        back_off_locked(a);
+        change = ADAPTIVE_BACKOFF_ERROR;
+    } else if (a->round_erases >= a->limit) {
+        double mean = a->round_samples ? a->round_sum_ms / a->round_samples : 0;
+        double error_rate = (double)a->round_errors / a->round_erases;
+        if (a->round_samples && (a->best_ms == 0 || mean < a->best_ms)) {
+            a->best_ms = mean;
+        }
+        a->last_mean_ms = mean;
+        double target = a->target_ms > 0 ? a->target_ms : 2 * a->best_ms;
+        if (a->round_samples && mean > target) {
+            back_off_locked(a);
+            change = ADAPTIVE_BACKOFF_LATENCY;
+        } else {
+            if (error_rate <= a->max_error_rate && a->limit < a->max) {
+                int grown = a->slow_start ? a->limit * 2 : a->limit + 1;
+                a->limit = grown > a->max ? a->max : grown;
+                a->increases++;
+                change = ADAPTIVE_GROW;
+            }
+            new_round_locked(a);
+        }
+    }
+    if (a->limit == before && change != ADAPTIVE_HOLD) {
+        // Already at a bound; nothing to tell the scheduler
+        change = ADAPTIVE_HOLD;
+    }
+    *limit = a->limit;
+    pthread_mutex_unlock(&a->lock);
+    return change;
+}
+
+int adaptive_set_max(adaptive_t *a, int max) {
+    pthread_mutex_lock(&a->lock);
+    a->max = max < a->min ? a->min : max;
+    if (a->limit > a->max) {
+        a->limit = a->max;
+    }
+    int limit = a->limit;
+    pthread_mutex_unlock(&a->lock);
+    return limit;
+}
+
+void adaptive_print(adaptive_t *a, FILE *out) {
+    pthread_mutex_lock(&a->lock);
+    fprintf(out, "Concurrency: limit=%d min=%d max=%d increases=%llu decreases=%llu handshake_ms=%.3f best_handshake_ms=%.3f\n",
+            a->limit, a->min, a->max, (unsigned long long)a->increases, (unsigned long long)a->decreases,
+            a->last_mean_ms, a->best_ms);
+    pthread_mutex_unlock(&a->lock);
+}
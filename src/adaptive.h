@@ -0,0 +1,60 @@
+#ifndef IDEVICEERASE_ADAPTIVE_H
+#define IDEVICEERASE_ADAPTIVE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// AIMD concurrency controller for --adaptive.
+//
+// Finished erases are grouped into rounds of 'limit' erases each. After a
+// round whose mean handshake latency stayed within the target and whose
+// error rate stayed within max_error_rate, the limit grows: it doubles
+// until the first back-off (slow start), then grows by one. A timeout or a
+// connection error, or a round over the latency target, cuts it by
+// 'backoff' right away, at most once per round. Without an explicit target
+// the latency target is twice the best round mean seen so far.
+
+typedef enum {
+    ADAPTIVE_HOLD = 0,
+    ADAPTIVE_GROW,
+    ADAPTIVE_BACKOFF_ERROR,
+    ADAPTIVE_BACKOFF_LATENCY
+} adaptive_change_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int limit;
+    int min;
+    int max;
+    double target_ms;           // 0: twice best_ms
+    double max_error_rate;
+    double backoff;             // factor applied on back-off
+    int slow_start;
+
+    double best_ms;             // lowest round mean
+    double last_mean_ms;
+    // Current round
+    int round_erases;
+    int round_errors;
+    int round_samples;
+    double round_sum_ms;
+    int round_backed_off;
+
+    uint64_t increases;
+    uint64_t decreases;
+} adaptive_t;
+
+void adaptive_init(adaptive_t *a, int initial, int min, int max, double target_ms);
+
+// Feeds one finished erase. handshake_ms < 0 if the handshake did not run.
+// Returns what happened to the limit; *limit is set to the current one.
+adaptive_change_t adaptive_observe(adaptive_t *a, double handshake_ms, int error, int *limit);
+
+// Upper bound changed, e.g. by a profile reload; returns the new limit
+int adaptive_set_max(adaptive_t *a, int max);
+
+// Prints "Concurrency: limit=... min=... max=... increases=... decreases=... handshake_ms=..."
+void adaptive_print(adaptive_t *a, FILE *out);
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE 4096
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+    arena_chunk_t *next;
+    size_t size;    // usable bytes in data
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+struct arena_deferred {
+    arena_deferred_t *next;
+    void (*fn)(void *);
+    void *ptr;
+    size_t size;
+};
+
+void arena_init(arena_t *a, size_t limit, arena_hook_fn hook, void *hook_data) {
+    memset(a, 0, sizeof(*a));
+    a->limit = limit;
+    a->hook = hook;
+    a->hook_data = hook_data;
+}
+
+static arena_chunk_t *arena_grow(arena_t *a, size_t size) {
+    size_t usable = size > ARENA_CHUNK_SIZE - sizeof(arena_chunk_t) ? size : ARENA_CHUNK_SIZE - sizeof(arena_chunk_t);
+    size_t total = sizeof(arena_chunk_t) + usable;
+    if (a->limit && a->reserved + a->held + total > a->limit) {
+        return NULL;
+    }
+    arena_chunk_t *c = malloc(total);
+    if (!c) {
+        return NULL;
+    }
+    c->size = usable;
+    c->used = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->reserved += total;
+    a->heap_allocs++;
+    if (a->reserved + a->held > a->peak) {
+        a->peak = a->reserved + a->held;
+    }
+    if (a->hook) {
+        a->hook((ssize_t)total, a->hook_data);
+    }
+    return c;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_chunk_t *c = a->chunks;
+    if (!c || c->size - c->used < size) {
+        // The rest of the current chunk is abandoned; chunks are small
+        c = arena_grow(a, size);
+        if (!c) {
+            return NULL;
+        }
+    }
+    void *p = c->data + c->used;
+    c->used += size;
+    a->allocs++;
+    return p;
+}
+
+int arena_defer(arena_t *a, void (*fn)(void *), void *ptr, size_t size) {
+    if (a->limit && a->reserved + a->held + size > a->limit) {
+        return -1;
+    }
+    arena_deferred_t *d = arena_alloc(a, sizeof(*d));
+    if (!d) {
+        return -1;
+    }
+    d->fn = fn;
+    d->ptr = ptr;
+    d->size = size;
+    d->next = a->deferred;
+    a->deferred = d;
+    a->held += size;
+    if (a->reserved + a->held > a->peak) {
+        a->peak = a->reserved + a->held;
+    }
+    if (a->hook && size) {
+        a->hook((ssize_t)size, a->hook_data);
+    }
+    return 0;
+}
+
+arena_mark_t arena_mark(const arena_t *a) {
+    return a->deferred;
+}
+
+void arena_release_to(arena_t *a, arena_mark_t mark) {
+    while (a->deferred && a->deferred != mark) {
+        arena_deferred_t *d = a->deferred;
+        a->deferred = d->next;
+        d->fn(d->ptr);
+        a->held -= d->size;
+        if (a->hook && d->size) {
+            a->hook(-(ssize_t)d->size, a->hook_data);
+        }
+    }
+}
+
+void arena_release(arena_t *a) {
+    arena_release_to(a, NULL);
+    while (a->chunks) {
+        arena_chunk_t *c = a->chunks;
+        a->chunks = c->next;
+        if (a->hook) {
+            a->hook(-(ssize_t)(sizeof(arena_chunk_t) + c->size), a->hook_data);
+        }
+        free(c);
+    }
+    a->reserved = 0;
+}
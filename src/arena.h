@@ -0,0 +1,58 @@
+#ifndef IDEVICEERASE_ARENA_H
+#define IDEVICEERASE_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Per-session arena.
+//
+// Memory handed out by arena_alloc() lives until the arena is released and
+// is never freed on its own. Objects owned by other libraries (plists,
+// service descriptors, libimobiledevice clients) are registered with
+// arena_defer() and destroyed in reverse order on release, so an error path
+// only has to return. Their size, as far as the caller knows it, counts
+// against the limit as well.
+
+typedef struct arena_chunk arena_chunk_t;
+typedef struct arena_deferred arena_deferred_t;
+
+// Called whenever the arena takes memory from or returns it to the heap,
+// with the change in bytes.
+typedef void (*arena_hook_fn)(ssize_t delta_bytes, void *user_data);
+
+typedef struct {
+    arena_chunk_t *chunks;
+    arena_deferred_t *deferred;
+    size_t limit;           // cap on reserved plus held bytes, 0: none
+    size_t reserved;        // bytes taken from the heap
+    size_t held;            // bytes of deferred objects, by their given size
+    size_t peak;            // high-water mark of 'reserved' plus 'held'
+    unsigned allocs;        // arena_alloc() and arena_defer() calls
+    unsigned heap_allocs;   // chunks taken from the heap
+    arena_hook_fn hook;
+    void *hook_data;
+} arena_t;
+
+// Position to roll deferred cleanups back to with arena_release_to()
+typedef arena_deferred_t *arena_mark_t;
+
+void arena_init(arena_t *a, size_t limit, arena_hook_fn hook, void *hook_data);
+
+// NULL once 'limit' would be exceeded (or the heap is exhausted).
+void *arena_alloc(arena_t *a, size_t size);
+
+// Runs fn(ptr) when the arena is released, counting size bytes against the
+// limit until then. Returns -1 without taking ownership if that would
+// exceed the limit or the record cannot be allocated; the caller still
+// owns ptr.
+int arena_defer(arena_t *a, void (*fn)(void *), void *ptr, size_t size);
+
+arena_mark_t arena_mark(const arena_t *a);
+// Runs the cleanups registered after 'mark', newest first; memory stays.
+void arena_release_to(arena_t *a, arena_mark_t mark);
+
+// Runs every cleanup and gives all memory back; the arena can be reused.
+void arena_release(arena_t *a);
+
+#endif
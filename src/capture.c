@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "phase.h"
+#include "varint.h"
+
+struct capture_writer {
+    FILE *file;
+    uint64_t start_ns;
+    uint64_t last_ns;
+};
+
+struct capture_reader {
+    FILE *file;
+    uint64_t time_ns;
+    char *buf;
+    uint32_t buf_size;
+};
+
+capture_writer_t *capture_open(const char *path) {
+    capture_writer_t *w = calloc(1, sizeof(*w));
+    if (!w) {
+        return NULL;
+    }
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        free(w);
+        return NULL;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t wall_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    unsigned char le[8];
+    for (int i = 0; i < 8; i++) {
+        le[i] = (wall_ns >> (8 * i)) & 0xff;
+    }
+    fwrite(CAPTURE_MAGIC, 1, 8, w->file);
+    fwrite(le, 1, 8, w->file);
+    w->start_ns = w->last_ns = phase_now_ns();
+    return w;
+}
+
+void capture_write(capture_writer_t *w, capture_type_t type, uint32_t conn_id, const char *data, uint32_t len) {
+    uint64_t now = phase_now_ns();
+    putc(type, w->file);
+    varint_put(w->file, conn_id);
+    varint_put(w->file, now - w->last_ns);
+    varint_put(w->file, len);
+    if (len) {
+        fwrite(data, 1, len, w->file);
+    }
+    w->last_ns = now;
+}
+
+void capture_close(capture_writer_t *w) {
+    if (!w) {
+        return;
+    }
+    fclose(w->file);
+    free(w);
+}
+
+capture_reader_t *capture_reader_open(const char *path) {
+    capture_reader_t *r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    r->file = fopen(path, "rb");
+    char header[16];
+    if (!r->file || fread(header, 1, sizeof(header), r->file) != sizeof(header) || memcmp(header, CAPTURE_MAGIC, 8) != 0) {
+        if (r->file) {
+            fclose(r->file);
+        }
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+int capture_read(capture_reader_t *r, capture_record_t *rec) {
+    int type = getc(r->file);
+    if (type == EOF) {
+        return 0;
+    }
+    uint64_t conn_id, delta, len;
+    if (type < CAPTURE_OPEN || type > CAPTURE_CLOSE || varint_get(r->file, &conn_id) < 0 ||
+        varint_get(r->file, &delta) < 0 || varint_get(r->file, &len) < 0 || len > 0x7fffffff) {
+        return -1;
+    }
+    if (len > r->buf_size) {
+        char *grown = realloc(r->buf, len);
+        if (!grown) {
+            return -1;
+        }
+        r->buf = grown;
+        r->buf_size = (uint32_t)len;
+    }
+    if (len && fread(r->buf, 1, len, r->file) != len) {
+        return -1;
+    }
+    r->time_ns += delta;
+    rec->type = (capture_type_t)type;
+    rec->conn_id = (uint32_t)conn_id;
+    rec->time_ns = r->time_ns;
+    rec->len = (uint32_t)len;
+    rec->data = r->buf;
+    return 1;
+}
+
+void capture_reader_close(capture_reader_t *r) {
+    if (!r) {
+        return;
+    }
+    fclose(r->file);
+    free(r->buf);
+    free(r);
+}
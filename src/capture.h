@@ -0,0 +1,45 @@
+#ifndef IDEVICEERASE_CAPTURE_H
+#define IDEVICEERASE_CAPTURE_H
+
+#include <stdint.h>
+
+// Binary session capture files.
+//
+// A capture starts with the 8-byte magic "IDECAP1\n" and the wall-clock
+// start time (unix nanoseconds, 8 bytes little endian), followed by records:
+//
+//   u8 type | varint conn_id | varint delta_ns | varint len | len bytes
+//
+// delta_ns is the time since the previous record in the file, so a capture
+// costs a few bytes of framing per send or receive.
+
+#define CAPTURE_MAGIC "IDECAP1\n"
+
+typedef enum {
+    CAPTURE_OPEN = 1,    // connection opened, no payload
+    CAPTURE_CLIENT = 2,  // bytes sent by ideviceerase
+    CAPTURE_DEVICE = 3,  // bytes sent by usbmuxd or the device
+    CAPTURE_CLOSE = 4,   // connection closed, no payload
+} capture_type_t;
+
+typedef struct {
+    capture_type_t type;
+    uint32_t conn_id;
+    uint64_t time_ns;    // since the start of the capture
+    uint32_t len;
+    const char *data;    // valid until the next capture_read()
+} capture_record_t;
+
+typedef struct capture_writer capture_writer_t;
+typedef struct capture_reader capture_reader_t;
+
+capture_writer_t *capture_open(const char *path);
+void capture_write(capture_writer_t *w, capture_type_t type, uint32_t conn_id, const char *data, uint32_t len);
+void capture_close(capture_writer_t *w);
+
+capture_reader_t *capture_reader_open(const char *path);
+// Returns 1 when a record was read, 0 at end of file, -1 on a corrupt file.
+int capture_read(capture_reader_t *r, capture_record_t *rec);
+void capture_reader_close(capture_reader_t *r);
+
+#endif
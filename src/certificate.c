@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
+
+#include "certificate.h"
+#include "json.h"
+
+#define CERT_QUEUE_MAX 65536
+#define CERT_BATCH 256
+#define CERT_LINE_MAX 2048
+
+typedef struct queued_cert {
+    struct queued_cert *next;
+    certificate_t cert;
+} queued_cert_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    queued_cert_t *head;
+    queued_cert_t **tail;
+    int count;
+    int stopping;
+
+    pthread_t *threads;
+    int num_threads;
+    EVP_PKEY *key;
+    const EVP_MD *md;                   // NULL for Ed25519/Ed448
+    char station[300];
+
+    // Archive, guarded by write_lock
+    pthread_mutex_t write_lock;
+    char *dir;
+    FILE *out;
+    uint64_t out_bytes;
+    uint64_t rotate_bytes;
+    int archive_seq;
+    uint64_t written;
+} certs = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+    .write_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+uint64_t certificate_unix_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+void certificate_hash_plist(plist_t plist, unsigned char out[32]) {
+    char *bin = NULL;
+    uint32_t len = 0;
+    plist_to_bin(plist, &bin, &len);
+    SHA256((const unsigned char *)(bin ? bin : ""), bin ? len : 0, out);
+    plist_mem_free(bin);
+}
+
+static int open_archive_locked(void) {
+    char path[4096];
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm);
+    snprintf(path, sizeof(path), "%s/certificates-%s-%d.jsonl", certs.dir, stamp, certs.archive_seq++);
+    certs.out = fopen(path, "a");
+    if (!certs.out) {
+        fprintf(stderr, "Error: Could not create certificate archive %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    certs.out_bytes = 0;
+    return 0;
+}
+
+static void close_archive_locked(void) {
+    if (certs.out) {
+        fflush(certs.out);
+        fsync(fileno(certs.out));
+        fclose(certs.out);
+        certs.out = NULL;
+    }
+}
+
+static void write_batch(const char *buf, size_t len, int lines) {
+    pthread_mutex_lock(&certs.write_lock);
+    if (certs.out && certs.out_bytes >= certs.rotate_bytes) {
+        close_archive_locked();
+    }
+    if (!certs.out && open_archive_locked() < 0) {
+        pthread_mutex_unlock(&certs.write_lock);
+        return;
+    }
+    // A certificate is for a device already erased: it has to survive a
+    // crash or Ctrl-C from here on
+    if (fwrite(buf, 1, len, certs.out) == len && fflush(certs.out) == 0 && fsync(fileno(certs.out)) == 0) {
+        certs.out_bytes += len;
+        certs.written += lines;
+    } else {
+        fprintf(stderr, "Error: Could not write certificates: %s\n", strerror(errno));
+    }
+    pthread_mutex_unlock(&certs.write_lock);
+}
+
+static size_t put_field(char *out, size_t pos, size_t size, const char *name, const char *value, int first) {
+    pos += snprintf(out + pos, size - pos, "%s\"%s\":\"", first ? "{" : ",", name);
+    pos = json_escape(out, pos, size, value);
+    pos += snprintf(out + pos, size - pos, "\"");
+    return pos;
+}
+
+static void format_time(uint64_t unix_ms, char out[32]) {
+    time_t secs = (time_t)(unix_ms / 1000);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    size_t n = strftime(out, 32, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(out + n, 32 - n, ".%03uZ", (unsigned)(unix_ms % 1000));
+}
+
+// Formats and signs one certificate into line; returns its length or 0
+static size_t sign_one(EVP_MD_CTX *ctx, const certificate_t *c, char *line, size_t size) {
+    char started[32], finished[32], hash[65] = "";
+    format_time(c->started_ms, started);
+    format_time(c->finished_ms, finished);
+    for (int i = 0; c->has_response && i < 32; i++) {
+        snprintf(hash + i * 2, 3, "%02x", c->response_sha256[i]);
+    }
+    size_t pos = put_field(line, 0, size, "udid", c->udid, 1);
+    pos = put_field(line, pos, size, "ecid", c->ecid, 0);
+    pos = put_field(line, pos, size, "serial", c->serial, 0);
+    pos = put_field(line, pos, size, "started", started, 0);
+    pos = put_field(line, pos, size, "finished", finished, 0);
+    pos = put_field(line, pos, size, "outcome", c->outcome, 0);
+    pos = put_field(line, pos, size, "response_sha256", hash, 0);
+    pos = put_field(line, pos, size, "station", certs.station, 0);
+    // The signed payload is the object as it would end here
+    line[pos] = '}';
+
+    unsigned char sig[512];
+    size_t sig_len = sizeof(sig);
+    EVP_MD_CTX_reset(ctx);
+    if (EVP_DigestSignInit(ctx, NULL, certs.md, NULL, certs.key) != 1 ||
+        EVP_DigestSign(ctx, sig, &sig_len, (const unsigned char *)line, pos + 1) != 1) {
+        fprintf(stderr, "Error: Could not sign the certificate of device %s.\n", c->udid);
+        return 0;
+    }
+    char b64[((sizeof(sig) + 2) / 3) * 4 + 1];
+    EVP_EncodeBlock((unsigned char *)b64, sig, (int)sig_len);
+    pos += snprintf(line + pos, size - pos, ",\"signature\":\"%s\"}\n", b64);
+    return pos < size ? pos : 0;
+}
+
+static void *signer_thread(void *arg) {
+    (void)arg;
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    char *buf = malloc((size_t)CERT_BATCH * CERT_LINE_MAX);
+    if (!ctx || !buf) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        EVP_MD_CTX_free(ctx);
+        free(buf);
+        return NULL;
+    }
+    for (;;) {
+        pthread_mutex_lock(&certs.lock);
+        while (!certs.head && !certs.stopping) {
+            pthread_cond_wait(&certs.not_empty, &certs.lock);
+        }
+        if (!certs.head) {
+            pthread_mutex_unlock(&certs.lock);
+            break;
+        }
+        // Take a whole batch at once; one lock round and one write per batch
+        queued_cert_t *batch = certs.head;
+        queued_cert_t *last = batch;
+        int n = 1;
+        while (n < CERT_BATCH && last->next) {
+            last = last->next;
+            n++;
+        }
+        certs.head = last->next;
+        if (!certs.head) {
+            certs.tail = &certs.head;
+        }
+        last->next = NULL;
+        certs.count -= n;
+        pthread_cond_broadcast(&certs.not_full);
+        pthread_mutex_unlock(&certs.lock);
+
+        size_t len = 0;
+        int lines = 0;
+        while (batch) {
+            queued_cert_t *q = batch;
+            batch = q->next;
+            size_t line_len = sign_one(ctx, &q->cert, buf + len, CERT_LINE_MAX);
+            if (line_len) {
+                len += line_len;
+                lines++;
+            }
+            free(q);
+        }
+        if (len) {
+            write_batch(buf, len, lines);
+        }
+    }
+    EVP_MD_CTX_free(ctx);
+    free(buf);
+    return NULL;
+}
+
+int certificates_open(const char *dir, const char *key_path, int threads, uint64_t rotate_bytes) {
+    FILE *f = fopen(key_path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Could not open signing key %s: %s\n", key_path, strerror(errno));
+        return -1;
+    }
+    certs.key = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+    fclose(f);
+    if (!certs.key) {
+        fprintf(stderr, "Error: %s does not hold a PEM private key.\n", key_path);
+        return -1;
+    }
+    int type = EVP_PKEY_base_id(certs.key);
+    certs.md = type == EVP_PKEY_ED25519 || type == EVP_PKEY_ED448 ? NULL : EVP_sha256();
+    certs.dir = strdup(dir);
+    if (!certs.dir) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        EVP_PKEY_free(certs.key);
+        certs.key = NULL;
+        return -1;
+    }
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    snprintf(certs.station, sizeof(certs.station), "%s", host);
+    certs.rotate_bytes = rotate_bytes;
+    certs.head = NULL;
+    certs.tail = &certs.head;
+    certs.stopping = 0;
+
+    // Fail now rather than after the first erase
+    pthread_mutex_lock(&certs.write_lock);
+    int res = open_archive_locked();
+    pthread_mutex_unlock(&certs.write_lock);
+    if (res < 0) {
+        certificates_close();
+        return -1;
+    }
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    certs.threads = calloc(threads, sizeof(pthread_t));
+    for (int i = 0; certs.threads && i < threads; i++) {
+        if (pthread_create(&certs.threads[i], NULL, signer_thread, NULL) != 0) {
+            break;
+        }
+        certs.num_threads++;
+    }
+    if (certs.num_threads == 0) {
+        fprintf(stderr, "Error: Could not start certificate signer threads.\n");
+        certificates_close();
+        return -1;
+    }
+    return 0;
+}
+
+void certificate_submit(const certificate_t *cert) {
+    queued_cert_t *q = malloc(sizeof(*q));
+    if (!q) {
+        fprintf(stderr, "Error: Out of memory; no certificate for device %s.\n", cert->udid);
+        return;
+    }
+    q->cert = *cert;
+    q->next = NULL;
+    pthread_mutex_lock(&certs.lock);
+    while (certs.count >= CERT_QUEUE_MAX && !certs.stopping) {
+        pthread_cond_wait(&certs.not_full, &certs.lock);
+    }
+    *certs.tail = q;
+    certs.tail = &q->next;
+    certs.count++;
+    pthread_cond_signal(&certs.not_empty);
+    pthread_mutex_unlock(&certs.lock);
+}
+
+uint64_t certificates_close(void) {
+    pthread_mutex_lock(&certs.lock);
+    certs.stopping = 1;
+    pthread_cond_broadcast(&certs.not_empty);
+    pthread_cond_broadcast(&certs.not_full);
+    pthread_mutex_unlock(&certs.lock);
+    for (int i = 0; i < certs.num_threads; i++) {
+        pthread_join(certs.threads[i], NULL);
+    }
+    free(certs.threads);
+    certs.threads = NULL;
+    certs.num_threads = 0;
+    pthread_mutex_lock(&certs.write_lock);
+    close_archive_locked();
+    pthread_mutex_unlock(&certs.write_lock);
+    EVP_PKEY_free(certs.key);
+    certs.key = NULL;
+    free(certs.dir);
+    certs.dir = NULL;
+    return certs.written;
+}
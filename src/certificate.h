@@ -0,0 +1,51 @@
+#ifndef IDEVICEERASE_CERTIFICATE_H
+#define IDEVICEERASE_CERTIFICATE_H
+
+#include <stdint.h>
+
+#include <plist/plist.h>
+
+// Signed erase certificates.
+//
+// Every erase that reached the MobileObliterator stage gets one JSON line
+// in a certificate archive:
+//
+//   {"udid":"...","ecid":"...","serial":"...","started":"2026-...Z",
+//    "finished":"...","outcome":"erased","response_sha256":"...",
+//    "station":"...","signature":"<base64>"}
+//
+// The signature covers the line with its ',"signature":"..."' member
+// removed, signed with SHA-256 (or plain Ed25519) by the key given to
+// certificates_open(). Signing happens on a pool of threads that take
+// certificates in batches, so erase sessions only pay for a copy. Archives
+// are named certificates-<UTC time>-<n>.jsonl and rotated by size.
+
+typedef struct {
+    char udid[64];
+    char ecid[32];                      // empty if unknown
+    char serial[32];                    // empty if unknown
+    uint64_t started_ms;                // unix time
+    uint64_t finished_ms;
+    char outcome[48];                   // "erased" or "failed:<phase>"
+    unsigned char response_sha256[32];
+    int has_response;                   // response_sha256 is set
+} certificate_t;
+
+// Loads the PEM private key once and starts the signer threads
+// (threads <= 0: one per CPU). Returns 0, or -1 with a message.
+int certificates_open(const char *dir, const char *key_path, int threads, uint64_t rotate_bytes);
+
+// Queues a copy of cert. Blocks only while the signers are a full queue
+// behind.
+void certificate_submit(const certificate_t *cert);
+
+// Signs and writes everything queued, then stops the pool.
+// Returns the number of certificates written.
+uint64_t certificates_close(void);
+
+// SHA-256 over the binary plist encoding
+void certificate_hash_plist(plist_t plist, unsigned char out[32]);
+
+uint64_t certificate_unix_ms(void);
+
+#endif
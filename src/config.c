@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "config.h"
+
+// The profile is the first member, so a profile pointer is its snapshot
+typedef struct snapshot {
+    station_profile_t profile;
+    int refs;
+    struct snapshot *retired_next;
+} snapshot_t;
+
+#define DEFAULT_LOCKDOWN_TTL_MS 30000
+
+static snapshot_t builtin = { .profile = { .name = "builtin", .lockdown_ttl_ms = DEFAULT_LOCKDOWN_TTL_MS } };
+static snapshot_t *current = &builtin;
+// Readers between loading 'current' and taking their reference
+static int acquiring = 0;
+// Replaced snapshots that may still be referenced; watcher thread only
+static snapshot_t *retired = NULL;
+
+static char *config_path = NULL;
+static char *config_profile = NULL;
+static uint64_t generation = 0;
+
+static struct {
+    pthread_t thread;
+    int running;
+    int inotify_fd;
+    int stop_pipe[2];
+    void (*on_reload)(const station_profile_t *profile);
+} watcher = { .inotify_fd = -1, .stop_pipe = { -1, -1 } };
+
+static int parse_uint(const char *value, uint32_t *out) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long v = strtoul(value, &end, 10);
+    if (errno || !end || end == value || *end != '\0' || value[0] == '-' || v > UINT32_MAX) {
+        return -1;
+    }
+    *out = (uint32_t)v;
+    return 0;
+}
+
+static int set_key(station_profile_t *p, const char *key, const char *value) {
+    uint32_t v;
+    if (strcmp(key, "output") == 0) {
+        if (strcmp(value, "text") == 0) {
+            p->output = OUTPUT_TEXT;
+        } else if (strcmp(value, "json") == 0) {
+            p->output = OUTPUT_JSON;
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    if (parse_uint(value, &v) < 0) {
+        return -1;
+    }
+    if (strcmp(key, "workers") == 0) {
+        p->workers = (int)v;
+    } else if (strcmp(key, "hub_cap") == 0) {
+        p->hub_cap = (int)v;
+    } else if (strcmp(key, "retries") == 0) {
+        p->retries = (int)v;
+    } else if (strcmp(key, "retry_delay_ms") == 0) {
+        p->retry_delay_ms = v;
+    } else if (strcmp(key, "session_memory_kb") == 0) {
+        p->session_memory_kb = v;
+    } else if (strcmp(key, "lockdown_ttl_ms") == 0) {
+        p->lockdown_ttl_ms = v;
+    } else if (strncmp(key, "timeout.", 8) == 0 && phase_from_name(key + 8) >= 0) {
+        p->timeout_ms[phase_from_name(key + 8)] = v;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static char *trim(char *s) {
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+// Parses the whole file and returns the wanted profile in *out
+static int parse_file(const char *path, const char *want, station_profile_t *out) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Could not open config %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    station_profile_t cur, chosen, first;
+    int in_profile = 0, profiles = 0, have_chosen = 0, lineno = 0, res = 0;
+    char line[512];
+    memset(&cur, 0, sizeof(cur));
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *s = trim(line);
+        if (*s == '\0') {
+            continue;
+        }
+        if (*s == '[') {
+            char *close = strchr(s, ']');
+            if (!close || close[1] != '\0' || close == s + 1 || (size_t)(close - s - 1) >= sizeof(cur.name)) {
+                fprintf(stderr, "Error: %s:%d: expected \"[profile-name]\".\n", path, lineno);
+                res = -1;
+                break;
+            }
+            if (in_profile && (want ? strcmp(cur.name, want) == 0 : strcmp(cur.name, "default") == 0)) {
+                chosen = cur;
+                have_chosen = 1;
+            }
+            memset(&cur, 0, sizeof(cur));
+            cur.lockdown_ttl_ms = DEFAULT_LOCKDOWN_TTL_MS;
+            memcpy(cur.name, s + 1, close - s - 1);
+            in_profile = 1;
+            if (profiles++ == 0) {
+                first = cur;
+            }
+            continue;
+        }
+        char *eq = strchr(s, '=');
+        if (!in_profile || !eq) {
+            fprintf(stderr, "Error: %s:%d: expected \"key = value\" inside a [profile].\n", path, lineno);
+            res = -1;
+            break;
+        }
+        *eq = '\0';
+        char *key = trim(s);
+        char *value = trim(eq + 1);
+        if (set_key(&cur, key, value) < 0) {
+            fprintf(stderr, "Error: %s:%d: invalid setting '%s = %s'.\n", path, lineno, key, value);
+            res = -1;
+            break;
+        }
+        if (profiles == 1) {
+            first = cur;
+        }
+    }
+    fclose(f);
+    if (res < 0) {
+        return -1;
+    }
+    if (in_profile && (want ? strcmp(cur.name, want) == 0 : strcmp(cur.name, "default") == 0)) {
+        chosen = cur;
+        have_chosen = 1;
+    }
+    if (!have_chosen && !want && profiles == 1) {
+        chosen = first;
+        have_chosen = 1;
+    }
+    if (!have_chosen) {
+        if (want) {
+            fprintf(stderr, "Error: No profile '%s' in %s.\n", want, path);
+        } else {
+            fprintf(stderr, "Error: %s has no [default] profile; pick one with --profile.\n", path);
+        }
+        return -1;
+    }
+    *out = chosen;
+    return 0;
+}
+
+static void free_unused_retired(void) {
+    snapshot_t **link = &retired;
+    while (*link) {
+        snapshot_t *s = *link;
+        if (__atomic_load_n(&s->refs, __ATOMIC_ACQUIRE) == 0) {
+            *link = s->retired_next;
+            free(s);
+        } else {
+            link = &s->retired_next;
+        }
+    }
+}
+
+static void publish(snapshot_t *s) {
+    s->profile.generation = ++generation;
+    snapshot_t *old = __atomic_exchange_n(&current, s, __ATOMIC_SEQ_CST);
+    // Grace period: a reader that loaded 'old' holds its reference once
+    // it has left config_acquire()
+    while (__atomic_load_n(&acquiring, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+    if (old != &builtin) {
+        old->retired_next = retired;
+        retired = old;
+    }
+    free_unused_retired();
+}
+
+static int load_snapshot(void) {
+    snapshot_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    if (parse_file(config_path, config_profile, &s->profile) < 0) {
+        free(s);
+        return -1;
+    }
+    publish(s);
+    return 0;
+}
+
+int config_load(const char *path, const char *profile_name) {
+    free(config_path);
+    free(config_profile);
+    config_path = strdup(path);
+    config_profile = profile_name ? strdup(profile_name) : NULL;
+    if (!config_path || (profile_name && !config_profile)) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    return load_snapshot();
+}
+
+const station_profile_t *config_acquire(void) {
+    __atomic_add_fetch(&acquiring, 1, __ATOMIC_SEQ_CST);
+    snapshot_t *s = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&acquiring, 1, __ATOMIC_RELEASE);
+    return &s->profile;
+}
+
+void config_release(const station_profile_t *profile) {
+    snapshot_t *s = (snapshot_t *)profile;
+    __atomic_sub_fetch(&s->refs, 1, __ATOMIC_RELEASE);
+}
+
+static int is_config_event(const struct inotify_event *ev, const char *base) {
+    return ev->len > 0 && strcmp(ev->name, base) == 0;
+}
+
+static void *watch_thread(void *arg) {
+    (void)arg;
+    const char *slash = strrchr(config_path, '/');
+    const char *base = slash ? slash + 1 : config_path;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        { .fd = watcher.stop_pipe[0], .events = POLLIN },
+        { .fd = watcher.inotify_fd, .events = POLLIN },
+    };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        ssize_t n = read(watcher.inotify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            continue;
+        }
+        int changed = 0;
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            changed |= is_config_event(ev, base);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        if (!changed) {
+            continue;
+        }
+        // Let a burst of writes settle before re-reading
+        usleep(50000);
+        while (read(watcher.inotify_fd, buf, sizeof(buf)) > 0) {
+        }
+        if (load_snapshot() < 0) {
+            fprintf(stderr, "Warning: Keeping the current profile; %s could not be reloaded.\n", config_path);
+            continue;
+        }
+        const station_profile_t *profile = config_acquire();
+        printf("Reloaded profile '%s' from %s.\n", profile->name, config_path);
+        if (watcher.on_reload) {
+            watcher.on_reload(profile);
+        }
+        config_release(profile);
+    }
+    return NULL;
+}
+
+int config_watch_start(void (*on_reload)(const station_profile_t *profile)) {
+    if (!config_path || watcher.running) {
+        return 0;
+    }
+    char *dir = strdup(config_path);
+    if (!dir) {
+        return -1;
+    }
+    char *slash = strrchr(dir, '/');
+    if (slash == dir) {
+        slash[1] = '\0';
+    } else if (slash) {
+        *slash = '\0';
+    } else {
+        strcpy(dir, ".");
+    }
+    // Watch the directory: editors often replace the file by renaming
+    watcher.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.inotify_fd < 0 || inotify_add_watch(watcher.inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        pipe(watcher.stop_pipe) < 0) {
+        fprintf(stderr, "Error: Could not watch %s for changes: %s\n", config_path, strerror(errno));
+        free(dir);
+        config_watch_stop();
+        return -1;
+    }
+    free(dir);
+    watcher.on_reload = on_reload;
+    if (pthread_create(&watcher.thread, NULL, watch_thread, NULL) != 0) {
+        fprintf(stderr, "Error: Could not start config watcher thread.\n");
+        config_watch_stop();
+        return -1;
+    }
+    watcher.running = 1;
+    return 0;
+}
+
+void config_watch_stop(void) {
+    if (watcher.running) {
+        if (write(watcher.stop_pipe[1], "x", 1) == 1) {
+            pthread_join(watcher.thread, NULL);
+        }
+        watcher.running = 0;
+    }
+    if (watcher.inotify_fd >= 0) {
+        close(watcher.inotify_fd);
+        watcher.inotify_fd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (watcher.stop_pipe[i] >= 0) {
+            close(watcher.stop_pipe[i]);
+            watcher.stop_pipe[i] = -1;
+        }
+    }
+    free_unused_retired();
+}
@@ -0,0 +1,61 @@
+#ifndef IDEVICEERASE_CONFIG_H
+#define IDEVICEERASE_CONFIG_H
+
+#include <stdint.h>
+
+#include "phase.h"
+
+// Station configuration profiles.
+//
+// A configuration file holds named profiles:
+//
+//   [fast-bench]
+//   workers = 8
+//   hub_cap = 4
+//   retries = 2
+//   retry_delay_ms = 1500
+//   output = json
+//   session_memory_kb = 256
+//   lockdown_ttl_ms = 30000
+//   timeout.handshake = 10000
+//   timeout.recv = 45000
+//
+// The selected profile is published as an immutable snapshot. Sessions
+// take a reference to the current snapshot when they start and keep it
+// until they end; a reload swaps in a new snapshot without waiting for
+// them, and the old one is freed once its last session has released it.
+
+typedef enum {
+    OUTPUT_TEXT = 0,  // "Timing: ..." lines
+    OUTPUT_JSON       // one JSON object per erase
+} output_format_t;
+
+typedef struct {
+    char name[64];
+    int workers;                       // 0: keep --workers
+    int hub_cap;                       // concurrent erases per USB hub, 0: unlimited
+    int retries;                       // extra attempts when connecting fails
+    uint32_t retry_delay_ms;
+    uint32_t session_memory_kb;        // arena budget per erase, 0: unlimited
+    uint32_t lockdown_ttl_ms;          // keep lockdown sessions for retries, 0: off
+    uint32_t timeout_ms[PHASE_COUNT];  // 0: no timeout
+    output_format_t output;
+    uint64_t generation;               // bumped on every reload
+} station_profile_t;
+
+// Loads the named profile (NULL: "default", or the only profile in the
+// file). Returns 0 on success, -1 with a message on stderr.
+int config_load(const char *path, const char *profile_name);
+
+// Current profile; built-in defaults if config_load() was never called.
+// Lock-free; every acquire must be paired with a release.
+const station_profile_t *config_acquire(void);
+void config_release(const station_profile_t *profile);
+
+// Watches the loaded file with inotify and swaps in the re-read profile
+// whenever it changes. on_reload runs on the watcher thread after each
+// successful swap. A file that fails to parse keeps the old profile.
+int config_watch_start(void (*on_reload)(const station_profile_t *profile));
+void config_watch_stop(void);
+
+#endif
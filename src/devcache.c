@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <plist/plist.h>
+
+#include "devcache.h"
+#include "phase.h"
+
+#define DEVCACHE_SETTLE_MS 100  // quiet time that ends usbmuxd's initial burst
+#define DEVCACHE_START_MS 2000  // longest devcache_start() waits for it
+#define DEVCACHE_RETRY_MS 1000  // between attempts to subscribe again
+
+typedef struct {
+    usbmux_device_t dev;
+    plist_t properties;     // as usbmuxd sent them, for ListDevices replies
+} cached_device_t;
+
+static struct {
+    pthread_rwlock_t lock;
+    cached_device_t *devices;
+    int count;
+    int cap;
+    int live;               // subscribed, and usbmuxd has listed what is there
+    devcache_stats_t stats; // updated with atomics
+} cache = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+// The subscription thread
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int fd;                 // current subscription, for devcache_stop()
+} listener = { .lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1 };
+
+static void attach_locked(plist_t properties) {
+    usbmux_device_t dev;
+    plist_t copy = NULL;
+    if (usbmux_parse_device(properties, &dev) < 0 || !(copy = plist_copy(properties))) {
+        return;
+    }
+    for (int i = 0; i < cache.count; i++) {
+        if (cache.devices[i].dev.device_id == dev.device_id) {
+            plist_free(cache.devices[i].properties);
+            cache.devices[i] = (cached_device_t){ dev, copy };
+            return;
+        }
+    }
+    if (cache.count == cache.cap) {
+        int cap = cache.cap ? cache.cap * 2 : 64;
+        cached_device_t *grown = realloc(cache.devices, cap * sizeof(cached_device_t));
+        if (!grown) {
+            plist_free(copy);
+            return;
+        }
+        cache.devices = grown;
+        cache.cap = cap;
+    }
+    cache.devices[cache.count++] = (cached_device_t){ dev, copy };
+}
+
+static void detach_locked(uint32_t device_id) {
+    for (int i = 0; i < cache.count; i++) {
+        if (cache.devices[i].dev.device_id == device_id) {
+            plist_free(cache.devices[i].properties);
+            cache.devices[i] = cache.devices[--cache.count];
+            return;
+        }
+    }
+}
+
+static void clear_locked(void) {
+    for (int i = 0; i < cache.count; i++) {
+        plist_free(cache.devices[i].properties);
+    }
+    cache.count = 0;
+    cache.live = 0;
+}
+
+static void apply(plist_t msg) {
+    plist_t type = plist_dict_get_item(msg, "MessageType");
+    const char *name = type && plist_get_node_type(type) == PLIST_STRING ? plist_get_string_ptr(type, NULL) : "";
+    if (strcmp(name, "Attached") == 0) {
+        pthread_rwlock_wrlock(&cache.lock);
+        attach_locked(plist_dict_get_item(msg, "Properties"));
+        pthread_rwlock_unlock(&cache.lock);
+    } else if (strcmp(name, "Detached") == 0) {
+        plist_t id = plist_dict_get_item(msg, "DeviceID");
+        uint64_t device_id = 0;
+        if (!id || plist_get_node_type(id) != PLIST_UINT) {
+            return;
+        }
+        plist_get_uint_val(id, &device_id);
+        pthread_rwlock_wrlock(&cache.lock);
+        detach_locked((uint32_t)device_id);
+        pthread_rwlock_unlock(&cache.lock);
+    } else {
+        return;
+    }
+    __atomic_add_fetch(&cache.stats.events, 1, __ATOMIC_RELAXED);
+}
+
+static int subscribe(void) {
+    int fd = usbmux_connect(getenv("USBMUXD_SOCKET_ADDRESS"));
+    if (fd >= 0 && usbmux_listen(fd) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Sleeps on the listener condition; listener.lock held
+static void wait_ms_locked(uint32_t ms) {
+    uint64_t due = phase_now_ns() + (uint64_t)ms * 1000000ULL;
+    struct timespec ts = { (time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL) };
+    pthread_cond_timedwait(&listener.cond, &listener.lock, &ts);
+}
+
+// Reads one subscription until it ends. usbmuxd starts it with an Attached
+// message for every device already there; the first quiet moment after
+// them makes the list current.
+static void read_subscription(int fd) {
+    int settled = 0;
+    for (;;) {
+        if (!settled) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, DEVCACHE_SETTLE_MS) == 0) {
+                pthread_rwlock_wrlock(&cache.lock);
+                cache.live = 1;
+                pthread_rwlock_unlock(&cache.lock);
+                pthread_mutex_lock(&listener.lock);
+                pthread_cond_broadcast(&listener.cond);
+                pthread_mutex_unlock(&listener.lock);
+                settled = 1;
+                continue;
+            }
+        }
+        plist_t msg = usbmux_read_message(fd);
+        if (!msg) {
+            return;
+        }
+        apply(msg);
+        plist_free(msg);
+    }
+}
+
+static void *listener_thread(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    for (;;) {
+        if (fd >= 0) {
+            read_subscription(fd);
+            pthread_rwlock_wrlock(&cache.lock);
+            clear_locked();
+            pthread_rwlock_unlock(&cache.lock);
+        }
+        pthread_mutex_lock(&listener.lock);
+        if (fd >= 0) {
+            listener.fd = -1;
+            close(fd);
+        }
+        if (!listener.stopping) {
+            if (fd >= 0) {
+                fprintf(stderr, "Warning: Lost the usbmuxd device subscription; asking usbmuxd directly until it is back.\n");
+            }
+            wait_ms_locked(DEVCACHE_RETRY_MS);
+        }
+        if (listener.stopping) {
+            pthread_mutex_unlock(&listener.lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&listener.lock);
+        fd = subscribe();
+        pthread_mutex_lock(&listener.lock);
+        listener.fd = fd;
+        if (listener.stopping && fd >= 0) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&listener.lock);
+    }
+}
+
+int devcache_start(void) {
+    int fd = subscribe();
+    if (fd < 0) {
+        return -1;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    // Wait times come from phase_now_ns(), which is CLOCK_MONOTONIC
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&listener.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    listener.stopping = 0;
+    listener.fd = fd;
+    if (pthread_create(&listener.thread, NULL, listener_thread, (void *)(intptr_t)fd) != 0) {
+        close(fd);
+        listener.fd = -1;
+        pthread_cond_destroy(&listener.cond);
+        return -1;
+    }
+    listener.running = 1;
+
+    uint64_t give_up = phase_now_ns() + DEVCACHE_START_MS * 1000000ULL;
+    pthread_mutex_lock(&listener.lock);
+    for (;;) {
+        pthread_rwlock_rdlock(&cache.lock);
+        int live = cache.live;
+        pthread_rwlock_unlock(&cache.lock);
+        uint64_t now = phase_now_ns();
+        if (live || now >= give_up) {
+            break;
+        }
+        wait_ms_locked((uint32_t)((give_up - now) / 1000000ULL) + 1);
+    }
+    pthread_mutex_unlock(&listener.lock);
+    return 0;
+}
+
+void devcache_stop(void) {
+    if (!listener.running) {
+        return;
+    }
+    pthread_mutex_lock(&listener.lock);
+    listener.stopping = 1;
+    if (listener.fd >= 0) {
+        shutdown(listener.fd, SHUT_RDWR);
+    }
+    pthread_cond_broadcast(&listener.cond);
+    pthread_mutex_unlock(&listener.lock);
+    pthread_join(listener.thread, NULL);
+    listener.running = 0;
+    pthread_cond_destroy(&listener.cond);
+    pthread_rwlock_wrlock(&cache.lock);
+    clear_locked();
+    free(cache.devices);
+    cache.devices = NULL;
+    cache.cap = 0;
+    pthread_rwlock_unlock(&cache.lock);
+}
+
+int devcache_lookup(const char *udid, usbmux_device_t *out) {
+    pthread_rwlock_rdlock(&cache.lock);
+    if (!cache.live) {
+        pthread_rwlock_unlock(&cache.lock);
+        return -1;
+    }
+    const usbmux_device_t *found = NULL;
+    for (int i = 0; i < cache.count; i++) {
+        const usbmux_device_t *dev = &cache.devices[i].dev;
+        if (strcasecmp(dev->udid, udid) == 0 && (!found || (found->network && !dev->network))) {
+            found = dev;
+        }
+    }
+    if (found && out) {
+        *out = *found;
+    }
+    pthread_rwlock_unlock(&cache.lock);
+    __atomic_add_fetch(&cache.stats.lookups, 1, __ATOMIC_RELAXED);
+    return found ? 1 : 0;
+}
+
+char *devcache_list_reply(uint32_t tag, uint32_t *len) {
+    plist_t list = plist_new_array();
+    pthread_rwlock_rdlock(&cache.lock);
+    if (!cache.live) {
+        pthread_rwlock_unlock(&cache.lock);
+        plist_free(list);
+        return NULL;
+    }
+    for (int i = 0; i < cache.count; i++) {
+        plist_t entry = plist_new_dict();
+        plist_dict_set_item(entry, "DeviceID", plist_new_uint(cache.devices[i].dev.device_id));
+        plist_dict_set_item(entry, "MessageType", plist_new_string("Attached"));
+        plist_dict_set_item(entry, "Properties", plist_copy(cache.devices[i].properties));
+        plist_array_append_item(list, entry);
+    }
+    pthread_rwlock_unlock(&cache.lock);
+
+    plist_t reply = plist_new_dict();
+    plist_dict_set_item(reply, "DeviceList", list);
+    char *xml = NULL;
+    uint32_t xml_len = 0;
+    plist_to_xml(reply, &xml, &xml_len);
+    plist_free(reply);
+    char *packet = xml ? malloc(sizeof(struct usbmuxd_header) + xml_len) : NULL;
+    if (packet) {
+        struct usbmuxd_header hdr = { sizeof(hdr) + xml_len, 1, USBMUXD_MESSAGE_PLIST, tag };
+        memcpy(packet, &hdr, sizeof(hdr));
+        memcpy(packet + sizeof(hdr), xml, xml_len);
+        *len = sizeof(hdr) + xml_len;
+        __atomic_add_fetch(&cache.stats.list_replies, 1, __ATOMIC_RELAXED);
+    }
+    plist_mem_free(xml);
+    return packet;
+}
+
+void devcache_get_stats(devcache_stats_t *out) {
+    out->events = __atomic_load_n(&cache.stats.events, __ATOMIC_RELAXED);
+    out->lookups = __atomic_load_n(&cache.stats.lookups, __ATOMIC_RELAXED);
+    out->list_replies = __atomic_load_n(&cache.stats.list_replies, __ATOMIC_RELAXED);
+}
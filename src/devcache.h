@@ -0,0 +1,40 @@
+#ifndef IDEVICEERASE_DEVCACHE_H
+#define IDEVICEERASE_DEVCACHE_H
+
+#include <stdint.h>
+
+#include "usbmux.h"
+
+// Process-wide list of attached devices, kept current from a single usbmuxd
+// Listen subscription instead of a ListDevices request per lookup.
+//
+// A thread reads the Attached and Detached messages and applies them to the
+// list; lookups are answered from memory. While the usbmuxd relay runs, it
+// also answers the ListDevices requests libimobiledevice makes for every
+// idevice_new_with_options() from the list (see devcache_list_reply()), so
+// usbmuxd sees one subscription instead of one request per connection. If
+// the subscription drops, the list is not used until it is back, and
+// callers fall back to asking usbmuxd.
+
+typedef struct {
+    uint64_t events;        // Attached and Detached messages applied
+    uint64_t lookups;       // devcache_lookup() calls answered
+    uint64_t list_replies;  // ListDevices requests answered
+} devcache_stats_t;
+
+// Subscribes and waits until usbmuxd has listed the devices already there.
+// Returns -1 if usbmuxd cannot be reached; lookups then report -1.
+int devcache_start(void);
+void devcache_stop(void);
+
+// 1 with *out filled (USB preferred over Wi-Fi sync) if the device is
+// attached, 0 if it is not, -1 if the list is not current. out may be NULL.
+int devcache_lookup(const char *udid, usbmux_device_t *out);
+
+// usbmuxd's reply to a ListDevices request with the given tag, header
+// included, in a malloc()ed buffer; NULL if the list is not current.
+char *devcache_list_reply(uint32_t tag, uint32_t *len);
+
+void devcache_get_stats(devcache_stats_t *out);
+
+#endif
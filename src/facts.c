@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "facts.h"
+
+plist_t facts_query(int i) {
+    plist_t query = plist_new_dict();
+    if (!query) {
+        return NULL;
+    }
+    if (i == 0) {
+        plist_dict_set_item(query, "Request", plist_new_string("IORegistry"));
+        plist_dict_set_item(query, "EntryClass", plist_new_string("IOPMPowerSource"));
+    } else {
+        plist_dict_set_item(query, "Request", plist_new_string("GasGauge"));
+    }
+    return query;
+}
+
+// Integer or boolean value of dict[key]; 0 if it has neither
+static int get_number(plist_t dict, const char *key, int64_t *value) {
+    plist_t node = dict ? plist_dict_get_item(dict, key) : NULL;
+    if (!node) {
+        return 0;
+    }
+    if (plist_get_node_type(node) == PLIST_UINT) {
+        uint64_t v = 0;
+        plist_get_uint_val(node, &v);
+        *value = (int64_t)v;
+        return 1;
+    }
+    if (plist_get_node_type(node) == PLIST_BOOLEAN) {
+        uint8_t v = 0;
+        plist_get_bool_val(node, &v);
+        *value = v;
+        return 1;
+    }
+    return 0;
+}
+
+// {"Status": "Success", "Diagnostics": {<section>: {...}}}
+static plist_t section(plist_t reply, const char *name) {
+    if (!reply || plist_get_node_type(reply) != PLIST_DICT) {
+        return NULL;
+    }
+    plist_t status = plist_dict_get_item(reply, "Status");
+    char *text = NULL;
+    if (status && plist_get_node_type(status) == PLIST_STRING) {
+        plist_get_string_val(status, &text);
+    }
+    int ok = text && strcmp(text, "Success") == 0;
+    plist_mem_free(text);
+    plist_t diagnostics = ok ? plist_dict_get_item(reply, "Diagnostics") : NULL;
+    plist_t entry = diagnostics ? plist_dict_get_item(diagnostics, name) : NULL;
+    return entry && plist_get_node_type(entry) == PLIST_DICT ? entry : NULL;
+}
+
+void facts_parse(int i, plist_t reply, device_facts_t *facts) {
+    int64_t v, w;
+    if (i == 0) {
+        plist_t entry = section(reply, "IORegistry");
+        if (get_number(entry, "CurrentCapacity", &v)) {
+            facts->battery_percent = (int)v;
+            facts->known |= FACT_BATTERY;
+        }
+        if (get_number(entry, "IsCharging", &v) && get_number(entry, "ExternalConnected", &w)) {
+            facts->charging = v || w;
+            facts->known |= FACT_CHARGING;
+        }
+        if (get_number(entry, "CycleCount", &v)) {
+            facts->cycle_count = (int)v;
+            facts->known |= FACT_CYCLES;
+        }
+        return;
+    }
+    plist_t entry = section(reply, "GasGauge");
+    if (get_number(entry, "CycleCount", &v)) {
+        facts->cycle_count = (int)v;
+        facts->known |= FACT_CYCLES;
+    }
+    if (get_number(entry, "FullChargeCapacity", &v) && get_number(entry, "DesignCapacity", &w) && w > 0) {
+        facts->health_percent = (int)(v * 100 / w);
+        facts->known |= FACT_HEALTH;
+    }
+}
+
+void facts_print(const device_facts_t *facts, const char *udid, FILE *out) {
+    if (!facts->known) {
+        return;
+    }
+    fprintf(out, "Battery: udid=%s", udid);
+    if (facts->known & FACT_BATTERY) {
+        fprintf(out, " level=%d%%", facts->battery_percent);
+    }
+    if (facts->known & FACT_CHARGING) {
+        fprintf(out, " charging=%s", facts->charging ? "yes" : "no");
+    }
+    if (facts->known & FACT_CYCLES) {
+        fprintf(out, " cycles=%d", facts->cycle_count);
+    }
+    if (facts->known & FACT_HEALTH) {
+        fprintf(out, " health=%d%%", facts->health_percent);
+    }
+    fprintf(out, "\n");
+}
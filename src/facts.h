@@ -0,0 +1,39 @@
+#ifndef IDEVICEERASE_FACTS_H
+#define IDEVICEERASE_FACTS_H
+
+#include <stdio.h>
+
+#include <plist/plist.h>
+
+// Battery facts the diagnostics relay reports, asked for on the erase's own
+// service connection: the queries go out together with the MobileObliterator
+// request, and the replies come back in the same order ahead of its answer,
+// so collecting them costs no extra round trip.
+
+#define FACTS_QUERIES 2
+
+#define FACT_BATTERY   0x1
+#define FACT_CHARGING  0x2
+#define FACT_CYCLES    0x4
+#define FACT_HEALTH    0x8
+
+typedef struct {
+    int known;                  // FACT_* bits that were reported
+    int battery_percent;
+    int charging;               // charging or on external power
+    int cycle_count;
+    int health_percent;         // full charge capacity over design capacity
+} device_facts_t;
+
+// Query i, 0 <= i < FACTS_QUERIES: the IOPMPowerSource IORegistry entry,
+// then the GasGauge diagnostics
+plist_t facts_query(int i);
+
+// Takes what it can use from the reply to query i
+void facts_parse(int i, plist_t reply, device_facts_t *facts);
+
+// "Battery: udid=... level=87% charging=yes cycles=312 health=91%", only
+// what is known; nothing if nothing is
+void facts_print(const device_facts_t *facts, const char *udid, FILE *out);
+
+#endif
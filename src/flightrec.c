@@ -0,0 +1,139 @@
+#include <string.h>
+
+#include <plist/plist.h>
+
+#include "flightrec.h"
+#include "phase.h"
+
+// Fixed part of every event, followed by len payload bytes
+typedef struct {
+    uint16_t len;
+    uint8_t type;
+    int8_t arg;
+    int32_t code;
+    uint32_t at_us;         // since flightrec_init()
+} event_header_t;
+
+#define HEX_BYTES 48        // of a payload that does not parse
+
+static void ring_write(flightrec_t *r, uint32_t pos, const void *data, uint32_t len) {
+    uint32_t off = pos % FLIGHTREC_BYTES;
+    uint32_t first = len < FLIGHTREC_BYTES - off ? len : FLIGHTREC_BYTES - off;
+    memcpy(r->ring + off, data, first);
+    memcpy(r->ring, (const unsigned char *)data + first, len - first);
+}
+
+static void ring_read(const flightrec_t *r, uint32_t pos, void *data, uint32_t len) {
+    uint32_t off = pos % FLIGHTREC_BYTES;
+    uint32_t first = len < FLIGHTREC_BYTES - off ? len : FLIGHTREC_BYTES - off;
+    memcpy(data, r->ring + off, first);
+    memcpy((unsigned char *)data + first, r->ring, len - first);
+}
+
+void flightrec_init(flightrec_t *r) {
+    r->start_ns = phase_now_ns();
+    r->head = r->tail = 0;
+    r->events = r->dropped = 0;
+}
+
+void flightrec_add(flightrec_t *r, flightrec_event_t type, int arg, int32_t code, const void *data, uint32_t len) {
+    if (!r) {
+        return;
+    }
+    if (len > FLIGHTREC_PAYLOAD_MAX) {
+        len = FLIGHTREC_PAYLOAD_MAX;
+    }
+    event_header_t hdr = { (uint16_t)len, (uint8_t)type, (int8_t)arg, code,
+                           (uint32_t)((phase_now_ns() - r->start_ns) / 1000) };
+    uint32_t size = sizeof(hdr) + len;
+    // Make room by dropping the oldest events
+    while (FLIGHTREC_BYTES - (r->head - r->tail) < size) {
+        event_header_t old;
+        ring_read(r, r->tail, &old, sizeof(old));
+        r->tail += sizeof(old) + old.len;
+        r->dropped++;
+    }
+    ring_write(r, r->head, &hdr, sizeof(hdr));
+    if (len) {
+        ring_write(r, r->head + sizeof(hdr), data, len);
+    }
+    r->head += size;
+    r->events++;
+}
+
+static void dump_payload(const unsigned char *data, uint32_t len, int32_t full_len, FILE *out) {
+    plist_t plist = NULL;
+    if (len == (uint32_t)full_len) {
+        if (len >= 8 && memcmp(data, "bplist00", 8) == 0) {
+            plist_from_bin((const char *)data, len, &plist);
+        } else {
+            plist_from_xml((const char *)data, len, &plist);
+        }
+    }
+    char *xml = NULL;
+    uint32_t xml_len = 0;
+    if (plist) {
+        plist_to_xml(plist, &xml, &xml_len);
+        plist_free(plist);
+    }
+    if (xml) {
+        // Indented under the event line
+        for (char *line = xml, *end; line < xml + xml_len && *line; line = end + 1) {
+            end = strchr(line, '\n');
+            if (!end) {
+                end = xml + xml_len;
+            }
+            fprintf(out, "      %.*s\n", (int)(end - line), line);
+        }
+        plist_mem_free(xml);
+        return;
+    }
+    // Cut short or not a plist: the leading bytes
+    fprintf(out, "      ");
+    for (uint32_t i = 0; i < len && i < HEX_BYTES; i++) {
+        fprintf(out, "%02x", data[i]);
+    }
+    fprintf(out, "%s\n", len > HEX_BYTES || len < (uint32_t)full_len ? "..." : "");
+}
+
+void flightrec_dump(const flightrec_t *r, const char *udid, FILE *out) {
+    static const char *end_names[] = { "ok", "failed", "timed out" };
+    unsigned char payload[FLIGHTREC_PAYLOAD_MAX];
+    flockfile(out);
+    fprintf(out, "Flight recorder for %s: %u events", udid, r->events);
+    if (r->dropped) {
+        fprintf(out, ", oldest %u overwritten", r->dropped);
+    }
+    fprintf(out, "\n");
+    for (uint32_t pos = r->tail; pos != r->head;) {
+        event_header_t hdr;
+        ring_read(r, pos, &hdr, sizeof(hdr));
+        ring_read(r, pos + sizeof(hdr), payload, hdr.len);
+        pos += sizeof(hdr) + hdr.len;
+        fprintf(out, "  %10.3fms ", hdr.at_us / 1e3);
+        switch (hdr.type) {
+            case FLIGHTREC_ATTEMPT:
+                fprintf(out, "attempt %d\n", hdr.arg);
+                break;
+            case FLIGHTREC_PHASE_BEGIN:
+                fprintf(out, "begin %s\n", phase_name(hdr.arg));
+                break;
+            case FLIGHTREC_PHASE_END:
+                fprintf(out, "end %s: %s\n", phase_name(hdr.arg),
+                        hdr.code >= 0 && hdr.code <= 2 ? end_names[hdr.code] : "?");
+                break;
+            case FLIGHTREC_ERROR:
+                fprintf(out, "error in %s: code %d\n", phase_name(hdr.arg), hdr.code);
+                break;
+            case FLIGHTREC_SEND:
+            case FLIGHTREC_RECV:
+                fprintf(out, "%s %d bytes\n", hdr.type == FLIGHTREC_SEND ? "sent" : "received", hdr.code);
+                dump_payload(payload, hdr.len, hdr.code, out);
+                break;
+            default:
+                fprintf(out, "event %u\n", hdr.type);
+                break;
+        }
+    }
+    funlockfile(out);
+}
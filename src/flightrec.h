@@ -0,0 +1,50 @@
+#ifndef IDEVICEERASE_FLIGHTREC_H
+#define IDEVICEERASE_FLIGHTREC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Per-erase flight recorder.
+//
+// Every erase records what happens to it, always: phases starting and
+// ending, error codes, and the leading bytes of every plist it sends and
+// receives over the native framing. Events are written in compact binary
+// form into a fixed ring that overwrites the oldest ones, so recording
+// costs a copy and never allocates. Nothing is rendered unless the erase
+// fails, in which case flightrec_dump() prints the ring as text, plists
+// decoded to XML.
+//
+// A recorder is written by one thread at a time: the one driving the erase.
+
+#define FLIGHTREC_BYTES 8192        // ring size per erase
+#define FLIGHTREC_PAYLOAD_MAX 768   // leading plist bytes kept per message
+
+typedef enum {
+    FLIGHTREC_ATTEMPT = 1,  // arg: attempt number
+    FLIGHTREC_PHASE_BEGIN,  // arg: phase
+    FLIGHTREC_PHASE_END,    // arg: phase; code: 0 ok, 1 failed, 2 timed out
+    FLIGHTREC_ERROR,        // arg: phase; code: library error code
+    FLIGHTREC_SEND,         // payload: plist as sent; code: its full length
+    FLIGHTREC_RECV,         // payload: plist as received; code: its full length
+} flightrec_event_t;
+
+typedef struct {
+    uint64_t start_ns;
+    uint32_t head;          // ring offsets, counting up; both wrap together
+    uint32_t tail;          // oldest event still in the ring
+    uint32_t events;        // recorded in total
+    uint32_t dropped;       // overwritten before a dump
+    unsigned char ring[FLIGHTREC_BYTES];
+} flightrec_t;
+
+// Empties the recorder; times are counted from here
+void flightrec_init(flightrec_t *r);
+
+// Records an event; only the first FLIGHTREC_PAYLOAD_MAX bytes of data are
+// kept. r may be NULL.
+void flightrec_add(flightrec_t *r, flightrec_event_t type, int arg, int32_t code, const void *data, uint32_t len);
+
+// Prints the events still in the ring, oldest first
+void flightrec_dump(const flightrec_t *r, const char *udid, FILE *out);
+
+#endif
@@ -2,135 +2,1314 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
 #include <libimobiledevice/diagnostics_relay.h>
 #include <plist/plist.h>
 
+#include "adaptive.h"
+#include "capture.h"
+#include "certificate.h"
+#include "config.h"
+#include "devcache.h"
+#include "facts.h"
+#include "flightrec.h"
+#include "lease.h"
+#include "lockdown_cache.h"
+#include "registry.h"
+#include "report.h"
+#include "muxproxy.h"
+#include "pairing.h"
+#include "phase.h"
+#include "pipeline.h"
+#include "portstats.h"
+#include "plisttrace.h"
+#include "preflight.h"
+#include "race.h"
+#include "scheduler.h"
+#include "session.h"
+#include "usbmux.h"
+#include "wire.h"
+
 // Global variables to store parsed arguments
-static char *udid = NULL;
 static char *ecid = NULL; // Parsed, but not used in core logic yet
 static int debug_flag = 0;
+static int timing_flag = 0;
+static char *capture_path = NULL;
+static char *transport = "direct"; // direct, poll or uring
+static int native_framing = 1;      // --framing native, or library
+static char *connection = "usb";    // usb, network or race
+static uint32_t race_delay_ms = RACE_DEFAULT_DELAY_MS;
+static int num_workers = 1;
+static int workers_given = 0;
+static char *config_file = NULL;
+static char *profile_name = NULL;
+static int class_shares[PRIORITY_COUNT];
+static int shares_given = 0;
+static double aging_seconds = 30.0;
+static char *lease_dir = NULL;
+static double lease_ttl_seconds = 30.0;
+static char *certificate_dir = NULL;
+static char *certificate_key = NULL;
+
+static uint32_t deadline_ms = 0;
+static int adaptive_flag = 0;
+static double latency_target_ms = 0;
+static adaptive_t controller;
+static char *report_dir = NULL;
+static int station_flag = 0;
+static int port_stats_flag = 0;
+static double slow_port_ratio = 2.0;
+static report_plist_format_t report_plists = REPORT_PLIST_NONE;
+static preflight_rules_t preflight_rules;  // --preflight; none: no preflight stage
+static char *rework_path = NULL;
+static char *plist_trace_path = NULL;   // --plist-trace
+
+#define CERTIFICATE_ARCHIVE_BYTES (64ULL << 20)
+#define REPORT_ARCHIVE_BYTES (256ULL << 20)
+#define ADAPTIVE_DEFAULT_MAX 32
+#define PAIRING_THREADS 4
+#define HUB_SLOT_RETRY_MS 500   // between looks at a hub at its cap
+
+// Erase jobs from -u and --manifest, run through the scheduler
+static erase_session_t *sessions = NULL;
+static int num_sessions = 0;
+static erase_priority_t default_priority = PRIORITY_STANDARD;
+// Sessions of devices paired by --station, added while the run lasts
+static pthread_mutex_t station_lock = PTHREAD_MUTEX_INITIALIZER;
+static erase_session_t *station_sessions = NULL;
+static sem_t station_stop;
+static scheduler_t *scheduler = NULL;
+
+// Erase attempts run through these stages in order; each has its own
+// threads, so a slow handshake holds up no one waiting for a send.
+// Discovery is the device cache and the job queue in front of them, and
+// there is no verify stage: waiting for the device's answer is the last
+// thing request does, and once it reboots there is nothing left to check
+typedef enum {
+    STAGE_CONNECT = 0,
+    STAGE_PREFLIGHT,
+    STAGE_SERVICE,
+    STAGE_REQUEST,
+    STAGE_COUNT
+} erase_stage_t;
+
+static const char *stage_names[STAGE_COUNT] = { "connect", "preflight", "service", "request" };
+static int stage_threads[STAGE_COUNT];  // 0: as many as erases may run at once
+static pipeline_stage_t *stages[STAGE_COUNT];
+
+// usbmuxd relay, used for --capture and the poll/uring transports
+static int relay_active = 0;
+static int relay_used = 0;
+static muxproxy_stats_t relay_stats;
+
+// Device list kept from one usbmuxd subscription (devcache.h)
+static int devcache_used = 0;
+
+// Session capture written with --capture
+static capture_writer_t *capture_writer = NULL;
 
 // Function to print usage information
 void print_usage(const char *prog_name) {
-    fprintf(stderr, "Usage: %s -u <device_udid> [--ecid <value>] [--debug]\n", prog_name);
+    fprintf(stderr, "Usage: %s -u <device_udid> [--ecid <value>] [--debug] [--timing] [--capture <file>] [--transport <type>]\n", prog_name);
+    fprintf(stderr, "       %s --manifest <file> [--workers <n>] [--shares <spec>] [--aging <seconds>] [...]\n", prog_name);
     fprintf(stderr, "A utility to erase all content and settings on an iDevice.\n\n");
-    fprintf(stderr, "  -u, --udid <device_udid>   : Target device UDID (mandatory).\n");
+    fprintf(stderr, "  -u, --udid <device_udid>   : Target device UDID (mandatory unless --manifest is given, repeatable).\n");
+    fprintf(stderr, "      --priority <class>     : Class for the following -u devices: express, standard (default) or bulk.\n");
+    fprintf(stderr, "      --manifest <file>      : Read erase jobs from a file, one \"<udid> [class]\" per line.\n");
+    fprintf(stderr, "      --station              : Keep running; pair and erase every device plugged in until interrupted.\n");
+    fprintf(stderr, "      --workers <n>          : Erase up to n devices at once (default 1).\n");
+    fprintf(stderr, "      --stage-threads <spec> : Threads per stage, e.g. connect=4,service=4,request=16 (default: --workers).\n");
+    fprintf(stderr, "      --shares <spec>        : Worker shares per class (default express=6,standard=3,bulk=1).\n");
+    fprintf(stderr, "      --aging <seconds>      : Wait after which a job outranks the next higher class (default 30).\n");
+    fprintf(stderr, "      --adaptive             : Adjust the number of concurrent erases to the bus, up to --workers (default 32).\n");
+    fprintf(stderr, "      --latency-target <ms>  : Handshake latency --adaptive keeps under (default: twice the best seen).\n");
+    fprintf(stderr, "      --config <file>        : Station configuration file; reloaded whenever it changes.\n");
+    fprintf(stderr, "      --profile <name>       : Profile to use from --config (default: [default]).\n");
+    fprintf(stderr, "      --deadline <seconds>   : Time budget of each erase, retries included, once its slot is taken.\n");
+    fprintf(stderr, "      --lease-dir <dir>      : Claim devices through lease files in a directory shared with other stations.\n");
+    fprintf(stderr, "      --lease-ttl <seconds>  : Time after which a station's silent lease may be taken over (default 30).\n");
+    fprintf(stderr, "      --certificates <dir>   : Write a signed certificate for every erase to archives in dir.\n");
+    fprintf(stderr, "      --cert-key <file>      : PEM private key the certificates are signed with.\n");
+    fprintf(stderr, "      --report <dir>         : Write per-device results to gzip-compressed, rotating archives in dir.\n");
+    fprintf(stderr, "      --report-plists <fmt>  : Also dump every plist exchanged into the report, as binary or json.\n");
+    fprintf(stderr, "      --plist-trace <file>   : Write every plist exchanged to file as sent, for ideviceerase-plistdecode.\n");
+    fprintf(stderr, "      --preflight <rules>    : Turn devices away before erasing, e.g. battery=20,findmy (see README).\n");
+    fprintf(stderr, "      --rework <file>        : Append devices that fail --preflight to file, with the reason.\n");
+    fprintf(stderr, "      --port-stats           : Track latency per USB port and warn about ports slower than the rest.\n");
+    fprintf(stderr, "      --slow-port-ratio <x>  : p95 ratio to the other ports at which --port-stats flags a port (default 2).\n");
     fprintf(stderr, "      --ecid <value>         : Target device ECID (optional, not currently used for erase operation).\n");
-    fprintf(stderr, "      --debug                : Enable debug output.\n\n");
+    fprintf(stderr, "      --debug                : Enable debug output.\n");
+    fprintf(stderr, "      --timing               : Print per-phase timing when done.\n");
+    fprintf(stderr, "      --capture <file>       : Record all usbmuxd and device traffic to a capture file.\n");
+    fprintf(stderr, "      --transport <type>     : usbmuxd I/O path: direct (default), poll or uring (relayed).\n");
+    fprintf(stderr, "      --framing <type>       : Diagnostics service framing: native (default) or library.\n");
+    fprintf(stderr, "      --connection <mode>    : Reach devices over usb (default), network (Wi-Fi sync) or race both.\n");
+    fprintf(stderr, "      --race-delay <ms>      : Time USB gets before --connection race tries the network too (default %d).\n\n", RACE_DEFAULT_DELAY_MS);
     fprintf(stderr, "WARNING: This is a destructive operation and cannot be undone.\n");
     fprintf(stderr, "Ensure you have backed up your device if you need to preserve its data.\n");
 }
 
-// Placeholder for the erase function
-int perform_erase(idevice_t device, lockdownd_client_t client, const char *udid_arg) {
-    printf("Attempting to perform erase on device %s\n", udid_arg);
-    // TODO: Implement erase logic here
+// Relay observer that appends every event to the capture file
+static void capture_observer(muxproxy_event_t event, uint32_t conn_id, const char *data, uint32_t len, void *user_data) {
+    static const capture_type_t types[] = {
+        [MUXPROXY_OPEN] = CAPTURE_OPEN,
+        [MUXPROXY_CLIENT_DATA] = CAPTURE_CLIENT,
+        [MUXPROXY_DEVICE_DATA] = CAPTURE_DEVICE,
+        [MUXPROXY_CLOSE] = CAPTURE_CLOSE,
+    };
+    capture_write((capture_writer_t *)user_data, types[event], conn_id, data, len);
+}
+
+// Starts the usbmuxd relay (recording if --capture was given); must run
+// before any libimobiledevice call
+static int start_relay(void) {
+    muxproxy_observer_t observer = NULL;
+    if (capture_path) {
+        capture_writer = capture_open(capture_path);
+        if (!capture_writer) {
+            fprintf(stderr, "Error: Could not create capture file %s.\n", capture_path);
+            return -1;
+        }
+        observer = capture_observer;
+    }
+    muxproxy_set_backend(strcmp(transport, "uring") == 0 ? MUXPROXY_BACKEND_URING : MUXPROXY_BACKEND_POLL);
+    if (muxproxy_start(observer, capture_writer) < 0) {
+        capture_close(capture_writer);
+        capture_writer = NULL;
+        return -1;
+    }
+    relay_active = 1;
+    relay_used = 1;
+    if (debug_flag && capture_path) {
+        printf("Capturing session to %s\n", capture_path);
+    }
+    return 0;
+}
+
+static void stop_relay(void) {
+    if (!relay_active) {
+        return;
+    }
+    muxproxy_stop();
+    muxproxy_get_stats(&relay_stats);
+    relay_active = 0;
+    if (capture_writer) {
+        capture_close(capture_writer);
+        capture_writer = NULL;
+    }
+}
+
+// Prints host cost of the run next to the --timing line
+static void print_transport(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu_ms = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3 +
+                    usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+    if (!relay_used) {
+        printf("Transport: backend=direct cpu=%.3fms\n", cpu_ms);
+        return;
+    }
+    printf("Transport: backend=%s relay_syscalls=%llu client_bytes=%llu device_bytes=%llu connections=%llu cpu=%.3fms\n",
+           muxproxy_backend_name(relay_stats.backend), (unsigned long long)relay_stats.syscalls,
+           (unsigned long long)relay_stats.client_bytes, (unsigned long long)relay_stats.device_bytes,
+           (unsigned long long)relay_stats.connections, cpu_ms);
+}
+
+// Prints what the service framing cost per erase; the library's own
+// framing cannot be observed
+static void print_framing(void) {
+    wire_stats_t stats;
+    uint64_t erases;
+    wire_stats_get(&stats, &erases);
+    if (!native_framing || !erases) {
+        return;
+    }
+    printf("Framing: codec=native messages=%.1f send_calls=%.1f recv_calls=%.1f copied_bytes=%.1f\n",
+           (double)(stats.messages_sent + stats.messages_received) / erases, (double)stats.send_calls / erases,
+           (double)stats.recv_calls / erases, (double)stats.bytes_copied / erases);
+}
+
+// Prints peak RSS and what the session arenas used
+static void print_memory(void) {
+    struct rusage usage;
+    session_memory_t mem;
+    getrusage(RUSAGE_SELF, &usage);
+    session_memory_get(&mem);
+    uint64_t sessions = mem.sessions ? mem.sessions : 1;
+    printf("Memory: rss_peak=%ldkB arena_peak=%.1fkB session_peak=%.1fkB allocs_per_erase=%.1f heap_allocs_per_erase=%.1f\n",
+           usage.ru_maxrss, mem.peak / 1024.0, mem.session_peak / 1024.0,
+           (double)mem.allocs / sessions, (double)mem.heap_allocs / sessions);
+}
+
+// Prints what an erase cost the host on average, per phase and in total;
+// bytes only when the relay counted them
+static void print_host(void) {
+    session_resources_t res;
+    session_resources_get(&res);
+    if (!res.erases) {
+        return;
+    }
+    printf("Host: erases=%llu", (unsigned long long)res.erases);
+    for (int i = 0; i <= PHASE_COUNT; i++) {
+        const phase_resources_t *r = i < PHASE_COUNT ? &res.phases[i] : &res.total;
+        if (i < PHASE_COUNT && !r->cpu_ns && !r->switches && !r->tx_bytes && !r->rx_bytes) {
+            continue;
+        }
+        printf(" %s=cpu:%.3fms,csw:%.1f", i < PHASE_COUNT ? phase_name(i) : "total",
+               r->cpu_ns / 1e6 / res.erases, (double)r->switches / res.erases);
+        if (relay_used) {
+            printf(",tx:%.0fB,rx:%.0fB", (double)r->tx_bytes / res.erases, (double)r->rx_bytes / res.erases);
+        }
+    }
+    printf("\n");
+}
+
+// Ends the run: stops the relay and prints the host, transport and memory
+// lines, if requested
+static void finish_run(void) {
+    lockdown_cache_clear();
+    lease_close();
+    preflight_rework_close();
+    if (plist_trace_path) {
+        uint64_t traced = plisttrace_close();
+        if (debug_flag) {
+            printf("Wrote %llu plists to %s\n", (unsigned long long)traced, plist_trace_path);
+        }
+    }
+    if (report_dir) {
+        report_stats_t stats;
+        report_close(&stats);
+        if (stats.dropped) {
+            fprintf(stderr, "Warning: The report fell behind; %llu plist dumps were dropped.\n", (unsigned long long)stats.dropped);
+        }
+        if (debug_flag) {
+            printf("Report: %llu records, %.1fkB compressed to %.1fkB in %d archive(s)\n", (unsigned long long)stats.records,
+                   stats.raw_bytes / 1024.0, stats.compressed_bytes / 1024.0, stats.archives);
+        }
+    }
+    if (certificate_key) {
+        uint64_t written = certificates_close();
+        if (debug_flag) {
+            printf("Wrote %llu erase certificates to %s\n", (unsigned long long)written, certificate_dir);
+        }
+    }
+    udid_registry_clear();
+    if (port_stats_flag) {
+        port_stats_report(stdout);
+        port_stats_clear();
+    }
+    // The relay may no longer ask a list that is going away
+    muxproxy_set_list_provider(NULL);
+    devcache_stop();
+    if (debug_flag && devcache_used) {
+        devcache_stats_t cache;
+        devcache_get_stats(&cache);
+        printf("Device list: events=%llu lookups=%llu list_replies=%llu\n", (unsigned long long)cache.events,
+               (unsigned long long)cache.lookups, (unsigned long long)cache.list_replies);
+    }
+    stop_relay();
+    if (timing_flag) {
+        print_host();
+        print_transport();
+        print_framing();
+        if (strcmp(connection, "race") == 0) {
+            race_stats_t races;
+            race_get_stats(&races);
+            race_stats_print(&races, stdout);
+        }
+        print_memory();
+        if (adaptive_flag) {
+            adaptive_print(&controller, stdout);
+        }
+    }
+}
+
+static int add_session(const char *udid_arg, erase_priority_t priority) {
+    if (num_sessions % 64 == 0) {
+        erase_session_t *grown = realloc(sessions, (num_sessions + 64) * sizeof(erase_session_t));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return -1;
+        }
+        sessions = grown;
+    }
+    erase_session_t *session = &sessions[num_sessions++];
+    memset(session, 0, sizeof(*session));
+    session->udid = udid_arg;
+    session->priority = priority;
+    session->result = 1;
+    return 0;
+}
+
+// Reads "<udid> [class]" lines; blank lines and '#' comments are skipped
+static int load_manifest(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Could not open manifest %s.\n", path);
+        return -1;
+    }
+    char line[512];
+    int lineno = 0, res = 0;
+    while (res == 0 && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char *save = NULL;
+        char *id = strtok_r(line, " \t\r\n", &save);
+        if (!id) {
+            continue;
+        }
+        char *cls = strtok_r(NULL, " \t\r\n", &save);
+        int priority = cls ? priority_from_name(cls) : (int)default_priority;
+        if (priority < 0 || strtok_r(NULL, " \t\r\n", &save)) {
+            fprintf(stderr, "Error: %s:%d: expected \"<udid> [express|standard|bulk]\".\n", path, lineno);
+            res = -1;
+            break;
+        }
+        char *copy = strdup(id);
+        if (!copy || add_session(copy, priority) < 0) {
+            free(copy);
+            res = -1;
+        }
+    }
+    fclose(f);
+    return res;
+}
+
+// Destructors for arena_defer()
+static void free_service(void *p) { lockdownd_service_descriptor_free(p); }
+static void free_diag_client(void *p) { diagnostics_relay_client_free(p); }
+static void close_wire(void *p) { wire_disconnect(p); }
+static void free_plist(void *p) { plist_free(p); }
+static void free_plist_mem(void *p) { plist_mem_free(p); }
+
+// Hands obj, of about size bytes, over to the session arena; if the
+// session is out of memory budget it is destroyed right away and -1 is
+// returned
+static int session_own(erase_session_t *session, void (*fn)(void *), void *obj, size_t size) {
+    if (arena_defer(&session->arena, fn, obj, size) < 0) {
+        fn(obj);
+        fprintf(stderr, "Error: Session memory budget exceeded on device %s.\n", session->udid);
+        return -1;
+    }
+    return 0;
+}
+
+// Rough heap footprint of a plist: a node header for every node and key,
+// plus string and data contents
+#define PLIST_NODE_BYTES 64
+
+static size_t plist_footprint(plist_t node) {
+    size_t size = PLIST_NODE_BYTES;
+    uint64_t len = 0;
+    switch (plist_get_node_type(node)) {
+        case PLIST_STRING:
+            plist_get_string_ptr(node, &len);
+            size += len + 1;
+            break;
+        case PLIST_DATA:
+            plist_get_data_ptr(node, &len);
+            size += len;
+            break;
+        case PLIST_ARRAY:
+            for (uint32_t i = 0; i < plist_array_get_size(node); i++) {
+                size += plist_footprint(plist_array_get_item(node, i));
+            }
+            break;
+        case PLIST_DICT: {
+            plist_dict_iter iter = NULL;
+            plist_t value = NULL;
+            plist_dict_new_iter(node, &iter);
+            for (plist_dict_next_item(node, iter, NULL, &value); value; plist_dict_next_item(node, iter, NULL, &value)) {
+                size += PLIST_NODE_BYTES + plist_footprint(value);
+            }
+            plist_mem_free(iter);
+            break;
+        }
+        default:
+            break;
+    }
+    return size;
+}
+
+static int session_own_plist(erase_session_t *session, plist_t plist) {
+    return session_own(session, free_plist, plist, plist_footprint(plist));
+}
+
+// Writes a message of the native framing to the plist trace as it went
+// over the wire
+static void trace_wire_message(void *ctx, int sent, const char *data, uint32_t len) {
+    erase_session_t *session = ctx;
+    plisttrace_write(session->udid, sent ? PHASE_SEND : PHASE_RECV, sent ? PLISTTRACE_SENT : PLISTTRACE_RECEIVED, data, len);
+}
+
+// Prints the plist as XML, or with --plist-trace or --report-plists hands
+// it to the trace or the report instead
+static void debug_print_plist(erase_session_t *session, erase_phase_t phase, const char *what, plist_t plist) {
+    // The native framing traces its own bytes. The library's client does not
+    // hand them out; it sends XML, so that is what is traced for it.
+    if (plist_trace_path && !native_framing) {
+        char *xml = NULL;
+        uint32_t xml_len = 0;
+        plist_to_xml(plist, &xml, &xml_len);
+        if (xml) {
+            plisttrace_write(session->udid, phase, phase == PHASE_SEND ? PLISTTRACE_SENT : PLISTTRACE_RECEIVED, xml, xml_len);
+            plist_mem_free(xml);
+        }
+    }
+    if (report_plists) {
+        report_plist(session->udid, what, plist, report_plists);
+    }
+    if (plist_trace_path || report_plists) {
+        return;
+    }
+    char *plist_xml = NULL;
+    uint32_t xml_len = 0;
+    plist_to_xml(plist, &plist_xml, &xml_len);
+    if (plist_xml && session_own(session, free_plist_mem, plist_xml, xml_len + 1) == 0) {
+        printf("%s:\n%s\n", what, plist_xml);
+    }
+}
+
+// Serial number and ECID for the erase certificate; --ecid wins over what
+// the device reports
+static void read_identity(erase_session_t *session, lockdownd_client_t client) {
+    certificate_t *cert = &session->certificate;
+    plist_t value = NULL;
+    if (cert->serial[0] == '\0' && lockdownd_get_value(client, NULL, "SerialNumber", &value) == LOCKDOWN_E_SUCCESS &&
+        plist_get_node_type(value) == PLIST_STRING) {
+        char *serial = NULL;
+        plist_get_string_val(value, &serial);
+        snprintf(cert->serial, sizeof(cert->serial), "%s", serial ? serial : "");
+        plist_mem_free(serial);
+    }
+    plist_free(value);
+    value = NULL;
+    if (ecid) {
+        snprintf(cert->ecid, sizeof(cert->ecid), "%s", ecid);
+    } else if (cert->ecid[0] == '\0' && lockdownd_get_value(client, NULL, "UniqueChipID", &value) == LOCKDOWN_E_SUCCESS &&
+               plist_get_node_type(value) == PLIST_UINT) {
+        uint64_t chip_id = 0;
+        plist_get_uint_val(value, &chip_id);
+        snprintf(cert->ecid, sizeof(cert->ecid), "0x%llX", (unsigned long long)chip_id);
+    }
+    plist_free(value);
+}
+
+// Wakes the erase job waiting for the session's current attempt
+static void attempt_done(erase_session_t *session, int result) {
+    session->attempt_result = result;
+    sem_post(&session->attempt_done);
+}
+
+// Ends an attempt that got a lockdown session: releases everything the
+// stages opened, keeping the lockdown session for a retry if it is still
+// good, and wakes the erase job. The session is not the stage's any more.
+static void attempt_finish(erase_session_t *session, int result) {
+    const char *udid = session->udid;
+    if (result == 0) {
+        printf("Erase process initiated successfully for device %s.\n", udid);
+    } else {
+        fprintf(stderr, "Failed to initiate erase process for device %s.\n", udid);
+    }
+
+    printf("Cleaning up...\n");
+    arena_release_to(&session->arena, session->attempt_mark);
+    session->diag = NULL;
+    // Worth keeping only if the erase request never went out: after it
+    // the device reboots
+    int failed = session->timing.failed_phase;
+    if (result != 0 && !session->timed_out && failed >= PHASE_START_SERVICE && failed < PHASE_SEND) {
+        lockdown_cache_put(udid, session->device, session->lockdown, session->profile->lockdown_ttl_ms);
+    } else {
+        lockdownd_client_free(session->lockdown);
+        idevice_free(session->device);
+    }
+    session->device = NULL;
+    session->lockdown = NULL;
+    printf("Cleanup complete.\n");
+    attempt_done(session, result);
+}
+
+// Service stage: starts the diagnostics relay and connects to it
+static void stage_service(void *item) {
+    erase_session_t *session = item;
+    lockdownd_client_t client = session->lockdown;
+    printf("Attempting to perform erase on device %s\n", session->udid);
+    // Everything below is owned by the session arena and released by
+    // attempt_finish(), whichever way the attempt ends:
     // 1. Start com.apple.diagnostics_relay service
     // 2. Create diagnostics_relay_client
+    // and then, in the request stage:
     // 3. Create {"Request": "MobileObliterator"} plist
     // 4. Send plist
     // 5. Handle response
 
     lockdownd_service_descriptor_t service = NULL;
     diagnostics_relay_client_t diag_client = NULL;
-    plist_t request_plist = NULL;
-    plist_t response_plist = NULL;
-    int ret_val = -1;
+
+    session->erase_ran = 1;
+    if (certificate_dir) {
+        read_identity(session, client);
+    }
 
     printf("Starting diagnostics relay service...\n");
-    if (lockdownd_start_service(client, "com.apple.diagnostics_relay", &service) != LOCKDOWN_E_SUCCESS || service == NULL || service->port == 0) {
+    session_phase_begin(session, PHASE_START_SERVICE);
+    lockdownd_error_t lerr = lockdownd_start_service(client, "com.apple.diagnostics_relay", &service);
+    if (service && session_own(session, free_service, service, sizeof(*service)) < 0) {
+        session_phase_end(session, 0);
+        attempt_finish(session, 1);
+        return;
+    }
+    if (lerr != LOCKDOWN_E_SUCCESS || service == NULL || service->port == 0) {
+        flightrec_add(&session->recorder, FLIGHTREC_ERROR, PHASE_START_SERVICE, lerr, NULL, 0);
+        session_phase_end(session, 0);
         fprintf(stderr, "Error: Could not start com.apple.diagnostics_relay service.\n");
-        if (service) {
-            lockdownd_service_descriptor_free(service);
-        }
-        return -1;
+        attempt_finish(session, 1);
+        return;
     }
+    session_phase_end(session, 1);
     printf("Diagnostics relay service started on port %d.\n", service->port);
 
-    if (diagnostics_relay_client_new(device, service, &diag_client) != DIAGNOSTICS_RELAY_E_SUCCESS) {
+    session_phase_begin(session, PHASE_SERVICE_CONNECT);
+    int derr = native_framing ? wire_connect(&session->wire, session->device, service)
+                              : diagnostics_relay_client_new(session->device, service, &diag_client);
+    if (derr != 0) {
+        flightrec_add(&session->recorder, FLIGHTREC_ERROR, PHASE_SERVICE_CONNECT, derr, NULL, 0);
+        session_phase_end(session, 0);
         fprintf(stderr, "Error: Could not connect to diagnostics_relay service.\n");
-        lockdownd_service_descriptor_free(service);
-        return -1;
+        attempt_finish(session, 1);
+        return;
     }
+    if (native_framing ? session_own(session, close_wire, &session->wire, 0) < 0
+                       : session_own(session, free_diag_client, diag_client, 0) < 0) {
+        session_phase_end(session, 0);
+        attempt_finish(session, 1);
+        return;
+    }
+    session_phase_end(session, 1);
     printf("Diagnostics relay client created.\n");
+    session->diag = diag_client;
+    pipeline_push(stages[STAGE_REQUEST], session);
+}
+
+// Sends the requests one after the other without waiting for replies
+static int send_requests(erase_session_t *session, const plist_t *requests, int count) {
+    if (native_framing) {
+        return wire_send_all(&session->wire, requests, count) == 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (diagnostics_relay_send(session->diag, requests[i]) != DIAGNOSTICS_RELAY_E_SUCCESS) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// What is left of the receive phase's timeout or of the --deadline budget,
+// whichever ends first; WIRE_RECV_TIMEOUT_MS if neither is set
+static unsigned int recv_timeout_ms(const erase_session_t *session) {
+    uint32_t phase_ms = session->profile->timeout_ms[PHASE_RECV];
+    uint64_t end = phase_ms ? session->timing.phase_start_ns + (uint64_t)phase_ms * 1000000ULL : 0;
+    if (session->budget_end_ns && (!end || session->budget_end_ns < end)) {
+        end = session->budget_end_ns;
+    }
+    if (!end) {
+        return WIRE_RECV_TIMEOUT_MS;
+    }
+    uint64_t now = phase_now_ns();
+    // 0 would wait forever; an expired wait still gets one try
+    return end > now ? (unsigned int)((end - now + 999999) / 1000000) : 1;
+}
+
+static int recv_reply(erase_session_t *session, plist_t *reply) {
+    if (native_framing) {
+        return wire_recv(&session->wire, reply, recv_timeout_ms(session)) == 0;
+    }
+    return diagnostics_relay_recv(session->diag, reply) == DIAGNOSTICS_RELAY_E_SUCCESS;
+}
+
+// Request stage: sends the battery queries and MobileObliterator in one go
+// and waits for the device's answers, which come back in the same order
+static void stage_request(void *item) {
+    erase_session_t *session = item;
+    const char *udid_arg = session->udid;
+    plist_t requests[FACTS_QUERIES + 1];
+    plist_t request_plist = NULL;
+    plist_t response_plist = NULL;
+
+    for (int i = 0; i < FACTS_QUERIES; i++) {
+        requests[i] = facts_query(i);
+        if (!requests[i]) {
+            fprintf(stderr, "Error: Could not create request PList.\n");
+            attempt_finish(session, 1);
+            return;
+        }
+        if (session_own_plist(session, requests[i]) < 0) {
+            attempt_finish(session, 1);
+            return;
+        }
+    }
 
     // Create {"Request": "MobileObliterator"} plist
     request_plist = plist_new_dict();
     if (!request_plist) {
         fprintf(stderr, "Error: Could not create request PList.\n");
-        diagnostics_relay_client_free(diag_client);
-        lockdownd_service_descriptor_free(service);
-        return -1;
+        attempt_finish(session, 1);
+        return;
     }
     plist_dict_set_item(request_plist, "Request", plist_new_string("MobileObliterator"));
-    if (debug_flag) {
-        char *plist_xml = NULL;
-        plist_to_xml(request_plist, &plist_xml, NULL);
-        printf("Sending PList:\n%s\n", plist_xml);
-        free(plist_xml);
+    if (session_own_plist(session, request_plist) < 0) {
+        attempt_finish(session, 1);
+        return;
+    }
+    requests[FACTS_QUERIES] = request_plist;
+    if (debug_flag || report_plists || plist_trace_path) {
+        for (int i = 0; i <= FACTS_QUERIES; i++) {
+            debug_print_plist(session, PHASE_SEND, "Sending PList", requests[i]);
+        }
     }
 
     printf("Sending MobileObliterator request...\n");
-    // diagnostics_relay_request_diagnostics is for getting info, not sending commands like this.
-    // diagnostics_relay_goodbye might be one option, or we might need to send raw plist.
-    // Let's try sending goodbye with our custom plist. This is a guess.
-    // If this doesn't work, the next step is to look for a generic send/receive plist function,
-    // or how other tools use this service for obliteration.
-    // For now, let's assume diagnostics_relay_goodbye might work or needs to be replaced.
-    // The diagnostics_relay.h header shows:
-    // diagnostics_relay_error_t diagnostics_relay_goodbye(diagnostics_relay_client_t client);
-    // This doesn't take a plist.
-    // diagnostics_relay_error_t diagnostics_relay_send(diagnostics_relay_client_t client, plist_t plist);
-    // diagnostics_relay_error_t diagnostics_relay_recv(diagnostics_relay_client_t client, plist_t *plist);
-
-    if (diagnostics_relay_send(diag_client, request_plist) != DIAGNOSTICS_RELAY_E_SUCCESS) {
+    // Another station may own the device by now
+    if (session->lease && !lease_valid(session->lease)) {
+        fprintf(stderr, "Error: Lease on device %s expired or was taken over; not sending the erase request.\n", udid_arg);
+        attempt_finish(session, 1);
+        return;
+    }
+
+    session_phase_begin(session, PHASE_SEND);
+    if (!send_requests(session, requests, FACTS_QUERIES + 1)) {
+        session_phase_end(session, 0);
         fprintf(stderr, "Error: Failed to send MobileObliterator request.\n");
-        plist_free(request_plist);
-        diagnostics_relay_client_free(diag_client);
-        lockdownd_service_descriptor_free(service);
-        return -1;
+        attempt_finish(session, 1);
+        return;
     }
+    session_phase_end(session, 1);
     printf("MobileObliterator request sent. Waiting for response...\n");
 
     // Attempt to receive a response. The device might just reboot without a proper response.
-    // Set a timeout for receiving the response?
-    if (diagnostics_relay_recv(diag_client, &response_plist) == DIAGNOSTICS_RELAY_E_SUCCESS && response_plist) {
-        if (debug_flag) {
-            char *plist_xml = NULL;
-            plist_to_xml(response_plist, &plist_xml, NULL);
-            printf("Received PList response:\n%s\n", plist_xml);
-            free(plist_xml);
+    session_phase_begin(session, PHASE_RECV);
+    int received = 0, lost_at = -1;
+    for (int i = 0; i <= FACTS_QUERIES; i++) {
+        plist_t reply = NULL;
+        received = recv_reply(session, &reply) && reply;
+        // Replies are in request order; the last one answers the erase
+        if (!received || i == FACTS_QUERIES) {
+            response_plist = reply;
+            lost_at = received ? -1 : i;
+            break;
+        }
+        facts_parse(i, reply, &session->facts);
+        if (session_own_plist(session, reply) == 0 && (debug_flag || report_plists || plist_trace_path)) {
+            debug_print_plist(session, PHASE_RECV, "Received PList response", reply);
+        }
+    }
+    facts_print(&session->facts, udid_arg, stdout);
+    // A battery query went unanswered, so the erase reply was never read:
+    // unlike a device rebooting without answering, nothing says it took it
+    if (lost_at >= 0 && lost_at < FACTS_QUERIES) {
+        session_phase_end(session, 0);
+        if (response_plist) {
+            plist_free(response_plist);
+        }
+        fprintf(stderr, "Error: Device %s did not answer battery query %d; the erase request went out but was never acknowledged.\n",
+                udid_arg, lost_at + 1);
+        attempt_finish(session, 1);
+        return;
+    }
+    if (received) {
+        session_phase_end(session, 1);
+        if (certificate_dir) {
+            certificate_hash_plist(response_plist, session->certificate.response_sha256);
+            session->certificate.has_response = 1;
+        }
+        if (session_own_plist(session, response_plist) == 0 && (debug_flag || report_plists || plist_trace_path)) {
+            debug_print_plist(session, PHASE_RECV, "Received PList response", response_plist);
         }
         // Check response for success, if any specific format is expected
         // For MobileObliterator, the device likely just reboots.
         // A simple acknowledgement might be {"Status": "Acknowledged"} or something similar.
         // Or it could be an empty response.
         printf("Erase command acknowledged by device (response received).\n");
-        ret_val = 0; // Success
     } else {
         // This path might be taken if the device reboots before sending a response,
         // which could be considered a success for an erase command.
+        session_phase_end(session, 1);
+        if (response_plist) {
+            plist_free(response_plist);
+        }
         printf("No specific response received, or error receiving. This might be normal for an erase command.\n");
         printf("Assuming erase command was accepted if no send error occurred.\n");
-        ret_val = 0; // Consider it a success if send was okay.
     }
 
+    // Consider it a success if send was okay.
+    printf("Device %s should now begin erasing all content and settings.\n", udid_arg);
+    attempt_finish(session, 0);
+}
+
+// Gives the stages without --stage-threads 'threads' threads if they have
+// fewer, so a reload that raises the worker count is not held back by the
+// stages; a lower count leaves the spare threads idle
+static void grow_pipeline(int threads) {
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (stages[i] && !stage_threads[i]) {
+            pipeline_stage_grow(stages[i], threads);
+        }
+    }
+}
+
+// Applies a reloaded profile to the running queue; erases already in
+// progress keep the snapshot they started with
+static void apply_profile(const station_profile_t *profile) {
+    if (!workers_given && profile->workers > 0 && scheduler) {
+        // With --adaptive the profile's worker count is the upper bound
+        scheduler_set_workers(scheduler, adaptive_flag ? adaptive_set_max(&controller, profile->workers) : profile->workers);
+        grow_pipeline(profile->workers);
+    }
+}
+
+// USB location of the device as reported by usbmuxd, 0 if it is not listed
+// or not connected by USB
+static uint32_t lookup_location(const char *udid) {
+    usbmux_device_t dev;
+    int cached = devcache_lookup(udid, &dev);
+    if (cached >= 0) {
+        return cached ? dev.location_id : 0;
+    }
+    usbmux_device_t *devices = NULL;
+    int n = usbmux_list_devices(&devices);
+    uint32_t location = 0;
+    for (int i = 0; i < n; i++) {
+        if (strcmp(devices[i].udid, udid) == 0) {
+            location = devices[i].location_id;
+            break;
+        }
+    }
+    free(devices);
+    return location;
+}
+
+// First attempt of a race connected: the rest is the handshake
+static void race_connected(void *user_data) {
+    erase_session_t *session = user_data;
+    session_phase_end(session, 1);
+    printf("Device connected.\n");
+    printf("Attempting to handshake with lockdown service...\n");
+    session_phase_begin(session, PHASE_HANDSHAKE);
+}
+
+// Connects and shakes hands over USB and Wi-Fi sync at once, keeping
+// whichever completes first (--connection race)
+static int race_lockdown(erase_session_t *session) {
+    race_result_t won;
+    printf("Connecting to device %s...\n", session->udid);
+    session_phase_begin(session, PHASE_CONNECT);
+    int res = race_connect(session->udid, RACE_USB, race_delay_ms, "ideviceerase", &session->timed_out,
+                           race_connected, session, &won);
+    // The attempts ran on threads of their own, not on this one
+    phase_account_add(&session->timing, PHASE_CONNECT, won.connect_cpu_ns, won.connect_switches);
+    phase_account_add(&session->timing, PHASE_HANDSHAKE, won.handshake_cpu_ns, won.handshake_switches);
+    if (res < 0) {
+        session_phase_end(session, 0);
+        if (won.connected) {
+            fprintf(stderr, "Error: Could not connect to lockdown service on device %s.\n", session->udid);
+        } else {
+            fprintf(stderr, "Error: Could not connect to device with UDID %s. Make sure it's connected and accessible.\n", session->udid);
+        }
+        session->device = NULL;
+        session->lockdown = NULL;
+        return -1;
+    }
+    session->device = won.device;
+    session->lockdown = won.lockdown;
+    idevice_get_handle(session->device, &session->device_id);
+    session_phase_end(session, 1);
+    printf("Lockdown handshake successful over %s%s.\n", race_transport_name(won.transport),
+           won.raced ? " (raced)" : "");
+    return 0;
+}
+
+// Connect stage: connects and shakes hands with lockdown, or picks up the
+// lockdown session the attempt before left behind
+static void stage_connect(void *item) {
+    erase_session_t *session = item;
+    const char *udid = session->udid;
+    session->attempt_mark = arena_mark(&session->arena);
+
+    // A retry picks up the lockdown session of the attempt before
+    session->lockdown_reused = lockdown_cache_take(udid, &session->device, &session->lockdown);
+    if (session->lockdown_reused) {
+        session_phase_begin(session, PHASE_HANDSHAKE);
+        session_phase_end(session, 1);
+        idevice_get_handle(session->device, &session->device_id);
+        printf("Reusing lockdown session for device %s.\n", udid);
+    } else if (strcmp(connection, "race") == 0) {
+        if (race_lockdown(session) < 0) {
+            attempt_done(session, 1);
+            return;
+        }
+    } else {
+        printf("Connecting to device %s...\n", udid);
+        session_phase_begin(session, PHASE_CONNECT);
+        idevice_error_t ierr = idevice_new_with_options(&session->device, udid, strcmp(connection, "network") == 0 ? IDEVICE_LOOKUP_NETWORK : IDEVICE_LOOKUP_USBMUX);
+        if (ierr != IDEVICE_E_SUCCESS) {
+            flightrec_add(&session->recorder, FLIGHTREC_ERROR, PHASE_CONNECT, ierr, NULL, 0);
+            session_phase_end(session, 0);
+            fprintf(stderr, "Error: Could not connect to device with UDID %s. Make sure it's connected and accessible.\n", udid);
+            session->device = NULL;
+            attempt_done(session, 1);
+            return;
+        }
+        session_phase_end(session, 1);
+        idevice_get_handle(session->device, &session->device_id);
+        printf("Device connected.\n");
+
+        printf("Attempting to handshake with lockdown service...\n");
+        session_phase_begin(session, PHASE_HANDSHAKE);
+        lockdownd_error_t lerr = lockdownd_client_new_with_handshake(session->device, &session->lockdown, "ideviceerase");
+        if (lerr != LOCKDOWN_E_SUCCESS) {
+            flightrec_add(&session->recorder, FLIGHTREC_ERROR, PHASE_HANDSHAKE, lerr, NULL, 0);
+            session_phase_end(session, 0);
+            fprintf(stderr, "Error: Could not connect to lockdown service on device %s.\n", udid);
+            idevice_free(session->device);
+            session->device = NULL;
+            session->lockdown = NULL;
+            attempt_done(session, 1);
+            return;
+        }
+        session_phase_end(session, 1);
+        printf("Lockdown handshake successful.\n");
+    }
+    int preflight = stages[STAGE_PREFLIGHT] && !session->preflight_passed;
+    pipeline_push(stages[preflight ? STAGE_PREFLIGHT : STAGE_SERVICE], session);
+}
+
+// Preflight stage: reads what the rules look at from lockdown and turns
+// devices away that fail one, before a service is started for them. It
+// runs within the attempt, so the device holds its worker, lease and hub
+// slot while it is checked.
+static void stage_preflight(void *item) {
+    erase_session_t *session = item;
+    preflight_verdict_t verdict;
+    session_phase_begin(session, PHASE_PREFLIGHT);
+    if (preflight_check(session->lockdown, &preflight_rules, &verdict) < 0) {
+        session_phase_end(session, 0);
+        fprintf(stderr, "Error: Could not read preflight values from device %s.\n", session->udid);
+        attempt_finish(session, 1);
+        return;
+    }
+    if (verdict.reason != PREFLIGHT_PASS) {
+        // Failing the phase marks the erase; retrying would not help
+        session->rejected = 1;
+        session_phase_end(session, 0);
+        fprintf(stderr, "Device %s failed preflight: %s (%s).\n", session->udid,
+                preflight_reason_code(verdict.reason), verdict.detail);
+        preflight_rework_add(session->udid, priority_name(session->priority), &verdict);
+        attempt_finish(session, 1);
+        return;
+    }
+    session_phase_end(session, 1);
+    session->preflight_passed = 1;
+    pipeline_push(stages[STAGE_SERVICE], session);
+}
+
+// One connect/handshake/erase attempt, run through the stages; returns 0
+// on success. Everything the attempt opened is released before it returns.
+static int erase_attempt(erase_session_t *session) {
+    pipeline_push(stages[STAGE_CONNECT], session);
+    while (sem_wait(&session->attempt_done) < 0) {
+    }
+    return session->attempt_result;
+}
+
+// Claims the device in --lease-dir. Returns 1 if it is ours, 0 if it was
+// erased elsewhere or cannot be claimed, and -1 if it went back into the
+// queue because another station is busy with it.
+static int claim_device(erase_session_t *session) {
+    char holder[300];
+    int status = lease_claim(session->udid, &session->lease, holder, sizeof(holder));
+    if (status == LEASE_CLAIMED) {
+        return 1;
+    }
+    if (status == LEASE_DONE) {
+        printf("Device %s was already erased by another station.\n", session->udid);
+        session->erased_elsewhere = 1;
+        session->result = 0;
+        return 0;
+    }
+    if (status < 0) {
+        session->result = 1;
+        return 0;
+    }
+    // Held: do the rest of the queue first, then check back every third of
+    // the TTL until the holder finishes or its lease expires
+    // Once submitted, the job may be running on another worker: nothing of
+    // the session is written after that
+    session->job.seq = 0;
+    session->job.submit_ns = 0;
+    int deferred = session->lease_deferred++;
+    if (!deferred) {
+        printf("Device %s is being erased by %s; coming back to it later.\n", session->udid, holder);
+        scheduler_submit(scheduler, &session->job);
+    } else {
+        if (deferred == 1) {
+            printf("Waiting for %s to finish with device %s...\n", holder, session->udid);
+        }
+        scheduler_submit_after(scheduler, &session->job, (uint64_t)(lease_ttl_seconds * 1e9 / 3));
+    }
+    return -1;
+}
+
+// Feeds a finished erase to the --adaptive controller. Errors are timeouts
+// and failures to reach the device; reused lockdown sessions say nothing
+// about handshake latency.
+static void observe_erase(erase_session_t *session) {
+    static const char *reasons[] = {
+        [ADAPTIVE_GROW] = "latency and errors within target",
+        [ADAPTIVE_BACKOFF_ERROR] = "timeout or connection error",
+        [ADAPTIVE_BACKOFF_LATENCY] = "handshake latency over target",
+    };
+    const phase_timing_t *t = &session->timing;
+    int failed = t->failed_phase;
+    int error = session->timed_out || (failed >= 0 && failed < PHASE_SEND && !session->rejected);
+    double handshake_ms = -1;
+    if ((t->ran_mask & (1u << PHASE_HANDSHAKE)) && failed != PHASE_HANDSHAKE && !session->lockdown_reused) {
+        handshake_ms = t->phase_ns[PHASE_HANDSHAKE] / 1e6;
+    }
+    int limit;
+    adaptive_change_t change = adaptive_observe(&controller, handshake_ms, error, &limit);
+    if (change != ADAPTIVE_HOLD) {
+        scheduler_set_workers(scheduler, limit);
+        if (debug_flag) {
+            printf("Concurrency limit now %d (%s).\n", limit, reasons[change]);
+        }
+    }
+}
+
+// Feeds the phase durations of a finished erase to the port statistics. A
+// phase that failed quickly says nothing about the port; one that timed out
+// does, and so does a slow one before it.
+static void record_port_stats(erase_session_t *session) {
+    uint32_t skip = 0;
+    int failed = session->timing.failed_phase;
+    if (failed >= 0 && !session->timed_out) {
+        skip |= 1u << failed;
+    }
+    if (session->lockdown_reused) {
+        skip |= 1u << PHASE_HANDSHAKE;
+    }
+    port_stats_record(session->location_id, &session->timing, skip);
+}
+
+// Queues the erase certificate; signing happens on the certificate pool
+static void submit_certificate(erase_session_t *session) {
+    certificate_t *cert = &session->certificate;
+    int failed = session->timing.failed_phase;
+    snprintf(cert->udid, sizeof(cert->udid), "%s", session->udid);
+    cert->finished_ms = certificate_unix_ms();
+    if (session->result == 0) {
+        snprintf(cert->outcome, sizeof(cert->outcome), "erased");
+    } else {
+        snprintf(cert->outcome, sizeof(cert->outcome), "failed:%s", failed >= 0 ? phase_name(failed) : "erase");
+    }
+    certificate_submit(cert);
+}
+
+// Hands the result to duplicates of the device and, with --station, to
+// pairing. A station forgets failed devices, so that plugging one in again
+// erases it anew instead of sharing the old result.
+static void leave_registry(erase_session_t *session) {
+    udid_registry_leave(session->udid, session, session->result);
+    if (station_flag) {
+        if (session->result != 0) {
+            udid_registry_forget(session->udid, session);
+        }
+        pairing_done(session->udid, session->result == 0);
+    }
+}
+
+// Takes what the erase needs before it may start: the device in this run,
+// its lease and a slot on its hub. Returns 1 with session->profile held if
+// the erase may start, 0 if it has ended, or -1 if the job went back into
+// the queue; the session is not to be written after that.
+static int admit_device(erase_session_t *session) {
+    // One session per device and run; duplicates get its result. The owner
+    // re-entering after a requeue is a no-op.
+    session->coalesce.result = &session->result;
+    udid_registry_status_t entered = udid_registry_enter(session->udid, session, &session->coalesce);
+    if (entered != UDID_OWNED) {
+        printf("Device %s is already being erased in this run; sharing that result.\n", session->udid);
+        session->coalesced = 1;
+        // A running owner reports to pairing itself when it leaves
+        if (station_flag && entered == UDID_FINISHED) {
+            pairing_done(session->udid, session->result == 0);
+        }
+        return 0;
+    }
+    if (lease_dir && !session->lease) {
+        int claimed = claim_device(session);
+        if (claimed == 0) {
+            leave_registry(session);
+        }
+        if (claimed <= 0) {
+            return claimed;
+        }
+    }
+    const station_profile_t *profile = config_acquire();
+    session->location_id = profile->hub_cap || port_stats_flag ? lookup_location(session->udid) : 0;
+    session->hub = profile->hub_cap && session->location_id ? (int)usbmux_hub(session->location_id) : -1;
+    if (hub_slot_try_acquire(session) < 0) {
+        config_release(profile);
+        // Keeps its place in the queue; other hubs' devices go first
+        int deferred = session->hub_deferred++;
+        if (!deferred) {
+            printf("Waiting for a free slot on hub %d for device %s...\n", session->hub, session->udid);
+        }
+        scheduler_submit_after(scheduler, &session->job, (uint64_t)HUB_SLOT_RETRY_MS * 1000000ULL);
+        return -1;
+    }
+    session->profile = profile;
+    return 1;
+}
+
+// Releases what the erase held and reports its result
+static void finish_erase(erase_session_t *session) {
+    const station_profile_t *profile = session->profile;
+    sem_destroy(&session->attempt_done);
+    // The recorder is only read when the erase failed; turned-away devices
+    // were already reported
+    if (session->result != 0 && !session->rejected) {
+        flightrec_dump(&session->recorder, session->udid, stderr);
+    }
+
+    hub_slot_release(session);
+    phase_timing_finish(&session->timing);
+    if (session->lease) {
+        // Once the request may have gone out, no station is to repeat it
+        int sent = session->result == 0 || session->timing.failed_phase >= PHASE_SEND;
+        lease_release(session->lease, sent);
+        session->lease = NULL;
+    }
+    leave_registry(session);
+    if (certificate_dir && session->erase_ran) {
+        submit_certificate(session);
+    }
+    if (timing_flag) {
+        const char *tag = num_sessions > 1 || station_flag ? session->udid : NULL;
+        flockfile(stdout);
+        if (profile->output == OUTPUT_JSON) {
+            phase_timing_print_json(&session->timing, tag, stdout);
+        } else {
+            phase_timing_print(&session->timing, tag, stdout);
+            phase_resources_print(&session->timing, tag, stdout);
+        }
+        funlockfile(stdout);
+    }
+    if (report_dir) {
+        report_result(&session->timing, session->udid);
+    }
+    session_resources_account(&session->timing);
+    if (adaptive_flag) {
+        observe_erase(session);
+    }
+    if (port_stats_flag && session->location_id) {
+        record_port_stats(session);
+    }
+    session_memory_account(&session->arena);
+    // The wire buffer is the arena's
+    wire_free(&session->wire);
+    arena_release(&session->arena);
+    session->profile = NULL;
+    config_release(profile);
+}
+
+// Scheduler job: connects to one device and erases it. The job runs again
+// after a requeue: while it waits for a lease or a hub slot, and between
+// attempts, it holds no worker.
+static void erase_device(scheduler_job_t *job) {
+    erase_session_t *session = job->data;
+    // No profile yet: the erase has not started
+    if (!session->profile) {
+        if (admit_device(session) <= 0) {
+            return;
+        }
+        const station_profile_t *profile = session->profile;
+        arena_init(&session->arena, (size_t)profile->session_memory_kb * 1024, session_memory_hook, NULL);
+        session->wire.arena = &session->arena;
+        phase_timing_init(&session->timing);
+        flightrec_init(&session->recorder);
+        session->wire.recorder = &session->recorder;
+        if (plist_trace_path) {
+            session->wire.tap = trace_wire_message;
+            session->wire.tap_ctx = session;
+        }
+        session->certificate.started_ms = certificate_unix_ms();
+        session->budget_ms = deadline_ms;
+        session->budget_end_ns = deadline_ms ? session->timing.start_ns + (uint64_t)deadline_ms * 1000000ULL : 0;
+        if (num_sessions > 1 || station_flag) {
+            uint64_t waited_ns = session->timing.start_ns - job->submit_ns;
+            printf("Starting %s erase of %s after %.3fs in queue.\n", priority_name(session->priority), session->udid, waited_ns / 1e9);
+        }
+        sem_init(&session->attempt_done, 0, 0);
+    }
+
+    const station_profile_t *profile = session->profile;
+    int attempt = session->attempts++;
+    watchdog_add(session);
+    flightrec_add(&session->recorder, FLIGHTREC_ATTEMPT, attempt + 1, 0, NULL, 0);
+    session->result = erase_attempt(session);
+    watchdog_remove(session);
+    // Never repeat a MobileObliterator request that may have gone out
+    int failed = session->timing.failed_phase;
+    if (session->result == 0 || session->rejected || attempt >= profile->retries || failed < 0 || failed >= PHASE_SEND) {
+        finish_erase(session);
+        return;
+    }
+    if (session->budget_end_ns &&
+        phase_now_ns() + (uint64_t)profile->retry_delay_ms * 1000000ULL >= session->budget_end_ns) {
+        printf("Not retrying device %s: its deadline would pass.\n", session->udid);
+        finish_erase(session);
+        return;
+    }
+    printf("Retrying device %s in %ums (attempt %d of %d)...\n", session->udid,
+           profile->retry_delay_ms, attempt + 2, profile->retries + 1);
+    phase_timing_retry(&session->timing);
+    // Keeps its lease and hub slot, and its place in the queue
+    scheduler_submit_after(scheduler, &session->job, (uint64_t)profile->retry_delay_ms * 1000000ULL);
+}
 
-    if (request_plist) plist_free(request_plist);
-    if (response_plist) plist_free(response_plist);
-    diagnostics_relay_client_free(diag_client);
-    lockdownd_service_descriptor_free(service);
+// Pairing hands a trusted device over: it becomes an erase job like any other
+static void queue_paired_device(const char *udid) {
+    erase_session_t *session = calloc(1, sizeof(*session));
+    char *copy = strdup(udid);
+    if (!session || !copy) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(session);
+        free(copy);
+        pairing_done(udid, 0);
+        return;
+    }
+    session->udid = copy;
+    session->priority = default_priority;
+    session->result = 1;
+    session->job.priority = session->priority;
+    session->job.data = session;
+    pthread_mutex_lock(&station_lock);
+    session->station_next = station_sessions;
+    station_sessions = session;
+    pthread_mutex_unlock(&station_lock);
+    scheduler_submit(scheduler, &session->job);
+}
 
-    if (ret_val == 0) {
-        printf("Device %s should now begin erasing all content and settings.\n", udid_arg);
+static void handle_stop_signal(int sig) {
+    (void)sig;
+    sem_post(&station_stop);
+}
+
+// --station: pairs and queues every device that is plugged in until SIGINT
+// or SIGTERM; a second signal ends the process right away
+static void run_station(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_signal;
+    sa.sa_flags = SA_RESETHAND;
+    sem_init(&station_stop, 0, 0);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (pairing_start(PAIRING_THREADS, queue_paired_device) == 0) {
+        printf("Station ready; plug in devices to erase them. Press Ctrl-C to stop.\n");
+        while (sem_wait(&station_stop) < 0) {
+        }
+        int waiting = pairing_stop();
+        printf("Stopping; finishing queued erases.");
+        if (waiting) {
+            printf(" %d device(s) were still waiting for Trust.", waiting);
+        }
+        printf("\n");
     }
-    return ret_val;
+    sem_destroy(&station_stop);
 }
 
+// Parses --stage-threads, e.g. "connect=4,request=16"; stages not named
+// keep the default
+static int parse_stage_threads(const char *spec) {
+    char *copy = strdup(spec);
+    if (!copy) {
+        return -1;
+    }
+    int res = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        if (!eq) {
+            res = -1;
+            break;
+        }
+        *eq = '\0';
+        int stage = -1;
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            if (strcmp(item, stage_names[i]) == 0) {
+                stage = i;
+            }
+        }
+        char *end = NULL;
+        long value = strtol(eq + 1, &end, 10);
+        if (stage < 0 || !end || *end != '\0' || value < 1 || value > 1024) {
+            res = -1;
+            break;
+        }
+        stage_threads[stage] = (int)value;
+    }
+    free(copy);
+    return res;
+}
+
+// Starts the stages; a stage without --stage-threads gets 'threads', the
+// most erases that may run at once, so it never holds one back
+static int start_pipeline(int threads) {
+    static const pipeline_run_fn run[STAGE_COUNT] = { stage_connect, stage_preflight, stage_service, stage_request };
+    // An erase sits in at most one queue at a time; if a reload raises the
+    // worker count past this, a full queue only makes the pusher wait
+    uint32_t capacity = threads * 2 > 64 ? (uint32_t)threads * 2 : 64;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (i == STAGE_PREFLIGHT && !preflight_rules.count) {
+            continue;
+        }
+        stages[i] = pipeline_stage_new(stage_names[i], stage_threads[i] ? stage_threads[i] : threads, capacity, run[i]);
+        if (!stages[i]) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Stops the stages once no erase runs any more, printing their
+// statistics with --timing
+static void stop_pipeline(void) {
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (!stages[i]) {
+            continue;
+        }
+        if (timing_flag) {
+            pipeline_stats_t stats;
+            pipeline_stage_stats(stages[i], &stats);
+            pipeline_stats_print(&stats, stdout);
+        }
+        pipeline_stage_free(stages[i]);
+        stages[i] = NULL;
+    }
+}
 
 int main(int argc, char *argv[]) {
     int opt;
@@ -138,14 +1317,46 @@ int main(int argc, char *argv[]) {
         {"udid",    required_argument, 0, 'u'},
         {"ecid",    required_argument, 0, 'e'},
         {"debug",   no_argument,       0, 'd'},
+        {"timing",  no_argument,       0, 't'},
+        {"capture", required_argument, 0, 'c'},
+        {"transport", required_argument, 0, 'T'},
+        {"framing", required_argument, 0, 'F'},
+        {"connection", required_argument, 0, 'X'},
+        {"race-delay", required_argument, 0, 'Y'},
+        {"priority", required_argument, 0, 'p'},
+        {"manifest", required_argument, 0, 'm'},
+        {"workers", required_argument, 0, 'w'},
+        {"stage-threads", required_argument, 0, 'H'},
+        {"station", no_argument,       0, 'N'},
+        {"shares",  required_argument, 0, 's'},
+        {"aging",   required_argument, 0, 'a'},
+        {"adaptive", no_argument,      0, 'A'},
+        {"latency-target", required_argument, 0, 'G'},
+        {"config",  required_argument, 0, 'C'},
+        {"profile", required_argument, 0, 'P'},
+        {"deadline", required_argument, 0, 'D'},
+        {"lease-dir", required_argument, 0, 'L'},
+        {"lease-ttl", required_argument, 0, 'l'},
+        {"certificates", required_argument, 0, 'Z'},
+        {"cert-key", required_argument, 0, 'K'},
+        {"report",  required_argument, 0, 'R'},
+        {"report-plists", required_argument, 0, 'Q'},
+        {"plist-trace", required_argument, 0, 'J'},
+        {"port-stats", no_argument,    0, 'S'},
+        {"preflight", required_argument, 0, 'V'},
+        {"rework",  required_argument, 0, 'W'},
+        {"slow-port-ratio", required_argument, 0, 'O'},
         {0, 0, 0, 0}
     };
     int option_index = 0;
+    int priority;
 
     while ((opt = getopt_long(argc, argv, "+u:e:d", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'u':
-                udid = optarg;
+                if (add_session(optarg, default_priority) < 0) {
+                    return 1;
+                }
                 break;
             case 'e':
                 ecid = optarg;
@@ -153,6 +1364,166 @@ int main(int argc, char *argv[]) {
             case 'd':
                 debug_flag = 1;
                 break;
+            case 't':
+                timing_flag = 1;
+                break;
+            case 'c':
+                capture_path = optarg;
+                break;
+            case 'T':
+                if (strcmp(optarg, "direct") != 0 && strcmp(optarg, "poll") != 0 && strcmp(optarg, "uring") != 0) {
+                    fprintf(stderr, "Error: Unknown transport '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                transport = optarg;
+                break;
+            case 'F':
+                if (strcmp(optarg, "native") != 0 && strcmp(optarg, "library") != 0) {
+                    fprintf(stderr, "Error: Unknown framing '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                native_framing = strcmp(optarg, "native") == 0;
+                break;
+            case 'X':
+                if (strcmp(optarg, "usb") != 0 && strcmp(optarg, "network") != 0 && strcmp(optarg, "race") != 0) {
+                    fprintf(stderr, "Error: Unknown connection mode '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                connection = optarg;
+                break;
+            case 'Y':
+                if (atoi(optarg) < 0 || atoi(optarg) > 60000) {
+                    fprintf(stderr, "Error: --race-delay must be between 0 and 60000 ms.\n");
+                    return 1;
+                }
+                race_delay_ms = (uint32_t)atoi(optarg);
+                break;
+            case 'p':
+                priority = priority_from_name(optarg);
+                if (priority < 0) {
+                    fprintf(stderr, "Error: Unknown priority class '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                default_priority = priority;
+                break;
+            case 'm':
+                if (load_manifest(optarg) < 0) {
+                    return 1;
+                }
+                break;
+            case 'w':
+                num_workers = atoi(optarg);
+                if (num_workers < 1) {
+                    fprintf(stderr, "Error: --workers must be at least 1.\n");
+                    return 1;
+                }
+                workers_given = 1;
+                break;
+            case 'H':
+                if (parse_stage_threads(optarg) < 0) {
+                    fprintf(stderr, "Error: Invalid --stage-threads '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'C':
+                config_file = optarg;
+                break;
+            case 'P':
+                profile_name = optarg;
+                break;
+            case 's':
+                if (scheduler_parse_shares(optarg, class_shares) < 0) {
+                    fprintf(stderr, "Error: Invalid --shares '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                shares_given = 1;
+                break;
+            case 'a':
+                aging_seconds = atof(optarg);
+                if (aging_seconds < 0) {
+                    fprintf(stderr, "Error: --aging must not be negative.\n");
+                    return 1;
+                }
+                break;
+            case 'A':
+                adaptive_flag = 1;
+                break;
+            case 'G':
+                latency_target_ms = atof(optarg);
+                if (latency_target_ms <= 0) {
+                    fprintf(stderr, "Error: --latency-target must be positive.\n");
+                    return 1;
+                }
+                break;
+            case 'N':
+                station_flag = 1;
+                break;
+            case 'S':
+                port_stats_flag = 1;
+                break;
+            case 'V':
+                if (preflight_parse(optarg, &preflight_rules) < 0) {
+                    fprintf(stderr, "Error: Invalid --preflight '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'W':
+                rework_path = optarg;
+                break;
+            case 'J':
+                plist_trace_path = optarg;
+                break;
+            case 'O':
+                slow_port_ratio = atof(optarg);
+                if (slow_port_ratio <= 1) {
+                    fprintf(stderr, "Error: --slow-port-ratio must be greater than 1.\n");
+                    return 1;
+                }
+                break;
+            case 'D':
+                if (atof(optarg) <= 0 || atof(optarg) > 86400) {
+                    fprintf(stderr, "Error: --deadline must be greater than 0 and at most 86400 seconds.\n");
+                    return 1;
+                }
+                deadline_ms = (uint32_t)(atof(optarg) * 1000);
+                break;
+            case 'L':
+                lease_dir = optarg;
+                break;
+            case 'Z':
+                certificate_dir = optarg;
+                break;
+            case 'K':
+                certificate_key = optarg;
+                break;
+            case 'R':
+                report_dir = optarg;
+                break;
+            case 'Q':
+                if (strcmp(optarg, "binary") == 0) {
+                    report_plists = REPORT_PLIST_BINARY;
+                } else if (strcmp(optarg, "json") == 0) {
+                    report_plists = REPORT_PLIST_JSON;
+                } else {
+                    fprintf(stderr, "Error: Unknown plist format '%s'.\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l':
+                lease_ttl_seconds = atof(optarg);
+                if (lease_ttl_seconds < 1) {
+                    fprintf(stderr, "Error: --lease-ttl must be at least 1 second.\n");
+                    return 1;
+                }
+                break;
             case '?':
                 print_usage(argv[0]);
                 return 1;
@@ -161,7 +1532,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (udid == NULL) {
+    if (num_sessions == 0 && !station_flag) {
         fprintf(stderr, "Error: UDID is a mandatory argument.\n");
         print_usage(argv[0]);
         return 1;
@@ -170,7 +1541,13 @@ int main(int argc, char *argv[]) {
     if (debug_flag) {
         printf("Debug mode enabled.\n");
         printf("Program: ideviceerase\n");
-        printf("UDID: %s\n", udid);
+        for (int i = 0; i < num_sessions; i++) {
+            if (num_sessions > 1) {
+                printf("UDID: %s (%s)\n", sessions[i].udid, priority_name(sessions[i].priority));
+            } else {
+                printf("UDID: %s\n", sessions[i].udid);
+            }
+        }
         if (ecid) {
             printf("ECID: %s\n", ecid);
         } else {
@@ -188,41 +1565,172 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    idevice_t device = NULL;
-    lockdownd_client_t lockdown_client = NULL;
-    int result = 1; // Default to failure
-
-    printf("Connecting to device %s...\n", udid);
-    if (idevice_new_with_options(&device, udid, IDEVICE_LOOKUP_USBMUX) != IDEVICE_E_SUCCESS) {
-        fprintf(stderr, "Error: Could not connect to device with UDID %s. Make sure it's connected and accessible.\n", udid);
+    if (profile_name && !config_file) {
+        fprintf(stderr, "Error: --profile needs --config.\n");
+        print_usage(argv[0]);
         return 1;
     }
-    printf("Device connected.\n");
+    if (report_plists && !report_dir) {
+        fprintf(stderr, "Error: --report-plists needs --report.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!certificate_dir != !certificate_key) {
+        fprintf(stderr, "Error: --certificates and --cert-key go together.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (rework_path && !preflight_rules.count) {
+        fprintf(stderr, "Error: --rework needs --preflight.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    int profile_workers = 0, profile_hub_cap = 0;
+    if (config_file) {
+        if (config_load(config_file, profile_name) < 0) {
+            return 1;
+        }
+        const station_profile_t *profile = config_acquire();
+        if (!workers_given && profile->workers > 0) {
+            num_workers = profile->workers;
+            profile_workers = 1;
+        }
+        profile_hub_cap = profile->hub_cap;
+        if (debug_flag) {
+            printf("Using profile '%s' from %s\n", profile->name, config_file);
+        }
+        config_release(profile);
+    }
 
-    printf("Attempting to handshake with lockdown service...\n");
-    if (lockdownd_client_new_with_handshake(device, &lockdown_client, "ideviceerase") != LOCKDOWN_E_SUCCESS) {
-        fprintf(stderr, "Error: Could not connect to lockdown service on device %s.\n", udid);
-        idevice_free(device);
+    // Phase timeouts and deadlines work by aborting relayed connections, so
+    // a station configuration or a deadline always runs with the relay. It
+    // goes first, before anything below starts a thread.
+    if ((capture_path || config_file || deadline_ms || strcmp(transport, "direct") != 0) && start_relay() < 0) {
+        return 1;
+    }
+    // The key is loaded once; signing runs on its own thread pool
+    if (certificate_key && certificates_open(certificate_dir, certificate_key, 0, CERTIFICATE_ARCHIVE_BYTES) < 0) {
+        stop_relay();
+        return 1;
+    }
+    if (report_dir && report_open(report_dir, REPORT_ARCHIVE_BYTES) < 0) {
+        finish_run();
+        return 1;
+    }
+    if (rework_path && preflight_rework_open(rework_path) < 0) {
+        finish_run();
+        return 1;
+    }
+    if (plist_trace_path && plisttrace_open(plist_trace_path) < 0) {
+        finish_run();
         return 1;
     }
-    printf("Lockdown handshake successful.\n");
 
-    if (perform_erase(device, lockdown_client, udid) == 0) {
-        printf("Erase process initiated successfully for device %s.\n", udid);
-        result = 0; // Success
-    } else {
-        fprintf(stderr, "Failed to initiate erase process for device %s.\n", udid);
-        result = 1; // Failure
+    // One usbmuxd subscription keeps the device list; through the relay it
+    // answers the lookup behind every idevice_new_with_options(). Without the
+    // relay it only serves the location lookups of hub caps and port
+    // statistics; a hub cap turned on by a reload looks devices up one by one.
+    if (relay_active || port_stats_flag || profile_hub_cap) {
+        if (devcache_start() == 0) {
+            devcache_used = 1;
+            if (relay_active) {
+                muxproxy_set_list_provider(devcache_list_reply);
+            }
+        } else if (debug_flag) {
+            printf("Could not subscribe to usbmuxd device events; looking devices up one by one\n");
+        }
+    }
+    if ((config_file || deadline_ms) && watchdog_start() < 0) {
+        finish_run();
+        return 1;
+    }
+    if (lease_dir && lease_open(lease_dir, (uint32_t)(lease_ttl_seconds * 1000)) < 0) {
+        watchdog_stop();
+        finish_run();
+        return 1;
     }
 
-    printf("Cleaning up...\n");
-    if (lockdown_client) {
-        lockdownd_client_free(lockdown_client);
+    if (port_stats_flag) {
+        port_stats_init(slow_port_ratio);
     }
-    if (device) {
-        idevice_free(device);
+    // Per-phase CPU and context switches go wherever timings go; bytes are
+    // counted by the relay
+    if (timing_flag || report_dir) {
+        phase_set_accounting(PHASE_ACCOUNT_CPU | (relay_used ? PHASE_ACCOUNT_BYTES : 0));
     }
-    printf("Cleanup complete.\n");
+    if (adaptive_flag) {
+        // --workers, or the profile's, is the ceiling; start low and grow
+        int max = workers_given || profile_workers ? num_workers : ADAPTIVE_DEFAULT_MAX;
+        adaptive_init(&controller, 1, 1, max, latency_target_ms);
+        num_workers = controller.limit;
+    }
+    if (start_pipeline(adaptive_flag ? controller.max : num_workers) < 0) {
+        stop_pipeline();
+        watchdog_stop();
+        finish_run();
+        return 1;
+    }
+    scheduler = scheduler_new(num_workers, shares_given ? class_shares : NULL,
+                                           (uint64_t)(aging_seconds * 1e9), erase_device);
+    if (!scheduler || (config_file && config_watch_start(apply_profile) < 0)) {
+        if (scheduler) {
+            scheduler_finish(scheduler);
+        }
+        stop_pipeline();
+        watchdog_stop();
+        finish_run();
+        return 1;
+    }
+    for (int i = 0; i < num_sessions; i++) {
+        sessions[i].job.priority = sessions[i].priority;
+        sessions[i].job.data = &sessions[i];
+        scheduler_submit(scheduler, &sessions[i].job);
+    }
+    if (station_flag) {
+        run_station();
+    }
+    scheduler_drain(scheduler);
+    // No reload may touch the scheduler once it is freed
+    config_watch_stop();
+    scheduler_free(scheduler);
+    scheduler = NULL;
+    stop_pipeline();
+    watchdog_stop();
+    finish_run();
 
+    int result = 0;
+    int failed = 0;
+    int elsewhere = 0;
+    int rejected = 0;
+    for (int i = 0; i < num_sessions; i++) {
+        if (sessions[i].result != 0) {
+            result = 1;
+            failed++;
+        }
+        elsewhere += sessions[i].erased_elsewhere;
+        rejected += sessions[i].rejected;
+    }
+    while (station_sessions) {
+        erase_session_t *session = station_sessions;
+        station_sessions = session->station_next;
+        if (session->result != 0) {
+            result = 1;
+            failed++;
+        }
+        elsewhere += session->erased_elsewhere;
+        rejected += session->rejected;
+        num_sessions++;
+        free((char *)session->udid);
+        free(session);
+    }
+    if (lease_dir) {
+        printf("Erase jobs finished: %d succeeded, %d failed, %d erased by other stations.\n",
+               num_sessions - failed - elsewhere, failed, elsewhere);
+    } else if (num_sessions > 1 || station_flag) {
+        printf("Erase jobs finished: %d succeeded, %d failed.\n", num_sessions - failed, failed);
+    }
+    if (rejected) {
+        printf("%d device(s) failed preflight%s.\n", rejected, rework_path ? " and were added to the rework list" : "");
+    }
     return result;
 }
@@ -0,0 +1,14 @@
+#include "json.h"
+
+size_t json_escape(char *out, size_t pos, size_t size, const char *s) {
+    for (; *s && pos + 2 < size; s++) {
+        if (*s == '"' || *s == '\\') {
+            out[pos++] = '\\';
+        }
+        if ((unsigned char)*s >= 0x20) {
+            out[pos++] = *s;
+        }
+    }
+    out[pos] = '\0';
+    return pos;
+}
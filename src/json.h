@@ -0,0 +1,11 @@
+#ifndef IDEVICEERASE_JSON_H
+#define IDEVICEERASE_JSON_H
+
+#include <stddef.h>
+
+// Writes s into out at pos as the inside of a JSON string: quotes and
+// backslashes escaped, control characters dropped, cut short to fit in
+// size with its terminating NUL. Returns the new end of out.
+size_t json_escape(char *out, size_t pos, size_t size, const char *s);
+
+#endif
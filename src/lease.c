@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "lease.h"
+#include "phase.h"
+
+struct lease {
+    struct lease *next;
+    char *udid;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    uint64_t renewed_ns;    // phase_now_ns() of the last successful heartbeat
+    int lost;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int stopping;
+    int dirfd;
+    uint32_t ttl_ms;
+    char station[300];
+    lease_t *held;
+} leases = { .lock = PTHREAD_MUTEX_INITIALIZER, .dirfd = -1 };
+
+const char *lease_station(void) {
+    return leases.station;
+}
+
+static uint64_t wall_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+static uint64_t wall_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return wall_ns(&ts);
+}
+
+// Touches every held lease still ours; called with the lock held
+static void renew_locked(void) {
+    uint64_t now = phase_now_ns();
+    for (lease_t *l = leases.held; l; l = l->next) {
+        if (l->lost) {
+            continue;
+        }
+        char name[256];
+        struct stat st;
+        snprintf(name, sizeof(name), "%s.lease", l->udid);
+        if (fstatat(leases.dirfd, name, &st, 0) < 0 || st.st_dev != l->dev || st.st_ino != l->ino) {
+            l->lost = 1;
+            fprintf(stderr, "Warning: Lost the lease on device %s to another station.\n", l->udid);
+            continue;
+        }
+        if (futimens(l->fd, NULL) == 0) {
+            l->renewed_ns = now;
+        }
+    }
+}
+
+static void *heartbeat_thread(void *arg) {
+    (void)arg;
+    uint64_t period_ns = (uint64_t)leases.ttl_ms * 1000000ULL / 3;
+    pthread_mutex_lock(&leases.lock);
+    while (!leases.stopping) {
+        uint64_t next = phase_now_ns() + period_ns;
+        struct timespec ts = { (time_t)(next / 1000000000ULL), (long)(next % 1000000000ULL) };
+        pthread_cond_timedwait(&leases.cond, &leases.lock, &ts);
+        if (!leases.stopping) {
+            renew_locked();
+        }
+    }
+    pthread_mutex_unlock(&leases.lock);
+    return NULL;
+}
+
+int lease_open(const char *dir, uint32_t ttl_ms) {
+    leases.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (leases.dirfd < 0) {
+        fprintf(stderr, "Error: Could not open lease directory %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    snprintf(leases.station, sizeof(leases.station), "%s:%d", host, (int)getpid());
+    leases.ttl_ms = ttl_ms;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&leases.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    leases.stopping = 0;
+    if (pthread_create(&leases.thread, NULL, heartbeat_thread, NULL) != 0) {
+        fprintf(stderr, "Error: Could not start lease heartbeat thread.\n");
+        pthread_cond_destroy(&leases.cond);
+        close(leases.dirfd);
+        leases.dirfd = -1;
+        return -1;
+    }
+    leases.running = 1;
+    return 0;
+}
+
+void lease_close(void) {
+    if (!leases.running) {
+        return;
+    }
+    pthread_mutex_lock(&leases.lock);
+    leases.stopping = 1;
+    pthread_cond_signal(&leases.cond);
+    pthread_mutex_unlock(&leases.lock);
+    pthread_join(leases.thread, NULL);
+    pthread_cond_destroy(&leases.cond);
+    leases.running = 0;
+    // Leases still held here belong to erases that never ended; let them
+    // expire rather than hand the devices out
+    while (leases.held) {
+        lease_t *l = leases.held;
+        leases.held = l->next;
+        close(l->fd);
+        free(l->udid);
+        free(l);
+    }
+    close(leases.dirfd);
+    leases.dirfd = -1;
+}
+
+static void read_holder(const char *name, char *holder, size_t holder_size) {
+    if (!holder || holder_size == 0) {
+        return;
+    }
+    snprintf(holder, holder_size, "unknown");
+    int fd = openat(leases.dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t n = read(fd, holder, holder_size - 1);
+    close(fd);
+    if (n > 0) {
+        holder[n] = '\0';
+        holder[strcspn(holder, "\n")] = '\0';
+    } else {
+        snprintf(holder, holder_size, "unknown");
+    }
+}
+
+static int is_done(const char *udid) {
+    char name[256];
+    snprintf(name, sizeof(name), "%s.done", udid);
+    return faccessat(leases.dirfd, name, F_OK, 0) == 0;
+}
+
+// Moves an expired lease aside. Returns 1 if the file we moved is still the
+// expired lease we looked at, so that the caller may create a fresh lease.
+// A lease that turns out to be live is put back, never removed.
+static int take_over(const char *name, const struct stat *seen, const char *owner) {
+    char stale[640], moved_owner[300];
+    struct stat st;
+    snprintf(stale, sizeof(stale), "%s.stale.%s.%llu", name, leases.station, (unsigned long long)wall_now_ns());
+    if (renameat(leases.dirfd, name, leases.dirfd, stale) < 0) {
+        return 0;
+    }
+    // The owner's heartbeat may have touched the inode between our stat and
+    // the rename; only an untouched file from the same owner is expired
+    read_holder(stale, moved_owner, sizeof(moved_owner));
+    if (fstatat(leases.dirfd, stale, &st, 0) == 0 && st.st_dev == seen->st_dev && st.st_ino == seen->st_ino &&
+        st.st_mtim.tv_sec == seen->st_mtim.tv_sec && st.st_mtim.tv_nsec == seen->st_mtim.tv_nsec &&
+        strcmp(moved_owner, owner) == 0) {
+        unlinkat(leases.dirfd, stale, 0);
+        return 1;
+    }
+    // Renewed, or someone else took it over first: put it back. If yet
+    // another station has claimed the name meanwhile, leave the file where
+    // it is; its holder finds the name replaced at its next heartbeat
+    if (renameat2(leases.dirfd, stale, leases.dirfd, name, RENAME_NOREPLACE) < 0) {
+        fprintf(stderr, "Warning: Lease of %s moved aside to %s; %s was claimed meanwhile.\n", moved_owner, stale, name);
+    }
+    return 0;
+}
+
+int lease_claim(const char *udid, lease_t **lease, char *holder, size_t holder_size) {
+    char name[256];
+    if (snprintf(name, sizeof(name), "%s.lease", udid) >= (int)sizeof(name) || strchr(udid, '/')) {
+        fprintf(stderr, "Error: Invalid UDID for a lease: %s\n", udid);
+        return -1;
+    }
+    for (int tries = 0; tries < 3; tries++) {
+        if (is_done(udid)) {
+            return LEASE_DONE;
+        }
+        int fd = openat(leases.dirfd, name, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            dprintf(fd, "%s\n", leases.station);
+            // A station may have finished and released between our checks
+            if (is_done(udid)) {
+                unlinkat(leases.dirfd, name, 0);
+                close(fd);
+                return LEASE_DONE;
+            }
+            struct stat st;
+            lease_t *l = calloc(1, sizeof(*l));
+            if (!l || fstat(fd, &st) < 0 || !(l->udid = strdup(udid))) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                free(l);
+                unlinkat(leases.dirfd, name, 0);
+                close(fd);
+                return -1;
+            }
+            l->fd = fd;
+            l->dev = st.st_dev;
+            l->ino = st.st_ino;
+            l->renewed_ns = phase_now_ns();
+            pthread_mutex_lock(&leases.lock);
+            l->next = leases.held;
+            leases.held = l;
+            pthread_mutex_unlock(&leases.lock);
+            *lease = l;
+            return LEASE_CLAIMED;
+        }
+        if (errno != EEXIST) {
+            fprintf(stderr, "Error: Could not create lease %s: %s\n", name, strerror(errno));
+            return -1;
+        }
+        struct stat st;
+        if (fstatat(leases.dirfd, name, &st, 0) < 0) {
+            continue;  // released meanwhile
+        }
+        if (wall_ns(&st.st_mtim) + (uint64_t)leases.ttl_ms * 1000000ULL > wall_now_ns()) {
+            read_holder(name, holder, holder_size);
+            return LEASE_HELD;
+        }
+        char owner[300];
+        read_holder(name, owner, sizeof(owner));
+        if (!take_over(name, &st, owner)) {
+            break;  // renewed or taken over by another station: back off
+        }
+        printf("Taking over the expired lease of %s on device %s.\n", owner, udid);
+    }
+    read_holder(name, holder, holder_size);
+    return LEASE_HELD;
+}
+
+int lease_valid(lease_t *lease) {
+    // The heartbeat looks only every ttl / 3; the file may have been taken
+    // over since, so look at it again
+    char name[256];
+    struct stat st;
+    snprintf(name, sizeof(name), "%s.lease", lease->udid);
+    int ours = fstatat(leases.dirfd, name, &st, 0) == 0 && st.st_dev == lease->dev && st.st_ino == lease->ino;
+    pthread_mutex_lock(&leases.lock);
+    if (!ours && !lease->lost) {
+        lease->lost = 1;
+        fprintf(stderr, "Warning: Lost the lease on device %s to another station.\n", lease->udid);
+    }
+    int valid = !lease->lost && phase_now_ns() - lease->renewed_ns < (uint64_t)leases.ttl_ms * 1000000ULL;
+    pthread_mutex_unlock(&leases.lock);
+    return valid;
+}
+
+void lease_release(lease_t *lease, int done) {
+    char name[256];
+    pthread_mutex_lock(&leases.lock);
+    for (lease_t **link = &leases.held; *link; link = &(*link)->next) {
+        if (*link == lease) {
+            *link = lease->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&leases.lock);
+    if (done) {
+        snprintf(name, sizeof(name), "%s.done", lease->udid);
+        int fd = openat(leases.dirfd, name, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            dprintf(fd, "%s\n", leases.station);
+            close(fd);
+        } else {
+            fprintf(stderr, "Warning: Could not mark device %s as erased: %s\n", lease->udid, strerror(errno));
+        }
+    }
+    snprintf(name, sizeof(name), "%s.lease", lease->udid);
+    struct stat st;
+    if (!lease->lost && fstatat(leases.dirfd, name, &st, 0) == 0 && st.st_dev == lease->dev && st.st_ino == lease->ino) {
+        unlinkat(leases.dirfd, name, 0);
+    }
+    close(lease->fd);
+    free(lease->udid);
+    free(lease);
+}
@@ -0,0 +1,49 @@
+#ifndef IDEVICEERASE_LEASE_H
+#define IDEVICEERASE_LEASE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Device leases in a directory shared by several stations.
+//
+// A station claims a device by creating "<udid>.lease" with O_EXCL and keeps
+// the claim alive by touching the file every ttl / 3. A lease whose mtime
+// is older than the TTL belongs to a station that died and may be taken
+// over; the takeover renames the stale file out of the way and only
+// succeeds for the one station whose rename moved the inode it saw, still
+// untouched by its owner. A lease renewed meanwhile is put back. A
+// finished erase leaves "<udid>.done" behind, so no station erases the
+// device again.
+//
+// Stations compare mtimes against their own clock, so their clocks must
+// agree to well within the TTL.
+
+typedef struct lease lease_t;
+
+typedef enum {
+    LEASE_CLAIMED = 0,  // the device is ours
+    LEASE_HELD,         // another live station is erasing it
+    LEASE_DONE          // already erased by some station
+} lease_status_t;
+
+// Opens the shared directory and starts the heartbeat thread.
+int lease_open(const char *dir, uint32_t ttl_ms);
+void lease_close(void);
+
+// On LEASE_CLAIMED *lease is set; on LEASE_HELD the holder's station name
+// is copied to holder. Returns -1 on errors other than contention.
+int lease_claim(const char *udid, lease_t **lease, char *holder, size_t holder_size);
+
+// 0 once the lease may have passed to another station: the file is gone
+// or replaced, now or at a heartbeat, or no heartbeat succeeded within the
+// TTL. Nothing that cannot be repeated may be sent to the device then, so
+// call it right before sending.
+int lease_valid(lease_t *lease);
+
+// Drops the claim; done != 0 marks the device as erased first.
+void lease_release(lease_t *lease, int done);
+
+// "<hostname>:<pid>", written into every lease file
+const char *lease_station(void);
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "lockdown_cache.h"
+#include "phase.h"
+
+typedef struct cached_session {
+    struct cached_session *next;
+    char *udid;
+    idevice_t device;
+    lockdownd_client_t client;
+    uint64_t expires_ns;
+} cached_session_t;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cached_session_t *cache = NULL;
+
+static void free_entry(cached_session_t *e) {
+    lockdownd_client_free(e->client);
+    idevice_free(e->device);
+    free(e->udid);
+    free(e);
+}
+
+// Unlinks expired entries onto *expired; frees happen outside the lock
+static void collect_expired_locked(uint64_t now, cached_session_t **expired) {
+    cached_session_t **link = &cache;
+    while (*link) {
+        cached_session_t *e = *link;
+        if (e->expires_ns <= now) {
+            *link = e->next;
+            e->next = *expired;
+            *expired = e;
+        } else {
+            link = &e->next;
+        }
+    }
+}
+
+static void free_list(cached_session_t *list) {
+    while (list) {
+        cached_session_t *next = list->next;
+        free_entry(list);
+        list = next;
+    }
+}
+
+int lockdown_cache_take(const char *udid, idevice_t *device, lockdownd_client_t *client) {
+    cached_session_t *expired = NULL, *hit = NULL;
+    pthread_mutex_lock(&cache_lock);
+    collect_expired_locked(phase_now_ns(), &expired);
+    for (cached_session_t **link = &cache; *link; link = &(*link)->next) {
+        if (strcmp((*link)->udid, udid) == 0) {
+            hit = *link;
+            *link = hit->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    free_list(expired);
+    if (!hit) {
+        return 0;
+    }
+    // The device may have gone away, or the relay aborted the connection
+    char *type = NULL;
+    if (lockdownd_query_type(hit->client, &type) != LOCKDOWN_E_SUCCESS) {
+        free_entry(hit);
+        return 0;
+    }
+    free(type);
+    *device = hit->device;
+    *client = hit->client;
+    free(hit->udid);
+    free(hit);
+    return 1;
+}
+
+void lockdown_cache_put(const char *udid, idevice_t device, lockdownd_client_t client, uint32_t ttl_ms) {
+    cached_session_t *e = ttl_ms ? calloc(1, sizeof(*e)) : NULL;
+    if (e) {
+        e->udid = strdup(udid);
+    }
+    if (!e || !e->udid) {
+        free(e);
+        lockdownd_client_free(client);
+        idevice_free(device);
+        return;
+    }
+    e->device = device;
+    e->client = client;
+    e->expires_ns = phase_now_ns() + (uint64_t)ttl_ms * 1000000ULL;
+    cached_session_t *expired = NULL;
+    pthread_mutex_lock(&cache_lock);
+    collect_expired_locked(phase_now_ns(), &expired);
+    e->next = cache;
+    cache = e;
+    pthread_mutex_unlock(&cache_lock);
+    free_list(expired);
+}
+
+void lockdown_cache_clear(void) {
+    pthread_mutex_lock(&cache_lock);
+    cached_session_t *all = cache;
+    cache = NULL;
+    pthread_mutex_unlock(&cache_lock);
+    free_list(all);
+}
@@ -0,0 +1,26 @@
+#ifndef IDEVICEERASE_LOCKDOWN_CACHE_H
+#define IDEVICEERASE_LOCKDOWN_CACHE_H
+
+#include <stdint.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+
+// Keeps a device's lockdown session open for a while after an attempt that
+// failed past the handshake, so a retry within the same run skips the
+// pairing check and TLS handshake of lockdownd_client_new_with_handshake().
+// libimobiledevice does not expose its TLS session, so the session itself
+// is kept rather than a ticket to resume it.
+
+// Returns 1 and hands over the cached connection if there is a live one for
+// udid younger than its TTL, 0 otherwise. Costs one lockdown round trip to
+// check that the session is still up.
+int lockdown_cache_take(const char *udid, idevice_t *device, lockdownd_client_t *client);
+
+// Takes ownership of device and client; they are freed after ttl_ms or at
+// lockdown_cache_clear(), whichever comes first. ttl_ms == 0 frees them now.
+void lockdown_cache_put(const char *udid, idevice_t device, lockdownd_client_t client, uint32_t ttl_ms);
+
+void lockdown_cache_clear(void);
+
+#endif
@@ -0,0 +1,608 @@
+#define _GNU_SOURCE // accept4, pipe2, memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "muxproxy.h"
+#include "muxproxy_backend.h"
+#include "usbmux.h"
+
+#define RELAY_BUFFER_SIZE 65536
+#define FIRST_MESSAGE_MAX 4096  // larger first requests are never ListDevices
+
+typedef struct {
+    int client_fd;   // ideviceerase side
+    int upstream_fd; // usbmuxd side
+    uint32_t id;
+} proxy_conn_t;
+
+// Open connections by device, for muxproxy_abort_device(). Shared with the
+// thread that aborts; an entry is dropped before its socket is closed.
+typedef struct {
+    uint32_t conn_id;
+    int client_fd;
+    uint32_t device_id; // from the usbmuxd Connect request, 0 until then
+    int device_slot;    // index into tracked.devices once device_id is set
+} tracked_conn_t;
+
+// Bytes relayed per device over the whole run, for muxproxy_device_bytes()
+typedef struct {
+    uint32_t device_id;
+    uint64_t client_bytes;
+    uint64_t device_bytes;
+} device_bytes_t;
+
+static struct {
+    pthread_mutex_t lock;
+    tracked_conn_t *items;
+    int count;
+    int cap;
+    device_bytes_t *devices;
+    int num_devices;
+    int last;           // item found by the previous lookup
+} tracked = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// A connection whose first usbmuxd request is still being gathered, so a
+// ListDevices can be answered from the list provider. Relay thread only.
+typedef struct {
+    uint32_t conn_id;
+    uint32_t have;
+    char buf[FIRST_MESSAGE_MAX];
+} pending_first_t;
+
+static struct {
+    pending_first_t **items;
+    int count;
+    int cap;
+} pending;
+
+static muxproxy_list_fn list_provider;  // read with atomics by the relay
+
+static struct {
+    int listen_fd;
+    int wake_pipe[2];
+    pthread_t thread;
+    int running;
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    char *saved_address;  // USBMUXD_SOCKET_ADDRESS before we replaced it
+    muxproxy_observer_t observer;
+    void *user_data;
+    proxy_conn_t *conns;
+    int num_conns;
+    int cap_conns;
+    uint32_t next_id;
+    muxproxy_backend_t requested_backend;
+    muxproxy_stats_t stats;
+} proxy = { .listen_fd = -1, .wake_pipe = { -1, -1 } };
+
+// Connects to the real usbmuxd, honouring the address we replaced
+static int connect_upstream(void) {
+    proxy.stats.syscalls += 2; // socket + connect
+    return usbmux_connect(proxy.saved_address);
+}
+
+static void track(uint32_t id, int client_fd) {
+    pthread_mutex_lock(&tracked.lock);
+    if (tracked.count == tracked.cap) {
+        int cap = tracked.cap ? tracked.cap * 2 : 16;
+        tracked_conn_t *grown = realloc(tracked.items, cap * sizeof(tracked_conn_t));
+        if (!grown) {
+            pthread_mutex_unlock(&tracked.lock);
+            return;
+        }
+        tracked.items = grown;
+        tracked.cap = cap;
+    }
+    tracked.items[tracked.count++] = (tracked_conn_t){ id, client_fd, 0, -1 };
+    pthread_mutex_unlock(&tracked.lock);
+}
+
+static void untrack(uint32_t id) {
+    pthread_mutex_lock(&tracked.lock);
+    for (int i = 0; i < tracked.count; i++) {
+        if (tracked.items[i].conn_id == id) {
+            tracked.items[i] = tracked.items[--tracked.count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tracked.lock);
+}
+
+// Data arrives in bursts per connection, so the last hit is tried first
+static tracked_conn_t *find_tracked_locked(uint32_t id) {
+    if (tracked.last < tracked.count && tracked.items[tracked.last].conn_id == id) {
+        return &tracked.items[tracked.last];
+    }
+    for (int i = 0; i < tracked.count; i++) {
+        if (tracked.items[i].conn_id == id) {
+            tracked.last = i;
+            return &tracked.items[i];
+        }
+    }
+    return NULL;
+}
+
+static int device_slot_locked(uint32_t device_id) {
+    for (int i = 0; i < tracked.num_devices; i++) {
+        if (tracked.devices[i].device_id == device_id) {
+            return i;
+        }
+    }
+    if (tracked.num_devices % 64 == 0) {
+        device_bytes_t *grown = realloc(tracked.devices, (tracked.num_devices + 64) * sizeof(device_bytes_t));
+        if (!grown) {
+            return -1;
+        }
+        tracked.devices = grown;
+    }
+    tracked.devices[tracked.num_devices] = (device_bytes_t){ device_id, 0, 0 };
+    return tracked.num_devices++;
+}
+
+// Adds relayed bytes to the device the connection was opened to
+static void count_device_bytes(uint32_t id, int from_client, uint32_t len) {
+    pthread_mutex_lock(&tracked.lock);
+    tracked_conn_t *t = find_tracked_locked(id);
+    if (t && t->device_slot >= 0) {
+        device_bytes_t *d = &tracked.devices[t->device_slot];
+        if (from_client) {
+            d->client_bytes += len;
+        } else {
+            d->device_bytes += len;
+        }
+    }
+    pthread_mutex_unlock(&tracked.lock);
+}
+
+// Device a usbmuxd Connect request is for, or 0 if data is something else
+static uint32_t connect_device_id(const char *data, uint32_t len) {
+    struct usbmuxd_header hdr;
+    if (len < sizeof(hdr)) {
+        return 0;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.version != 1 || hdr.message != USBMUXD_MESSAGE_PLIST || !memmem(data, len, "<string>Connect</string>", 24)) {
+        return 0;
+    }
+    const char *key = memmem(data, len, "<key>DeviceID</key>", 19);
+    const char *end = data + len;
+    if (!key) {
+        return 0;
+    }
+    const char *value = memmem(key, end - key, "<integer>", 9);
+    if (!value || end - value < 10) {
+        return 0;
+    }
+    return (uint32_t)strtoul(value + 9, NULL, 10);
+}
+
+static void pending_add(uint32_t id) {
+    if (pending.count == pending.cap) {
+        int cap = pending.cap ? pending.cap * 2 : 16;
+        pending_first_t **grown = realloc(pending.items, cap * sizeof(pending_first_t *));
+        if (!grown) {
+            return;
+        }
+        pending.items = grown;
+        pending.cap = cap;
+    }
+    pending_first_t *p = malloc(sizeof(pending_first_t));
+    if (p) {
+        p->conn_id = id;
+        p->have = 0;
+        pending.items[pending.count++] = p;
+    }
+}
+
+static void pending_drop(int index) {
+    free(pending.items[index]);
+    pending.items[index] = pending.items[--pending.count];
+}
+
+static int write_full(int fd, const char *buf, size_t len);
+static void notify(muxproxy_event_t event, uint32_t id, const char *data, uint32_t len);
+
+// Client data on a connection that has not finished its first request is
+// held here instead of being relayed. libusbmuxd opens a connection for
+// every ListDevices, so once a whole request is in, a ListDevices is
+// answered by the list provider and never reaches usbmuxd; anything else
+// is sent on as it came. Returns 1 if the data was taken care of, 0 if the
+// caller relays it, -1 if the connection failed.
+static int answer_first(uint32_t id, int client_fd, int upstream_fd, const char *data, uint32_t len) {
+    int index = -1;
+    for (int i = 0; i < pending.count; i++) {
+        if (pending.items[i]->conn_id == id) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        return 0;
+    }
+    pending_first_t *p = pending.items[index];
+    struct usbmuxd_header hdr;
+    if (len > FIRST_MESSAGE_MAX - p->have) {
+        // Too long to be a ListDevices; relay what was held, then this
+        int failed = write_full(upstream_fd, p->buf, p->have) < 0;
+        pending_drop(index);
+        return failed ? -1 : 0;
+    }
+    memcpy(p->buf + p->have, data, len);
+    p->have += len;
+    if (p->have < sizeof(hdr)) {
+        return 1;
+    }
+    memcpy(&hdr, p->buf, sizeof(hdr));
+    if (hdr.length > sizeof(hdr) && hdr.length <= FIRST_MESSAGE_MAX && p->have < hdr.length) {
+        return 1;
+    }
+
+    char *reply = NULL;
+    uint32_t reply_len = 0;
+    muxproxy_list_fn provider = __atomic_load_n(&list_provider, __ATOMIC_ACQUIRE);
+    if (provider && hdr.version == 1 && hdr.message == 8 && p->have == hdr.length &&
+        memmem(p->buf, p->have, "<string>ListDevices</string>", 28)) {
+        reply = provider(hdr.tag, &reply_len);
+    }
+    int result;
+    if (reply) {
+        notify(MUXPROXY_DEVICE_DATA, id, reply, reply_len);
+        result = write_full(client_fd, reply, reply_len) < 0 ? -1 : 1;
+        free(reply);
+    } else {
+        result = write_full(upstream_fd, p->buf, p->have) < 0 ? -1 : 1;
+    }
+    pending_drop(index);
+    return result;
+}
+
+static void notify(muxproxy_event_t event, uint32_t id, const char *data, uint32_t len) {
+    if (event == MUXPROXY_CLIENT_DATA) {
+        proxy.stats.client_bytes += len;
+        uint32_t device_id = connect_device_id(data, len);
+        if (device_id) {
+            pthread_mutex_lock(&tracked.lock);
+            tracked_conn_t *t = find_tracked_locked(id);
+            if (t) {
+                t->device_id = device_id;
+                t->device_slot = device_slot_locked(device_id);
+            }
+            pthread_mutex_unlock(&tracked.lock);
+        } else {
+            count_device_bytes(id, 1, len);
+        }
+    } else if (event == MUXPROXY_DEVICE_DATA) {
+        proxy.stats.device_bytes += len;
+        count_device_bytes(id, 0, len);
+    } else if (event == MUXPROXY_OPEN) {
+        proxy.stats.connections++;
+        if (__atomic_load_n(&list_provider, __ATOMIC_ACQUIRE)) {
+            pending_add(id);
+        }
+    } else if (event == MUXPROXY_CLOSE) {
+        untrack(id);
+        for (int i = 0; i < pending.count; i++) {
+            if (pending.items[i]->conn_id == id) {
+                pending_drop(i);
+                break;
+            }
+        }
+    }
+    if (proxy.observer) {
+        proxy.observer(event, id, data, len, proxy.user_data);
+    }
+}
+
+static int write_full(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        proxy.stats.syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void accept_client(void) {
+    int client_fd = accept4(proxy.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    proxy.stats.syscalls++;
+    if (client_fd < 0) {
+        return;
+    }
+    int upstream_fd = connect_upstream();
+    if (upstream_fd < 0) {
+        // The client sees the same failure it would have seen without us
+        close(client_fd);
+        return;
+    }
+    if (proxy.num_conns == proxy.cap_conns) {
+        int cap = proxy.cap_conns ? proxy.cap_conns * 2 : 16;
+        proxy_conn_t *grown = realloc(proxy.conns, cap * sizeof(proxy_conn_t));
+        if (!grown) {
+            close(client_fd);
+            close(upstream_fd);
+            return;
+        }
+        proxy.conns = grown;
+        proxy.cap_conns = cap;
+    }
+    proxy_conn_t *c = &proxy.conns[proxy.num_conns++];
+    c->client_fd = client_fd;
+    c->upstream_fd = upstream_fd;
+    c->id = proxy.next_id++;
+    notify(MUXPROXY_OPEN, c->id, NULL, 0);
+    track(c->id, client_fd);
+}
+
+static void close_conn(int index) {
+    proxy_conn_t *c = &proxy.conns[index];
+    notify(MUXPROXY_CLOSE, c->id, NULL, 0);
+    close(c->client_fd);
+    close(c->upstream_fd);
+    proxy.stats.syscalls += 2;
+    proxy.conns[index] = proxy.conns[--proxy.num_conns];
+}
+
+// Moves one chunk from 'from' to 'to'; returns -1 once the connection is done
+static int relay_chunk(proxy_conn_t *c, int from_client, char *buf) {
+    int from = from_client ? c->client_fd : c->upstream_fd;
+    int to = from_client ? c->upstream_fd : c->client_fd;
+    ssize_t n = recv(from, buf, RELAY_BUFFER_SIZE, 0);
+    proxy.stats.syscalls++;
+    if (n < 0 && errno == EINTR) {
+        return 0;
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    notify(from_client ? MUXPROXY_CLIENT_DATA : MUXPROXY_DEVICE_DATA, c->id, buf, (uint32_t)n);
+    if (from_client) {
+        int answered = answer_first(c->id, c->client_fd, c->upstream_fd, buf, (uint32_t)n);
+        if (answered != 0) {
+            return answered < 0 ? -1 : 0;
+        }
+    }
+    return write_full(to, buf, n);
+}
+
+static void poll_loop(void) {
+    char *buf = malloc(RELAY_BUFFER_SIZE);
+    struct pollfd *fds = NULL;
+    int cap_fds = 0;
+    if (!buf) {
+        return;
+    }
+    proxy.stats.backend = MUXPROXY_BACKEND_POLL;
+    for (;;) {
+        int nfds = 2 + 2 * proxy.num_conns;
+        if (nfds > cap_fds) {
+            struct pollfd *grown = realloc(fds, nfds * sizeof(struct pollfd));
+            if (!grown) {
+                break;
+            }
+            fds = grown;
+            cap_fds = nfds;
+        }
+        fds[0].fd = proxy.wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = proxy.listen_fd;
+        fds[1].events = POLLIN;
+        for (int i = 0; i < proxy.num_conns; i++) {
+            fds[2 + 2 * i].fd = proxy.conns[i].client_fd;
+            fds[2 + 2 * i].events = POLLIN;
+            fds[3 + 2 * i].fd = proxy.conns[i].upstream_fd;
+            fds[3 + 2 * i].events = POLLIN;
+        }
+        proxy.stats.syscalls++;
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        // Walk backwards so close_conn() can swap the last entry in
+        int polled = (nfds - 2) / 2;
+        for (int i = polled - 1; i >= 0; i--) {
+            short client_ev = fds[2 + 2 * i].revents;
+            short upstream_ev = fds[3 + 2 * i].revents;
+            int done = 0;
+            if (client_ev) {
+                done = relay_chunk(&proxy.conns[i], 1, buf) < 0;
+            }
+            if (!done && upstream_ev) {
+                done = relay_chunk(&proxy.conns[i], 0, buf) < 0;
+            }
+            if (done) {
+                close_conn(i);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            accept_client();
+        }
+    }
+    while (proxy.num_conns > 0) {
+        close_conn(proxy.num_conns - 1);
+    }
+    free(fds);
+    free(buf);
+}
+
+static void *relay_thread(void *arg) {
+    (void)arg;
+    // A relayed peer can vanish at any time; never let that raise SIGPIPE
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (proxy.requested_backend == MUXPROXY_BACKEND_URING) {
+        muxproxy_env_t env = {
+            .listen_fd = proxy.listen_fd,
+            .wake_fd = proxy.wake_pipe[0],
+            .connect_upstream = connect_upstream,
+            .notify = notify,
+            .answer = answer_first,
+            .track = track,
+            .stats = &proxy.stats,
+        };
+        if (muxproxy_uring_run(&env) == 0) {
+            return NULL;
+        }
+    }
+    poll_loop();
+    return NULL;
+}
+
+void muxproxy_set_backend(muxproxy_backend_t backend) {
+    proxy.requested_backend = backend;
+}
+
+void muxproxy_set_list_provider(muxproxy_list_fn provider) {
+    __atomic_store_n(&list_provider, provider, __ATOMIC_RELEASE);
+}
+
+void muxproxy_get_stats(muxproxy_stats_t *stats) {
+    *stats = proxy.stats;
+}
+
+int muxproxy_abort_device(uint32_t device_id) {
+    int aborted = 0;
+    pthread_mutex_lock(&tracked.lock);
+    for (int i = 0; i < tracked.count; i++) {
+        if (tracked.items[i].device_id == device_id) {
+            // The relay sees EOF and tears the connection down as usual
+            shutdown(tracked.items[i].client_fd, SHUT_RDWR);
+            aborted++;
+        }
+    }
+    pthread_mutex_unlock(&tracked.lock);
+    return aborted;
+}
+
+void muxproxy_device_bytes(uint32_t device_id, uint64_t *client_bytes, uint64_t *device_bytes) {
+    *client_bytes = *device_bytes = 0;
+    pthread_mutex_lock(&tracked.lock);
+    for (int i = 0; i < tracked.num_devices; i++) {
+        if (tracked.devices[i].device_id == device_id) {
+            *client_bytes = tracked.devices[i].client_bytes;
+            *device_bytes = tracked.devices[i].device_bytes;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tracked.lock);
+}
+
+const char *muxproxy_backend_name(muxproxy_backend_t backend) {
+    return backend == MUXPROXY_BACKEND_URING ? "uring" : "poll";
+}
+
+int muxproxy_start(muxproxy_observer_t observer, void *user_data) {
+    if (proxy.running) {
+        return 0;
+    }
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(proxy.socket_path, sizeof(proxy.socket_path), "%s/ideviceerase-mux.%d.sock",
+             (tmpdir && *tmpdir) ? tmpdir : "/tmp", (int)getpid());
+
+    proxy.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (proxy.listen_fd < 0) {
+        fprintf(stderr, "Error: Could not create usbmuxd relay socket: %s\n", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, proxy.socket_path);
+    unlink(proxy.socket_path);
+    if (bind(proxy.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(proxy.listen_fd, 128) < 0) {
+        fprintf(stderr, "Error: Could not listen on %s: %s\n", proxy.socket_path, strerror(errno));
+        close(proxy.listen_fd);
+        proxy.listen_fd = -1;
+        return -1;
+    }
+    if (pipe2(proxy.wake_pipe, O_CLOEXEC) < 0) {
+        fprintf(stderr, "Error: Could not create usbmuxd relay pipe: %s\n", strerror(errno));
+        close(proxy.listen_fd);
+        unlink(proxy.socket_path);
+        proxy.listen_fd = -1;
+        return -1;
+    }
+
+    const char *current = getenv("USBMUXD_SOCKET_ADDRESS");
+    proxy.saved_address = current ? strdup(current) : NULL;
+    proxy.observer = observer;
+    proxy.user_data = user_data;
+    memset(&proxy.stats, 0, sizeof(proxy.stats));
+    proxy.stats.backend = proxy.requested_backend;
+    if (pthread_create(&proxy.thread, NULL, relay_thread, NULL) != 0) {
+        fprintf(stderr, "Error: Could not start usbmuxd relay thread.\n");
+        muxproxy_stop();
+        return -1;
+    }
+    proxy.running = 1;
+
+    char address[sizeof(proxy.socket_path) + 5];
+    snprintf(address, sizeof(address), "UNIX:%s", proxy.socket_path);
+    setenv("USBMUXD_SOCKET_ADDRESS", address, 1);
+    return 0;
+}
+
+void muxproxy_stop(void) {
+    if (proxy.running) {
+        if (write(proxy.wake_pipe[1], "x", 1) < 0) {
+            // The relay thread is stuck elsewhere; joining would hang
+            return;
+        }
+        pthread_join(proxy.thread, NULL);
+        proxy.running = 0;
+    }
+    if (proxy.saved_address) {
+        setenv("USBMUXD_SOCKET_ADDRESS", proxy.saved_address, 1);
+    } else {
+        unsetenv("USBMUXD_SOCKET_ADDRESS");
+    }
+    free(proxy.saved_address);
+    proxy.saved_address = NULL;
+    if (proxy.listen_fd >= 0) {
+        close(proxy.listen_fd);
+        unlink(proxy.socket_path);
+        proxy.listen_fd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (proxy.wake_pipe[i] >= 0) {
+            close(proxy.wake_pipe[i]);
+            proxy.wake_pipe[i] = -1;
+        }
+    }
+    free(proxy.conns);
+    proxy.conns = NULL;
+    proxy.num_conns = proxy.cap_conns = 0;
+    while (pending.count > 0) {
+        pending_drop(pending.count - 1);
+    }
+    free(pending.items);
+    pending.items = NULL;
+    pending.cap = 0;
+    pthread_mutex_lock(&tracked.lock);
+    free(tracked.items);
+    tracked.items = NULL;
+    tracked.count = tracked.cap = 0;
+    pthread_mutex_unlock(&tracked.lock);
+}
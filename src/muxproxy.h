@@ -0,0 +1,77 @@
+#ifndef IDEVICEERASE_MUXPROXY_H
+#define IDEVICEERASE_MUXPROXY_H
+
+#include <stdint.h>
+
+// In-process usbmuxd relay.
+//
+// muxproxy_start() listens on a private UNIX socket and points
+// USBMUXD_SOCKET_ADDRESS at it, so every usbmuxd request and every device
+// connection libimobiledevice makes afterwards passes through the relay on
+// its way to the real usbmuxd (the previous USBMUXD_SOCKET_ADDRESS, or
+// /var/run/usbmuxd). It must be started before the first libimobiledevice
+// call and before any other thread is created.
+
+typedef enum {
+    MUXPROXY_OPEN = 1,    // new client connection
+    MUXPROXY_CLIENT_DATA, // bytes sent by ideviceerase
+    MUXPROXY_DEVICE_DATA, // bytes sent by usbmuxd or the device
+    MUXPROXY_CLOSE        // connection closed by either side
+} muxproxy_event_t;
+
+// Called from the relay thread for every event, in order.
+typedef void (*muxproxy_observer_t)(muxproxy_event_t event, uint32_t conn_id,
+                                    const char *data, uint32_t len, void *user_data);
+
+// How the relay thread moves bytes. The io_uring backend batches the I/O
+// of all relayed connections into one io_uring_enter() per wakeup and reads
+// into registered buffers; when the kernel does not offer io_uring (or the
+// opcodes it needs) the relay falls back to the poll backend at runtime.
+typedef enum {
+    MUXPROXY_BACKEND_POLL = 0,
+    MUXPROXY_BACKEND_URING
+} muxproxy_backend_t;
+
+typedef struct {
+    muxproxy_backend_t backend; // backend that actually ran
+    uint64_t syscalls;          // system calls made by the relay thread
+    uint64_t client_bytes;      // bytes relayed from ideviceerase
+    uint64_t device_bytes;      // bytes relayed from usbmuxd or the device
+    uint64_t connections;
+} muxproxy_stats_t;
+
+// Returns usbmuxd's reply to a ListDevices request with the given tag,
+// header included, in a malloc()ed buffer; NULL to let usbmuxd answer.
+typedef char *(*muxproxy_list_fn)(uint32_t tag, uint32_t *len);
+
+// Has the relay answer ListDevices requests on connections opened from now
+// on with the provider's reply instead of relaying them; NULL to stop.
+// Safe from any thread.
+void muxproxy_set_list_provider(muxproxy_list_fn provider);
+
+// Selects the backend for the next muxproxy_start() (default: poll).
+void muxproxy_set_backend(muxproxy_backend_t backend);
+
+// Returns 0 on success, -1 on failure (with a message on stderr).
+int muxproxy_start(muxproxy_observer_t observer, void *user_data);
+
+// Closes all relayed connections and restores USBMUXD_SOCKET_ADDRESS.
+void muxproxy_stop(void);
+
+// Shuts down every relayed connection to the given usbmuxd device (the
+// DeviceID from its Connect request), so whatever libimobiledevice call is
+// blocked on them returns with an error. Safe from any thread; returns the
+// number of connections aborted.
+int muxproxy_abort_device(uint32_t device_id);
+
+// Bytes relayed so far on all connections to a device (the DeviceID from
+// their Connect requests), counted from the end of the Connect request: the
+// device's own traffic. Safe from any thread; 0 for unknown devices.
+void muxproxy_device_bytes(uint32_t device_id, uint64_t *client_bytes, uint64_t *device_bytes);
+
+// Relay counters; only meaningful after muxproxy_stop().
+void muxproxy_get_stats(muxproxy_stats_t *stats);
+
+const char *muxproxy_backend_name(muxproxy_backend_t backend);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef IDEVICEERASE_MUXPROXY_BACKEND_H
+#define IDEVICEERASE_MUXPROXY_BACKEND_H
+
+#include "muxproxy.h"
+
+// Interface between the relay core (muxproxy.c) and its I/O backends.
+// Everything here runs on the relay thread.
+
+typedef struct {
+    int listen_fd;
+    int wake_fd;  // readable once muxproxy_stop() wants the loop to end
+    int (*connect_upstream)(void);
+    void (*notify)(muxproxy_event_t event, uint32_t conn_id, const char *data, uint32_t len);
+    void (*track)(uint32_t conn_id, int client_fd);  // after MUXPROXY_OPEN
+    // Offered client data after notify(); 1: handled (read on), 0: relay
+    // it, -1: close the connection
+    int (*answer)(uint32_t conn_id, int client_fd, int upstream_fd, const char *data, uint32_t len);
+    muxproxy_stats_t *stats;
+} muxproxy_env_t;
+
+// Runs the io_uring relay loop until wake_fd becomes readable. Returns 0
+// after a normal stop, or -1 without having touched any connection when
+// io_uring is not usable, in which case the caller runs the poll loop.
+int muxproxy_uring_run(const muxproxy_env_t *env);
+
+#endif
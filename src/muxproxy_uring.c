@@ -0,0 +1,450 @@
+// io_uring backend for the usbmuxd relay.
+//
+// One ring serves every relayed connection: completions for all devices are
+// reaped together and the follow-up reads and writes they trigger are
+// submitted with a single io_uring_enter(). Each connection slot owns two
+// registered buffers (one per direction), so reads land in pinned memory
+// without per-call page lookups. If the buffers cannot be registered the
+// backend gives up and the relay runs its poll loop instead. The ring is
+// driven with raw system calls, which keeps liburing out of the dependency
+// list.
+//
+// This only changes how the relay moves bytes. libimobiledevice on the
+// other side of the relay socket still makes its own send and recv calls
+// per message, so an erase costs the same system calls on its own threads
+// with either backend.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "muxproxy_backend.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 512
+// Two registered buffers per slot; older kernels take at most UIO_MAXIOV
+// (1024) in one registration. Together they pin 8MB of memory.
+#define URING_SLOTS 512
+#define URING_BUFFER_SIZE 8192
+
+// user_data layout: slot index << 8 | operation
+enum {
+    OP_ACCEPT = 1,
+    OP_WAKE,
+    OP_READ_CLIENT,    // client -> upstream direction
+    OP_WRITE_UPSTREAM,
+    OP_READ_UPSTREAM,  // upstream -> client direction
+    OP_WRITE_CLIENT,
+};
+
+typedef struct {
+    int in_use;
+    int closing;
+    int inflight;
+    int client_fd;
+    int upstream_fd;
+    uint32_t id;
+    uint32_t len[2];  // bytes waiting to be written, per direction
+    uint32_t off[2];
+} uring_slot_t;
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned sq_entries;
+    unsigned to_submit;
+    char *buffers;
+    uring_slot_t *slots;
+    const muxproxy_env_t *env;
+    char wake_byte;
+} uring_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Checks that the kernel implements every opcode the relay uses
+static int uring_probe(uring_t *u) {
+    static const int needed[] = {
+        IORING_OP_ACCEPT, IORING_OP_READ, IORING_OP_SEND,
+        IORING_OP_READ_FIXED,
+    };
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) {
+        return -1;
+    }
+    int res = sys_io_uring_register(u->fd, IORING_REGISTER_PROBE, probe, 256);
+    for (size_t i = 0; res == 0 && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        if (needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+            res = -1;
+        }
+    }
+    free(probe);
+    return res < 0 ? -1 : 0;
+}
+
+static void uring_unmap(uring_t *u) {
+    if (u->sqes && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqes_size);
+    }
+    if (u->cq_ptr && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr) {
+        munmap(u->cq_ptr, u->cq_size);
+    }
+    if (u->sq_ptr && u->sq_ptr != MAP_FAILED) {
+        munmap(u->sq_ptr, u->sq_size);
+    }
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+}
+
+static int uring_init(uring_t *u) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (u->fd < 0) {
+        return -1;
+    }
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_size > u->sq_size) {
+            u->sq_size = u->cq_size;
+        }
+        u->cq_size = u->sq_size;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        uring_unmap(u);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) {
+            uring_unmap(u);
+            return -1;
+        }
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        uring_unmap(u);
+        return -1;
+    }
+    char *sq = u->sq_ptr, *cq = u->cq_ptr;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    u->sq_entries = p.sq_entries;
+    if (uring_probe(u) < 0) {
+        uring_unmap(u);
+        return -1;
+    }
+    return 0;
+}
+
+static int uring_submit(uring_t *u, unsigned min_complete) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        u->env->stats->syscalls++;
+        int res = sys_io_uring_enter(u->fd, u->to_submit, min_complete, flags);
+        if (res >= 0) {
+            u->to_submit -= (unsigned)res < u->to_submit ? (unsigned)res : u->to_submit;
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -1;
+        }
+        if (errno != EINTR) {
+            // Completion queue is full; let the caller reap first
+            return 0;
+        }
+    }
+}
+
+static struct io_uring_sqe *uring_get_sqe(uring_t *u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *u->sq_tail;
+    if (tail - head >= u->sq_entries) {
+        // Submission queue is full: flush what is there without waiting
+        uring_submit(u, 0);
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= u->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[index] = index;
+    // The kernel only looks at queued entries in io_uring_enter(), so the
+    // caller can keep filling this one in after the tail moves.
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+    return sqe;
+}
+
+static char *slot_buffer(uring_t *u, int slot, int dir) {
+    return u->buffers + ((size_t)slot * 2 + dir) * URING_BUFFER_SIZE;
+}
+
+static int queue_accept(uring_t *u) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = u->env->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = OP_ACCEPT;
+    return 0;
+}
+
+static int queue_wake(uring_t *u) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = u->env->wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&u->wake_byte;
+    sqe->len = 1;
+    sqe->user_data = OP_WAKE;
+    return 0;
+}
+
+// dir 0 reads from the client, dir 1 from usbmuxd
+static int queue_read(uring_t *u, int slot, int dir) {
+    uring_slot_t *s = &u->slots[slot];
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->fd = dir == 0 ? s->client_fd : s->upstream_fd;
+    sqe->addr = (uint64_t)(uintptr_t)slot_buffer(u, slot, dir);
+    sqe->len = URING_BUFFER_SIZE;
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->buf_index = slot * 2 + dir;
+    sqe->user_data = ((uint64_t)slot << 8) | (dir == 0 ? OP_READ_CLIENT : OP_READ_UPSTREAM);
+    s->inflight++;
+    return 0;
+}
+
+static int queue_write(uring_t *u, int slot, int dir) {
+    uring_slot_t *s = &u->slots[slot];
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = dir == 0 ? s->upstream_fd : s->client_fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot_buffer(u, slot, dir) + s->off[dir]);
+    sqe->len = s->len[dir] - s->off[dir];
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = ((uint64_t)slot << 8) | (dir == 0 ? OP_WRITE_UPSTREAM : OP_WRITE_CLIENT);
+    s->inflight++;
+    return 0;
+}
+
+static void slot_begin_close(uring_t *u, int slot) {
+    uring_slot_t *s = &u->slots[slot];
+    if (!s->closing) {
+        s->closing = 1;
+        // Makes the other direction's pending read complete right away
+        shutdown(s->client_fd, SHUT_RDWR);
+        shutdown(s->upstream_fd, SHUT_RDWR);
+        u->env->stats->syscalls += 2;
+    }
+}
+
+static void slot_release(uring_t *u, int slot) {
+    uring_slot_t *s = &u->slots[slot];
+    u->env->notify(MUXPROXY_CLOSE, s->id, NULL, 0);
+    close(s->client_fd);
+    close(s->upstream_fd);
+    u->env->stats->syscalls += 2;
+    memset(s, 0, sizeof(*s));
+}
+
+static void handle_accept(uring_t *u, int res, uint32_t *next_id) {
+    if (res < 0) {
+        return;
+    }
+    int upstream_fd = u->env->connect_upstream();
+    int slot = -1;
+    for (int i = 0; upstream_fd >= 0 && i < URING_SLOTS; i++) {
+        if (!u->slots[i].in_use) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        // No upstream, or every slot busy: the client sees a closed usbmuxd
+        close(res);
+        if (upstream_fd >= 0) {
+            close(upstream_fd);
+        }
+        return;
+    }
+    uring_slot_t *s = &u->slots[slot];
+    memset(s, 0, sizeof(*s));
+    s->in_use = 1;
+    s->client_fd = res;
+    s->upstream_fd = upstream_fd;
+    s->id = (*next_id)++;
+    u->env->notify(MUXPROXY_OPEN, s->id, NULL, 0);
+    u->env->track(s->id, s->client_fd);
+    if (queue_read(u, slot, 0) < 0 || queue_read(u, slot, 1) < 0) {
+        slot_begin_close(u, slot);
+    }
+}
+
+static void handle_io(uring_t *u, int slot, int op, int res) {
+    uring_slot_t *s = &u->slots[slot];
+    s->inflight--;
+    int dir = (op == OP_READ_CLIENT || op == OP_WRITE_UPSTREAM) ? 0 : 1;
+    if (s->closing) {
+        // Waiting for the remaining operations to drain
+    } else if (op == OP_READ_CLIENT || op == OP_READ_UPSTREAM) {
+        if (res <= 0) {
+            slot_begin_close(u, slot);
+        } else {
+            u->env->notify(dir == 0 ? MUXPROXY_CLIENT_DATA : MUXPROXY_DEVICE_DATA, s->id, slot_buffer(u, slot, dir), (uint32_t)res);
+            int answered = dir == 0 ? u->env->answer(s->id, s->client_fd, s->upstream_fd, slot_buffer(u, slot, dir), (uint32_t)res) : 0;
+            s->len[dir] = (uint32_t)res;
+            s->off[dir] = 0;
+            if (answered < 0 || (answered > 0 ? queue_read(u, slot, dir) : queue_write(u, slot, dir)) < 0) {
+                slot_begin_close(u, slot);
+            }
+        }
+    } else {
+        if (res <= 0) {
+            slot_begin_close(u, slot);
+        } else {
+            s->off[dir] += (uint32_t)res;
+            int queued = s->off[dir] < s->len[dir] ? queue_write(u, slot, dir) : queue_read(u, slot, dir);
+            if (queued < 0) {
+                slot_begin_close(u, slot);
+            }
+        }
+    }
+    if (s->closing && s->inflight == 0) {
+        slot_release(u, slot);
+    }
+}
+
+int muxproxy_uring_run(const muxproxy_env_t *env) {
+    uring_t u;
+    memset(&u, 0, sizeof(u));
+    u.env = env;
+    if (uring_init(&u) < 0) {
+        return -1;
+    }
+    u.slots = calloc(URING_SLOTS, sizeof(uring_slot_t));
+    u.buffers = mmap(NULL, (size_t)URING_SLOTS * 2 * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!u.slots || u.buffers == MAP_FAILED) {
+        free(u.slots);
+        if (u.buffers != MAP_FAILED) {
+            munmap(u.buffers, (size_t)URING_SLOTS * 2 * URING_BUFFER_SIZE);
+        }
+        uring_unmap(&u);
+        return -1;
+    }
+    int registered = 0;
+    struct iovec *iov = calloc(URING_SLOTS * 2, sizeof(struct iovec));
+    if (iov) {
+        for (int i = 0; i < URING_SLOTS * 2; i++) {
+            iov[i].iov_base = u.buffers + (size_t)i * URING_BUFFER_SIZE;
+            iov[i].iov_len = URING_BUFFER_SIZE;
+        }
+        registered = sys_io_uring_register(u.fd, IORING_REGISTER_BUFFERS, iov, URING_SLOTS * 2) == 0;
+        free(iov);
+    }
+    // Fails under a tight RLIMIT_MEMLOCK; without its buffers the ring
+    // saves nothing over poll, so the relay runs that instead
+    if (!registered) {
+        uring_unmap(&u);
+        munmap(u.buffers, (size_t)URING_SLOTS * 2 * URING_BUFFER_SIZE);
+        free(u.slots);
+        return -1;
+    }
+    env->stats->backend = MUXPROXY_BACKEND_URING;
+
+    uint32_t next_id = 0;
+    int stopping = queue_accept(&u) < 0 || queue_wake(&u) < 0;
+    while (!stopping) {
+        if (uring_submit(&u, 1) < 0) {
+            break;
+        }
+        unsigned head = *u.cq_head;
+        unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &u.cqes[head & *u.cq_mask];
+            int op = (int)(cqe->user_data & 0xff);
+            int slot = (int)(cqe->user_data >> 8);
+            int res = cqe->res;
+            if (op == OP_WAKE) {
+                stopping = 1;
+            } else if (op == OP_ACCEPT) {
+                handle_accept(&u, res, &next_id);
+                if (queue_accept(&u) < 0) {
+                    stopping = 1;
+                }
+            } else {
+                handle_io(&u, slot, op, res);
+            }
+        }
+        __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    for (int i = 0; i < URING_SLOTS; i++) {
+        if (u.slots[i].in_use) {
+            slot_release(&u, i);
+        }
+    }
+    // Closing the ring cancels whatever is still queued
+    uring_unmap(&u);
+    munmap(u.buffers, (size_t)URING_SLOTS * 2 * URING_BUFFER_SIZE);
+    free(u.slots);
+    return 0;
+}
+
+#else
+
+int muxproxy_uring_run(const muxproxy_env_t *env) {
+    (void)env;
+    return -1;
+}
+
+#endif
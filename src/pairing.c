@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+
+#include "pairing.h"
+#include "phase.h"
+
+#define PAIRING_MAX_FAILURES 3
+
+typedef enum {
+    PAIR_QUEUED = 0,    // waiting for a pairing thread
+    PAIR_RUNNING,       // a pairing thread is on it
+    PAIR_PARKED,        // waiting for the user to tap Trust
+    PAIR_HANDED_OVER,   // paired, its erase is queued or running
+    PAIR_ERASED
+} pair_state_t;
+
+typedef struct pair_device {
+    struct pair_device *next;
+    char *udid;
+    pair_state_t state;
+    uint64_t due_ns;    // when a queued or parked device is tried next
+    int failures;
+    int announced;      // the parked message was printed
+    int removed;        // unplugged during an attempt
+} pair_device_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pair_device_t *devices;
+    pthread_t *threads;
+    int num_threads;
+    int stopping;
+    idevice_subscription_context_t events;
+    pairing_ready_fn on_paired;
+} pairing = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static pair_device_t *find_locked(const char *udid) {
+    for (pair_device_t *d = pairing.devices; d; d = d->next) {
+        if (strcmp(d->udid, udid) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static void remove_locked(pair_device_t *dev) {
+    for (pair_device_t **link = &pairing.devices; *link; link = &(*link)->next) {
+        if (*link == dev) {
+            *link = dev->next;
+            free(dev->udid);
+            free(dev);
+            return;
+        }
+    }
+}
+
+// Runs on libimobiledevice's event thread
+static void on_event(const idevice_event_t *event, void *user_data) {
+    (void)user_data;
+    if (event->conn_type != CONNECTION_USBMUXD || !event->udid) {
+        return;
+    }
+    pthread_mutex_lock(&pairing.lock);
+    pair_device_t *dev = find_locked(event->udid);
+    switch (event->event) {
+        case IDEVICE_DEVICE_ADD:
+            if (dev) {
+                // Back from the erase, or a replug during an attempt
+                dev->removed = 0;
+                break;
+            }
+            dev = calloc(1, sizeof(*dev));
+            if (!dev || !(dev->udid = strdup(event->udid))) {
+                free(dev);
+                fprintf(stderr, "Error: Out of memory.\n");
+                break;
+            }
+            dev->next = pairing.devices;
+            pairing.devices = dev;
+            printf("Device %s attached; pairing.\n", dev->udid);
+            pthread_cond_signal(&pairing.cond);
+            break;
+        case IDEVICE_DEVICE_REMOVE:
+            if (!dev) {
+                break;
+            }
+            if (dev->state == PAIR_RUNNING) {
+                dev->removed = 1;
+            } else if (dev->state == PAIR_QUEUED || dev->state == PAIR_PARKED) {
+                if (dev->announced) {
+                    printf("Device %s was unplugged before it was trusted.\n", dev->udid);
+                }
+                remove_locked(dev);
+            }
+            break;
+        case IDEVICE_DEVICE_PAIRED:
+            if (dev && dev->state == PAIR_PARKED) {
+                dev->due_ns = 0;
+                pthread_cond_signal(&pairing.cond);
+            }
+            break;
+    }
+    pthread_mutex_unlock(&pairing.lock);
+}
+
+// One pairing attempt; holds the device only while it runs
+static lockdownd_error_t try_pair(const char *udid) {
+    idevice_t device = NULL;
+    lockdownd_client_t client = NULL;
+    if (idevice_new_with_options(&device, udid, IDEVICE_LOOKUP_USBMUX) != IDEVICE_E_SUCCESS) {
+        return LOCKDOWN_E_MUX_ERROR;
+    }
+    lockdownd_error_t err = lockdownd_client_new(device, &client, "ideviceerase");
+    if (err == LOCKDOWN_E_SUCCESS) {
+        // A pair record the device still accepts is all the erase needs
+        err = lockdownd_validate_pair(client, NULL);
+        if (err != LOCKDOWN_E_SUCCESS) {
+            err = lockdownd_pair(client, NULL);
+        }
+        lockdownd_client_free(client);
+    }
+    idevice_free(device);
+    return err;
+}
+
+// Next device that is due, or NULL with *next_due set to the earliest
+// time one will be (0: none)
+static pair_device_t *next_due_locked(uint64_t now, uint64_t *next_due) {
+    *next_due = 0;
+    for (pair_device_t *d = pairing.devices; d; d = d->next) {
+        if (d->state != PAIR_QUEUED && d->state != PAIR_PARKED) {
+            continue;
+        }
+        if (d->due_ns <= now) {
+            return d;
+        }
+        if (!*next_due || d->due_ns < *next_due) {
+            *next_due = d->due_ns;
+        }
+    }
+    return NULL;
+}
+
+static void park_locked(pair_device_t *dev, const char *why) {
+    dev->state = PAIR_PARKED;
+    dev->due_ns = phase_now_ns() + PAIRING_POLL_MS * 1000000ULL;
+    if (!dev->announced) {
+        printf("Device %s is waiting: %s.\n", dev->udid, why);
+        dev->announced = 1;
+    }
+}
+
+static void *pairing_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pairing.lock);
+    while (!pairing.stopping) {
+        uint64_t next_due;
+        pair_device_t *dev = next_due_locked(phase_now_ns(), &next_due);
+        if (!dev) {
+            if (next_due) {
+                struct timespec ts = { (time_t)(next_due / 1000000000ULL), (long)(next_due % 1000000000ULL) };
+                pthread_cond_timedwait(&pairing.cond, &pairing.lock, &ts);
+            } else {
+                pthread_cond_wait(&pairing.cond, &pairing.lock);
+            }
+            continue;
+        }
+        // A running entry is never freed by anyone else
+        dev->state = PAIR_RUNNING;
+        pthread_mutex_unlock(&pairing.lock);
+        lockdownd_error_t err = try_pair(dev->udid);
+        pthread_mutex_lock(&pairing.lock);
+
+        if (dev->removed) {
+            remove_locked(dev);
+            continue;
+        }
+        switch (err) {
+            case LOCKDOWN_E_SUCCESS:
+                dev->state = PAIR_HANDED_OVER;
+                printf("Device %s is paired; queueing its erase.\n", dev->udid);
+                pthread_mutex_unlock(&pairing.lock);
+                pairing.on_paired(dev->udid);
+                pthread_mutex_lock(&pairing.lock);
+                break;
+            case LOCKDOWN_E_PAIRING_DIALOG_RESPONSE_PENDING:
+                park_locked(dev, "tap Trust on its screen");
+                break;
+            case LOCKDOWN_E_PASSWORD_PROTECTED:
+                park_locked(dev, "unlock it to show the Trust dialog");
+                break;
+            case LOCKDOWN_E_USER_DENIED_PAIRING:
+                fprintf(stderr, "Error: Trust was denied on device %s; plug it in again to retry.\n", dev->udid);
+                remove_locked(dev);
+                break;
+            default:
+                // Devices often refuse lockdown for a moment after attaching
+                if (++dev->failures >= PAIRING_MAX_FAILURES) {
+                    fprintf(stderr, "Error: Could not pair with device %s (lockdown error %d).\n", dev->udid, err);
+                    remove_locked(dev);
+                } else {
+                    dev->state = PAIR_QUEUED;
+                    dev->due_ns = phase_now_ns() + PAIRING_POLL_MS * 1000000ULL;
+                }
+                break;
+        }
+    }
+    pthread_mutex_unlock(&pairing.lock);
+    return NULL;
+}
+
+int pairing_start(int threads, pairing_ready_fn on_paired) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    // Due times come from phase_now_ns(), which is CLOCK_MONOTONIC
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pairing.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pairing.on_paired = on_paired;
+    pairing.stopping = 0;
+    pairing.threads = calloc(threads, sizeof(pthread_t));
+    if (!pairing.threads) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pairing.threads[i], NULL, pairing_thread, NULL) != 0) {
+            fprintf(stderr, "Error: Could not start pairing thread.\n");
+            pairing_stop();
+            return -1;
+        }
+        pairing.num_threads++;
+    }
+    if (idevice_events_subscribe(&pairing.events, on_event, NULL) != IDEVICE_E_SUCCESS) {
+        fprintf(stderr, "Error: Could not subscribe to device events.\n");
+        pairing_stop();
+        return -1;
+    }
+    return 0;
+}
+
+void pairing_done(const char *udid, int erased) {
+    pthread_mutex_lock(&pairing.lock);
+    pair_device_t *dev = find_locked(udid);
+    if (dev && dev->state == PAIR_HANDED_OVER) {
+        if (erased) {
+            dev->state = PAIR_ERASED;
+        } else {
+            remove_locked(dev);
+        }
+    }
+    pthread_mutex_unlock(&pairing.lock);
+}
+
+int pairing_stop(void) {
+    if (pairing.events) {
+        idevice_events_unsubscribe(pairing.events);
+        pairing.events = NULL;
+    }
+    pthread_mutex_lock(&pairing.lock);
+    pairing.stopping = 1;
+    pthread_cond_broadcast(&pairing.cond);
+    pthread_mutex_unlock(&pairing.lock);
+    for (int i = 0; i < pairing.num_threads; i++) {
+        pthread_join(pairing.threads[i], NULL);
+    }
+    free(pairing.threads);
+    pairing.threads = NULL;
+    pairing.num_threads = 0;
+    pthread_cond_destroy(&pairing.cond);
+
+    int waiting = 0;
+    while (pairing.devices) {
+        waiting += pairing.devices->state == PAIR_PARKED;
+        remove_locked(pairing.devices);
+    }
+    return waiting;
+}
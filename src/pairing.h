@@ -0,0 +1,34 @@
+#ifndef IDEVICEERASE_PAIRING_H
+#define IDEVICEERASE_PAIRING_H
+
+// Pairing stage for --station.
+//
+// Every device that usbmuxd reports as attached over USB is paired by a
+// small pool of pairing threads, all devices in parallel. A device whose
+// Trust dialog is still open (or that is locked with a passcode) is parked:
+// it holds no connection and no erase worker, and is tried again when
+// usbmuxd reports it as paired (IDEVICE_DEVICE_PAIRED) or, since a device
+// only tells the host once the host asks again, every PAIRING_POLL_MS.
+// Once paired it is handed to on_paired, which runs on a pairing thread
+// and is expected to queue the erase.
+//
+// A device handed over is not paired again in the same run unless its
+// erase failed (see pairing_done()), so a device coming back from the
+// erase is left alone.
+
+#define PAIRING_POLL_MS 2000
+
+typedef void (*pairing_ready_fn)(const char *udid);
+
+// Subscribes to device events and starts 'threads' pairing threads.
+int pairing_start(int threads, pairing_ready_fn on_paired);
+
+// Reports the end of an erase handed over by on_paired. A device that was
+// not erased is forgotten, so plugging it in again pairs and erases it anew.
+void pairing_done(const char *udid, int erased);
+
+// Unsubscribes, waits for pairing attempts in progress and returns how
+// many devices were still waiting for Trust.
+int pairing_stop(void);
+
+#endif
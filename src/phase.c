@@ -0,0 +1,224 @@
+#define _GNU_SOURCE // RUSAGE_THREAD
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "json.h"
+#include "phase.h"
+
+static int accounting = 0;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "connect",
+    "handshake",
+    "preflight",
+    "start_service",
+    "service_connect",
+    "send",
+    "recv",
+};
+
+uint64_t phase_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+const char *phase_name(erase_phase_t phase) {
+    if (phase < 0 || phase >= PHASE_COUNT) {
+        return "unknown";
+    }
+    return phase_names[phase];
+}
+
+int phase_from_name(const char *name) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (strcmp(name, phase_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void phase_thread_usage(uint64_t *cpu_ns, uint64_t *switches) {
+    struct timespec ts;
+    struct rusage usage;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    *cpu_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    getrusage(RUSAGE_THREAD, &usage);
+    *switches = (uint64_t)(usage.ru_nvcsw + usage.ru_nivcsw);
+}
+
+static void sample_resources(phase_resources_t *r, uint64_t tx_bytes, uint64_t rx_bytes) {
+    phase_thread_usage(&r->cpu_ns, &r->switches);
+    r->tx_bytes = tx_bytes;
+    r->rx_bytes = rx_bytes;
+}
+
+void phase_set_accounting(int flags) {
+    accounting = flags;
+}
+
+void phase_timing_init(phase_timing_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->current = -1;
+    t->failed_phase = -1;
+    t->accounted = accounting;
+    t->start_ns = phase_now_ns();
+}
+
+void phase_begin(phase_timing_t *t, erase_phase_t phase) {
+    t->current = phase;
+    t->ran_mask |= 1u << phase;
+    t->phase_start_ns = phase_now_ns();
+}
+
+void phase_end(phase_timing_t *t, int ok) {
+    if (t->current < 0) {
+        return;
+    }
+    t->phase_ns[t->current] += phase_now_ns() - t->phase_start_ns;
+    if (!ok && t->failed_phase < 0) {
+        t->failed_phase = t->current;
+    }
+    t->current = -1;
+}
+
+void phase_account_begin(phase_timing_t *t, uint64_t tx_bytes, uint64_t rx_bytes) {
+    if (t->accounted) {
+        sample_resources(&t->phase_start_res, tx_bytes, rx_bytes);
+    }
+}
+
+void phase_account_end(phase_timing_t *t, erase_phase_t phase, uint64_t tx_bytes, uint64_t rx_bytes) {
+    if (!t->accounted || phase < 0 || phase >= PHASE_COUNT) {
+        return;
+    }
+    phase_resources_t now, *res = &t->phase_res[phase];
+    sample_resources(&now, tx_bytes, rx_bytes);
+    res->cpu_ns += now.cpu_ns - t->phase_start_res.cpu_ns;
+    res->switches += now.switches - t->phase_start_res.switches;
+    res->tx_bytes += now.tx_bytes - t->phase_start_res.tx_bytes;
+    res->rx_bytes += now.rx_bytes - t->phase_start_res.rx_bytes;
+}
+
+void phase_account_add(phase_timing_t *t, erase_phase_t phase, uint64_t cpu_ns, uint64_t switches) {
+    if (!t->accounted || phase < 0 || phase >= PHASE_COUNT) {
+        return;
+    }
+    t->phase_res[phase].cpu_ns += cpu_ns;
+    t->phase_res[phase].switches += switches;
+}
+
+void phase_timing_finish(phase_timing_t *t) {
+    if (t->current >= 0) {
+        phase_end(t, 0);
+    }
+    t->total_ns = phase_now_ns() - t->start_ns;
+}
+
+void phase_timing_retry(phase_timing_t *t) {
+    uint64_t start_ns = t->start_ns;
+    phase_timing_init(t);
+    t->start_ns = start_ns;
+}
+
+void phase_timing_print(const phase_timing_t *t, const char *udid, FILE *out) {
+    fprintf(out, "Timing:");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (t->ran_mask & (1u << i)) {
+            fprintf(out, " %s=%.3fms", phase_names[i], t->phase_ns[i] / 1e6);
+        }
+    }
+    fprintf(out, " total=%.3fms", t->total_ns / 1e6);
+    if (t->failed_phase >= 0) {
+        fprintf(out, " status=failed:%s", phase_names[t->failed_phase]);
+    } else {
+        fprintf(out, " status=success");
+    }
+    if (udid) {
+        fprintf(out, " udid=%s", udid);
+    }
+    fprintf(out, "\n");
+}
+
+void phase_timing_print_json(const phase_timing_t *t, const char *udid, FILE *out) {
+    fprintf(out, "{");
+    if (udid) {
+        char escaped[256];
+        json_escape(escaped, 0, sizeof(escaped), udid);
+        fprintf(out, "\"udid\":\"%s\",", escaped);
+    }
+    fprintf(out, "\"phases\":{");
+    const char *sep = "";
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (t->ran_mask & (1u << i)) {
+            fprintf(out, "%s\"%s\":%.3f", sep, phase_names[i], t->phase_ns[i] / 1e6);
+            sep = ",";
+        }
+    }
+    fprintf(out, "}");
+    if (t->accounted) {
+        phase_resources_t total;
+        phase_resources_total(t, &total);
+        fprintf(out, ",\"resources\":{");
+        for (int i = 0; i <= PHASE_COUNT; i++) {
+            const phase_resources_t *r = i < PHASE_COUNT ? &t->phase_res[i] : &total;
+            if (i < PHASE_COUNT && !(t->ran_mask & (1u << i))) {
+                continue;
+            }
+            fprintf(out, "\"%s\":{\"cpu_ms\":%.3f,\"csw\":%llu", i < PHASE_COUNT ? phase_names[i] : "total",
+                    r->cpu_ns / 1e6, (unsigned long long)r->switches);
+            if (t->accounted & PHASE_ACCOUNT_BYTES) {
+                fprintf(out, ",\"tx_bytes\":%llu,\"rx_bytes\":%llu", (unsigned long long)r->tx_bytes,
+                        (unsigned long long)r->rx_bytes);
+            }
+            fprintf(out, "}%s", i < PHASE_COUNT ? "," : "");
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, ",\"total_ms\":%.3f,", t->total_ns / 1e6);
+    if (t->failed_phase >= 0) {
+        fprintf(out, "\"status\":\"failed:%s\"}\n", phase_names[t->failed_phase]);
+    } else {
+        fprintf(out, "\"status\":\"success\"}\n");
+    }
+}
+
+void phase_resources_total(const phase_timing_t *t, phase_resources_t *total) {
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (t->ran_mask & (1u << i)) {
+            total->cpu_ns += t->phase_res[i].cpu_ns;
+            total->switches += t->phase_res[i].switches;
+            total->tx_bytes += t->phase_res[i].tx_bytes;
+            total->rx_bytes += t->phase_res[i].rx_bytes;
+        }
+    }
+}
+
+static void print_resources(const char *name, const phase_resources_t *r, int bytes, FILE *out) {
+    fprintf(out, " %s=cpu:%.3fms,csw:%llu", name, r->cpu_ns / 1e6, (unsigned long long)r->switches);
+    if (bytes) {
+        fprintf(out, ",tx:%lluB,rx:%lluB", (unsigned long long)r->tx_bytes, (unsigned long long)r->rx_bytes);
+    }
+}
+
+void phase_resources_print(const phase_timing_t *t, const char *udid, FILE *out) {
+    if (!t->accounted) {
+        return;
+    }
+    phase_resources_t total;
+    phase_resources_total(t, &total);
+    fprintf(out, "Resources:");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (t->ran_mask & (1u << i)) {
+            print_resources(phase_names[i], &t->phase_res[i], t->accounted & PHASE_ACCOUNT_BYTES, out);
+        }
+    }
+    print_resources("total", &total, t->accounted & PHASE_ACCOUNT_BYTES, out);
+    if (udid) {
+        fprintf(out, " udid=%s", udid);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,99 @@
+#ifndef IDEVICEERASE_PHASE_H
+#define IDEVICEERASE_PHASE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Phases of a single erase, in the order they run.
+typedef enum {
+    PHASE_CONNECT = 0,      // idevice_new_with_options
+    PHASE_HANDSHAKE,        // lockdownd_client_new_with_handshake
+    PHASE_PREFLIGHT,        // lockdown values read for --preflight
+    PHASE_START_SERVICE,    // lockdownd_start_service
+    PHASE_SERVICE_CONNECT,  // diagnostics_relay_client_new
+    PHASE_SEND,             // MobileObliterator request
+    PHASE_RECV,             // MobileObliterator response
+    PHASE_COUNT
+} erase_phase_t;
+
+// Host resources used by the thread that ran a phase.
+typedef struct {
+    uint64_t cpu_ns;        // CLOCK_THREAD_CPUTIME_ID
+    uint64_t switches;      // voluntary and involuntary context switches
+    uint64_t tx_bytes;      // sent to the device, TLS records included
+    uint64_t rx_bytes;      // received from it
+} phase_resources_t;
+
+// What phase_set_accounting() turns on
+#define PHASE_ACCOUNT_CPU   0x1     // thread CPU time and context switches
+#define PHASE_ACCOUNT_BYTES 0x2     // bytes, when the caller can count them
+
+// Wall-clock timing of one erase, filled in as the phases run.
+typedef struct {
+    uint64_t start_ns;
+    uint64_t total_ns;
+    uint64_t phase_start_ns;
+    uint64_t phase_ns[PHASE_COUNT];
+    uint32_t ran_mask;      // bit set for every phase that started
+    int current;            // phase in progress, -1 if none
+    int failed_phase;       // phase that failed, -1 if none
+    // Filled in while phase_set_accounting() is on
+    int accounted;          // PHASE_ACCOUNT_* flags
+    phase_resources_t phase_start_res;
+    phase_resources_t phase_res[PHASE_COUNT];
+} phase_timing_t;
+
+// Monotonic clock in nanoseconds.
+uint64_t phase_now_ns(void);
+
+// Short name used in the "Timing:" output line, e.g. "start_service".
+const char *phase_name(erase_phase_t phase);
+
+// Inverse of phase_name(); returns -1 for unknown names.
+int phase_from_name(const char *name);
+
+// Makes phase_timing_init() mark timings as accounted, so that
+// phase_account_begin()/phase_account_end() record the thread's CPU time and
+// context switches, and the bytes the caller passes in if flags has
+// PHASE_ACCOUNT_BYTES. Off (0) by default.
+void phase_set_accounting(int flags);
+
+void phase_timing_init(phase_timing_t *t);
+void phase_begin(phase_timing_t *t, erase_phase_t phase);
+// Ends the current phase; ok == 0 marks it as the failed phase.
+void phase_end(phase_timing_t *t, int ok);
+// Resource accounting of one phase, taken on the thread that runs it. Kept
+// apart from phase_begin()/phase_end() because the samples are system calls
+// and those two usually run under a lock. tx_bytes and rx_bytes are running
+// byte counters of the device's connections. No-ops unless accounted.
+void phase_account_begin(phase_timing_t *t, uint64_t tx_bytes, uint64_t rx_bytes);
+void phase_account_end(phase_timing_t *t, erase_phase_t phase, uint64_t tx_bytes, uint64_t rx_bytes);
+// Adds CPU time and context switches spent on the phase by other threads,
+// as measured with phase_thread_usage() there. No-op unless accounted.
+void phase_account_add(phase_timing_t *t, erase_phase_t phase, uint64_t cpu_ns, uint64_t switches);
+// CPU time and context switches of the calling thread so far
+void phase_thread_usage(uint64_t *cpu_ns, uint64_t *switches);
+void phase_timing_finish(phase_timing_t *t);
+// Forgets the phases of a failed attempt before a retry; the total keeps
+// counting from the first attempt.
+void phase_timing_retry(phase_timing_t *t);
+
+// Prints a single machine-readable line:
+// "Timing: connect=1.234ms handshake=... total=...ms status=success|failed:<phase> [udid=<udid>]"
+// udid may be NULL.
+void phase_timing_print(const phase_timing_t *t, const char *udid, FILE *out);
+
+// Same content as one JSON object per line:
+// {"udid":"...","phases":{"connect":1.234,...},"total_ms":...,"status":"success"}
+// With accounting, "resources":{"connect":{"cpu_ms":...,"csw":...[,"tx_bytes":...,
+// "rx_bytes":...]},...,"total":{...}} comes before "total_ms".
+void phase_timing_print_json(const phase_timing_t *t, const char *udid, FILE *out);
+
+// Sum of the resources of all phases that ran
+void phase_resources_total(const phase_timing_t *t, phase_resources_t *total);
+
+// "Resources: connect=cpu:0.412ms,csw:3[,tx:310B,rx:120B] ... total=... [udid=<udid>]",
+// nothing unless the erase was accounted
+void phase_resources_print(const phase_timing_t *t, const char *udid, FILE *out);
+
+#endif
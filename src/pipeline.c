@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include "phase.h"
+#include "pipeline.h"
+
+typedef struct {
+    uint64_t seq;           // == position when free, position + 1 when full
+    void *item;
+    uint64_t enqueued_ns;
+} cell_t;
+
+struct pipeline_stage {
+    // Producers and consumers each get a cache line for their position
+    _Alignas(64) uint64_t enqueue_pos;
+    _Alignas(64) uint64_t dequeue_pos;
+    _Alignas(64) cell_t *cells;
+    uint64_t mask;
+    sem_t free_cells;
+    sem_t items;
+
+    const char *name;
+    pipeline_run_fn run;
+    pthread_mutex_t lock;   // guards threads and num_threads
+    pthread_t *threads;
+    int num_threads;
+    uint64_t created_ns;
+    // Statistics, updated with atomics
+    uint32_t depth;
+    uint32_t max_depth;
+    uint64_t done;
+    uint64_t wait_ns;
+    uint64_t service_ns;
+};
+
+static void enqueue(pipeline_stage_t *s, void *item) {
+    uint64_t pos = __atomic_load_n(&s->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell_t *cell = &s->cells[pos & s->mask];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&s->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->item = item;
+                cell->enqueued_ns = phase_now_ns();
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return;
+            }
+        } else if (seq < pos) {
+            // The consumer of this cell's last lap has not finished with it
+            sched_yield();
+            pos = __atomic_load_n(&s->enqueue_pos, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&s->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void *dequeue(pipeline_stage_t *s, uint64_t *enqueued_ns) {
+    uint64_t pos = __atomic_load_n(&s->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell_t *cell = &s->cells[pos & s->mask];
+        uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos + 1) {
+            if (__atomic_compare_exchange_n(&s->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                void *item = cell->item;
+                *enqueued_ns = cell->enqueued_ns;
+                __atomic_store_n(&cell->seq, pos + s->mask + 1, __ATOMIC_RELEASE);
+                return item;
+            }
+        } else if (seq < pos + 1) {
+            // Our semaphore token is for a cell whose producer is still
+            // writing it
+            sched_yield();
+            pos = __atomic_load_n(&s->dequeue_pos, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&s->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void sem_wait_uninterrupted(sem_t *sem) {
+    while (sem_wait(sem) < 0 && errno == EINTR) {
+    }
+}
+
+// Pushes without statistics; NULL tells one thread to stop
+static void push(pipeline_stage_t *s, void *item) {
+    sem_wait_uninterrupted(&s->free_cells);
+    enqueue(s, item);
+    sem_post(&s->items);
+}
+
+void pipeline_push(pipeline_stage_t *s, void *item) {
+    uint32_t depth = __atomic_add_fetch(&s->depth, 1, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&s->max_depth, __ATOMIC_RELAXED);
+    while (depth > max && !__atomic_compare_exchange_n(&s->max_depth, &max, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    push(s, item);
+}
+
+static void *stage_thread(void *arg) {
+    pipeline_stage_t *s = arg;
+    for (;;) {
+        uint64_t enqueued_ns;
+        sem_wait_uninterrupted(&s->items);
+        void *item = dequeue(s, &enqueued_ns);
+        sem_post(&s->free_cells);
+        if (!item) {
+            break;
+        }
+        uint64_t start = phase_now_ns();
+        __atomic_sub_fetch(&s->depth, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->wait_ns, start - enqueued_ns, __ATOMIC_RELAXED);
+        s->run(item);
+        __atomic_add_fetch(&s->service_ns, phase_now_ns() - start, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->done, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+pipeline_stage_t *pipeline_stage_new(const char *name, int threads, uint32_t capacity, pipeline_run_fn run) {
+    uint64_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    pipeline_stage_t *s = aligned_alloc(64, (sizeof(*s) + 63) & ~(size_t)63);
+    if (!s) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+    memset(s, 0, sizeof(*s));
+    s->cells = calloc(size, sizeof(cell_t));
+    s->threads = calloc(threads, sizeof(pthread_t));
+    if (!s->cells || !s->threads) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(s->cells);
+        free(s->threads);
+        free(s);
+        return NULL;
+    }
+    for (uint64_t i = 0; i < size; i++) {
+        s->cells[i].seq = i;
+    }
+    s->mask = size - 1;
+    sem_init(&s->free_cells, 0, (unsigned)size);
+    sem_init(&s->items, 0, 0);
+    pthread_mutex_init(&s->lock, NULL);
+    s->name = name;
+    s->run = run;
+    s->created_ns = phase_now_ns();
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&s->threads[i], NULL, stage_thread, s) != 0) {
+            fprintf(stderr, "Error: Could not start %s stage thread.\n", name);
+            pipeline_stage_free(s);
+            return NULL;
+        }
+        s->num_threads++;
+    }
+    return s;
+}
+
+int pipeline_stage_grow(pipeline_stage_t *s, int threads) {
+    pthread_mutex_lock(&s->lock);
+    int res = 0;
+    if (threads > s->num_threads) {
+        pthread_t *grown = realloc(s->threads, threads * sizeof(pthread_t));
+        if (!grown) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            res = -1;
+        } else {
+            s->threads = grown;
+            while (s->num_threads < threads) {
+                if (pthread_create(&s->threads[s->num_threads], NULL, stage_thread, s) != 0) {
+                    fprintf(stderr, "Error: Could not start %s stage thread.\n", s->name);
+                    res = -1;
+                    break;
+                }
+                __atomic_add_fetch(&s->num_threads, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return res;
+}
+
+void pipeline_stage_free(pipeline_stage_t *s) {
+    pthread_mutex_lock(&s->lock);
+    // Queued behind everything else, so the queue drains first
+    for (int i = 0; i < s->num_threads; i++) {
+        push(s, NULL);
+    }
+    for (int i = 0; i < s->num_threads; i++) {
+        pthread_join(s->threads[i], NULL);
+    }
+    pthread_mutex_unlock(&s->lock);
+    pthread_mutex_destroy(&s->lock);
+    sem_destroy(&s->free_cells);
+    sem_destroy(&s->items);
+    free(s->threads);
+    free(s->cells);
+    free(s);
+}
+
+void pipeline_stage_stats(pipeline_stage_t *s, pipeline_stats_t *out) {
+    out->name = s->name;
+    out->threads = __atomic_load_n(&s->num_threads, __ATOMIC_RELAXED);
+    out->items = __atomic_load_n(&s->done, __ATOMIC_RELAXED);
+    out->depth = __atomic_load_n(&s->depth, __ATOMIC_RELAXED);
+    out->max_depth = __atomic_load_n(&s->max_depth, __ATOMIC_RELAXED);
+    out->wait_ns = __atomic_load_n(&s->wait_ns, __ATOMIC_RELAXED);
+    out->service_ns = __atomic_load_n(&s->service_ns, __ATOMIC_RELAXED);
+    out->lifetime_ns = phase_now_ns() - s->created_ns;
+}
+
+void pipeline_stats_print(const pipeline_stats_t *st, FILE *out) {
+    uint64_t items = st->items ? st->items : 1;
+    double capacity_ns = (double)st->lifetime_ns * (st->threads ? st->threads : 1);
+    fprintf(out, "Stage: name=%s threads=%d items=%llu queue_now=%u queue_max=%u wait_ms=%.3f service_ms=%.3f busy=%.1f%%\n",
+            st->name, st->threads, (unsigned long long)st->items, st->depth, st->max_depth,
+            st->wait_ns / 1e6 / items, st->service_ns / 1e6 / items,
+            capacity_ns > 0 ? 100.0 * st->service_ns / capacity_ns : 0.0);
+}
@@ -0,0 +1,55 @@
+#ifndef IDEVICEERASE_PIPELINE_H
+#define IDEVICEERASE_PIPELINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// One stage of the erase pipeline: a pool of threads fed by a bounded
+// queue. Items are opaque pointers (erase sessions); a stage's run function
+// passes each item on with pipeline_push() to the next stage, or hands it
+// back to whoever waits for it.
+//
+// The queue is Vyukov's bounded array queue: producers and consumers claim
+// cells with a compare-and-swap on their position and publish them through
+// the cell's sequence number, so neither side takes a lock. Any thread may
+// push, and all of the stage's threads pop. Two semaphores count free cells
+// and published items so that idle threads sleep and a producer facing a
+// full queue waits instead of spinning.
+
+typedef struct pipeline_stage pipeline_stage_t;
+
+typedef void (*pipeline_run_fn)(void *item);
+
+typedef struct {
+    const char *name;
+    int threads;
+    uint64_t items;         // items the run function finished
+    uint32_t depth;         // items queued right now
+    uint32_t max_depth;
+    uint64_t wait_ns;       // time items spent queued, all items
+    uint64_t service_ns;    // time spent in the run function, all items
+    uint64_t lifetime_ns;   // since the stage was created
+} pipeline_stats_t;
+
+// capacity is rounded up to a power of two. Returns NULL with a message on
+// stderr on failure.
+pipeline_stage_t *pipeline_stage_new(const char *name, int threads, uint32_t capacity, pipeline_run_fn run);
+
+// Starts threads until the stage has 'threads' of them; never stops any.
+// Returns -1 with a message on stderr if a thread could not be started.
+int pipeline_stage_grow(pipeline_stage_t *stage, int threads);
+
+// Queues item; blocks while the queue is full. Safe from any thread.
+void pipeline_push(pipeline_stage_t *stage, void *item);
+
+// Waits for the queue to empty and the threads to finish, then frees the
+// stage. No one may push to it any more.
+void pipeline_stage_free(pipeline_stage_t *stage);
+
+void pipeline_stage_stats(pipeline_stage_t *stage, pipeline_stats_t *out);
+
+// "Stage: name=connect threads=8 items=... queue_now=... queue_max=... wait_ms=...
+// service_ms=... busy=...%", averages per item
+void pipeline_stats_print(const pipeline_stats_t *stats, FILE *out);
+
+#endif
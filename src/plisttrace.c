@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "plisttrace.h"
+#include "phase.h"
+#include "varint.h"
+
+#define UDID_MAX 255
+
+struct plisttrace_reader {
+    FILE *file;
+    uint64_t start_wall_ns;
+    uint64_t time_ns;
+    char udid[UDID_MAX + 1];
+    char *buf;
+    uint32_t buf_size;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    FILE *file;
+    uint64_t last_ns;
+    uint64_t plists;
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+int plisttrace_open(const char *path) {
+    trace.file = fopen(path, "wb");
+    if (!trace.file) {
+        fprintf(stderr, "Error: Could not create plist trace %s.\n", path);
+        return -1;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t wall_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    unsigned char le[8];
+    for (int i = 0; i < 8; i++) {
+        le[i] = (wall_ns >> (8 * i)) & 0xff;
+    }
+    fwrite(PLISTTRACE_MAGIC, 1, 8, trace.file);
+    fwrite(le, 1, 8, trace.file);
+    trace.last_ns = phase_now_ns();
+    trace.plists = 0;
+    return 0;
+}
+
+void plisttrace_write(const char *udid, int phase, plisttrace_direction_t direction, const char *data, uint32_t len) {
+    size_t udid_len = strnlen(udid, UDID_MAX);
+    pthread_mutex_lock(&trace.lock);
+    if (trace.file) {
+        uint64_t now = phase_now_ns();
+        putc(direction, trace.file);
+        putc(phase < 0 ? 0xff : phase, trace.file);
+        varint_put(trace.file, now - trace.last_ns);
+        varint_put(trace.file, udid_len);
+        fwrite(udid, 1, udid_len, trace.file);
+        varint_put(trace.file, len);
+        fwrite(data, 1, len, trace.file);
+        trace.last_ns = now;
+        trace.plists++;
+    }
+    pthread_mutex_unlock(&trace.lock);
+}
+
+uint64_t plisttrace_close(void) {
+    pthread_mutex_lock(&trace.lock);
+    uint64_t plists = trace.plists;
+    if (trace.file) {
+        fclose(trace.file);
+        trace.file = NULL;
+    }
+    pthread_mutex_unlock(&trace.lock);
+    return plists;
+}
+
+plisttrace_reader_t *plisttrace_reader_open(const char *path) {
+    plisttrace_reader_t *r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+    r->file = fopen(path, "rb");
+    unsigned char header[16];
+    if (!r->file || fread(header, 1, sizeof(header), r->file) != sizeof(header) ||
+        memcmp(header, PLISTTRACE_MAGIC, 8) != 0) {
+        if (r->file) {
+            fclose(r->file);
+        }
+        free(r);
+        return NULL;
+    }
+    for (int i = 0; i < 8; i++) {
+        r->start_wall_ns |= (uint64_t)header[8 + i] << (8 * i);
+    }
+    return r;
+}
+
+int plisttrace_read(plisttrace_reader_t *r, plisttrace_record_t *rec) {
+    int direction = getc(r->file);
+    if (direction == EOF) {
+        return 0;
+    }
+    int phase = getc(r->file);
+    uint64_t delta, udid_len, len;
+    if ((direction != PLISTTRACE_SENT && direction != PLISTTRACE_RECEIVED) || phase == EOF ||
+        varint_get(r->file, &delta) < 0 || varint_get(r->file, &udid_len) < 0 || udid_len > UDID_MAX ||
+        fread(r->udid, 1, udid_len, r->file) != udid_len || varint_get(r->file, &len) < 0 || len > 0x7fffffff) {
+        return -1;
+    }
+    r->udid[udid_len] = '\0';
+    if (len > r->buf_size) {
+        char *grown = realloc(r->buf, len);
+        if (!grown) {
+            return -1;
+        }
+        r->buf = grown;
+        r->buf_size = (uint32_t)len;
+    }
+    if (len && fread(r->buf, 1, len, r->file) != len) {
+        return -1;
+    }
+    r->time_ns += delta;
+    rec->direction = (plisttrace_direction_t)direction;
+    rec->phase = phase == 0xff ? -1 : phase;
+    rec->time_ns = r->time_ns;
+    rec->udid = r->udid;
+    rec->len = (uint32_t)len;
+    rec->data = r->buf;
+    return 1;
+}
+
+uint64_t plisttrace_start_time(const plisttrace_reader_t *r) {
+    return r->start_wall_ns;
+}
+
+void plisttrace_reader_close(plisttrace_reader_t *r) {
+    if (!r) {
+        return;
+    }
+    fclose(r->file);
+    free(r->buf);
+    free(r);
+}
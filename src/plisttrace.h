@@ -0,0 +1,50 @@
+#ifndef IDEVICEERASE_PLISTTRACE_H
+#define IDEVICEERASE_PLISTTRACE_H
+
+#include <stdint.h>
+
+// Plist trace files, written by --plist-trace in place of the XML that
+// --debug prints, and read back by ideviceerase-plistdecode.
+//
+// A trace starts with the 8-byte magic "IDEPLT1\n" and the wall-clock
+// start time (unix nanoseconds, 8 bytes little endian), followed by records:
+//
+//   u8 direction | u8 phase | varint delta_ns | varint udid_len | udid
+//   | varint len | len bytes of plist, binary or XML
+//
+// delta_ns is the time since the previous record in the file. The plist is
+// stored as it went over the wire, without decoding or encoding it again;
+// rendering it is left to the decoder.
+
+#define PLISTTRACE_MAGIC "IDEPLT1\n"
+
+typedef enum {
+    PLISTTRACE_SENT = 1,
+    PLISTTRACE_RECEIVED = 2,
+} plisttrace_direction_t;
+
+typedef struct {
+    plisttrace_direction_t direction;
+    int phase;              // erase_phase_t
+    uint64_t time_ns;       // since the start of the trace
+    const char *udid;       // valid until the next plisttrace_read()
+    uint32_t len;
+    const char *data;       // likewise
+} plisttrace_record_t;
+
+typedef struct plisttrace_reader plisttrace_reader_t;
+
+// Writing: one trace per run, safe from any thread
+int plisttrace_open(const char *path);
+void plisttrace_write(const char *udid, int phase, plisttrace_direction_t direction, const char *data, uint32_t len);
+// Returns the number of plists written
+uint64_t plisttrace_close(void);
+
+plisttrace_reader_t *plisttrace_reader_open(const char *path);
+// Returns 1 when a record was read, 0 at end of file, -1 on a corrupt file.
+int plisttrace_read(plisttrace_reader_t *r, plisttrace_record_t *rec);
+// Wall-clock start of the trace, unix nanoseconds
+uint64_t plisttrace_start_time(const plisttrace_reader_t *r);
+void plisttrace_reader_close(plisttrace_reader_t *r);
+
+#endif
@@ -0,0 +1,185 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "portstats.h"
+
+#define BUCKETS 80                  // up to PORT_BUCKET_BASE_MS * 2^20, about 260s
+#define BUCKETS_PER_OCTAVE 4
+#define PORT_BUCKET_BASE_MS 0.25
+#define MIN_WEIGHT 8.0              // decayed samples needed on either side
+#define RECOVER_FACTOR 0.75
+
+typedef struct {
+    double weight[BUCKETS];
+    double total;
+    uint64_t updated_ns;            // weights are as of this time
+} histogram_t;
+
+typedef struct {
+    uint32_t location_id;
+    histogram_t phases[PHASE_COUNT];
+    uint64_t samples[PHASE_COUNT];
+    uint32_t slow_mask;             // bit per phase the port is slow in
+} port_t;
+
+static struct {
+    pthread_mutex_t lock;
+    double ratio;
+    port_t *ports;
+    int num_ports;
+    histogram_t station[PHASE_COUNT];   // all ports together
+} stats = { .lock = PTHREAD_MUTEX_INITIALIZER, .ratio = 2.0 };
+
+static int bucket_of(double ms) {
+    if (ms <= PORT_BUCKET_BASE_MS) {
+        return 0;
+    }
+    int i = (int)ceil(log2(ms / PORT_BUCKET_BASE_MS) * BUCKETS_PER_OCTAVE);
+    return i >= BUCKETS ? BUCKETS - 1 : i;
+}
+
+static double bucket_upper_ms(int i) {
+    return PORT_BUCKET_BASE_MS * exp2((double)i / BUCKETS_PER_OCTAVE);
+}
+
+static void decay(histogram_t *h, uint64_t now) {
+    if (h->updated_ns && now > h->updated_ns && h->total > 0) {
+        double f = exp2(-(double)(now - h->updated_ns) / 1e9 / PORT_STATS_HALF_LIFE_S);
+        for (int i = 0; i < BUCKETS; i++) {
+            h->weight[i] *= f;
+        }
+        h->total *= f;
+    }
+    h->updated_ns = now;
+}
+
+// q-quantile of a histogram, interpolated inside its bucket
+static double quantile(const double *weight, double total, double q) {
+    double target = q * total, cum = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        if (weight[i] > 0 && cum + weight[i] >= target) {
+            double lo = i ? bucket_upper_ms(i - 1) : 0, hi = bucket_upper_ms(i);
+            return lo + (hi - lo) * (target - cum) / weight[i];
+        }
+        cum += weight[i];
+    }
+    return bucket_upper_ms(BUCKETS - 1);
+}
+
+// p95 of the port and of all other ports in one phase; returns 0 while
+// either side has less than min_weight recent samples, or none at all
+static int compare_locked(port_t *p, int phase, uint64_t now, double min_weight, double *p95, double *norm_p95) {
+    histogram_t *mine = &p->phases[phase];
+    histogram_t *all = &stats.station[phase];
+    decay(mine, now);
+    decay(all, now);
+    double others[BUCKETS], others_total = all->total - mine->total;
+    if (mine->total < min_weight || others_total < min_weight || mine->total <= 0 || others_total <= 0) {
+        return 0;
+    }
+    for (int i = 0; i < BUCKETS; i++) {
+        // Both sides decayed to the same time; only rounding can go negative
+        others[i] = all->weight[i] > mine->weight[i] ? all->weight[i] - mine->weight[i] : 0;
+    }
+    *p95 = quantile(mine->weight, mine->total, 0.95);
+    *norm_p95 = quantile(others, others_total, 0.95);
+    return 1;
+}
+
+static port_t *find_port_locked(uint32_t location_id) {
+    for (int i = 0; i < stats.num_ports; i++) {
+        if (stats.ports[i].location_id == location_id) {
+            return &stats.ports[i];
+        }
+    }
+    port_t *grown = realloc(stats.ports, (stats.num_ports + 1) * sizeof(port_t));
+    if (!grown) {
+        return NULL;
+    }
+    stats.ports = grown;
+    memset(&stats.ports[stats.num_ports], 0, sizeof(port_t));
+    stats.ports[stats.num_ports].location_id = location_id;
+    return &stats.ports[stats.num_ports++];
+}
+
+void port_stats_init(double ratio) {
+    pthread_mutex_lock(&stats.lock);
+    stats.ratio = ratio;
+    pthread_mutex_unlock(&stats.lock);
+}
+
+void port_stats_record(uint32_t location_id, const phase_timing_t *t, uint32_t skip_mask) {
+    uint64_t now = phase_now_ns();
+    pthread_mutex_lock(&stats.lock);
+    port_t *p = find_port_locked(location_id);
+    if (!p) {
+        pthread_mutex_unlock(&stats.lock);
+        return;
+    }
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (!(t->ran_mask & (1u << phase)) || (skip_mask & (1u << phase))) {
+            continue;
+        }
+        int bucket = bucket_of(t->phase_ns[phase] / 1e6);
+        histogram_t *hists[2] = { &p->phases[phase], &stats.station[phase] };
+        for (int h = 0; h < 2; h++) {
+            decay(hists[h], now);
+            hists[h]->weight[bucket] += 1;
+            hists[h]->total += 1;
+        }
+        p->samples[phase]++;
+
+        double p95, norm;
+        if (!compare_locked(p, phase, now, MIN_WEIGHT, &p95, &norm)) {
+            continue;
+        }
+        int slow = (p->slow_mask >> phase) & 1;
+        if (!slow && p95 > stats.ratio * norm && p95 - norm >= PORT_STATS_MIN_EXCESS_MS) {
+            p->slow_mask |= 1u << phase;
+            fprintf(stderr, "Warning: Port 0x%08x (bus %u) looks slow in %s: p95 %.1fms against %.1fms on the other ports.\n",
+                    location_id, location_id >> 16, phase_name(phase), p95, norm);
+        } else if (slow && p95 < RECOVER_FACTOR * stats.ratio * norm) {
+            p->slow_mask &= ~(1u << phase);
+            printf("Port 0x%08x (bus %u) is back to normal in %s: p95 %.1fms against %.1fms.\n",
+                   location_id, location_id >> 16, phase_name(phase), p95, norm);
+        }
+    }
+    pthread_mutex_unlock(&stats.lock);
+}
+
+void port_stats_report(FILE *out) {
+    uint64_t now = phase_now_ns();
+    pthread_mutex_lock(&stats.lock);
+    int slow = 0;
+    for (int i = 0; i < stats.num_ports; i++) {
+        slow += stats.ports[i].slow_mask != 0;
+    }
+    fprintf(out, "Ports: seen=%d slow=%d\n", stats.num_ports, slow);
+    for (int i = 0; i < stats.num_ports; i++) {
+        port_t *p = &stats.ports[i];
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            if (!((p->slow_mask >> phase) & 1)) {
+                continue;
+            }
+            // Still flagged but with few recent samples: the p95 is from
+            // whatever weight is left, and no longer enough to clear it
+            double p95 = 0, norm = 0;
+            compare_locked(p, phase, now, 0, &p95, &norm);
+            fprintf(out, "Slow port: location=0x%08x bus=%u phase=%s p95_ms=%.3f norm_p95_ms=%.3f samples=%llu%s\n",
+                    p->location_id, p->location_id >> 16, phase_name(phase), p95, norm,
+                    (unsigned long long)p->samples[phase], p->phases[phase].total < MIN_WEIGHT ? " recent=few" : "");
+        }
+    }
+    pthread_mutex_unlock(&stats.lock);
+}
+
+void port_stats_clear(void) {
+    pthread_mutex_lock(&stats.lock);
+    free(stats.ports);
+    stats.ports = NULL;
+    stats.num_ports = 0;
+    memset(stats.station, 0, sizeof(stats.station));
+    pthread_mutex_unlock(&stats.lock);
+}
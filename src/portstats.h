@@ -0,0 +1,38 @@
+#ifndef IDEVICEERASE_PORTSTATS_H
+#define IDEVICEERASE_PORTSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "phase.h"
+
+// Per-port latency statistics for --port-stats.
+//
+// Every USB location usbmuxd reports (see usbmux_device_t.location_id)
+// keeps one histogram per phase with log-spaced buckets (four per octave,
+// about 19% wide). Weights decay with a half-life of PORT_STATS_HALF_LIFE_S
+// seconds, so on a station that runs for days the statistics follow the
+// port's recent state rather than its whole history.
+//
+// A port is slow in a phase when its p95 is more than 'ratio' times the
+// p95 of all other ports together, and at least PORT_STATS_MIN_EXCESS_MS
+// above it, with enough recent samples on both sides. It stops being slow
+// once its p95 is back under 0.75 * ratio times the norm.
+
+#define PORT_STATS_HALF_LIFE_S 900
+#define PORT_STATS_MIN_EXCESS_MS 50.0
+
+void port_stats_init(double ratio);
+
+// Adds the phases of one erase on the port at location_id. Phases whose bit
+// is set in skip_mask are left out. Prints a warning when the port turns
+// slow in a phase, and a note when it recovers.
+void port_stats_record(uint32_t location_id, const phase_timing_t *t, uint32_t skip_mask);
+
+// Prints "Ports: seen=... slow=..." and one "Slow port: ..." line per port
+// and phase that is slow at the moment.
+void port_stats_report(FILE *out);
+
+void port_stats_clear(void);
+
+#endif
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <plist/plist.h>
+
+#include "preflight.h"
+
+#define BATTERY_DOMAIN "com.apple.mobile.battery"
+#define FMIP_DOMAIN "com.apple.fmip"
+
+static const char *reason_codes[PREFLIGHT_REASONS] = {
+    [PREFLIGHT_PASS] = "pass",
+    [PREFLIGHT_LOW_BATTERY] = "low_battery",
+    [PREFLIGHT_FIND_MY] = "find_my",
+    [PREFLIGHT_VALUE] = "value",
+    [PREFLIGHT_UNREADABLE] = "unreadable",
+};
+
+static struct {
+    pthread_mutex_t lock;
+    FILE *file;
+} rework = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int copy_field(char *dst, size_t size, const char *src, size_t len) {
+    if (len >= size) {
+        return -1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return 0;
+}
+
+static int parse_rule(const char *rule, size_t len, preflight_rule_t *out) {
+    memset(out, 0, sizeof(*out));
+    const char *colon = memchr(rule, ':', len);
+    const char *eq = memchr(rule, '=', len);
+    if (len == 6 && strncmp(rule, "findmy", 6) == 0) {
+        out->reason = PREFLIGHT_FIND_MY;
+        strcpy(out->domain, FMIP_DOMAIN);
+        strcpy(out->key, "IsAssociated");
+        return 0;
+    }
+    if (len > 8 && strncmp(rule, "battery=", 8) == 0) {
+        char *end = NULL;
+        long percent = strtol(rule + 8, &end, 10);
+        if (end != rule + len || percent < 1 || percent > 100) {
+            return -1;
+        }
+        out->reason = PREFLIGHT_LOW_BATTERY;
+        out->min_percent = (int)percent;
+        strcpy(out->domain, BATTERY_DOMAIN);
+        strcpy(out->key, "BatteryCurrentCapacity");
+        return 0;
+    }
+    if (!colon || !eq || eq < colon || eq == colon + 1 || eq == rule + len - 1) {
+        return -1;
+    }
+    out->reason = PREFLIGHT_VALUE;
+    if (copy_field(out->domain, sizeof(out->domain), rule, colon - rule) < 0 ||
+        copy_field(out->key, sizeof(out->key), colon + 1, eq - colon - 1) < 0 ||
+        copy_field(out->value, sizeof(out->value), eq + 1, rule + len - eq - 1) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int preflight_parse(const char *spec, preflight_rules_t *out) {
+    memset(out, 0, sizeof(*out));
+    const char *p = spec;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        if (len == 0 || out->count == PREFLIGHT_MAX_RULES || parse_rule(p, len, &out->rules[out->count]) < 0) {
+            return -1;
+        }
+        out->count++;
+        p += len;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return out->count > 0 ? 0 : -1;
+}
+
+// Text form of a scalar value, for comparing and reporting; "" otherwise
+static void value_text(plist_t node, char *buf, size_t size) {
+    uint64_t u = 0;
+    uint8_t b = 0;
+    buf[0] = '\0';
+    switch (node ? plist_get_node_type(node) : PLIST_NONE) {
+        case PLIST_STRING:
+            snprintf(buf, size, "%s", plist_get_string_ptr(node, NULL));
+            break;
+        case PLIST_BOOLEAN:
+            plist_get_bool_val(node, &b);
+            snprintf(buf, size, "%s", b ? "true" : "false");
+            break;
+        case PLIST_UINT:
+            plist_get_uint_val(node, &u);
+            snprintf(buf, size, "%llu", (unsigned long long)u);
+            break;
+        default:
+            break;
+    }
+}
+
+// The rule's verdict on its domain's values; NULL domain: not readable
+static preflight_reason_t evaluate(const preflight_rule_t *rule, plist_t domain, char *detail, size_t size) {
+    if (!domain || plist_get_node_type(domain) != PLIST_DICT) {
+        snprintf(detail, size, "domain=%s", rule->domain[0] ? rule->domain : "(root)");
+        return PREFLIGHT_UNREADABLE;
+    }
+    char text[64];
+    value_text(plist_dict_get_item(domain, rule->key), text, sizeof(text));
+    switch (rule->reason) {
+        case PREFLIGHT_LOW_BATTERY: {
+            char charging[8];
+            value_text(plist_dict_get_item(domain, "BatteryIsCharging"), charging, sizeof(charging));
+            if (*text && atoi(text) < rule->min_percent && strcmp(charging, "true") != 0) {
+                snprintf(detail, size, "battery=%s%% minimum=%d%%", text, rule->min_percent);
+                return PREFLIGHT_LOW_BATTERY;
+            }
+            return PREFLIGHT_PASS;
+        }
+        case PREFLIGHT_FIND_MY:
+            if (strcmp(text, "true") == 0) {
+                snprintf(detail, size, "%s:%s=true", rule->domain, rule->key);
+                return PREFLIGHT_FIND_MY;
+            }
+            return PREFLIGHT_PASS;
+        default:
+            if (strcmp(text, rule->value) == 0) {
+                snprintf(detail, size, "%s:%s=%s", rule->domain, rule->key, text);
+                return PREFLIGHT_VALUE;
+            }
+            return PREFLIGHT_PASS;
+    }
+}
+
+int preflight_check(lockdownd_client_t lockdown, const preflight_rules_t *rules, preflight_verdict_t *verdict) {
+    // Each domain is read once, however many rules look at it
+    plist_t domains[PREFLIGHT_MAX_RULES] = { NULL };
+    int first[PREFLIGHT_MAX_RULES];
+    int res = 0;
+    for (int i = 0; i < rules->count; i++) {
+        first[i] = i;
+        for (int j = 0; j < i; j++) {
+            if (strcmp(rules->rules[j].domain, rules->rules[i].domain) == 0) {
+                first[i] = first[j];
+                break;
+            }
+        }
+        if (first[i] != i) {
+            continue;
+        }
+        const char *domain = rules->rules[i].domain[0] ? rules->rules[i].domain : NULL;
+        lockdownd_error_t err = lockdownd_get_value(lockdown, domain, NULL, &domains[i]);
+        if (err == LOCKDOWN_E_MUX_ERROR || err == LOCKDOWN_E_SSL_ERROR || err == LOCKDOWN_E_RECEIVE_TIMEOUT ||
+            err == LOCKDOWN_E_PLIST_ERROR) {
+            res = -1;
+            break;
+        }
+    }
+
+    verdict->reason = PREFLIGHT_PASS;
+    verdict->detail[0] = '\0';
+    for (int i = 0; res == 0 && i < rules->count; i++) {
+        verdict->reason = evaluate(&rules->rules[i], domains[first[i]], verdict->detail, sizeof(verdict->detail));
+        if (verdict->reason != PREFLIGHT_PASS) {
+            break;
+        }
+    }
+    for (int i = 0; i < rules->count; i++) {
+        if (domains[i]) {
+            plist_free(domains[i]);
+        }
+    }
+    return res;
+}
+
+const char *preflight_reason_code(preflight_reason_t reason) {
+    return reason >= 0 && reason < PREFLIGHT_REASONS ? reason_codes[reason] : "unknown";
+}
+
+int preflight_rework_open(const char *path) {
+    rework.file = fopen(path, "a");
+    if (!rework.file) {
+        fprintf(stderr, "Error: Could not open rework list %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void preflight_rework_add(const char *udid, const char *priority, const preflight_verdict_t *verdict) {
+    pthread_mutex_lock(&rework.lock);
+    if (rework.file) {
+        fprintf(rework.file, "%s %s # %s %s\n", udid, priority, preflight_reason_code(verdict->reason), verdict->detail);
+        fflush(rework.file);
+    }
+    pthread_mutex_unlock(&rework.lock);
+}
+
+void preflight_rework_close(void) {
+    pthread_mutex_lock(&rework.lock);
+    if (rework.file) {
+        fclose(rework.file);
+        rework.file = NULL;
+    }
+    pthread_mutex_unlock(&rework.lock);
+}
@@ -0,0 +1,66 @@
+#ifndef IDEVICEERASE_PREFLIGHT_H
+#define IDEVICEERASE_PREFLIGHT_H
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+
+// Preflight checks, run on the open lockdown client before an erase takes
+// a service connection, so devices that cannot be erased are turned away
+// before the request goes out. Rules, as given to --preflight:
+//
+//   battery=<percent>        below percent and not charging
+//   findmy                   Find My, and with it Activation Lock, is on
+//   <domain>:<key>=<value>   a lockdown value equals value (as text; an
+//                            empty domain is the root domain)
+//
+// The values come from one GetValue per lockdown domain the rules name,
+// each asking for the whole domain. A domain the device will not give out
+// rejects the device: nothing says its rules pass.
+
+#define PREFLIGHT_MAX_RULES 16
+
+typedef enum {
+    PREFLIGHT_PASS = 0,
+    PREFLIGHT_LOW_BATTERY,
+    PREFLIGHT_FIND_MY,
+    PREFLIGHT_VALUE,
+    PREFLIGHT_UNREADABLE,           // a domain a rule needs was not given out
+    PREFLIGHT_REASONS
+} preflight_reason_t;
+
+typedef struct {
+    preflight_reason_t reason;      // what a match rejects with
+    char domain[64];                // "" for the root domain
+    char key[64];
+    char value[64];                 // PREFLIGHT_VALUE
+    int min_percent;                // PREFLIGHT_LOW_BATTERY
+} preflight_rule_t;
+
+typedef struct {
+    preflight_rule_t rules[PREFLIGHT_MAX_RULES];
+    int count;
+} preflight_rules_t;
+
+typedef struct {
+    preflight_reason_t reason;
+    char detail[160];               // what was found, e.g. "battery=12%"
+} preflight_verdict_t;
+
+// Parses a comma-separated rule list; -1 if it has an unknown rule.
+int preflight_parse(const char *spec, preflight_rules_t *out);
+
+// Returns 0 with the first rule the device fails (or PREFLIGHT_PASS) in
+// *verdict, or -1 if the lockdown connection failed.
+int preflight_check(lockdownd_client_t lockdown, const preflight_rules_t *rules, preflight_verdict_t *verdict);
+
+// Reason code used in the rework list, e.g. "low_battery"
+const char *preflight_reason_code(preflight_reason_t reason);
+
+// Rework list: rejected devices are appended as "<udid> <class> # <reason>
+// <detail>" lines, so the file can be given to --manifest once they have
+// been dealt with. Safe from any thread.
+int preflight_rework_open(const char *path);
+void preflight_rework_add(const char *udid, const char *priority, const preflight_verdict_t *verdict);
+void preflight_rework_close(void);
+
+#endif
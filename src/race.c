@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "race.h"
+#include "muxproxy.h"
+#include "phase.h"
+
+#define RACE_POLL_MS 50 // how often a waiting race looks at *cancel
+
+typedef struct race race_t;
+
+typedef struct {
+    race_t *race;
+    race_transport_t transport;
+    int started;
+    int done;
+    uint32_t device_id;         // usbmuxd DeviceID once connected, for aborts
+} contender_t;
+
+// Shared by the caller and the attempt threads; whoever drops the last
+// reference frees it
+struct race {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;
+    int winner;                 // index into contenders, -1 until one wins
+    int over;                   // caller has returned; attempts give up
+    int connected;
+    char *udid;
+    const char *label;
+    idevice_t device;           // the winner's, until the caller takes them
+    lockdownd_client_t lockdown;
+    contender_t contenders[RACE_TRANSPORTS];
+    // Summed over the attempts that have finished
+    uint64_t connect_cpu_ns, connect_switches;
+    uint64_t handshake_cpu_ns, handshake_switches;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    race_stats_t totals;
+} stats = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void race_unref_locked(race_t *race) {
+    if (--race->refs > 0) {
+        pthread_mutex_unlock(&race->lock);
+        return;
+    }
+    pthread_mutex_unlock(&race->lock);
+    pthread_cond_destroy(&race->cond);
+    pthread_mutex_destroy(&race->lock);
+    free(race->udid);
+    free(race);
+}
+
+static void *contender_thread(void *arg) {
+    contender_t *c = arg;
+    race_t *race = c->race;
+    enum idevice_options lookup = c->transport == RACE_NETWORK ? IDEVICE_LOOKUP_NETWORK : IDEVICE_LOOKUP_USBMUX;
+    idevice_t device = NULL;
+    lockdownd_client_t lockdown = NULL;
+    uint64_t cpu[3], switches[3];  // at the start, connected, done
+
+    phase_thread_usage(&cpu[0], &switches[0]);
+    int ok = idevice_new_with_options(&device, race->udid, lookup) == IDEVICE_E_SUCCESS;
+    phase_thread_usage(&cpu[1], &switches[1]);
+    if (ok) {
+        uint32_t device_id = 0;
+        idevice_get_handle(device, &device_id);
+        pthread_mutex_lock(&race->lock);
+        c->device_id = device_id;
+        race->connected = 1;
+        int give_up = race->winner >= 0 || race->over;
+        pthread_cond_broadcast(&race->cond);
+        pthread_mutex_unlock(&race->lock);
+        ok = !give_up && lockdownd_client_new_with_handshake(device, &lockdown, race->label) == LOCKDOWN_E_SUCCESS;
+    }
+    phase_thread_usage(&cpu[2], &switches[2]);
+
+    pthread_mutex_lock(&race->lock);
+    race->connect_cpu_ns += cpu[1] - cpu[0];
+    race->connect_switches += switches[1] - switches[0];
+    race->handshake_cpu_ns += cpu[2] - cpu[1];
+    race->handshake_switches += switches[2] - switches[1];
+    if (ok && race->winner < 0 && !race->over) {
+        race->winner = (int)(c - race->contenders);
+        race->device = device;
+        race->lockdown = lockdown;
+        device = NULL;
+        lockdown = NULL;
+    }
+    c->done = 1;
+    pthread_cond_broadcast(&race->cond);
+    race_unref_locked(race);
+
+    // Lost, or the race was given up
+    if (lockdown) {
+        lockdownd_client_free(lockdown);
+    }
+    if (device) {
+        idevice_free(device);
+    }
+    return NULL;
+}
+
+// race->lock held
+static void start_locked(race_t *race, race_transport_t transport) {
+    contender_t *c = &race->contenders[transport];
+    pthread_attr_t attr;
+    pthread_t thread;
+    c->started = 1;
+    race->refs++;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, contender_thread, c) != 0) {
+        race->refs--;
+        c->done = 1;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Shuts down the relayed connections of every attempt still running
+static void abort_others_locked(race_t *race, int keep) {
+    for (int i = 0; i < RACE_TRANSPORTS; i++) {
+        contender_t *c = &race->contenders[i];
+        if (i != keep && c->started && !c->done && c->device_id) {
+            muxproxy_abort_device(c->device_id);
+        }
+    }
+}
+
+int race_connect(const char *udid, race_transport_t first, uint32_t delay_ms, const char *label,
+                 const int *cancel, race_connected_fn connected, void *user_data, race_result_t *out) {
+    memset(out, 0, sizeof(*out));
+    race_t *race = calloc(1, sizeof(race_t));
+    if (!race || !(race->udid = strdup(udid))) {
+        free(race);
+        return -1;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    // Waits are timed with phase_now_ns(), which is CLOCK_MONOTONIC
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&race->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&race->lock, NULL);
+    race->refs = 1;
+    race->winner = -1;
+    race->label = label;
+    race_transport_t second = first == RACE_USB ? RACE_NETWORK : RACE_USB;
+    for (int i = 0; i < RACE_TRANSPORTS; i++) {
+        race->contenders[i] = (contender_t){ .race = race, .transport = (race_transport_t)i };
+    }
+
+    uint64_t second_at = phase_now_ns() + (uint64_t)delay_ms * 1000000ULL;
+    int reported = 0;
+    pthread_mutex_lock(&race->lock);
+    start_locked(race, first);
+    for (;;) {
+        if (race->connected && !reported) {
+            // Not under the lock: the callback starts the handshake phase
+            reported = 1;
+            pthread_mutex_unlock(&race->lock);
+            connected(user_data);
+            pthread_mutex_lock(&race->lock);
+            continue;
+        }
+        if (race->winner >= 0) {
+            break;
+        }
+        uint64_t now = phase_now_ns();
+        if (!race->contenders[second].started && (race->contenders[first].done || now >= second_at)) {
+            start_locked(race, second);
+            out->raced = 1;
+            continue;
+        }
+        if (race->contenders[first].done && race->contenders[second].done) {
+            break;
+        }
+        if (__atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+            break;
+        }
+        uint64_t wake = now + RACE_POLL_MS * 1000000ULL;
+        if (!race->contenders[second].started && second_at < wake) {
+            wake = second_at;
+        }
+        struct timespec ts = { (time_t)(wake / 1000000000ULL), (long)(wake % 1000000000ULL) };
+        pthread_cond_timedwait(&race->cond, &race->lock, &ts);
+    }
+
+    race->over = 1;
+    out->connected = race->connected;
+    out->connect_cpu_ns = race->connect_cpu_ns;
+    out->connect_switches = race->connect_switches;
+    out->handshake_cpu_ns = race->handshake_cpu_ns;
+    out->handshake_switches = race->handshake_switches;
+    int winner = race->winner;
+    if (winner >= 0) {
+        out->device = race->device;
+        out->lockdown = race->lockdown;
+        out->transport = (race_transport_t)winner;
+    }
+    abort_others_locked(race, winner);
+    race_unref_locked(race);
+
+    pthread_mutex_lock(&stats.lock);
+    stats.totals.races++;
+    stats.totals.raced += out->raced;
+    if (winner >= 0) {
+        stats.totals.won[winner]++;
+    }
+    pthread_mutex_unlock(&stats.lock);
+    return winner >= 0 ? 0 : -1;
+}
+
+const char *race_transport_name(race_transport_t transport) {
+    return transport == RACE_NETWORK ? "network" : "usb";
+}
+
+void race_get_stats(race_stats_t *out) {
+    pthread_mutex_lock(&stats.lock);
+    *out = stats.totals;
+    pthread_mutex_unlock(&stats.lock);
+}
+
+void race_stats_print(const race_stats_t *s, FILE *out) {
+    fprintf(out, "Race: connects=%llu raced=%llu won_usb=%llu won_network=%llu\n", (unsigned long long)s->races,
+            (unsigned long long)s->raced, (unsigned long long)s->won[RACE_USB], (unsigned long long)s->won[RACE_NETWORK]);
+}
@@ -0,0 +1,63 @@
+#ifndef IDEVICEERASE_RACE_H
+#define IDEVICEERASE_RACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+
+// Connection racing for devices usbmuxd sees both over USB and over Wi-Fi
+// sync ("happy eyeballs").
+//
+// The connection and lockdown handshake start over the preferred
+// transport. If they have not completed after a short delay, or fail
+// before it, the same starts over the other transport as well, and the
+// first handshake to complete wins. Each attempt runs on a thread of its
+// own; the loser is aborted through the relay if it runs, and frees what it
+// got when its calls return.
+
+#define RACE_DEFAULT_DELAY_MS 250
+
+typedef enum {
+    RACE_USB = 0,
+    RACE_NETWORK,
+    RACE_TRANSPORTS
+} race_transport_t;
+
+typedef struct {
+    idevice_t device;
+    lockdownd_client_t lockdown;
+    race_transport_t transport;   // transport that won
+    int raced;                    // the other transport was tried too
+    int connected;                // some attempt got as far as the handshake
+    // CPU time and context switches the attempt threads spent connecting
+    // and in the handshake; an attempt still running when the race ended
+    // is not counted
+    uint64_t connect_cpu_ns, connect_switches;
+    uint64_t handshake_cpu_ns, handshake_switches;
+} race_result_t;
+
+typedef struct {
+    uint64_t races;
+    uint64_t raced;               // races in which both transports ran
+    uint64_t won[RACE_TRANSPORTS];
+} race_stats_t;
+
+// Called on the caller's thread when the first attempt has connected and
+// starts its handshake, before race_connect() returns with success.
+typedef void (*race_connected_fn)(void *user_data);
+
+// Races the transports, 'first' first, for the device. Returns 0 with the
+// winner's device and lockdown client in *out, or -1 if every attempt
+// failed; out->connected then tells whether that was in the handshake. A
+// race is given up, and its attempts aborted, once *cancel is set.
+int race_connect(const char *udid, race_transport_t first, uint32_t delay_ms, const char *label,
+                 const int *cancel, race_connected_fn connected, void *user_data, race_result_t *out);
+
+const char *race_transport_name(race_transport_t transport);
+
+void race_get_stats(race_stats_t *out);
+void race_stats_print(const race_stats_t *stats, FILE *out);
+
+#endif
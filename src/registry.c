@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "registry.h"
+
+#define REGISTRY_SHARDS 16
+#define REGISTRY_BUCKETS 64     // per shard
+
+typedef enum {
+    ENTRY_RUNNING = 0,
+    ENTRY_DONE
+} entry_state_t;
+
+typedef struct registry_entry {
+    struct registry_entry *next;
+    entry_state_t state;
+    const void *owner;
+    int result;                 // valid once ENTRY_DONE
+    udid_waiter_t *waiters;
+    char udid[];
+} registry_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    registry_entry_t *buckets[REGISTRY_BUCKETS];
+} registry_shard_t;
+
+static registry_shard_t shards[REGISTRY_SHARDS] = {
+    [0 ... REGISTRY_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+// FNV-1a over the lower-cased UDID
+static uint32_t udid_hash(const char *udid) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)udid; *p; p++) {
+        h = (h ^ (uint32_t)tolower(*p)) * 16777619u;
+    }
+    return h;
+}
+
+static registry_entry_t **find_locked(registry_shard_t *shard, uint32_t hash, const char *udid) {
+    registry_entry_t **link = &shard->buckets[(hash / REGISTRY_SHARDS) % REGISTRY_BUCKETS];
+    while (*link && strcasecmp((*link)->udid, udid) != 0) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+udid_registry_status_t udid_registry_enter(const char *udid, const void *owner, udid_waiter_t *waiter) {
+    uint32_t hash = udid_hash(udid);
+    registry_shard_t *shard = &shards[hash % REGISTRY_SHARDS];
+    udid_registry_status_t status = UDID_OWNED;
+    pthread_mutex_lock(&shard->lock);
+    registry_entry_t **link = find_locked(shard, hash, udid);
+    registry_entry_t *e = *link;
+    if (!e) {
+        size_t len = strlen(udid) + 1;
+        e = calloc(1, sizeof(*e) + len);
+        // Without memory, let the session go ahead unregistered
+        if (e) {
+            memcpy(e->udid, udid, len);
+            e->owner = owner;
+            *link = e;
+        }
+    } else if (e->owner != owner) {
+        if (e->state == ENTRY_DONE) {
+            status = UDID_FINISHED;
+            *waiter->result = e->result;
+        } else {
+            status = UDID_COALESCED;
+            waiter->next = e->waiters;
+            e->waiters = waiter;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+}
+
+void udid_registry_leave(const char *udid, const void *owner, int result) {
+    uint32_t hash = udid_hash(udid);
+    registry_shard_t *shard = &shards[hash % REGISTRY_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    registry_entry_t *e = *find_locked(shard, hash, udid);
+    if (e && e->owner == owner) {
+        e->state = ENTRY_DONE;
+        e->result = result;
+        for (udid_waiter_t *w = e->waiters; w; w = w->next) {
+            *w->result = result;
+        }
+        e->waiters = NULL;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void udid_registry_forget(const char *udid, const void *owner) {
+    uint32_t hash = udid_hash(udid);
+    registry_shard_t *shard = &shards[hash % REGISTRY_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    registry_entry_t **link = find_locked(shard, hash, udid);
+    registry_entry_t *e = *link;
+    if (e && e->owner == owner && e->state == ENTRY_DONE) {
+        *link = e->next;
+        free(e);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void udid_registry_clear(void) {
+    for (int s = 0; s < REGISTRY_SHARDS; s++) {
+        pthread_mutex_lock(&shards[s].lock);
+        for (int b = 0; b < REGISTRY_BUCKETS; b++) {
+            while (shards[s].buckets[b]) {
+                registry_entry_t *e = shards[s].buckets[b];
+                shards[s].buckets[b] = e->next;
+                free(e);
+            }
+        }
+        pthread_mutex_unlock(&shards[s].lock);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef IDEVICEERASE_REGISTRY_H
+#define IDEVICEERASE_REGISTRY_H
+
+// Process-wide registry of the UDIDs being erased, so that one device is
+// never erased by two sessions of the same run, whether it was listed
+// twice or shows up under two lookups. UDIDs compare case-insensitively.
+//
+// The map is split into shards with a lock each, so sessions of different
+// devices rarely touch the same lock.
+
+// A session that found its device taken; it gets the owner's result
+typedef struct udid_waiter {
+    struct udid_waiter *next;
+    int *result;
+} udid_waiter_t;
+
+typedef enum {
+    UDID_OWNED = 0,     // owner holds the device (also when it re-enters)
+    UDID_COALESCED,     // *waiter->result will be set when the owner leaves
+    UDID_FINISHED       // the owner has left; *waiter->result is its result
+} udid_registry_status_t;
+
+// Enters owner as the session erasing udid. If another owner has it or has
+// already finished with it, waiter is attached to it instead: its result is
+// written when that owner leaves, or right away if it already has.
+udid_registry_status_t udid_registry_enter(const char *udid, const void *owner, udid_waiter_t *waiter);
+
+// Ends owner's erase of udid with result and hands it to every waiter.
+void udid_registry_leave(const char *udid, const void *owner, int result);
+
+// Removes the entry owner has left, so that udid can be entered again.
+void udid_registry_forget(const char *udid, const void *owner);
+
+void udid_registry_clear(void);
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "json.h"
+#include "report.h"
+
+#define REPORT_BACKLOG_MAX (64u << 20)
+#define REPORT_OUT_CHUNK (256u << 10)
+
+typedef struct report_record {
+    struct report_record *next;
+    size_t len;
+    int droppable;
+    char data[];
+} report_record_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    report_record_t *head;
+    report_record_t **tail;
+    size_t backlog;             // bytes queued
+    int stopping;
+    int running;
+    pthread_t thread;
+    report_stats_t stats;
+
+    // Compression thread only
+    char *dir;
+    uint64_t rotate_bytes;
+    FILE *out;
+    uint64_t out_bytes;
+    z_stream zs;
+    unsigned char *chunk;
+} report = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int open_archive(void) {
+    char path[4096];
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm);
+    snprintf(path, sizeof(path), "%s/report-%s-%d.gz", report.dir, stamp, report.stats.archives);
+    report.out = fopen(path, "w");
+    if (!report.out) {
+        fprintf(stderr, "Error: Could not create report archive %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    memset(&report.zs, 0, sizeof(report.zs));
+    // 15 + 16: gzip framing, so the archives open with zcat
+    if (deflateInit2(&report.zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Error: Could not set up report compression.\n");
+        fclose(report.out);
+        report.out = NULL;
+        return -1;
+    }
+    report.out_bytes = 0;
+    report.stats.archives++;
+    return 0;
+}
+
+// Runs deflate over input (may be empty) and writes what it produces
+static void deflate_out(const void *data, size_t len, int flush) {
+    report.zs.next_in = (Bytef *)data;
+    report.zs.avail_in = (uInt)len;
+    do {
+        report.zs.next_out = report.chunk;
+        report.zs.avail_out = REPORT_OUT_CHUNK;
+        deflate(&report.zs, flush);
+        size_t have = REPORT_OUT_CHUNK - report.zs.avail_out;
+        if (have && fwrite(report.chunk, 1, have, report.out) != have) {
+            fprintf(stderr, "Error: Could not write report: %s\n", strerror(errno));
+        }
+        report.out_bytes += have;
+        report.stats.compressed_bytes += have;
+    } while (report.zs.avail_out == 0);
+}
+
+static void close_archive(void) {
+    if (!report.out) {
+        return;
+    }
+    deflate_out(NULL, 0, Z_FINISH);
+    deflateEnd(&report.zs);
+    fclose(report.out);
+    report.out = NULL;
+}
+
+static void *compress_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&report.lock);
+    for (;;) {
+        while (!report.head && !report.stopping) {
+            pthread_cond_wait(&report.cond, &report.lock);
+        }
+        if (!report.head) {
+            break;
+        }
+        // Take everything queued; compress without the lock
+        report_record_t *list = report.head;
+        report.head = NULL;
+        report.tail = &report.head;
+        pthread_mutex_unlock(&report.lock);
+
+        size_t taken = 0;
+        while (list) {
+            report_record_t *r = list;
+            list = r->next;
+            if (report.out && report.out_bytes >= report.rotate_bytes) {
+                close_archive();
+            }
+            if (report.out || open_archive() == 0) {
+                deflate_out(r->data, r->len, Z_NO_FLUSH);
+            }
+            taken += r->len;
+            free(r);
+        }
+        // Each batch ends on a byte boundary in the file, so a crash loses
+        // at most the batch being compressed and zcat reads up to there
+        if (report.out) {
+            deflate_out(NULL, 0, Z_SYNC_FLUSH);
+            fflush(report.out);
+        }
+
+        pthread_mutex_lock(&report.lock);
+        report.backlog -= taken;
+    }
+    pthread_mutex_unlock(&report.lock);
+    close_archive();
+    return NULL;
+}
+
+static void enqueue(report_record_t *r) {
+    pthread_mutex_lock(&report.lock);
+    if (r->droppable && report.backlog + r->len > REPORT_BACKLOG_MAX) {
+        report.stats.dropped++;
+        pthread_mutex_unlock(&report.lock);
+        free(r);
+        return;
+    }
+    r->next = NULL;
+    *report.tail = r;
+    report.tail = &r->next;
+    report.backlog += r->len;
+    report.stats.records++;
+    report.stats.raw_bytes += r->len;
+    pthread_cond_signal(&report.cond);
+    pthread_mutex_unlock(&report.lock);
+}
+
+int report_open(const char *dir, uint64_t rotate_bytes) {
+    report.dir = strdup(dir);
+    report.chunk = malloc(REPORT_OUT_CHUNK);
+    if (!report.dir || !report.chunk) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        report_close(NULL);
+        return -1;
+    }
+    report.rotate_bytes = rotate_bytes;
+    report.head = NULL;
+    report.tail = &report.head;
+    report.stopping = 0;
+    // Fail now rather than after the first erase
+    if (open_archive() < 0) {
+        report_close(NULL);
+        return -1;
+    }
+    if (pthread_create(&report.thread, NULL, compress_thread, NULL) != 0) {
+        fprintf(stderr, "Error: Could not start report thread.\n");
+        report_close(NULL);
+        return -1;
+    }
+    report.running = 1;
+    return 0;
+}
+
+void report_result(const phase_timing_t *t, const char *udid) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    if (!mem) {
+        return;
+    }
+    phase_timing_print_json(t, udid, mem);
+    fclose(mem);
+    report_record_t *r = malloc(sizeof(*r) + len);
+    if (r) {
+        memcpy(r->data, buf, len);
+        r->len = len;
+        r->droppable = 0;
+        enqueue(r);
+    }
+    free(buf);
+}
+
+void report_plist(const char *udid, const char *what, plist_t plist, report_plist_format_t format) {
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *mem = open_memstream(&body, &body_len);
+    if (!mem) {
+        return;
+    }
+    plist_write_to_stream(plist, mem, format == REPORT_PLIST_JSON ? PLIST_FORMAT_JSON : PLIST_FORMAT_BINARY,
+                          PLIST_OPT_COMPACT);
+    fclose(mem);
+    char udid_json[160], what_json[160], header[512];
+    json_escape(udid_json, 0, sizeof(udid_json), udid);
+    json_escape(what_json, 0, sizeof(what_json), what);
+    int header_len = snprintf(header, sizeof(header), "{\"udid\":\"%s\",\"plist\":\"%s\",\"format\":\"%s\",\"bytes\":%zu}\n",
+                              udid_json, what_json, format == REPORT_PLIST_JSON ? "json" : "binary", body_len);
+    if (header_len < 0 || header_len >= (int)sizeof(header)) {
+        free(body);
+        return;
+    }
+    report_record_t *r = malloc(sizeof(*r) + header_len + body_len + 1);
+    if (r) {
+        memcpy(r->data, header, header_len);
+        memcpy(r->data + header_len, body, body_len);
+        r->data[header_len + body_len] = '\n';
+        r->len = header_len + body_len + 1;
+        r->droppable = 1;
+        enqueue(r);
+    }
+    free(body);
+}
+
+void report_close(report_stats_t *stats) {
+    if (report.running) {
+        pthread_mutex_lock(&report.lock);
+        report.stopping = 1;
+        pthread_cond_signal(&report.cond);
+        pthread_mutex_unlock(&report.lock);
+        pthread_join(report.thread, NULL);
+        report.running = 0;
+    } else {
+        close_archive();
+    }
+    if (stats) {
+        *stats = report.stats;
+    }
+    free(report.chunk);
+    report.chunk = NULL;
+    free(report.dir);
+    report.dir = NULL;
+}
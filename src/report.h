@@ -0,0 +1,46 @@
+#ifndef IDEVICEERASE_REPORT_H
+#define IDEVICEERASE_REPORT_H
+
+#include <stdint.h>
+
+#include <plist/plist.h>
+
+#include "phase.h"
+
+// Compressed run reports.
+//
+// Sessions hand their records to a background thread, which gzips them
+// into report-<UTC time>-<n>.gz archives in the report directory and
+// starts a new archive once the current one reaches its size limit. The
+// uncompressed stream is a sequence of lines:
+//
+//   {"udid":"...","phases":{...},"total_ms":...,"status":"..."}
+//       the result of one erase, as printed by --timing in json output
+//   {"udid":"...","plist":"<what>","format":"binary|json","bytes":N}
+//       followed by the N bytes of the plist and a newline
+//
+// Submitting never blocks on compression or disk I/O. If the thread falls
+// more than a fixed backlog behind, plist dumps are dropped (and counted);
+// results never are.
+
+typedef enum {
+    REPORT_PLIST_NONE = 0,
+    REPORT_PLIST_BINARY,
+    REPORT_PLIST_JSON
+} report_plist_format_t;
+
+typedef struct {
+    uint64_t records;
+    uint64_t raw_bytes;         // before compression
+    uint64_t compressed_bytes;
+    uint64_t dropped;           // plist dumps dropped under backlog
+    int archives;
+} report_stats_t;
+
+int report_open(const char *dir, uint64_t rotate_bytes);
+void report_result(const phase_timing_t *t, const char *udid);
+void report_plist(const char *udid, const char *what, plist_t plist, report_plist_format_t format);
+// Compresses everything queued and closes the archive
+void report_close(report_stats_t *stats);
+
+#endif
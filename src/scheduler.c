@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "phase.h"
+#include "scheduler.h"
+
+static const char *priority_names[PRIORITY_COUNT] = { "express", "standard", "bulk" };
+static const int default_shares[PRIORITY_COUNT] = { 6, 3, 1 };
+
+typedef int (*job_order_fn)(const scheduler_job_t *a, const scheduler_job_t *b);
+
+typedef struct {
+    scheduler_job_t **items;
+    int count;
+    int cap;
+    job_order_fn before;
+} job_heap_t;
+
+struct scheduler {
+    scheduler_job_t *inbox;   // lock-free LIFO of submitted jobs
+    uint64_t next_seq;
+    sem_t wake;
+
+    pthread_mutex_t lock;     // guards everything below
+    job_heap_t heaps[PRIORITY_COUNT];
+    job_heap_t delayed;       // not due yet, soonest on top
+    int running[PRIORITY_COUNT];
+    int running_total;
+    int class_cap[PRIORITY_COUNT];
+    int shares[PRIORITY_COUNT];
+    int limit;                // workers allowed to run jobs
+    int closed;
+    int joined;               // all threads joined; no new ones
+
+    int workers;              // threads started, >= limit
+    pthread_t *threads;
+    uint64_t aging_ns;
+    scheduler_run_fn run;
+};
+
+static int job_before(const scheduler_job_t *a, const scheduler_job_t *b) {
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+static int job_due_before(const scheduler_job_t *a, const scheduler_job_t *b) {
+    return a->not_before_ns < b->not_before_ns || (a->not_before_ns == b->not_before_ns && job_before(a, b));
+}
+
+static int heap_push(job_heap_t *h, scheduler_job_t *job) {
+    if (h->count == h->cap) {
+        int cap = h->cap ? h->cap * 2 : 64;
+        scheduler_job_t **grown = realloc(h->items, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        h->items = grown;
+        h->cap = cap;
+    }
+    int i = h->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!h->before(job, h->items[parent])) {
+            break;
+        }
+        h->items[i] = h->items[parent];
+        i = parent;
+    }
+    h->items[i] = job;
+    return 0;
+}
+
+static scheduler_job_t *heap_pop(job_heap_t *h) {
+    scheduler_job_t *top = h->items[0];
+    scheduler_job_t *last = h->items[--h->count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= h->count) {
+            break;
+        }
+        if (child + 1 < h->count && h->before(h->items[child + 1], h->items[child])) {
+            child++;
+        }
+        if (!h->before(h->items[child], last)) {
+            break;
+        }
+        h->items[i] = h->items[child];
+        i = child;
+    }
+    if (h->count > 0) {
+        h->items[i] = last;
+    }
+    return top;
+}
+
+static void drain_inbox_locked(scheduler_t *s) {
+    scheduler_job_t *job = __atomic_exchange_n(&s->inbox, NULL, __ATOMIC_ACQUIRE);
+    uint64_t now = phase_now_ns();
+    // Due delayed jobs join the heaps with the new arrivals
+    while (s->delayed.count > 0 && s->delayed.items[0]->not_before_ns <= now) {
+        scheduler_job_t *due = heap_pop(&s->delayed);
+        due->not_before_ns = 0;
+        due->next = job;
+        job = due;
+    }
+    while (job) {
+        scheduler_job_t *next = job->next;
+        job_heap_t *heap = job->not_before_ns > now ? &s->delayed : &s->heaps[job->priority];
+        if (heap_push(heap, job) < 0) {
+            // Out of memory: keep the job in the inbox for the next attempt
+            job->next = NULL;
+            scheduler_submit(s, job);
+        }
+        job = next;
+    }
+}
+
+// Classes below their share go first; if none of the waiting classes is,
+// any waiting class may use the idle worker. Among those, lowest key wins.
+static scheduler_job_t *pick_locked(scheduler_t *s) {
+    if (s->running_total >= s->limit) {
+        return NULL;
+    }
+    int below_share = 0;
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        if (s->heaps[c].count > 0 && s->running[c] < s->class_cap[c]) {
+            below_share = 1;
+        }
+    }
+    int best = -1;
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        if (s->heaps[c].count == 0 || (below_share && s->running[c] >= s->class_cap[c])) {
+            continue;
+        }
+        if (best < 0 || job_before(s->heaps[c].items[0], s->heaps[best].items[0])) {
+            best = c;
+        }
+    }
+    return best < 0 ? NULL : heap_pop(&s->heaps[best]);
+}
+
+static int queues_empty_locked(scheduler_t *s) {
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        if (s->heaps[c].count > 0) {
+            return 0;
+        }
+    }
+    return s->delayed.count == 0 && __atomic_load_n(&s->inbox, __ATOMIC_ACQUIRE) == NULL;
+}
+
+// Sleeps until woken, or until the soonest delayed job is due
+static void wait_for_work(scheduler_t *s, uint64_t due_ns) {
+    if (!due_ns) {
+        while (sem_wait(&s->wake) < 0 && errno == EINTR) {
+        }
+        return;
+    }
+    uint64_t now = phase_now_ns();
+    uint64_t wait_ns = due_ns > now ? due_ns - now : 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wait_ns += (uint64_t)ts.tv_nsec;
+    ts.tv_sec += (time_t)(wait_ns / 1000000000ULL);
+    ts.tv_nsec = (long)(wait_ns % 1000000000ULL);
+    while (sem_timedwait(&s->wake, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+static void *worker_main(void *arg) {
+    scheduler_t *s = arg;
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        drain_inbox_locked(s);
+        scheduler_job_t *job = pick_locked(s);
+        if (job) {
+            s->running[job->priority]++;
+            s->running_total++;
+        }
+        int done = !job && s->closed && s->running_total == 0 && queues_empty_locked(s);
+        uint64_t due_ns = s->delayed.count > 0 ? s->delayed.items[0]->not_before_ns : 0;
+        pthread_mutex_unlock(&s->lock);
+
+        if (job) {
+            erase_priority_t priority = job->priority;
+            s->run(job);
+            pthread_mutex_lock(&s->lock);
+            s->running[priority]--;
+            s->running_total--;
+            pthread_mutex_unlock(&s->lock);
+            // A share was released; let a waiting worker re-evaluate
+            sem_post(&s->wake);
+            continue;
+        }
+        if (done) {
+            sem_post(&s->wake);
+            break;
+        }
+        wait_for_work(s, due_ns);
+    }
+    return NULL;
+}
+
+static void set_limit_locked(scheduler_t *s, int limit) {
+    int total_shares = 0;
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        total_shares += s->shares[c] > 0 ? s->shares[c] : 0;
+    }
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        if (s->shares[c] <= 0 || total_shares == 0) {
+            s->class_cap[c] = 0;
+        } else {
+            s->class_cap[c] = limit * s->shares[c] / total_shares;
+            if (s->class_cap[c] < 1) {
+                s->class_cap[c] = 1;
+            }
+        }
+    }
+    s->limit = limit;
+}
+
+scheduler_t *scheduler_new(int workers, const int shares[PRIORITY_COUNT], uint64_t aging_ns, scheduler_run_fn run) {
+    if (workers < 1) {
+        workers = 1;
+    }
+    if (!shares) {
+        shares = default_shares;
+    }
+    scheduler_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    s->threads = calloc(workers, sizeof(pthread_t));
+    if (!s->threads || sem_init(&s->wake, 0, 0) < 0) {
+        free(s->threads);
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        s->heaps[c].before = job_before;
+    }
+    s->delayed.before = job_due_before;
+    s->aging_ns = aging_ns;
+    s->run = run;
+
+    memcpy(s->shares, shares, sizeof(s->shares));
+    set_limit_locked(s, workers);
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&s->threads[i], NULL, worker_main, s) != 0) {
+            break;
+        }
+        s->workers++;
+    }
+    if (s->workers == 0) {
+        fprintf(stderr, "Error: Could not start erase workers.\n");
+        sem_destroy(&s->wake);
+        pthread_mutex_destroy(&s->lock);
+        free(s->threads);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void scheduler_set_workers(scheduler_t *s, int workers) {
+    if (workers < 1) {
+        workers = 1;
+    }
+    pthread_mutex_lock(&s->lock);
+    if (workers > s->workers && !s->joined) {
+        pthread_t *grown = realloc(s->threads, workers * sizeof(pthread_t));
+        if (grown) {
+            s->threads = grown;
+            while (s->workers < workers && pthread_create(&s->threads[s->workers], NULL, worker_main, s) == 0) {
+                s->workers++;
+            }
+        }
+        if (workers > s->workers) {
+            workers = s->workers;
+        }
+    }
+    // Lowering the limit lets running jobs finish; they are not preempted
+    set_limit_locked(s, workers);
+    pthread_mutex_unlock(&s->lock);
+    for (int i = 0; i < workers; i++) {
+        sem_post(&s->wake);
+    }
+}
+
+void scheduler_submit(scheduler_t *s, scheduler_job_t *job) {
+    if (job->seq == 0 && job->submit_ns == 0) {
+        job->submit_ns = phase_now_ns();
+        job->seq = __atomic_add_fetch(&s->next_seq, 1, __ATOMIC_RELAXED);
+        job->key = job->submit_ns + (uint64_t)job->priority * s->aging_ns;
+    }
+    scheduler_job_t *head = __atomic_load_n(&s->inbox, __ATOMIC_RELAXED);
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&s->inbox, &head, job, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    sem_post(&s->wake);
+}
+
+void scheduler_submit_after(scheduler_t *s, scheduler_job_t *job, uint64_t delay_ns) {
+    job->not_before_ns = phase_now_ns() + delay_ns;
+    scheduler_submit(s, job);
+}
+
+void scheduler_drain(scheduler_t *s) {
+    pthread_mutex_lock(&s->lock);
+    s->closed = 1;
+    pthread_mutex_unlock(&s->lock);
+    for (int i = 0; i < s->workers; i++) {
+        sem_post(&s->wake);
+    }
+    // scheduler_set_workers() may still add threads while jobs finish
+    for (int i = 0;; i++) {
+        pthread_mutex_lock(&s->lock);
+        int started = s->workers;
+        pthread_t thread = i < started ? s->threads[i] : 0;
+        s->joined = i >= started;
+        pthread_mutex_unlock(&s->lock);
+        if (i >= started) {
+            break;
+        }
+        pthread_join(thread, NULL);
+    }
+}
+
+void scheduler_free(scheduler_t *s) {
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        free(s->heaps[c].items);
+    }
+    free(s->delayed.items);
+    sem_destroy(&s->wake);
+    pthread_mutex_destroy(&s->lock);
+    free(s->threads);
+    free(s);
+}
+
+void scheduler_finish(scheduler_t *s) {
+    scheduler_drain(s);
+    scheduler_free(s);
+}
+
+const char *priority_name(erase_priority_t priority) {
+    if (priority < 0 || priority >= PRIORITY_COUNT) {
+        return "unknown";
+    }
+    return priority_names[priority];
+}
+
+int priority_from_name(const char *name) {
+    for (int c = 0; c < PRIORITY_COUNT; c++) {
+        if (strcmp(name, priority_names[c]) == 0) {
+            return c;
+        }
+    }
+    if (name[0] >= '0' && name[0] < '0' + PRIORITY_COUNT && name[1] == '\0') {
+        return name[0] - '0';
+    }
+    return -1;
+}
+
+int scheduler_parse_shares(const char *spec, int shares[PRIORITY_COUNT]) {
+    memcpy(shares, default_shares, sizeof(default_shares));
+    char *copy = strdup(spec);
+    if (!copy) {
+        return -1;
+    }
+    int res = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        if (!eq) {
+            res = -1;
+            break;
+        }
+        *eq = '\0';
+        int c = priority_from_name(item);
+        char *end = NULL;
+        long value = strtol(eq + 1, &end, 10);
+        if (c < 0 || !end || *end != '\0' || value < 0) {
+            res = -1;
+            break;
+        }
+        shares[c] = (int)value;
+    }
+    free(copy);
+    return res;
+}
@@ -0,0 +1,67 @@
+#ifndef IDEVICEERASE_SCHEDULER_H
+#define IDEVICEERASE_SCHEDULER_H
+
+#include <stdint.h>
+
+// Priority-aware job scheduler in front of the erase workers.
+//
+// Submission is lock-free: jobs are pushed onto an atomic inbox and a
+// semaphore is posted, so submitting never waits for a running erase.
+// Workers move the inbox into one binary heap per priority class and pick
+// the next job among the classes allowed to run.
+//
+// Aging: a job's heap key is its submit time plus class * aging, so a job
+// waits at most 'aging' per class step before it outranks newer work of a
+// higher class. Shares: each class is guaranteed its share of the workers
+// when every class has work; idle share is lent to whoever is waiting.
+
+typedef enum {
+    PRIORITY_EXPRESS = 0,
+    PRIORITY_STANDARD,
+    PRIORITY_BULK,
+    PRIORITY_COUNT
+} erase_priority_t;
+
+typedef struct scheduler_job {
+    struct scheduler_job *next;   // inbox link, owned by the scheduler
+    erase_priority_t priority;
+    uint64_t submit_ns;
+    uint64_t key;                 // aging-adjusted ordering key
+    uint64_t seq;                 // submission order, breaks key ties
+    uint64_t not_before_ns;       // set by scheduler_submit_after()
+    void *data;
+} scheduler_job_t;
+
+typedef void (*scheduler_run_fn)(scheduler_job_t *job);
+
+typedef struct scheduler scheduler_t;
+
+// shares may be NULL for the default 6/3/1 split.
+scheduler_t *scheduler_new(int workers, const int shares[PRIORITY_COUNT], uint64_t aging_ns, scheduler_run_fn run);
+
+// Changes how many jobs may run at once. Threads are added as needed;
+// lowering the count lets running jobs finish.
+void scheduler_set_workers(scheduler_t *s, int workers);
+
+// Lock-free; safe from any thread, including running jobs.
+void scheduler_submit(scheduler_t *s, scheduler_job_t *job);
+
+// Like scheduler_submit(), but the job is not started before delay_ns from
+// now. Waiting jobs hold no worker; they sit in one more binary heap,
+// ordered by when they are due, until they join their class's heap.
+void scheduler_submit_after(scheduler_t *s, scheduler_job_t *job, uint64_t delay_ns);
+
+// Stops accepting work and waits until every submitted job has run.
+// scheduler_set_workers() may still be called until scheduler_free().
+void scheduler_drain(scheduler_t *s);
+void scheduler_free(scheduler_t *s);
+// scheduler_drain() and scheduler_free() in one.
+void scheduler_finish(scheduler_t *s);
+
+const char *priority_name(erase_priority_t priority);
+// Accepts the class names or 0..2; returns -1 for anything else.
+int priority_from_name(const char *name);
+// Parses "express=6,standard=3,bulk=1" (any subset) into shares.
+int scheduler_parse_shares(const char *spec, int shares[PRIORITY_COUNT]);
+
+#endif
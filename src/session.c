@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "muxproxy.h"
+#include "session.h"
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+    int stopping;
+    erase_session_t *sessions;
+} watchdog = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+typedef struct {
+    int hub;
+    int in_use;
+} hub_usage_t;
+
+static struct {
+    pthread_mutex_t lock;
+    hub_usage_t *hubs;
+    int num_hubs;
+} hub_slots = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    pthread_mutex_t lock;
+    session_memory_t totals;
+} memory = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void session_memory_hook(ssize_t delta_bytes, void *user_data) {
+    (void)user_data;
+    pthread_mutex_lock(&memory.lock);
+    memory.totals.current += delta_bytes;
+    if (memory.totals.current > memory.totals.peak) {
+        memory.totals.peak = memory.totals.current;
+    }
+    pthread_mutex_unlock(&memory.lock);
+}
+
+void session_memory_account(const arena_t *arena) {
+    pthread_mutex_lock(&memory.lock);
+    memory.totals.sessions++;
+    memory.totals.allocs += arena->allocs;
+    memory.totals.heap_allocs += arena->heap_allocs;
+    if (arena->peak > memory.totals.session_peak) {
+        memory.totals.session_peak = arena->peak;
+    }
+    pthread_mutex_unlock(&memory.lock);
+}
+
+void session_memory_get(session_memory_t *out) {
+    pthread_mutex_lock(&memory.lock);
+    *out = memory.totals;
+    pthread_mutex_unlock(&memory.lock);
+}
+
+static struct {
+    pthread_mutex_t lock;
+    session_resources_t totals;
+} resources = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void add_resources(phase_resources_t *sum, const phase_resources_t *r) {
+    sum->cpu_ns += r->cpu_ns;
+    sum->switches += r->switches;
+    sum->tx_bytes += r->tx_bytes;
+    sum->rx_bytes += r->rx_bytes;
+}
+
+void session_resources_account(const phase_timing_t *timing) {
+    if (!timing->accounted) {
+        return;
+    }
+    phase_resources_t total;
+    phase_resources_total(timing, &total);
+    pthread_mutex_lock(&resources.lock);
+    resources.totals.erases++;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (timing->ran_mask & (1u << i)) {
+            add_resources(&resources.totals.phases[i], &timing->phase_res[i]);
+        }
+    }
+    add_resources(&resources.totals.total, &total);
+    pthread_mutex_unlock(&resources.lock);
+}
+
+void session_resources_get(session_resources_t *out) {
+    pthread_mutex_lock(&resources.lock);
+    *out = resources.totals;
+    pthread_mutex_unlock(&resources.lock);
+}
+
+static void expire_locked(erase_session_t *s) {
+    int phase = s->timing.current;
+    s->timed_out = 1;
+    s->deadline_ns = 0;
+    if (s->deadline_is_budget) {
+        fprintf(stderr, "Error: Deadline of %ums exhausted during %s on device %s.\n",
+                s->budget_ms, phase >= 0 ? phase_name(phase) : "erase", s->udid);
+    } else {
+        fprintf(stderr, "Error: %s timed out after %ums on device %s.\n",
+                phase >= 0 ? phase_name(phase) : "erase",
+                phase >= 0 ? s->profile->timeout_ms[phase] : 0, s->udid);
+    }
+    if (s->device_id) {
+        muxproxy_abort_device(s->device_id);
+    }
+}
+
+static void *watchdog_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&watchdog.lock);
+    while (!watchdog.stopping) {
+        uint64_t now = phase_now_ns();
+        uint64_t next = 0;
+        for (erase_session_t *s = watchdog.sessions; s; s = s->watch_next) {
+            if (s->deadline_ns && s->deadline_ns <= now) {
+                expire_locked(s);
+            } else if (s->deadline_ns && (!next || s->deadline_ns < next)) {
+                next = s->deadline_ns;
+            }
+        }
+        if (!next) {
+            pthread_cond_wait(&watchdog.cond, &watchdog.lock);
+            continue;
+        }
+        struct timespec ts = { (time_t)(next / 1000000000ULL), (long)(next % 1000000000ULL) };
+        pthread_cond_timedwait(&watchdog.cond, &watchdog.lock, &ts);
+    }
+    pthread_mutex_unlock(&watchdog.lock);
+    return NULL;
+}
+
+int watchdog_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    // Deadlines come from phase_now_ns(), which is CLOCK_MONOTONIC
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watchdog.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    watchdog.stopping = 0;
+    if (pthread_create(&watchdog.thread, NULL, watchdog_thread, NULL) != 0) {
+        fprintf(stderr, "Error: Could not start watchdog thread.\n");
+        pthread_cond_destroy(&watchdog.cond);
+        return -1;
+    }
+    watchdog.running = 1;
+    return 0;
+}
+
+void watchdog_stop(void) {
+    if (!watchdog.running) {
+        return;
+    }
+    pthread_mutex_lock(&watchdog.lock);
+    watchdog.stopping = 1;
+    pthread_cond_signal(&watchdog.cond);
+    pthread_mutex_unlock(&watchdog.lock);
+    pthread_join(watchdog.thread, NULL);
+    pthread_cond_destroy(&watchdog.cond);
+    watchdog.running = 0;
+}
+
+void watchdog_add(erase_session_t *session) {
+    pthread_mutex_lock(&watchdog.lock);
+    session->deadline_ns = 0;
+    session->timed_out = 0;
+    session->watch_next = watchdog.sessions;
+    watchdog.sessions = session;
+    pthread_mutex_unlock(&watchdog.lock);
+}
+
+void watchdog_remove(erase_session_t *session) {
+    pthread_mutex_lock(&watchdog.lock);
+    for (erase_session_t **link = &watchdog.sessions; *link; link = &(*link)->watch_next) {
+        if (*link == session) {
+            *link = session->watch_next;
+            break;
+        }
+    }
+    session->watch_next = NULL;
+    pthread_mutex_unlock(&watchdog.lock);
+}
+
+// Relay counters of the session's device; the device is known from the
+// handshake on, which is where its own traffic starts
+static void device_bytes(erase_session_t *session, uint64_t *tx, uint64_t *rx) {
+    if ((session->timing.accounted & PHASE_ACCOUNT_BYTES) && session->device_id) {
+        muxproxy_device_bytes(session->device_id, tx, rx);
+    }
+}
+
+void session_phase_begin(erase_session_t *session, erase_phase_t phase) {
+    uint32_t timeout_ms = session->profile ? session->profile->timeout_ms[phase] : 0;
+    uint64_t tx = 0, rx = 0;
+    device_bytes(session, &tx, &rx);
+    phase_account_begin(&session->timing, tx, rx);
+    flightrec_add(&session->recorder, FLIGHTREC_PHASE_BEGIN, phase, 0, NULL, 0);
+    pthread_mutex_lock(&watchdog.lock);
+    phase_begin(&session->timing, phase);
+    uint64_t deadline = timeout_ms ? session->timing.phase_start_ns + (uint64_t)timeout_ms * 1000000ULL : 0;
+    // Every phase gets what is left of the session's budget at most
+    session->deadline_is_budget = session->budget_end_ns && (!deadline || session->budget_end_ns < deadline);
+    if (session->deadline_is_budget) {
+        deadline = session->budget_end_ns;
+    }
+    if (watchdog.running && deadline) {
+        session->deadline_ns = deadline;
+        pthread_cond_signal(&watchdog.cond);
+    }
+    pthread_mutex_unlock(&watchdog.lock);
+}
+
+void session_phase_end(erase_session_t *session, int ok) {
+    // Only this thread moves timing.current
+    int phase = session->timing.current;
+    pthread_mutex_lock(&watchdog.lock);
+    session->deadline_ns = 0;
+    int outcome = session->timed_out ? 2 : !ok;
+    phase_end(&session->timing, ok && !session->timed_out);
+    pthread_mutex_unlock(&watchdog.lock);
+    flightrec_add(&session->recorder, FLIGHTREC_PHASE_END, phase, outcome, NULL, 0);
+    uint64_t tx = 0, rx = 0;
+    device_bytes(session, &tx, &rx);
+    phase_account_end(&session->timing, phase, tx, rx);
+}
+
+// Index of the hub's entry, added if it is new; -1 if out of memory. An
+// index, not a pointer: adding a hub may move the table.
+static int find_hub_locked(int hub) {
+    for (int i = 0; i < hub_slots.num_hubs; i++) {
+        if (hub_slots.hubs[i].hub == hub) {
+            return i;
+        }
+    }
+    hub_usage_t *grown = realloc(hub_slots.hubs, (hub_slots.num_hubs + 1) * sizeof(hub_usage_t));
+    if (!grown) {
+        return -1;
+    }
+    hub_slots.hubs = grown;
+    hub_slots.hubs[hub_slots.num_hubs] = (hub_usage_t){ hub, 0 };
+    return hub_slots.num_hubs++;
+}
+
+int hub_slot_try_acquire(erase_session_t *session) {
+    if (session->hub < 0) {
+        return 0;
+    }
+    // The cap of the current profile, so a reload applies at the next try
+    const station_profile_t *profile = config_acquire();
+    int cap = profile->hub_cap;
+    config_release(profile);
+    pthread_mutex_lock(&hub_slots.lock);
+    int slot = find_hub_locked(session->hub);
+    int taken = slot < 0 || cap == 0 || hub_slots.hubs[slot].in_use < cap;
+    if (slot < 0) {
+        session->hub = -1;
+    } else if (taken) {
+        hub_slots.hubs[slot].in_use++;
+    }
+    pthread_mutex_unlock(&hub_slots.lock);
+    return taken ? 0 : -1;
+}
+
+void hub_slot_release(erase_session_t *session) {
+    if (session->hub < 0) {
+        return;
+    }
+    pthread_mutex_lock(&hub_slots.lock);
+    int slot = find_hub_locked(session->hub);
+    if (slot >= 0) {
+        hub_slots.hubs[slot].in_use--;
+    }
+    pthread_mutex_unlock(&hub_slots.lock);
+}
@@ -0,0 +1,114 @@
+#ifndef IDEVICEERASE_SESSION_H
+#define IDEVICEERASE_SESSION_H
+
+#include <stdint.h>
+#include <semaphore.h>
+#include <sys/types.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/diagnostics_relay.h>
+
+#include "arena.h"
+#include "certificate.h"
+#include "config.h"
+#include "facts.h"
+#include "flightrec.h"
+#include "lease.h"
+#include "phase.h"
+#include "registry.h"
+#include "scheduler.h"
+#include "wire.h"
+
+// One erase job: the target device and everything recorded while erasing it.
+typedef struct erase_session {
+    const char *udid;
+    erase_priority_t priority;
+    phase_timing_t timing;
+    int result;                         // 0 on success
+    scheduler_job_t job;                // job.data points back at the session
+
+    const station_profile_t *profile;   // snapshot held for the whole erase
+    uint32_t device_id;                 // usbmuxd DeviceID once connected
+    uint32_t location_id;               // USB location of the device, 0 if unknown
+    int hub;                            // usbmux_hub() of the device, -1 if unknown
+    arena_t arena;                      // everything the erase allocates
+    lease_t *lease;                     // claim in --lease-dir while erasing
+    int lease_deferred;                 // requeues because another station held it
+    int hub_deferred;                   // requeues because its hub was at its cap
+    int attempts;                       // attempts made so far
+    int erased_elsewhere;               // another station had already erased it
+    udid_waiter_t coalesce;             // set up when another session has the device
+    int coalesced;                      // result came from that session
+    certificate_t certificate;          // filled in when --certificates is given
+    int erase_ran;                      // perform_erase() was reached
+    int lockdown_reused;                // last attempt skipped the handshake
+    int preflight_passed;               // later attempts skip the preflight
+    int rejected;                       // turned away by --preflight
+    // The current attempt, handed from stage to stage
+    idevice_t device;
+    lockdownd_client_t lockdown;
+    diagnostics_relay_client_t diag;    // owned by the arena; --framing library
+    device_facts_t facts;               // battery, asked for along with the erase request
+    wire_t wire;                        // service connection; its buffer lives as long as the session
+    arena_mark_t attempt_mark;          // arena state before the attempt
+    int attempt_result;                 // 0 on success, set before attempt_done is posted
+    sem_t attempt_done;
+    struct erase_session *station_next; // sessions queued by --station pairing
+    uint32_t budget_ms;                 // --deadline for the whole erase, 0: none
+    uint64_t budget_end_ns;             // when it runs out, set once the slot is taken
+    // Watchdog state, guarded by the watchdog lock
+    uint64_t deadline_ns;               // end of the current phase's timeout, 0: none
+    int deadline_is_budget;             // deadline_ns is budget_end_ns
+    int timed_out;
+    struct erase_session *watch_next;
+    flightrec_t recorder;               // events of the erase, dumped if it fails
+} erase_session_t;
+
+// Per-phase timeouts. While a session is registered, a phase that outlives
+// profile->timeout_ms[phase], or the session's remaining budget if that
+// ends first, gets the session's relayed device connections aborted (see
+// muxproxy_abort_device()), which makes the blocked libimobiledevice call
+// fail. Needs the usbmuxd relay to be running.
+int watchdog_start(void);
+void watchdog_stop(void);
+void watchdog_add(erase_session_t *session);
+void watchdog_remove(erase_session_t *session);
+
+// Memory of all session arenas together. session_memory_hook() is the
+// arena hook; session_memory_account() adds a finished session's counters.
+typedef struct {
+    size_t current;         // bytes held by live arenas
+    size_t peak;            // high-water mark of 'current'
+    size_t session_peak;    // largest single arena
+    uint64_t sessions;
+    uint64_t allocs;        // arena allocations and cleanups, all sessions
+    uint64_t heap_allocs;   // heap chunks behind them
+} session_memory_t;
+
+void session_memory_hook(ssize_t delta_bytes, void *user_data);
+void session_memory_account(const arena_t *arena);
+void session_memory_get(session_memory_t *out);
+
+// Host resources of all accounted erases together (see phase_set_accounting())
+typedef struct {
+    uint64_t erases;
+    phase_resources_t phases[PHASE_COUNT];
+    phase_resources_t total;
+} session_resources_t;
+
+void session_resources_account(const phase_timing_t *timing);
+void session_resources_get(session_resources_t *out);
+
+// phase_begin()/phase_end() on session->timing, arming the phase timeout,
+// taking the phase's resource samples and recording the phase
+void session_phase_begin(erase_session_t *session, erase_phase_t phase);
+void session_phase_end(erase_session_t *session, int ok);
+
+// Per-hub concurrency cap: takes a slot on the session's hub if it has
+// one free under the current profile's hub_cap and returns 0, or returns
+// -1 without waiting. Sessions with hub == -1 are never held back.
+int hub_slot_try_acquire(erase_session_t *session);
+void hub_slot_release(erase_session_t *session);
+
+#endif
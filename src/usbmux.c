@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <plist/plist.h>
+
+#include "usbmux.h"
+
+#define DEFAULT_USBMUXD_SOCKET "/var/run/usbmuxd"
+#define MAX_REPLY_SIZE (4 * 1024 * 1024)
+
+static int connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connect_tcp(const char *host_port) {
+    char host[256];
+    const char *colon = strrchr(host_port, ':');
+    if (!colon || (size_t)(colon - host_port) >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, host_port, colon - host_port);
+    host[colon - host_port] = '\0';
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int usbmux_connect(const char *address) {
+    if (!address || !*address) {
+        return connect_unix(DEFAULT_USBMUXD_SOCKET);
+    }
+    if (strncmp(address, "UNIX:", 5) == 0) {
+        return connect_unix(address + 5);
+    }
+    return connect_tcp(address);
+}
+
+static int io_full(int fd, void *buf, size_t len, int sending) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = sending ? send(fd, p, len, MSG_NOSIGNAL) : recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static uint64_t dict_uint(plist_t dict, const char *key) {
+    uint64_t val = 0;
+    plist_t node = plist_dict_get_item(dict, key);
+    if (node && plist_get_node_type(node) == PLIST_UINT) {
+        plist_get_uint_val(node, &val);
+    }
+    return val;
+}
+
+static int send_request(int fd, const char *type, uint32_t tag) {
+    plist_t req = plist_new_dict();
+    plist_dict_set_item(req, "MessageType", plist_new_string(type));
+    plist_dict_set_item(req, "ClientVersionString", plist_new_string("ideviceerase"));
+    plist_dict_set_item(req, "ProgName", plist_new_string("ideviceerase"));
+    char *xml = NULL;
+    uint32_t xml_len = 0;
+    plist_to_xml(req, &xml, &xml_len);
+    plist_free(req);
+    if (!xml) {
+        return -1;
+    }
+    struct usbmuxd_header hdr = { sizeof(hdr) + xml_len, 1, USBMUXD_MESSAGE_PLIST, tag };
+    int res = io_full(fd, &hdr, sizeof(hdr), 1);
+    if (res == 0) {
+        res = io_full(fd, xml, xml_len, 1);
+    }
+    plist_mem_free(xml);
+    return res;
+}
+
+plist_t usbmux_read_message(int fd) {
+    struct usbmuxd_header hdr;
+    if (io_full(fd, &hdr, sizeof(hdr), 0) < 0 || hdr.length < sizeof(hdr) || hdr.length > MAX_REPLY_SIZE) {
+        return NULL;
+    }
+    uint32_t len = hdr.length - sizeof(hdr);
+    char *buf = malloc(len);
+    if (!buf || io_full(fd, buf, len, 0) < 0) {
+        free(buf);
+        return NULL;
+    }
+    plist_t reply = NULL;
+    plist_from_memory(buf, len, &reply, NULL);
+    free(buf);
+    return reply;
+}
+
+int usbmux_parse_device(plist_t props, usbmux_device_t *out) {
+    plist_t serial = props ? plist_dict_get_item(props, "SerialNumber") : NULL;
+    if (!serial || plist_get_node_type(serial) != PLIST_STRING) {
+        return -1;
+    }
+    plist_t type = plist_dict_get_item(props, "ConnectionType");
+    const char *type_str = type && plist_get_node_type(type) == PLIST_STRING ? plist_get_string_ptr(type, NULL) : NULL;
+    out->device_id = (uint32_t)dict_uint(props, "DeviceID");
+    out->location_id = (uint32_t)dict_uint(props, "LocationID");
+    out->network = type_str && strcmp(type_str, "Network") == 0;
+    snprintf(out->udid, sizeof(out->udid), "%s", plist_get_string_ptr(serial, NULL));
+    return 0;
+}
+
+int usbmux_listen(int fd) {
+    if (send_request(fd, "Listen", 1) < 0) {
+        return -1;
+    }
+    plist_t reply = usbmux_read_message(fd);
+    plist_t number = reply ? plist_dict_get_item(reply, "Number") : NULL;
+    int ok = number && dict_uint(reply, "Number") == 0;
+    plist_free(reply);
+    return ok ? 0 : -1;
+}
+
+int usbmux_list_devices(usbmux_device_t **devices) {
+    *devices = NULL;
+    int fd = usbmux_connect(getenv("USBMUXD_SOCKET_ADDRESS"));
+    if (fd < 0) {
+        return -1;
+    }
+    plist_t reply = send_request(fd, "ListDevices", 1) == 0 ? usbmux_read_message(fd) : NULL;
+    close(fd);
+    plist_t list = reply ? plist_dict_get_item(reply, "DeviceList") : NULL;
+    if (!list || plist_get_node_type(list) != PLIST_ARRAY) {
+        plist_free(reply);
+        return -1;
+    }
+    uint32_t count = plist_array_get_size(list);
+    usbmux_device_t *out = calloc(count ? count : 1, sizeof(usbmux_device_t));
+    if (!out) {
+        plist_free(reply);
+        return -1;
+    }
+    int n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        plist_t props = plist_dict_get_item(plist_array_get_item(list, i), "Properties");
+        if (usbmux_parse_device(props, &out[n]) == 0) {
+            n++;
+        }
+    }
+    plist_free(reply);
+    *devices = out;
+    return n;
+}
@@ -0,0 +1,54 @@
+#ifndef IDEVICEERASE_USBMUX_H
+#define IDEVICEERASE_USBMUX_H
+
+#include <stdint.h>
+
+#include <plist/plist.h>
+
+// Direct access to the usbmuxd protocol for the few things libusbmuxd does
+// not expose, such as where a device is plugged in.
+
+#define USBMUXD_MESSAGE_PLIST 8
+
+// Header of every usbmuxd message, in host byte order; the plist follows
+struct usbmuxd_header {
+    uint32_t length;        // header included
+    uint32_t version;       // 1 for plist messages
+    uint32_t message;
+    uint32_t tag;
+};
+
+typedef struct {
+    uint32_t device_id;    // usbmuxd DeviceID, as used in Connect requests
+    uint32_t location_id;  // USB LocationID: bus << 16 | address; 0 for network
+    int network;           // connected over Wi-Fi sync rather than USB
+    char udid[64];
+} usbmux_device_t;
+
+// Connects to usbmuxd at the given USBMUXD_SOCKET_ADDRESS-style address:
+// "UNIX:<path>", "<host>:<port>", or NULL/empty for /var/run/usbmuxd.
+// Returns a socket or -1.
+int usbmux_connect(const char *address);
+
+// Sends ListDevices to the usbmuxd named by USBMUXD_SOCKET_ADDRESS. Returns
+// the number of devices (and a malloc()ed array in *devices), or -1.
+int usbmux_list_devices(usbmux_device_t **devices);
+
+// Sends Listen on a fresh connection and waits for usbmuxd to accept it.
+// Attached, Detached and Paired messages follow on fd, starting with one
+// Attached for every device already there.
+int usbmux_listen(int fd);
+
+// Reads one message from usbmuxd; NULL on error or end of stream.
+plist_t usbmux_read_message(int fd);
+
+// Fills *out from the Properties of an Attached message or DeviceList
+// entry; -1 if they do not name a device.
+int usbmux_parse_device(plist_t properties, usbmux_device_t *out);
+
+// The hub a device hangs off, as far as usbmuxd tells: its USB bus.
+static inline uint32_t usbmux_hub(uint32_t location_id) {
+    return location_id >> 16;
+}
+
+#endif
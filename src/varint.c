@@ -0,0 +1,30 @@
+#include "varint.h"
+
+void varint_put(FILE *f, uint64_t v) {
+    unsigned char out[10];
+    int n = 0;
+    do {
+        out[n] = v & 0x7f;
+        v >>= 7;
+        if (v) {
+            out[n] |= 0x80;
+        }
+        n++;
+    } while (v);
+    fwrite(out, 1, n, f);
+}
+
+int varint_get(FILE *f, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) {
+            return -1;
+        }
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,16 @@
+#ifndef IDEVICEERASE_VARINT_H
+#define IDEVICEERASE_VARINT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Unsigned LEB128, as used by the capture and plist trace file formats:
+// seven bits per byte, least significant first, high bit set on all but
+// the last byte.
+
+void varint_put(FILE *f, uint64_t v);
+
+// Returns -1 at end of file or on a value longer than 64 bits
+int varint_get(FILE *f, uint64_t *v);
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "wire.h"
+
+#define WIRE_INITIAL_BUFFER 4096
+
+static struct {
+    pthread_mutex_t lock;
+    wire_stats_t totals;
+    uint64_t erases;
+} run = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int reserve(wire_t *w, uint64_t size) {
+    if (size <= w->cap) {
+        return 0;
+    }
+    uint64_t cap = w->cap ? w->cap : WIRE_INITIAL_BUFFER;
+    while (cap < size) {
+        cap *= 2;
+    }
+    char *grown;
+    if (w->arena) {
+        grown = arena_alloc(w->arena, cap);
+        if (grown && w->have) {
+            memcpy(grown, w->buf, w->have);
+        }
+    } else {
+        grown = realloc(w->buf, cap);
+    }
+    if (!grown) {
+        return -1;
+    }
+    // Only bytes not yet consumed are worth counting as moved
+    if (grown != w->buf) {
+        w->stats.bytes_copied += w->have;
+    }
+    w->buf = grown;
+    w->cap = (uint32_t)cap;
+    return 0;
+}
+
+int wire_connect(wire_t *w, idevice_t device, lockdownd_service_descriptor_t service) {
+    w->fd = -1;
+    w->have = 0;
+    if (idevice_connect(device, service->port, &w->conn) != IDEVICE_E_SUCCESS) {
+        w->conn = NULL;
+        return -1;
+    }
+    if (service->ssl_enabled) {
+        if (idevice_connection_enable_ssl(w->conn) != IDEVICE_E_SUCCESS) {
+            wire_disconnect(w);
+            return -1;
+        }
+    } else if (idevice_connection_get_fd(w->conn, &w->fd) != IDEVICE_E_SUCCESS) {
+        // Still works, through idevice_connection_send()
+        w->fd = -1;
+    }
+    return 0;
+}
+
+static int send_plain(wire_t *w, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        // sendmsg() is writev() that cannot raise SIGPIPE
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        ssize_t n = sendmsg(w->fd, &msg, MSG_NOSIGNAL);
+        w->stats.send_calls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Partial write: skip what went out
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int send_buffer(wire_t *w, const char *data, uint32_t len) {
+    while (len > 0) {
+        uint32_t sent = 0;
+        w->stats.send_calls++;
+        if (idevice_connection_send(w->conn, data, len, &sent) != IDEVICE_E_SUCCESS || sent == 0) {
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+int wire_send_all(wire_t *w, const plist_t *plists, int count) {
+    char *bin[WIRE_MAX_BATCH] = { NULL };
+    uint32_t be_len[WIRE_MAX_BATCH];
+    struct iovec iov[2 * WIRE_MAX_BATCH];
+    uint64_t total = 0;
+    int res = 0;
+    if (count < 1 || count > WIRE_MAX_BATCH) {
+        return -1;
+    }
+    for (int i = 0; i < count && res == 0; i++) {
+        uint32_t len = 0;
+        plist_to_bin(plists[i], &bin[i], &len);
+        if (!bin[i]) {
+            res = -1;
+            break;
+        }
+        flightrec_add(w->recorder, FLIGHTREC_SEND, 0, (int32_t)len, bin[i], len);
+        if (w->tap) {
+            w->tap(w->tap_ctx, 1, bin[i], len);
+        }
+        be_len[i] = htonl(len);
+        iov[2 * i] = (struct iovec){ .iov_base = &be_len[i], .iov_len = 4 };
+        iov[2 * i + 1] = (struct iovec){ .iov_base = bin[i], .iov_len = len };
+        total += 4 + len;
+    }
+    if (res < 0) {
+        // Nothing has gone out
+    } else if (w->fd >= 0) {
+        res = send_plain(w, iov, 2 * count);
+    } else if (reserve(w, w->have + total) < 0) {
+        res = -1;
+    } else {
+        // One TLS record for all; behind any unread reply bytes
+        char *out = w->buf + w->have;
+        for (int i = 0; i < 2 * count; i++) {
+            memcpy(out, iov[i].iov_base, iov[i].iov_len);
+            out += iov[i].iov_len;
+        }
+        w->stats.bytes_copied += total;
+        res = send_buffer(w, w->buf + w->have, (uint32_t)total);
+    }
+    for (int i = 0; i < count; i++) {
+        plist_mem_free(bin[i]);
+    }
+    if (res == 0) {
+        w->stats.messages_sent += count;
+    }
+    return res;
+}
+
+int wire_send(wire_t *w, plist_t plist) {
+    return wire_send_all(w, &plist, 1);
+}
+
+// Reads until 'need' bytes are buffered. A plain read takes whatever fits,
+// which is usually the rest of the message; a TLS read waits for exactly
+// what it asks for, so it asks for no more than is needed.
+static int fill(wire_t *w, uint32_t need, unsigned int timeout_ms) {
+    if (reserve(w, need) < 0) {
+        return -1;
+    }
+    while (w->have < need) {
+        uint32_t want = w->fd >= 0 ? w->cap - w->have : need - w->have;
+        uint32_t got = 0;
+        w->stats.recv_calls++;
+        if (idevice_connection_receive_timeout(w->conn, w->buf + w->have, want, &got, timeout_ms) != IDEVICE_E_SUCCESS ||
+            got == 0) {
+            return -1;
+        }
+        w->have += got;
+    }
+    return 0;
+}
+
+int wire_recv(wire_t *w, plist_t *plist, unsigned int timeout_ms) {
+    *plist = NULL;
+    if (fill(w, 4, timeout_ms) < 0) {
+        return -1;
+    }
+    uint32_t be_len;
+    memcpy(&be_len, w->buf, 4);
+    uint32_t len = ntohl(be_len);
+    if (len == 0 || len > WIRE_MAX_MESSAGE || fill(w, 4 + len, timeout_ms) < 0) {
+        return -1;
+    }
+    const char *body = w->buf + 4;
+    flightrec_add(w->recorder, FLIGHTREC_RECV, 0, (int32_t)len, body, len);
+    if (w->tap) {
+        w->tap(w->tap_ctx, 0, body, len);
+    }
+    if (len >= 8 && memcmp(body, "bplist00", 8) == 0) {
+        plist_from_bin(body, len, plist);
+    } else {
+        plist_from_xml(body, len, plist);
+    }
+    uint32_t rest = w->have - 4 - len;
+    if (rest) {
+        memmove(w->buf, w->buf + 4 + len, rest);
+        w->stats.bytes_copied += rest;
+    }
+    w->have = rest;
+    if (!*plist) {
+        return -1;
+    }
+    w->stats.messages_received++;
+    return 0;
+}
+
+void wire_disconnect(wire_t *w) {
+    if (w->conn) {
+        idevice_disconnect(w->conn);
+        w->conn = NULL;
+    }
+    w->fd = -1;
+    w->have = 0;
+}
+
+void wire_free(wire_t *w) {
+    wire_disconnect(w);
+    if (!w->arena) {
+        free(w->buf);
+    }
+    w->buf = NULL;
+    w->cap = 0;
+    if (!w->stats.messages_sent) {
+        return;
+    }
+    pthread_mutex_lock(&run.lock);
+    run.erases++;
+    run.totals.messages_sent += w->stats.messages_sent;
+    run.totals.messages_received += w->stats.messages_received;
+    run.totals.send_calls += w->stats.send_calls;
+    run.totals.recv_calls += w->stats.recv_calls;
+    run.totals.bytes_copied += w->stats.bytes_copied;
+    pthread_mutex_unlock(&run.lock);
+    memset(&w->stats, 0, sizeof(w->stats));
+}
+
+void wire_stats_get(wire_stats_t *out, uint64_t *erases) {
+    pthread_mutex_lock(&run.lock);
+    *out = run.totals;
+    *erases = run.erases;
+    pthread_mutex_unlock(&run.lock);
+}
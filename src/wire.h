@@ -0,0 +1,75 @@
+#ifndef IDEVICEERASE_WIRE_H
+#define IDEVICEERASE_WIRE_H
+
+#include <stdint.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <plist/plist.h>
+
+#include "arena.h"
+#include "flightrec.h"
+
+// Property list service framing of our own, in place of the diagnostics
+// relay client: each message is a 4-byte big-endian length followed by
+// the plist. Requests go out as binary plists; replies may be binary or
+// XML and are parsed straight out of the receive buffer.
+//
+// On a plain service connection a message is written with one vectored
+// send of header and payload on the connection's socket, and a read takes
+// whatever has arrived, so a reply usually costs a single recv(). On a TLS
+// connection header and payload are joined in the buffer and written as
+// one record. The buffer is kept for the life of the wire_t, across
+// messages and attempts. If the wire_t has an arena, the buffer comes from
+// it and counts against its limit; a buffer outgrown is left to the arena.
+
+#define WIRE_RECV_TIMEOUT_MS 30000     // when neither a phase timeout nor a deadline applies
+#define WIRE_MAX_MESSAGE (16 * 1024 * 1024)
+#define WIRE_MAX_BATCH 8
+
+typedef struct {
+    uint64_t messages_sent;
+    uint64_t messages_received;
+    uint64_t send_calls;        // sendmsg()s or TLS writes
+    uint64_t recv_calls;        // reads, TLS or not
+    uint64_t bytes_copied;      // copied in user space after encoding
+} wire_stats_t;
+
+typedef struct {
+    idevice_connection_t conn;
+    int fd;                     // socket for vectored sends, -1 on TLS
+    arena_t *arena;             // where the buffer comes from, the heap if NULL
+    char *buf;
+    uint32_t cap;
+    uint32_t have;              // bytes received but not consumed
+    wire_stats_t stats;
+    flightrec_t *recorder;      // gets every message sent and received, may be NULL
+    // Also gets every message, as the bytes sent or received; may be NULL
+    void (*tap)(void *ctx, int sent, const char *data, uint32_t len);
+    void *tap_ctx;
+} wire_t;
+
+// Connects to the service, with TLS if it asks for it. Returns -1 on failure.
+int wire_connect(wire_t *wire, idevice_t device, lockdownd_service_descriptor_t service);
+
+int wire_send(wire_t *wire, plist_t plist);
+
+// Sends up to WIRE_MAX_BATCH messages with one vectored send (one TLS
+// record), without waiting for replies in between. Their replies come back
+// in order, to as many wire_recv() calls.
+int wire_send_all(wire_t *wire, const plist_t *plists, int count);
+
+// Returns 0 with *plist set, or -1 on a connection error, timeout (0: no
+// timeout) or malformed message.
+int wire_recv(wire_t *wire, plist_t *plist, unsigned int timeout_ms);
+
+// Closes the connection; the buffer stays for the next one
+void wire_disconnect(wire_t *wire);
+
+// Disconnects, frees the buffer and adds the statistics to the run's totals
+void wire_free(wire_t *wire);
+
+// Totals of all wire_free()d wires that sent anything; *erases counts them
+void wire_stats_get(wire_stats_t *out, uint64_t *erases);
+
+#endif
@@ -17,8 +17,8 @@ cleanup() {
 trap cleanup EXIT
 
 # Compile the program using make
-# Check if 'ideviceerase' exists and if 'src/ideviceerase.c' is newer
-if [ ! -f ./ideviceerase ] || [ src/ideviceerase.c -nt ./ideviceerase ] || [ Makefile -nt ./ideviceerase ]; then
+# Check if 'ideviceerase' exists and if any source under src/ is newer
+if [ ! -f ./ideviceerase ] || [ -n "$(find src -name '*.[ch]' -newer ./ideviceerase)" ] || [ Makefile -nt ./ideviceerase ]; then
     echo "Compiling ideviceerase..."
     make clean > /dev/null
     make
@@ -152,6 +152,249 @@ fi
 rm -f test_stdout.txt
 cleanup
 
+# Test Case 7: --timing
+# The connection attempt fails without a device, which must still produce
+# a Timing line naming the failed phase.
+echo -n "Test Case 7: -u <udid> --timing - "
+./ideviceerase -u $DUMMY_UDID --timing > test_stdout.txt 2> $STDERR_FILE
+exit_code=$?
+if ! grep -q "Usage: ./ideviceerase" $STDERR_FILE && grep -q "^Timing: connect=.* total=.*ms status=" test_stdout.txt ; then
+    echo "PASS (Timing line printed)"
+else
+    echo "FAIL (Timing line missing)"
+    echo "Exit code: $exit_code"
+    echo "--- STDOUT ---"
+    cat test_stdout.txt
+    echo "--- STDERR ---"
+    cat $STDERR_FILE
+fi
+rm -f test_stdout.txt
+cleanup
+
+# Test Case 8: Manifest and priority classes
+# Both devices are queued; each attempt fails without a device and is
+# reported with its own Timing line.
+echo -n "Test Case 8: --manifest with --priority - "
+printf '# intake\n%s-A bulk\n' "$DUMMY_UDID" > test_manifest.txt
+./ideviceerase --manifest test_manifest.txt --priority express -u $DUMMY_UDID-B --timing > test_stdout.txt 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && ! grep -q "Usage: ./ideviceerase" $STDERR_FILE && \
+   grep -q "Connecting to device $DUMMY_UDID-A..." test_stdout.txt && grep -q "Connecting to device $DUMMY_UDID-B..." test_stdout.txt && \
+   [ "$(grep -c '^Timing: .* udid=' test_stdout.txt)" -eq 2 ]; then
+    echo "PASS (Both jobs scheduled)"
+else
+    echo "FAIL (Manifest jobs not scheduled as expected)"
+    echo "Exit code: $exit_code"
+    echo "--- STDOUT ---"
+    cat test_stdout.txt
+    echo "--- STDERR ---"
+    cat $STDERR_FILE
+fi
+rm -f test_stdout.txt test_manifest.txt
+cleanup
+
+# Test Case 9: Unknown priority class
+echo -n "Test Case 9: --priority <unknown> - "
+./ideviceerase --priority urgent -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: Unknown priority class 'urgent'." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected unknown priority error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 10: Station profile from a config file that lacks it
+echo -n "Test Case 10: --config with unknown --profile - "
+printf '[default]\nworkers = 2\n' > test_station.conf
+./ideviceerase --config test_station.conf --profile missing -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: No profile 'missing' in test_station.conf." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected missing profile error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+rm -f test_station.conf
+cleanup
+
+# Test Case 11: Device already erased by another station
+# The done marker in the lease directory makes the station skip the
+# device without connecting to it.
+echo -n "Test Case 11: --lease-dir with an erased device - "
+LEASE_DIR=$(mktemp -d)
+echo "other-station:1" > "$LEASE_DIR/$DUMMY_UDID.done"
+./ideviceerase --lease-dir "$LEASE_DIR" -u $DUMMY_UDID > test_stdout.txt 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 0 ] && grep -q "Device $DUMMY_UDID was already erased by another station." test_stdout.txt && \
+   ! grep -q "Connecting to device" test_stdout.txt && [ ! -e "$LEASE_DIR/$DUMMY_UDID.lease" ]; then
+    echo "PASS"
+else
+    echo "FAIL (Expected the device to be skipped, got exit code $exit_code)"
+    cat test_stdout.txt $STDERR_FILE
+fi
+rm -rf "$LEASE_DIR" test_stdout.txt
+cleanup
+
+# Test Case 12: The same device queued twice
+# Only one session connects; the other reports its result.
+echo -n "Test Case 12: duplicate -u <udid> - "
+./ideviceerase -u $DUMMY_UDID -u $DUMMY_UDID > test_stdout.txt 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && [ "$(grep -c "Connecting to device $DUMMY_UDID..." test_stdout.txt)" -eq 1 ] && \
+   grep -q "Device $DUMMY_UDID is already being erased in this run; sharing that result." test_stdout.txt && \
+   grep -q "Erase jobs finished: 0 succeeded, 2 failed." test_stdout.txt; then
+    echo "PASS"
+else
+    echo "FAIL (Expected one session for the device, got exit code $exit_code)"
+    cat test_stdout.txt $STDERR_FILE
+fi
+rm -f test_stdout.txt
+cleanup
+
+# Test Case 13: --certificates without a signing key
+echo -n "Test Case 13: --certificates without --cert-key - "
+./ideviceerase --certificates . -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: --certificates and --cert-key go together." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected missing key error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 14: Compressed run report
+# The failed attempt is recorded as a JSON result line in a gzip archive.
+echo -n "Test Case 14: --report <dir> - "
+REPORT_DIR=$(mktemp -d)
+./ideviceerase --report "$REPORT_DIR" -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && zcat "$REPORT_DIR"/report-*.gz 2> /dev/null | grep -q "^{\"udid\":\"$DUMMY_UDID\",.*\"status\":\"failed:connect\"}$"; then
+    echo "PASS"
+else
+    echo "FAIL (Expected a result line in the report, got exit code $exit_code)"
+    zcat "$REPORT_DIR"/report-*.gz
+    cat $STDERR_FILE
+fi
+rm -rf "$REPORT_DIR"
+cleanup
+
+# Test Case 15: Invalid --deadline
+echo -n "Test Case 15: --deadline 0 - "
+./ideviceerase --deadline 0 -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: --deadline must be greater than 0 and at most 86400 seconds." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected invalid deadline error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 16: Invalid --latency-target
+echo -n "Test Case 16: --adaptive --latency-target 0 - "
+./ideviceerase --adaptive --latency-target 0 -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: --latency-target must be positive." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected invalid latency target error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 17: Invalid --slow-port-ratio
+echo -n "Test Case 17: --port-stats --slow-port-ratio 1 - "
+./ideviceerase --port-stats --slow-port-ratio 1 -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: --slow-port-ratio must be greater than 1." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected invalid slow port ratio error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 18: Unknown stage in --stage-threads
+echo -n "Test Case 18: --stage-threads handshake=4 - "
+./ideviceerase --stage-threads handshake=4 -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: Invalid --stage-threads 'handshake=4'." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected invalid stage threads error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 19: Unknown --connection mode
+echo -n "Test Case 19: --connection bluetooth - "
+./ideviceerase --connection bluetooth -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: Unknown connection mode 'bluetooth'." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected unknown connection mode error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 20: Unknown --preflight rule
+echo -n "Test Case 20: --preflight charger - "
+./ideviceerase --preflight charger -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: Invalid --preflight 'charger'." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected invalid preflight error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 21: --plist-trace in a directory that does not exist
+echo -n "Test Case 21: --plist-trace /nonexistent/trace.plt - "
+./ideviceerase --plist-trace /nonexistent/trace.plt -u $DUMMY_UDID > /dev/null 2> $STDERR_FILE
+exit_code=$?
+if [ $exit_code -eq 1 ] && grep -q "Error: Could not create plist trace /nonexistent/trace.plt." $STDERR_FILE; then
+    echo "PASS"
+else
+    echo "FAIL (Expected plist trace error, got exit code $exit_code)"
+    cat $STDERR_FILE
+fi
+cleanup
+
+# Test Case 22: Native framing round trip against the fleet simulator
+# The simulator decodes the binary requests with libplist and answers in
+# binary; the battery facts only come out right if both directions survive
+# the framing. Device 0 has a 15% battery: 145 cycles, 95% health.
+echo -n "Test Case 22: --framing native against ideviceerase-fleetsim - "
+SIM_DIR=$(mktemp -d)
+SIM_UDID="00008030-F1EE700000000000"
+if make ideviceerase-fleetsim > /dev/null 2>&1; then
+    ./ideviceerase-fleetsim --serve-only --devices 1 --socket "$SIM_DIR/usbmuxd.sock" > /dev/null 2>&1 &
+    SIM_PID=$!
+    for _ in $(seq 50); do
+        [ -S "$SIM_DIR/usbmuxd.sock" ] && break
+        sleep 0.1
+    done
+    USBMUXD_SOCKET_ADDRESS="UNIX:$SIM_DIR/usbmuxd.sock" ./ideviceerase -u $SIM_UDID --framing native --deadline 30 > "$SIM_DIR/out" 2> $STDERR_FILE
+    exit_code=$?
+    kill $SIM_PID 2> /dev/null
+    wait $SIM_PID 2> /dev/null
+    if [ $exit_code -eq 0 ] && grep -q "^Battery: udid=$SIM_UDID level=15% charging=yes cycles=145 health=95%$" "$SIM_DIR/out"; then
+        echo "PASS"
+    else
+        echo "FAIL (Expected the simulated battery facts, got exit code $exit_code)"
+        cat "$SIM_DIR/out" $STDERR_FILE
+    fi
+else
+    echo "FAIL (Could not build ideviceerase-fleetsim)"
+fi
+rm -rf "$SIM_DIR"
+cleanup
+
 echo ""
 echo "=============================================="
 echo "All argument parsing tests completed."
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Compares fixed worker counts with --adaptive against the fleet simulator
+# on a bus that saturates: past --bus-capacity concurrent connections per
+# hub, handshakes slow down, and past twice that they start failing.
+#
+# Usage: tools/bench-adaptive.sh [devices-per-run] [bus-capacity]
+
+DEVICES=${1:-200}
+CAPACITY=${2:-8}
+HUBS=4
+RUNS="4 16 64 adaptive"
+WORKDIR=$(mktemp -d)
+SOCKET="$WORKDIR/usbmuxd.sock"
+
+cleanup() {
+    [ -n "$SIM_PID" ] && kill "$SIM_PID" 2> /dev/null && wait "$SIM_PID" 2> /dev/null
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+make ideviceerase tools > /dev/null || exit 1
+
+TOTAL=$((DEVICES * $(echo $RUNS | wc -w)))
+./ideviceerase-fleetsim --serve-only --devices "$TOTAL" --hubs "$HUBS" --bus-capacity "$CAPACITY" \
+    --socket "$SOCKET" > /dev/null &
+SIM_PID=$!
+for _ in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+
+# Every run erases its own devices; erased ones are away rebooting
+first=0
+for run in $RUNS; do
+    : > "$WORKDIR/manifest"
+    for i in $(seq "$first" $((first + DEVICES - 1))); do
+        printf "00008030-F1EE7%011X\n" "$i" >> "$WORKDIR/manifest"
+    done
+    first=$((first + DEVICES))
+    if [ "$run" = adaptive ]; then
+        echo "=== --adaptive (at most 64 workers) ==="
+        args="--adaptive --workers 64"
+    else
+        echo "=== --workers $run ==="
+        args="--workers $run"
+    fi
+    start=$(date +%s.%N)
+    # shellcheck disable=SC2086
+    USBMUXD_SOCKET_ADDRESS="UNIX:$SOCKET" ./ideviceerase --manifest "$WORKDIR/manifest" \
+        $args --timing 2>&1 | grep -E "^(Concurrency|Erase jobs finished):"
+    echo "Wall time: $(echo "$(date +%s.%N) - $start" | bc)s"
+done
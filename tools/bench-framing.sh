@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Compares the diagnostics service framing of the library with our own
+# against the fleet simulator: relay syscalls per erase, the framing's own
+# send and receive calls and bytes copied, and, when strace is available,
+# the send and receive syscalls the ideviceerase process makes per erase.
+#
+# Usage: tools/bench-framing.sh [devices] [workers]
+
+DEVICES=${1:-200}
+WORKERS=${2:-16}
+WORKDIR=$(mktemp -d)
+SOCKET="$WORKDIR/usbmuxd.sock"
+
+cleanup() {
+    [ -n "$SIM_PID" ] && kill "$SIM_PID" 2> /dev/null && wait "$SIM_PID" 2> /dev/null
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+make ideviceerase tools > /dev/null || exit 1
+
+./ideviceerase-fleetsim --serve-only --devices $((DEVICES * 2)) --socket "$SOCKET" > /dev/null &
+SIM_PID=$!
+for _ in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+
+# Each framing erases its own devices; erased ones are away rebooting
+first=0
+for framing in library native; do
+    : > "$WORKDIR/manifest"
+    for i in $(seq "$first" $((first + DEVICES - 1))); do
+        printf "00008030-F1EE7%011X\n" "$i" >> "$WORKDIR/manifest"
+    done
+    first=$((first + DEVICES))
+    echo "=== framing: $framing ==="
+    RUN=(./ideviceerase --manifest "$WORKDIR/manifest" --workers "$WORKERS" --transport poll --framing "$framing" --timing)
+    if command -v strace > /dev/null; then
+        RUN=(strace -f -c -o "$WORKDIR/strace.$framing" "${RUN[@]}")
+    fi
+    USBMUXD_SOCKET_ADDRESS="UNIX:$SOCKET" "${RUN[@]}" > "$WORKDIR/out.$framing" 2>&1
+    grep -E "^(Framing|Erase jobs finished):" "$WORKDIR/out.$framing"
+    awk -v devices="$DEVICES" '/^Transport:/ {
+             for (i = 1; i <= NF; i++) if ($i ~ /^relay_syscalls=/) { split($i, kv, "="); printf "  Relay syscalls per erase: %.1f\n", kv[2] / devices }
+         }' "$WORKDIR/out.$framing"
+    if [ -f "$WORKDIR/strace.$framing" ]; then
+        # The relay's own calls are in here too; they are the same for both
+        awk -v devices="$DEVICES" '$NF ~ /^(sendmsg|sendto|write|writev|recvfrom|recvmsg|read)$/ { calls += $4 }
+             END { printf "  Send and receive syscalls per erase (strace): %.1f\n", calls / devices }' "$WORKDIR/strace.$framing"
+    fi
+    echo ""
+done
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Compares lockdown handshake latency with and without session reuse
+# against the fleet simulator, with StartService failing half of the time
+# so that most erases need a retry.
+#
+# Usage: tools/bench-handshake.sh [devices] [concurrency]
+
+DEVICES=${1:-200}
+CONCURRENCY=${2:-32}
+WORKDIR=$(mktemp -d)
+
+cleanup() {
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+make ideviceerase tools > /dev/null || exit 1
+
+for ttl in 0 30000; do
+    cat > "$WORKDIR/station.conf" <<CONF
+[default]
+retries = 3
+retry_delay_ms = 0
+lockdown_ttl_ms = $ttl
+CONF
+    echo "=== lockdown_ttl_ms = $ttl ==="
+    ./ideviceerase-fleetsim --devices "$DEVICES" --concurrency "$CONCURRENCY" --seed 42 \
+        --fail start_service=0.5 -- --config "$WORKDIR/station.conf" |
+        grep -E "Erases:|Erase latency|handshake|start_service"
+    echo ""
+done
@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# Runs several ideviceerase stations on one host against the fleet
+# simulator. They share a manifest and a lease directory; the report shows
+# how the devices were split between them and checks that none was erased
+# twice.
+#
+# Usage: tools/bench-lease.sh [devices] [stations] [workers]
+
+DEVICES=${1:-200}
+STATIONS=${2:-4}
+WORKERS=${3:-8}
+WORKDIR=$(mktemp -d)
+SOCKET="$WORKDIR/usbmuxd.sock"
+
+cleanup() {
+    [ -n "$SIM_PID" ] && kill "$SIM_PID" 2> /dev/null && wait "$SIM_PID" 2> /dev/null
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+make ideviceerase tools > /dev/null || exit 1
+
+./ideviceerase-fleetsim --serve-only --devices "$DEVICES" --socket "$SOCKET" > /dev/null &
+SIM_PID=$!
+for _ in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+
+mkdir "$WORKDIR/leases"
+for i in $(seq 0 $((DEVICES - 1))); do
+    printf "00008030-F1EE7%011X\n" "$i"
+done > "$WORKDIR/manifest"
+
+for station in $(seq "$STATIONS"); do
+    USBMUXD_SOCKET_ADDRESS="UNIX:$SOCKET" ./ideviceerase --manifest "$WORKDIR/manifest" \
+        --workers "$WORKERS" --lease-dir "$WORKDIR/leases" --lease-ttl 5 > "$WORKDIR/station.$station" 2>&1 &
+done
+wait $(jobs -p | grep -v "^$SIM_PID$")
+
+for station in $(seq "$STATIONS"); do
+    echo "Station $station: $(grep "^Erase jobs finished:" "$WORKDIR/station.$station")"
+done
+twice=$(cat "$WORKDIR"/station.* | sed -n 's/^Erase process initiated successfully for device \(.*\)\.$/\1/p' | sort | uniq -d | wc -l)
+echo "Devices erased more than once: $twice"
+[ "$twice" -eq 0 ]
@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# Measures the memory of one ideviceerase process erasing 1, 100 and 1000
+# devices at once against the fleet simulator: peak RSS, what the session
+# arenas held, and allocations per erase.
+#
+# Usage: tools/bench-memory.sh [concurrency...]
+
+LEVELS=${*:-1 100 1000}
+WORKDIR=$(mktemp -d)
+SOCKET="$WORKDIR/usbmuxd.sock"
+
+TOTAL=0
+for level in $LEVELS; do
+    TOTAL=$((TOTAL + level))
+done
+
+cleanup() {
+    [ -n "$SIM_PID" ] && kill "$SIM_PID" 2> /dev/null && wait "$SIM_PID" 2> /dev/null
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+make ideviceerase tools > /dev/null || exit 1
+
+./ideviceerase-fleetsim --serve-only --devices "$TOTAL" --socket "$SOCKET" > /dev/null &
+SIM_PID=$!
+for _ in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+
+# Every level erases its own devices; erased ones are away rebooting
+first=0
+for level in $LEVELS; do
+    : > "$WORKDIR/manifest"
+    for i in $(seq "$first" $((first + level - 1))); do
+        printf "00008030-F1EE7%011X\n" "$i" >> "$WORKDIR/manifest"
+    done
+    first=$((first + level))
+    echo "=== $level concurrent sessions ==="
+    USBMUXD_SOCKET_ADDRESS="UNIX:$SOCKET" ./ideviceerase --manifest "$WORKDIR/manifest" \
+        --workers "$level" --timing 2>&1 | grep -E "^(Memory|Erase jobs finished):"
+done
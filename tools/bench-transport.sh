@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# Compares the usbmuxd transports of ideviceerase against the fleet simulator:
+# erase latency, CPU per erase, relay syscalls per erase and, when strace is
+# available, the total number of syscalls each ideviceerase process makes.
+#
+# Usage: tools/bench-transport.sh [devices] [concurrency]
+
+DEVICES=${1:-200}
+CONCURRENCY=${2:-32}
+WORKDIR=$(mktemp -d)
+
+cleanup() {
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+make ideviceerase tools > /dev/null || exit 1
+
+# Wrapper that counts every syscall of one ideviceerase run
+cat > "$WORKDIR/traced" <<WRAPPER
+#!/bin/bash
+exec strace -f -c -o "$WORKDIR/strace.\$\$" "$PWD/ideviceerase" "\$@"
+WRAPPER
+chmod +x "$WORKDIR/traced"
+
+for transport in direct poll uring; do
+    echo "=== transport: $transport ==="
+    ./ideviceerase-fleetsim --devices "$DEVICES" --concurrency "$CONCURRENCY" --seed 42 \
+        -- --transport "$transport"
+    if command -v strace > /dev/null; then
+        rm -f "$WORKDIR"/strace.*
+        ./ideviceerase-fleetsim --devices "$DEVICES" --concurrency "$CONCURRENCY" --seed 42 \
+            --binary "$WORKDIR/traced" -- --transport "$transport" > /dev/null
+        awk '$NF == "total" { calls += $(NF-2); runs++ }
+             END { if (runs) printf "  Total syscalls per erase (strace): %.1f\n", calls / runs }' "$WORKDIR"/strace.*
+    fi
+    echo ""
+done
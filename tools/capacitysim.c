@@ -0,0 +1,666 @@
+// ideviceerase-capacitysim: predicts what a station layout erases in a day.
+//
+// Reads the per-erase timings of real runs, the "Timing:" lines of
+// --timing or the JSON lines of --report, and replays them in a
+// discrete-event simulation of stations with a given number of workers,
+// hubs, ports and per-hub cap, under a stream of arriving devices. Each
+// simulated erase takes the phases of one recorded erase picked at random,
+// so slow handshakes and failures come in the proportions they were seen
+// in. A day of traffic takes well under a second.
+//
+// The model follows ideviceerase: a device takes a port on arrival (or
+// waits for one), is queued for a worker, and the worker holds it until
+// the device's hub is under its cap. After a successful erase the device
+// keeps its port while it reboots.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+
+#include "phase.h"
+
+typedef struct {
+    double total_s;
+    double reboot_s;        // from a "reboot" field, -1 if not recorded
+    int success;
+} sample_t;
+
+typedef struct {
+    int *items;
+    int head;
+    int tail;
+    int cap;
+} fifo_t;
+
+typedef struct {
+    int station;
+    int hub;
+    int sample;
+    double arrive_t;
+    double plug_t;
+    double start_t;
+} device_t;
+
+typedef struct {
+    int workers_idle;
+    int present;            // devices on the station's ports or waiting for one
+    int erasing;
+    int held;               // workers waiting for a hub slot
+    fifo_t intake;          // waiting for a port
+    fifo_t jobs;            // plugged in, waiting for a worker
+    int *ports_used;
+    int *in_use;            // erases running per hub
+    fifo_t *blocked;        // per hub, devices whose worker waits for a slot
+} station_t;
+
+enum { EV_ARRIVE, EV_ERASED, EV_UNPLUG };
+
+typedef struct {
+    double t;
+    unsigned long long seq;
+    int type;
+    int device;
+} event_t;
+
+// Settings
+static int num_stations = 1;
+static int num_workers = 1;
+static int num_hubs = 1;
+static int ports_per_hub = 0;   // 0: a port for every device
+static int hub_cap = 0;         // 0: unlimited
+static double rate = 0;         // arrivals per hour
+static int batch = 0;           // devices all there at the start
+static double hours = 24;
+static double reboot_s = 0;     // when the timings do not say
+static unsigned long long seed = 1;
+
+static sample_t *samples = NULL;
+static int num_samples = 0;
+static int cap_samples = 0;
+
+static event_t *heap = NULL;
+static int heap_len = 0;
+static int heap_cap = 0;
+static unsigned long long event_seq = 0;
+
+static device_t *devices = NULL;
+static int num_devices = 0;
+static int cap_devices = 0;
+static station_t *stations = NULL;
+
+// Results
+static double now = 0;
+static double *waits = NULL;    // arrival to erase start, per started device
+static double *port_waits = NULL;
+static int started = 0;
+static int erased = 0;
+static int failed = 0;
+static int queued = 0;          // devices arrived but not started
+static int peak_queued = 0;
+static int queued_at_end = -1;
+static double last_done_t = 0;
+static double erasing_area = 0; // worker-seconds spent erasing
+static double held_area = 0;    // worker-seconds held by the hub cap
+static double area_t = 0;
+
+static unsigned long long rng_state = 0;
+
+static double rng_uniform(void) {
+    if (rng_state == 0) {
+        rng_state = seed * 0x9E3779B97F4A7C15ULL;
+        if (rng_state == 0) {
+            rng_state = 1;
+        }
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void *resize(void *p, size_t size) {
+    void *grown = realloc(p, size);
+    if (!grown) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    return grown;
+}
+
+static void *grow(void *p, int *cap, size_t size) {
+    int n = *cap ? *cap * 2 : 64;
+    p = resize(p, n * size);
+    *cap = n;
+    return p;
+}
+
+static void fifo_push(fifo_t *q, int v) {
+    if (q->tail == q->cap) {
+        if (q->head > 0) {
+            memmove(q->items, q->items + q->head, (q->tail - q->head) * sizeof(int));
+            q->tail -= q->head;
+            q->head = 0;
+        } else {
+            q->items = grow(q->items, &q->cap, sizeof(int));
+        }
+    }
+    q->items[q->tail++] = v;
+}
+
+static int fifo_pop(fifo_t *q) {
+    return q->head < q->tail ? q->items[q->head++] : -1;
+}
+
+static int fifo_len(const fifo_t *q) {
+    return q->tail - q->head;
+}
+
+// --- recorded timings ---
+
+static void add_sample(double total_ms, double reboot_ms, int success) {
+    if (total_ms <= 0) {
+        return;
+    }
+    if (num_samples == cap_samples) {
+        samples = grow(samples, &cap_samples, sizeof(sample_t));
+    }
+    samples[num_samples++] = (sample_t){ total_ms / 1e3, reboot_ms >= 0 ? reboot_ms / 1e3 : -1, success };
+}
+
+// "Timing: connect=1.234ms ... total=5.678ms status=success [udid=...]"
+static void parse_timing_line(char *line) {
+    double sum_ms = 0, total_ms = -1, reboot_ms = -1;
+    int success = -1;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            continue;
+        }
+        *eq = '\0';
+        if (strcmp(tok, "status") == 0) {
+            success = strcmp(eq + 1, "success") == 0;
+        } else if (strcmp(tok, "total") == 0) {
+            total_ms = strtod(eq + 1, NULL);
+        } else if (strcmp(tok, "reboot") == 0) {
+            reboot_ms = strtod(eq + 1, NULL);
+        } else if (phase_from_name(tok) >= 0) {
+            sum_ms += strtod(eq + 1, NULL);
+        }
+    }
+    if (success >= 0) {
+        add_sample(total_ms >= 0 ? total_ms : sum_ms, reboot_ms, success);
+    }
+}
+
+// {"udid":"...","phases":{"connect":1.234,...},...,"total_ms":...,"status":"success"}
+static void parse_json_line(const char *line) {
+    const char *phases = strstr(line, "\"phases\":{");
+    const char *status = strstr(line, "\"status\":\"");
+    const char *total = strstr(line, "\"total_ms\":");
+    if (!phases || !status) {
+        return;
+    }
+    double sum_ms = 0, reboot_ms = -1;
+    const char *p = phases + 10;
+    const char *end = strchr(p, '}');
+    while (end && p < end) {
+        const char *name = strchr(p, '"');
+        const char *name_end = name ? strchr(name + 1, '"') : NULL;
+        if (!name_end || name_end > end || name_end[1] != ':') {
+            break;
+        }
+        char key[32];
+        snprintf(key, sizeof(key), "%.*s", (int)(name_end - name - 1), name + 1);
+        char *after = NULL;
+        double ms = strtod(name_end + 2, &after);
+        if (strcmp(key, "reboot") == 0) {
+            reboot_ms = ms;
+        } else if (phase_from_name(key) >= 0) {
+            sum_ms += ms;
+        }
+        p = after;
+    }
+    int success = strncmp(status + 10, "success\"", 8) == 0;
+    add_sample(total ? strtod(total + 11, NULL) : sum_ms, reboot_ms, success);
+}
+
+static int read_timings(const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Could not open %s.\n", path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, f) > 0) {
+        char *timing = strstr(line, "Timing:");
+        if (timing) {
+            parse_timing_line(timing + 7);
+        } else if (line[0] == '{') {
+            parse_json_line(line);
+        }
+    }
+    free(line);
+    if (f != stdin) {
+        fclose(f);
+    }
+    return 0;
+}
+
+// --- event queue: binary min-heap on time, then insertion order ---
+
+static int event_before(const event_t *a, const event_t *b) {
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void schedule(double t, int type, int device) {
+    if (heap_len == heap_cap) {
+        heap = grow(heap, &heap_cap, sizeof(event_t));
+    }
+    int i = heap_len++;
+    event_t ev = { t, event_seq++, type, device };
+    while (i > 0 && event_before(&ev, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = ev;
+}
+
+static event_t next_event(void) {
+    event_t top = heap[0];
+    event_t last = heap[--heap_len];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap_len) {
+            break;
+        }
+        if (child + 1 < heap_len && event_before(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!event_before(&heap[child], &last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_len > 0) {
+        heap[i] = last;
+    }
+    return top;
+}
+
+// --- the station model ---
+
+static void advance(double t) {
+    int erasing = 0, held = 0;
+    for (int s = 0; s < num_stations; s++) {
+        erasing += stations[s].erasing;
+        held += stations[s].held;
+    }
+    erasing_area += (t - area_t) * erasing;
+    held_area += (t - area_t) * held;
+    area_t = t;
+    now = t;
+}
+
+static int new_device(double t) {
+    if (num_devices == cap_devices) {
+        devices = grow(devices, &cap_devices, sizeof(device_t));
+        // One wait per device at most
+        waits = resize(waits, cap_devices * sizeof(double));
+        port_waits = resize(port_waits, cap_devices * sizeof(double));
+    }
+    devices[num_devices] = (device_t){ .station = -1, .hub = -1, .arrive_t = t };
+    return num_devices++;
+}
+
+static void start_erase(int d) {
+    device_t *dev = &devices[d];
+    station_t *st = &stations[dev->station];
+    st->in_use[dev->hub]++;
+    st->erasing++;
+    dev->start_t = now;
+    dev->sample = (int)(rng_uniform() * num_samples);
+    waits[started] = now - dev->arrive_t;
+    port_waits[started] = dev->plug_t - dev->arrive_t;
+    started++;
+    queued--;
+    schedule(now + samples[dev->sample].total_s, EV_ERASED, d);
+}
+
+// Idle workers take queued devices in order; a worker whose device's hub
+// is at its cap waits with it
+static void dispatch(station_t *st) {
+    while (st->workers_idle > 0 && fifo_len(&st->jobs) > 0) {
+        int d = fifo_pop(&st->jobs);
+        int hub = devices[d].hub;
+        st->workers_idle--;
+        if (hub_cap && st->in_use[hub] >= hub_cap) {
+            st->held++;
+            fifo_push(&st->blocked[hub], d);
+        } else {
+            start_erase(d);
+        }
+    }
+}
+
+static void plug(station_t *st, int d, int hub) {
+    devices[d].hub = hub;
+    devices[d].plug_t = now;
+    st->ports_used[hub]++;
+    fifo_push(&st->jobs, d);
+    dispatch(st);
+}
+
+static void arrive(int d) {
+    // Devices go to the station and the hub with the fewest devices
+    int s = 0;
+    for (int i = 1; i < num_stations; i++) {
+        if (stations[i].present < stations[s].present) {
+            s = i;
+        }
+    }
+    station_t *st = &stations[s];
+    devices[d].station = s;
+    st->present++;
+    queued++;
+    if (queued > peak_queued) {
+        peak_queued = queued;
+    }
+    int hub = 0;
+    for (int h = 1; h < num_hubs; h++) {
+        if (st->ports_used[h] < st->ports_used[hub]) {
+            hub = h;
+        }
+    }
+    if (ports_per_hub && st->ports_used[hub] >= ports_per_hub) {
+        fifo_push(&st->intake, d);
+        return;
+    }
+    plug(st, d, hub);
+}
+
+static void erased_event(int d) {
+    device_t *dev = &devices[d];
+    station_t *st = &stations[dev->station];
+    const sample_t *sample = &samples[dev->sample];
+    st->in_use[dev->hub]--;
+    st->erasing--;
+    st->workers_idle++;
+    if (sample->success) {
+        erased++;
+    } else {
+        failed++;
+    }
+    last_done_t = now;
+    // The slot goes to a worker already waiting for this hub
+    int waiting = fifo_pop(&st->blocked[dev->hub]);
+    if (waiting >= 0) {
+        st->held--;
+        start_erase(waiting);
+    }
+    dispatch(st);
+    // A failed device is unplugged right away, an erased one after rebooting
+    double reboot = !sample->success ? 0 : sample->reboot_s >= 0 ? sample->reboot_s : reboot_s;
+    schedule(now + reboot, EV_UNPLUG, d);
+}
+
+static void unplug_event(int d) {
+    device_t *dev = &devices[d];
+    station_t *st = &stations[dev->station];
+    st->ports_used[dev->hub]--;
+    st->present--;
+    int next = fifo_pop(&st->intake);
+    if (next >= 0) {
+        plug(st, next, dev->hub);
+    }
+}
+
+static void simulate(void) {
+    stations = calloc(num_stations, sizeof(station_t));
+    for (int s = 0; s < num_stations; s++) {
+        stations[s].workers_idle = num_workers;
+        stations[s].ports_used = calloc(num_hubs, sizeof(int));
+        stations[s].in_use = calloc(num_hubs, sizeof(int));
+        stations[s].blocked = calloc(num_hubs, sizeof(fifo_t));
+    }
+    for (int i = 0; i < batch; i++) {
+        schedule(0, EV_ARRIVE, new_device(0));
+    }
+    double end_t = hours * 3600;
+    if (rate > 0) {
+        schedule(-log(1 - rng_uniform()) * 3600 / rate, EV_ARRIVE, -1);
+    }
+    while (heap_len > 0) {
+        event_t ev = next_event();
+        if (queued_at_end < 0 && ev.t > end_t) {
+            queued_at_end = queued;
+        }
+        advance(ev.t);
+        switch (ev.type) {
+            case EV_ARRIVE:
+                if (ev.device < 0) {
+                    // Poisson arrivals: the next one is drawn as this one comes
+                    int d = new_device(now);
+                    double next = now - log(1 - rng_uniform()) * 3600 / rate;
+                    if (next < end_t) {
+                        schedule(next, EV_ARRIVE, -1);
+                    }
+                    ev.device = d;
+                }
+                arrive(ev.device);
+                break;
+            case EV_ERASED:
+                erased_event(ev.device);
+                break;
+            case EV_UNPLUG:
+                unplug_event(ev.device);
+                break;
+        }
+    }
+    if (queued_at_end < 0) {
+        queued_at_end = 0;
+    }
+}
+
+// --- report ---
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, int n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    int idx = (int)ceil(p / 100.0 * n) - 1;
+    if (idx < 0) {
+        idx = 0;
+    }
+    return sorted[idx < n ? idx : n - 1];
+}
+
+static void print_report(double wall_s) {
+    double mean_s = 0, recorded_reboot_s = 0;
+    int successes = 0, reboots = 0;
+    for (int i = 0; i < num_samples; i++) {
+        mean_s += samples[i].total_s;
+        successes += samples[i].success;
+        if (samples[i].reboot_s >= 0) {
+            recorded_reboot_s += samples[i].reboot_s;
+            reboots++;
+        }
+    }
+    printf("Capacity simulation: %d station(s) x %d worker(s), %d hub(s) each", num_stations, num_workers, num_hubs);
+    if (ports_per_hub) {
+        printf(" with %d port(s)", ports_per_hub);
+    }
+    if (hub_cap) {
+        printf(", %d erase(s) per hub at once", hub_cap);
+    }
+    printf("\n");
+    printf("  Timings: %d recorded erases, %.1f%% succeeded, mean %.3f s", num_samples,
+           100.0 * successes / num_samples, mean_s / num_samples);
+    if (reboots) {
+        printf(", reboot %.1f s (recorded)\n", recorded_reboot_s / reboots);
+    } else {
+        printf(", reboot %.1f s\n", reboot_s);
+    }
+    printf("  Arrivals: %d devices", num_devices);
+    if (rate > 0) {
+        printf(" at %.1f per hour over %.1f h", rate, hours);
+    }
+    if (batch) {
+        printf(", %d at the start", batch);
+    }
+    printf("\n");
+    // Over the time it took to get through them, backlog included
+    double span_h = last_done_t / 3600;
+    printf("  Erases: %d succeeded, %d failed; %.1f per hour", erased, failed, span_h > 0 ? erased / span_h : 0);
+    if (rate > 0 && last_done_t > hours * 3600) {
+        printf(", last one done %.2f h after the end of arrivals", last_done_t / 3600 - hours);
+    }
+    printf("\n");
+    qsort(waits, started, sizeof(double), cmp_double);
+    double mean_wait = 0;
+    for (int i = 0; i < started; i++) {
+        mean_wait += waits[i];
+    }
+    printf("  Queueing delay (s): mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", started ? mean_wait / started : 0,
+           percentile(waits, started, 50), percentile(waits, started, 90), percentile(waits, started, 99),
+           percentile(waits, started, 100));
+    if (ports_per_hub) {
+        qsort(port_waits, started, sizeof(double), cmp_double);
+        printf("  Waiting for a port (s): p50 %.1f  p99 %.1f  max %.1f\n", percentile(port_waits, started, 50),
+               percentile(port_waits, started, 99), percentile(port_waits, started, 100));
+    }
+    printf("  Queue: peak %d device(s)", peak_queued);
+    if (rate > 0) {
+        printf(", %d still waiting when arrivals end", queued_at_end);
+    }
+    printf("\n");
+    double worker_s = (double)num_stations * num_workers * area_t;
+    printf("  Workers: %.1f%% erasing, %.1f%% held by the hub cap\n", worker_s > 0 ? 100 * erasing_area / worker_s : 0,
+           worker_s > 0 ? 100 * held_area / worker_s : 0);
+    printf("  Simulated %.1f h in %.3f s\n", area_t / 3600, wall_s);
+}
+
+static void print_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s (--rate <n> | --devices <n>) [options] [<timings>...]\n", prog_name);
+    fprintf(stderr, "Simulates stations erasing a stream of devices, using erase timings recorded by ideviceerase.\n\n");
+    fprintf(stderr, "Timings are read from the files given, or standard input: \"Timing:\" lines of --timing,\n");
+    fprintf(stderr, "or the JSON lines of --report archives (zcat them first).\n\n");
+    fprintf(stderr, "  -r, --rate <n>            : Devices arriving per hour, at random (Poisson).\n");
+    fprintf(stderr, "  -n, --devices <n>         : Devices all there at the start, like a --manifest.\n");
+    fprintf(stderr, "      --hours <h>           : How long devices arrive for with --rate (default 24).\n");
+    fprintf(stderr, "      --stations <n>        : Stations devices are spread over (default 1).\n");
+    fprintf(stderr, "  -w, --workers <n>         : Erases each station runs at once, as --workers (default 1).\n");
+    fprintf(stderr, "      --hubs <n>            : Hubs per station (default 1).\n");
+    fprintf(stderr, "      --ports-per-hub <n>   : Ports per hub; devices wait for a free one (default unlimited).\n");
+    fprintf(stderr, "      --hub-cap <n>         : Erases per hub at once, as hub_cap (default unlimited).\n");
+    fprintf(stderr, "      --reboot <seconds>    : Time an erased device keeps its port, unless recorded (default 0).\n");
+    fprintf(stderr, "      --seed <n>            : Random seed (default 1).\n");
+}
+
+static int positive(const char *arg, const char *option, double *out) {
+    char *end = NULL;
+    double v = strtod(arg, &end);
+    if (end == arg || *end != '\0' || v < 0) {
+        fprintf(stderr, "Error: Invalid %s '%s'.\n", option, arg);
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    enum { OPT_HOURS = 256, OPT_STATIONS, OPT_HUBS, OPT_PORTS_PER_HUB, OPT_HUB_CAP, OPT_REBOOT, OPT_SEED };
+    static struct option long_options[] = {
+        {"rate",          required_argument, 0, 'r'},
+        {"devices",       required_argument, 0, 'n'},
+        {"workers",       required_argument, 0, 'w'},
+        {"hours",         required_argument, 0, OPT_HOURS},
+        {"stations",      required_argument, 0, OPT_STATIONS},
+        {"hubs",          required_argument, 0, OPT_HUBS},
+        {"ports-per-hub", required_argument, 0, OPT_PORTS_PER_HUB},
+        {"hub-cap",       required_argument, 0, OPT_HUB_CAP},
+        {"reboot",        required_argument, 0, OPT_REBOOT},
+        {"seed",          required_argument, 0, OPT_SEED},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    double v = 0;
+    while ((opt = getopt_long(argc, argv, "r:n:w:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                if (positive(optarg, "--rate", &rate) < 0) {
+                    return 1;
+                }
+                break;
+            case 'n':
+                batch = atoi(optarg);
+                break;
+            case 'w':
+                num_workers = atoi(optarg);
+                break;
+            case OPT_HOURS:
+                if (positive(optarg, "--hours", &hours) < 0) {
+                    return 1;
+                }
+                break;
+            case OPT_STATIONS:
+                num_stations = atoi(optarg);
+                break;
+            case OPT_HUBS:
+                num_hubs = atoi(optarg);
+                break;
+            case OPT_PORTS_PER_HUB:
+                ports_per_hub = atoi(optarg);
+                break;
+            case OPT_HUB_CAP:
+                hub_cap = atoi(optarg);
+                break;
+            case OPT_REBOOT:
+                if (positive(optarg, "--reboot", &v) < 0) {
+                    return 1;
+                }
+                reboot_s = v;
+                break;
+            case OPT_SEED:
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if ((rate <= 0 && batch <= 0) || batch < 0 || num_workers < 1 || num_stations < 1 || num_hubs < 1 ||
+        ports_per_hub < 0 || hub_cap < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (optind == argc) {
+        if (read_timings("-") < 0) {
+            return 1;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        if (read_timings(argv[i]) < 0) {
+            return 1;
+        }
+    }
+    if (num_samples == 0) {
+        fprintf(stderr, "Error: No erase timings found in the input.\n");
+        return 1;
+    }
+
+    uint64_t start_ns = phase_now_ns();
+    simulate();
+    print_report((phase_now_ns() - start_ns) / 1e9);
+    return 0;
+}
@@ -0,0 +1,83 @@
+// ideviceerase-certbench: measures how many erase certificates the signer
+// pool of ideviceerase writes per minute, without any devices.
+//
+// Submits synthetic certificates as fast as one thread can and reports the
+// rate at which the pool signed and wrote them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "certificate.h"
+#include "phase.h"
+
+static void print_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s -k <key.pem> -o <dir> [-n <count>] [-j <threads>]\n", prog_name);
+    fprintf(stderr, "Signs synthetic erase certificates and reports the throughput.\n\n");
+    fprintf(stderr, "  -k, --key <file>       : PEM private key to sign with (mandatory).\n");
+    fprintf(stderr, "  -o, --output <dir>     : Directory for the certificate archives (mandatory).\n");
+    fprintf(stderr, "  -n, --count <n>        : Number of certificates (default 50000).\n");
+    fprintf(stderr, "  -j, --threads <n>      : Signer threads (default: one per CPU).\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *key_path = NULL;
+    const char *dir = NULL;
+    int count = 50000;
+    int threads = 0;
+    static struct option long_options[] = {
+        {"key",     required_argument, 0, 'k'},
+        {"output",  required_argument, 0, 'o'},
+        {"count",   required_argument, 0, 'n'},
+        {"threads", required_argument, 0, 'j'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "k:o:n:j:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                key_path = optarg;
+                break;
+            case 'o':
+                dir = optarg;
+                break;
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!key_path || !dir || count < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (certificates_open(dir, key_path, threads, 64ULL << 20) < 0) {
+        return 1;
+    }
+
+    uint64_t start_ns = phase_now_ns();
+    certificate_t cert;
+    memset(&cert, 0, sizeof(cert));
+    snprintf(cert.outcome, sizeof(cert.outcome), "erased");
+    snprintf(cert.serial, sizeof(cert.serial), "F2LXK0QWHG7F");
+    cert.has_response = 1;
+    for (int i = 0; i < count; i++) {
+        snprintf(cert.udid, sizeof(cert.udid), "00008030-F1EE7%011X", i);
+        snprintf(cert.ecid, sizeof(cert.ecid), "0x%X", 0x1A2B3C00 + i);
+        cert.started_ms = certificate_unix_ms();
+        cert.finished_ms = cert.started_ms + 150;
+        memcpy(cert.response_sha256, &i, sizeof(i));
+        certificate_submit(&cert);
+    }
+    uint64_t written = certificates_close();
+    double secs = (phase_now_ns() - start_ns) / 1e9;
+    printf("Certificates: %llu written in %.3f s, %.0f per minute\n",
+           (unsigned long long)written, secs, secs > 0 ? written * 60.0 / secs : 0);
+    return written == (uint64_t)count ? 0 : 1;
+}
@@ -0,0 +1,1347 @@
+// ideviceerase-fleetsim: load generator for ideviceerase.
+//
+// Simulates a fleet of devices behind a fake usbmuxd socket and drives
+// ideviceerase against it, one process per device, reporting throughput and
+// tail latency. The fake speaks enough of the usbmuxd, lockdown and
+// diagnostics_relay protocols for the unmodified erase flow to run end to
+// end, with sessions left unencrypted (EnableSessionSSL = false).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <plist/plist.h>
+
+#include "phase.h"
+#include "usbmux.h"
+
+extern char **environ;
+
+#define USBMUXD_RESULT_OK 0
+#define USBMUXD_RESULT_BADDEV 2
+#define USBMUXD_RESULT_CONNREFUSED 3
+#define LOCKDOWN_PORT 62078
+#define MAX_DEVICE_CONNS 8
+#define MAX_PLIST_SIZE (4 * 1024 * 1024)
+
+// Latency distributions, all in milliseconds
+typedef enum { DIST_FIXED, DIST_UNIFORM, DIST_NORMAL, DIST_LOGNORMAL, DIST_EXP } dist_kind_t;
+
+typedef struct {
+    dist_kind_t kind;
+    double a, b;
+} dist_t;
+
+// Phases the fake can be told to fail, with their probabilities
+enum { FAIL_CONNECT, FAIL_HANDSHAKE, FAIL_START_SERVICE, FAIL_RECV, FAIL_COUNT };
+static const char *fail_names[FAIL_COUNT] = { "connect", "handshake", "start_service", "recv" };
+
+typedef struct {
+    char udid[44];
+    uint32_t device_id;   // usbmuxd DeviceID, changes on every attach
+    uint32_t location;
+    double slowdown;      // latency factor of its port (--slow-port)
+    int battery;          // percent, reported through the diagnostics relay
+    bool untrusted;       // needs Trust tapped before lockdown sessions work (--untrusted)
+    bool find_my;         // Find My on, as lockdown reports it (--find-my)
+    uint64_t trust_at_ns; // when the user taps Trust, 0: dialog not shown yet
+    bool attached;
+    int erase_count;
+    int conns[MAX_DEVICE_CONNS];
+} sim_device_t;
+
+// Simulation settings
+static int num_devices = 500;
+static int concurrency = 64;
+static int num_hubs = 16;
+static int ports_per_hub = 0;   // devices on a hub share this many ports, 0: one port each
+static int bus_capacity = 0;    // tunnels a hub carries at full speed, 0: unlimited
+#define MAX_SLOW_PORTS 16
+static struct { int device; double factor; } slow_ports[MAX_SLOW_PORTS];
+static int num_slow_ports = 0;
+static double churn_rate = 0.0; // unplug events per second across the fleet
+static double fail_rate[FAIL_COUNT];
+static unsigned long long seed = 1;
+static bool serve_only = false;
+static const char *socket_path = NULL;
+static const char *erase_binary = "./ideviceerase";
+static dist_t connect_latency = { DIST_FIXED, 1, 0 };
+static dist_t handshake_latency = { DIST_LOGNORMAL, 40, 0.5 };
+static dist_t service_latency = { DIST_LOGNORMAL, 15, 0.4 };
+static dist_t recv_latency = { DIST_LOGNORMAL, 80, 0.6 };
+static dist_t reboot_time = { DIST_NORMAL, 30000, 5000 };
+static dist_t replug_time = { DIST_UNIFORM, 1000, 5000 };
+static dist_t trust_delay = { DIST_UNIFORM, 2000, 10000 };
+static double untrusted_share = 0.0;
+static double find_my_share = 0.0;
+
+// Fleet state, guarded by fleet_lock
+static pthread_mutex_t fleet_lock = PTHREAD_MUTEX_INITIALIZER;
+static sim_device_t *fleet = NULL;
+static int *hub_active = NULL;  // open tunnels per hub, indexed by location >> 16
+static uint32_t next_device_id = 1;
+static int *listeners = NULL;
+static int num_listeners = 0;
+// usbmuxd requests served, by kind
+static uint64_t list_requests = 0;
+static uint64_t listen_requests = 0;
+static uint64_t connect_requests = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+// Random numbers: xorshift64*, one state per thread
+static __thread unsigned long long rng_state = 0;
+static unsigned long long rng_counter = 0;
+
+static double rng_uniform(void) {
+    if (rng_state == 0) {
+        rng_state = seed * 0x9E3779B97F4A7C15ULL + __atomic_add_fetch(&rng_counter, 1, __ATOMIC_RELAXED);
+        if (rng_state == 0) {
+            rng_state = 1;
+        }
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_normal(void) {
+    double u1 = rng_uniform(), u2 = rng_uniform();
+    if (u1 < 1e-300) {
+        u1 = 1e-300;
+    }
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static double dist_sample(const dist_t *d) {
+    double v = 0;
+    switch (d->kind) {
+        case DIST_FIXED:
+            v = d->a;
+            break;
+        case DIST_UNIFORM:
+            v = d->a + (d->b - d->a) * rng_uniform();
+            break;
+        case DIST_NORMAL:
+            v = d->a + d->b * rng_normal();
+            break;
+        case DIST_LOGNORMAL:
+            // a is the median, b the sigma of the underlying normal
+            v = d->a * exp(d->b * rng_normal());
+            break;
+        case DIST_EXP:
+            v = -d->a * log(1.0 - rng_uniform());
+            break;
+    }
+    return v < 0 ? 0 : v;
+}
+
+// Parses "fixed:MS", "uniform:MIN,MAX", "normal:MEAN,SD",
+// "lognormal:MEDIAN,SIGMA" or "exp:MEAN".
+static int dist_parse(const char *spec, dist_t *d) {
+    static const struct { const char *name; dist_kind_t kind; int args; } kinds[] = {
+        { "fixed", DIST_FIXED, 1 }, { "uniform", DIST_UNIFORM, 2 }, { "normal", DIST_NORMAL, 2 },
+        { "lognormal", DIST_LOGNORMAL, 2 }, { "exp", DIST_EXP, 1 },
+    };
+    const char *colon = strchr(spec, ':');
+    if (!colon) {
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        if (strlen(kinds[i].name) == (size_t)(colon - spec) && strncmp(spec, kinds[i].name, colon - spec) == 0) {
+            double a = 0, b = 0;
+            int n = sscanf(colon + 1, "%lf,%lf", &a, &b);
+            if (n != kinds[i].args) {
+                return -1;
+            }
+            d->kind = kinds[i].kind;
+            d->a = a;
+            d->b = b;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void sleep_ms(double ms) {
+    if (ms <= 0) {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms / 1000.0);
+    ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1e6);
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = recv(fd, (char *)buf + done, len - done, 0);
+        if (n == 0) {
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = send(fd, (const char *)buf + done, len - done, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// usbmuxd messages: 16-byte header in host byte order, XML plist payload
+
+static int mux_send_plist(int fd, uint32_t tag, plist_t msg) {
+    char *xml = NULL;
+    uint32_t xml_len = 0;
+    plist_to_xml(msg, &xml, &xml_len);
+    if (!xml) {
+        return -1;
+    }
+    struct usbmuxd_header hdr = { sizeof(hdr) + xml_len, 1, USBMUXD_MESSAGE_PLIST, tag };
+    int res = write_full(fd, &hdr, sizeof(hdr));
+    if (res == 0) {
+        res = write_full(fd, xml, xml_len);
+    }
+    plist_mem_free(xml);
+    return res;
+}
+
+static int mux_send_result(int fd, uint32_t tag, uint64_t number) {
+    plist_t msg = plist_new_dict();
+    plist_dict_set_item(msg, "MessageType", plist_new_string("Result"));
+    plist_dict_set_item(msg, "Number", plist_new_uint(number));
+    int res = mux_send_plist(fd, tag, msg);
+    plist_free(msg);
+    return res;
+}
+
+static plist_t mux_recv_plist(int fd, uint32_t *tag) {
+    struct usbmuxd_header hdr;
+    if (read_full(fd, &hdr, sizeof(hdr)) < 0 || hdr.length < sizeof(hdr) || hdr.length > MAX_PLIST_SIZE) {
+        return NULL;
+    }
+    uint32_t len = hdr.length - sizeof(hdr);
+    char *buf = malloc(len);
+    if (!buf || read_full(fd, buf, len) < 0) {
+        free(buf);
+        return NULL;
+    }
+    plist_t msg = NULL;
+    plist_from_memory(buf, len, &msg, NULL);
+    free(buf);
+    *tag = hdr.tag;
+    return msg;
+}
+
+// Lockdown and services: 4-byte big-endian length, then the plist. Replies
+// go out in the format of the request, so ideviceerase's native framing,
+// which sends binary plists, gets binary replies to decode.
+
+static int service_send_plist(int fd, plist_t msg, plist_format_t format) {
+    char *data = NULL;
+    uint32_t len = 0;
+    if (format == PLIST_FORMAT_BINARY) {
+        plist_to_bin(msg, &data, &len);
+    } else {
+        plist_to_xml(msg, &data, &len);
+    }
+    if (!data) {
+        return -1;
+    }
+    uint32_t be_len = htonl(len);
+    int res = write_full(fd, &be_len, 4);
+    if (res == 0) {
+        res = write_full(fd, data, len);
+    }
+    plist_mem_free(data);
+    return res;
+}
+
+static plist_t service_recv_plist(int fd, plist_format_t *format) {
+    uint32_t be_len;
+    if (read_full(fd, &be_len, 4) < 0) {
+        return NULL;
+    }
+    uint32_t len = ntohl(be_len);
+    if (len == 0 || len > MAX_PLIST_SIZE) {
+        return NULL;
+    }
+    char *buf = malloc(len);
+    if (!buf || read_full(fd, buf, len) < 0) {
+        free(buf);
+        return NULL;
+    }
+    plist_t msg = NULL;
+    plist_from_memory(buf, len, &msg, format);
+    free(buf);
+    return msg;
+}
+
+static const char *dict_get_string(plist_t dict, const char *key) {
+    plist_t node = plist_dict_get_item(dict, key);
+    if (!node || plist_get_node_type(node) != PLIST_STRING) {
+        return NULL;
+    }
+    return plist_get_string_ptr(node, NULL);
+}
+
+static uint64_t dict_get_uint(plist_t dict, const char *key) {
+    uint64_t val = 0;
+    plist_t node = plist_dict_get_item(dict, key);
+    if (node && plist_get_node_type(node) == PLIST_UINT) {
+        plist_get_uint_val(node, &val);
+    }
+    return val;
+}
+
+// Fleet management. All of these expect fleet_lock to be held.
+
+static plist_t device_properties(const sim_device_t *dev) {
+    plist_t props = plist_new_dict();
+    plist_dict_set_item(props, "ConnectionSpeed", plist_new_uint(480000000));
+    plist_dict_set_item(props, "ConnectionType", plist_new_string("USB"));
+    plist_dict_set_item(props, "DeviceID", plist_new_uint(dev->device_id));
+    plist_dict_set_item(props, "LocationID", plist_new_uint(dev->location));
+    plist_dict_set_item(props, "ProductID", plist_new_uint(0x12a8));
+    plist_dict_set_item(props, "SerialNumber", plist_new_string(dev->udid));
+    return props;
+}
+
+static plist_t device_attached_message(const sim_device_t *dev) {
+    plist_t msg = plist_new_dict();
+    plist_dict_set_item(msg, "MessageType", plist_new_string("Attached"));
+    plist_dict_set_item(msg, "DeviceID", plist_new_uint(dev->device_id));
+    plist_dict_set_item(msg, "Properties", device_properties(dev));
+    return msg;
+}
+
+static void broadcast_locked(plist_t msg) {
+    for (int i = 0; i < num_listeners; i++) {
+        if (mux_send_plist(listeners[i], 0, msg) < 0) {
+            shutdown(listeners[i], SHUT_RDWR);
+            listeners[i--] = listeners[--num_listeners];
+        }
+    }
+}
+
+static void device_attach_locked(sim_device_t *dev) {
+    dev->device_id = next_device_id++;
+    dev->attached = true;
+    plist_t msg = device_attached_message(dev);
+    broadcast_locked(msg);
+    plist_free(msg);
+}
+
+static void device_detach_locked(sim_device_t *dev) {
+    if (!dev->attached) {
+        return;
+    }
+    dev->attached = false;
+    for (int i = 0; i < MAX_DEVICE_CONNS; i++) {
+        if (dev->conns[i] >= 0) {
+            shutdown(dev->conns[i], SHUT_RDWR);
+        }
+    }
+    plist_t msg = plist_new_dict();
+    plist_dict_set_item(msg, "MessageType", plist_new_string("Detached"));
+    plist_dict_set_item(msg, "DeviceID", plist_new_uint(dev->device_id));
+    broadcast_locked(msg);
+    plist_free(msg);
+}
+
+static sim_device_t *device_by_id_locked(uint32_t device_id) {
+    for (int i = 0; i < num_devices; i++) {
+        if (fleet[i].attached && fleet[i].device_id == device_id) {
+            return &fleet[i];
+        }
+    }
+    return NULL;
+}
+
+static void device_track_conn(sim_device_t *dev, int fd, bool add) {
+    pthread_mutex_lock(&fleet_lock);
+    for (int i = 0; i < MAX_DEVICE_CONNS; i++) {
+        if (add && dev->conns[i] < 0) {
+            dev->conns[i] = fd;
+            break;
+        }
+        if (!add && dev->conns[i] == fd) {
+            dev->conns[i] = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fleet_lock);
+}
+
+// Detached threads for delayed re-attach after reboot or replug
+typedef struct {
+    sim_device_t *dev;
+    double delay_ms;
+} reattach_t;
+
+static void *reattach_thread(void *arg) {
+    reattach_t *r = arg;
+    sleep_ms(r->delay_ms);
+    pthread_mutex_lock(&fleet_lock);
+    if (!r->dev->attached) {
+        device_attach_locked(r->dev);
+    }
+    pthread_mutex_unlock(&fleet_lock);
+    free(r);
+    return NULL;
+}
+
+static void spawn_detached(void *(*fn)(void *), void *arg) {
+    pthread_t th;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    if (pthread_create(&th, &attr, fn, arg) != 0) {
+        fprintf(stderr, "Error: Could not create simulator thread.\n");
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void schedule_reattach(sim_device_t *dev, double delay_ms) {
+    reattach_t *r = malloc(sizeof(*r));
+    if (!r) {
+        return;
+    }
+    r->dev = dev;
+    r->delay_ms = delay_ms;
+    spawn_detached(reattach_thread, r);
+}
+
+// Per-tunnel decision of which phase, if any, will fail. Only the phases
+// that can happen on this kind of tunnel are considered. StartService
+// failures are transient and drawn per request instead.
+static int pick_failure(bool lockdown) {
+    for (int i = 0; i < FAIL_COUNT; i++) {
+        bool relevant = i == FAIL_CONNECT || (lockdown ? i == FAIL_HANDSHAKE : i == FAIL_RECV);
+        if (relevant && fail_rate[i] > 0 && rng_uniform() < fail_rate[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static plist_t pair_record(void) {
+    static const char dummy_pem[] = "-----BEGIN CERTIFICATE-----\nZmxlZXRzaW0=\n-----END CERTIFICATE-----\n";
+    plist_t rec = plist_new_dict();
+    plist_dict_set_item(rec, "DeviceCertificate", plist_new_data(dummy_pem, sizeof(dummy_pem) - 1));
+    plist_dict_set_item(rec, "HostCertificate", plist_new_data(dummy_pem, sizeof(dummy_pem) - 1));
+    plist_dict_set_item(rec, "RootCertificate", plist_new_data(dummy_pem, sizeof(dummy_pem) - 1));
+    plist_dict_set_item(rec, "HostPrivateKey", plist_new_data(dummy_pem, sizeof(dummy_pem) - 1));
+    plist_dict_set_item(rec, "RootPrivateKey", plist_new_data(dummy_pem, sizeof(dummy_pem) - 1));
+    plist_dict_set_item(rec, "HostID", plist_new_string("00000000-0000-0000-0000-F1EE75100000"));
+    plist_dict_set_item(rec, "SystemBUID", plist_new_string("00000000-0000-0000-0000-F1EE75100001"));
+    plist_dict_set_item(rec, "WiFiMACAddress", plist_new_string("00:00:00:00:00:00"));
+    return rec;
+}
+
+static plist_t lockdown_value(const sim_device_t *dev, const char *domain, const char *key) {
+    if (domain && strcmp(domain, "com.apple.mobile.battery") == 0 && !key) {
+        plist_t battery = plist_new_dict();
+        plist_dict_set_item(battery, "BatteryCurrentCapacity", plist_new_uint(dev->battery));
+        plist_dict_set_item(battery, "BatteryIsCharging", plist_new_bool(0));
+        return battery;
+    } else if (domain && strcmp(domain, "com.apple.fmip") == 0 && !key) {
+        plist_t fmip = plist_new_dict();
+        plist_dict_set_item(fmip, "IsAssociated", plist_new_bool(dev->find_my));
+        return fmip;
+    } else if (domain) {
+        return NULL;
+    }
+    if (!key) {
+        plist_t all = plist_new_dict();
+        plist_dict_set_item(all, "ProductVersion", plist_new_string("17.5"));
+        plist_dict_set_item(all, "ProductType", plist_new_string("iPhone14,2"));
+        plist_dict_set_item(all, "UniqueDeviceID", plist_new_string(dev->udid));
+        plist_dict_set_item(all, "ActivationState", plist_new_string("Activated"));
+        return all;
+    }
+    if (strcmp(key, "ProductVersion") == 0) {
+        return plist_new_string("17.5");
+    } else if (strcmp(key, "UniqueDeviceID") == 0 || strcmp(key, "SerialNumber") == 0) {
+        return plist_new_string(dev->udid);
+    } else if (strcmp(key, "UniqueChipID") == 0) {
+        return plist_new_uint(0x1000000 + (dev - fleet));
+    } else if (strcmp(key, "ActivationState") == 0) {
+        return plist_new_string("Activated");
+    }
+    return NULL;
+}
+
+// Saturating bus model (--bus-capacity): a hub carries bus_capacity open
+// tunnels at full speed. Beyond that every transfer on the hub slows down
+// in proportion to the load, and past twice the capacity a share of new
+// connections is refused, as a bus that has run out of bandwidth would.
+static int bus_enter(sim_device_t *dev) {
+    pthread_mutex_lock(&fleet_lock);
+    int active = ++hub_active[dev->location >> 16];
+    pthread_mutex_unlock(&fleet_lock);
+    return active;
+}
+
+static void bus_leave(sim_device_t *dev) {
+    pthread_mutex_lock(&fleet_lock);
+    hub_active[dev->location >> 16]--;
+    pthread_mutex_unlock(&fleet_lock);
+}
+
+static void bus_sleep(sim_device_t *dev, double ms) {
+    ms *= dev->slowdown;
+    if (bus_capacity > 0) {
+        pthread_mutex_lock(&fleet_lock);
+        int active = hub_active[dev->location >> 16];
+        pthread_mutex_unlock(&fleet_lock);
+        if (active > bus_capacity) {
+            ms *= (double)active / bus_capacity;
+        }
+    }
+    sleep_ms(ms);
+}
+
+static void serve_lockdown(int fd, sim_device_t *dev, int failure) {
+    static uint32_t next_port = 49152;
+    plist_t req;
+    plist_format_t format = PLIST_FORMAT_XML;
+    while ((req = service_recv_plist(fd, &format)) != NULL) {
+        const char *request = dict_get_string(req, "Request");
+        if (!request) {
+            plist_free(req);
+            break;
+        }
+        plist_t resp = plist_new_dict();
+        plist_dict_set_item(resp, "Request", plist_new_string(request));
+        bool close_after = false;
+        if (strcmp(request, "QueryType") == 0) {
+            plist_dict_set_item(resp, "Type", plist_new_string("com.apple.mobile.lockdown"));
+        } else if (strcmp(request, "GetValue") == 0) {
+            const char *key = dict_get_string(req, "Key");
+            const char *domain = dict_get_string(req, "Domain");
+            plist_t value = lockdown_value(dev, domain, key);
+            if (key) {
+                plist_dict_set_item(resp, "Key", plist_new_string(key));
+            }
+            if (value) {
+                plist_dict_set_item(resp, "Value", value);
+            } else {
+                plist_dict_set_item(resp, "Error", plist_new_string("MissingValue"));
+            }
+        } else if (strcmp(request, "Pair") == 0 && dev->untrusted) {
+            // The first Pair shows the Trust dialog; the user taps it later
+            pthread_mutex_lock(&fleet_lock);
+            uint64_t now = phase_now_ns();
+            if (!dev->trust_at_ns) {
+                dev->trust_at_ns = now + (uint64_t)(dist_sample(&trust_delay) * 1e6);
+            }
+            if (now < dev->trust_at_ns) {
+                plist_dict_set_item(resp, "Error", plist_new_string("PairingDialogResponsePending"));
+            } else {
+                dev->untrusted = false;
+                plist_t paired = plist_new_dict();
+                plist_dict_set_item(paired, "MessageType", plist_new_string("Paired"));
+                plist_dict_set_item(paired, "DeviceID", plist_new_uint(dev->device_id));
+                broadcast_locked(paired);
+                plist_free(paired);
+            }
+            pthread_mutex_unlock(&fleet_lock);
+        } else if ((strcmp(request, "StartSession") == 0 || strcmp(request, "ValidatePair") == 0) && dev->untrusted) {
+            plist_dict_set_item(resp, "Error", plist_new_string("InvalidHostID"));
+        } else if (strcmp(request, "StartSession") == 0) {
+            bus_sleep(dev, dist_sample(&handshake_latency));
+            if (failure == FAIL_HANDSHAKE) {
+                plist_dict_set_item(resp, "Error", plist_new_string("InvalidHostID"));
+            } else {
+                plist_dict_set_item(resp, "SessionID", plist_new_string("F1EE7510-5E55-1000-0000-000000000000"));
+                plist_dict_set_item(resp, "EnableSessionSSL", plist_new_bool(0));
+            }
+        } else if (strcmp(request, "StartService") == 0) {
+            const char *service = dict_get_string(req, "Service");
+            bus_sleep(dev, dist_sample(&service_latency));
+            if (service) {
+                plist_dict_set_item(resp, "Service", plist_new_string(service));
+            }
+            if (fail_rate[FAIL_START_SERVICE] > 0 && rng_uniform() < fail_rate[FAIL_START_SERVICE]) {
+                plist_dict_set_item(resp, "Error", plist_new_string("ServiceLimit"));
+            } else if (!service || strcmp(service, "com.apple.diagnostics_relay") != 0) {
+                plist_dict_set_item(resp, "Error", plist_new_string("InvalidService"));
+            } else {
+                uint32_t port = __atomic_fetch_add(&next_port, 1, __ATOMIC_RELAXED);
+                plist_dict_set_item(resp, "Port", plist_new_uint(49152 + port % 16384));
+                plist_dict_set_item(resp, "EnableServiceSSL", plist_new_bool(0));
+            }
+        } else if (strcmp(request, "Goodbye") == 0) {
+            close_after = true;
+        } else if (strcmp(request, "StopSession") != 0 && strcmp(request, "ValidatePair") != 0 &&
+                   strcmp(request, "Pair") != 0) {
+            plist_dict_set_item(resp, "Error", plist_new_string("InvalidRequest"));
+        }
+        int res = service_send_plist(fd, resp, format);
+        plist_free(resp);
+        plist_free(req);
+        if (res < 0 || close_after) {
+            break;
+        }
+    }
+}
+
+// {<request>: {...}} for the IORegistry (IOPMPowerSource) and GasGauge queries
+static plist_t battery_diagnostics(const sim_device_t *dev, const char *request) {
+    plist_t entry = plist_new_dict();
+    int cycles = 100 + dev->battery * 3;
+    if (strcmp(request, "IORegistry") == 0) {
+        plist_dict_set_item(entry, "CurrentCapacity", plist_new_uint(dev->battery));
+        plist_dict_set_item(entry, "IsCharging", plist_new_bool(dev->battery < 100));
+        plist_dict_set_item(entry, "ExternalConnected", plist_new_bool(1));
+        plist_dict_set_item(entry, "CycleCount", plist_new_uint(cycles));
+    } else {
+        plist_dict_set_item(entry, "CycleCount", plist_new_uint(cycles));
+        plist_dict_set_item(entry, "DesignCapacity", plist_new_uint(3000));
+        plist_dict_set_item(entry, "FullChargeCapacity", plist_new_uint(3000 - cycles));
+    }
+    plist_t diagnostics = plist_new_dict();
+    plist_dict_set_item(diagnostics, request, entry);
+    return diagnostics;
+}
+
+static void serve_diagnostics(int fd, sim_device_t *dev, int failure) {
+    plist_t req;
+    plist_format_t format = PLIST_FORMAT_XML;
+    while ((req = service_recv_plist(fd, &format)) != NULL) {
+        const char *request = dict_get_string(req, "Request");
+        bool obliterate = request && strcmp(request, "MobileObliterator") == 0;
+        const char *battery_query = !request ? NULL
+                                    : strcmp(request, "IORegistry") == 0 ? "IORegistry"
+                                    : strcmp(request, "GasGauge") == 0 ? "GasGauge" : NULL;
+        plist_free(req);
+        if (obliterate) {
+            bus_sleep(dev, dist_sample(&recv_latency));
+            if (failure == FAIL_RECV) {
+                // The device drops the connection without answering
+                return;
+            }
+        }
+        plist_t resp = plist_new_dict();
+        plist_dict_set_item(resp, "Status", plist_new_string("Success"));
+        if (battery_query) {
+            plist_dict_set_item(resp, "Diagnostics", battery_diagnostics(dev, battery_query));
+        }
+        int res = service_send_plist(fd, resp, format);
+        plist_free(resp);
+        if (obliterate) {
+            // Give the reply a moment to drain, then reboot the device
+            sleep_ms(50);
+            pthread_mutex_lock(&fleet_lock);
+            dev->erase_count++;
+            device_detach_locked(dev);
+            pthread_mutex_unlock(&fleet_lock);
+            schedule_reattach(dev, dist_sample(&reboot_time));
+            return;
+        }
+        if (res < 0) {
+            return;
+        }
+    }
+}
+
+static void serve_tunnel(int fd, uint32_t tag, uint32_t device_id, uint16_t port) {
+    pthread_mutex_lock(&fleet_lock);
+    sim_device_t *dev = device_by_id_locked(device_id);
+    pthread_mutex_unlock(&fleet_lock);
+    if (!dev) {
+        mux_send_result(fd, tag, USBMUXD_RESULT_BADDEV);
+        return;
+    }
+    int failure = pick_failure(port == LOCKDOWN_PORT);
+    int active = bus_enter(dev);
+    if (bus_capacity > 0 && active > 2 * bus_capacity && rng_uniform() < 1.0 - 2.0 * bus_capacity / active) {
+        failure = FAIL_CONNECT;
+    }
+    bus_sleep(dev, dist_sample(&connect_latency));
+    if (failure == FAIL_CONNECT) {
+        mux_send_result(fd, tag, USBMUXD_RESULT_CONNREFUSED);
+    } else if (mux_send_result(fd, tag, USBMUXD_RESULT_OK) == 0) {
+        device_track_conn(dev, fd, true);
+        if (port == LOCKDOWN_PORT) {
+            serve_lockdown(fd, dev, failure);
+        } else {
+            serve_diagnostics(fd, dev, failure);
+        }
+        device_track_conn(dev, fd, false);
+    }
+    bus_leave(dev);
+}
+
+static void serve_listen(int fd, uint32_t tag) {
+    pthread_mutex_lock(&fleet_lock);
+    int *grown = realloc(listeners, (num_listeners + 1) * sizeof(int));
+    if (!grown || mux_send_result(fd, tag, USBMUXD_RESULT_OK) < 0) {
+        if (grown) {
+            listeners = grown;
+        }
+        pthread_mutex_unlock(&fleet_lock);
+        return;
+    }
+    listeners = grown;
+    listeners[num_listeners++] = fd;
+    for (int i = 0; i < num_devices; i++) {
+        if (fleet[i].attached) {
+            plist_t msg = device_attached_message(&fleet[i]);
+            mux_send_plist(fd, 0, msg);
+            plist_free(msg);
+        }
+    }
+    pthread_mutex_unlock(&fleet_lock);
+
+    // Nothing more is expected from the client; wait for it to go away
+    char buf[64];
+    while (recv(fd, buf, sizeof(buf), 0) > 0) {
+    }
+    pthread_mutex_lock(&fleet_lock);
+    for (int i = 0; i < num_listeners; i++) {
+        if (listeners[i] == fd) {
+            listeners[i] = listeners[--num_listeners];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fleet_lock);
+}
+
+static void *client_thread(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    uint32_t tag = 0;
+    plist_t msg;
+    while ((msg = mux_recv_plist(fd, &tag)) != NULL) {
+        const char *type = dict_get_string(msg, "MessageType");
+        int res = 0;
+        if (!type) {
+            res = -1;
+        } else if (strcmp(type, "ListDevices") == 0) {
+            __atomic_add_fetch(&list_requests, 1, __ATOMIC_RELAXED);
+            plist_t resp = plist_new_dict();
+            plist_t list = plist_new_array();
+            pthread_mutex_lock(&fleet_lock);
+            for (int i = 0; i < num_devices; i++) {
+                if (fleet[i].attached) {
+                    plist_array_append_item(list, device_attached_message(&fleet[i]));
+                }
+            }
+            pthread_mutex_unlock(&fleet_lock);
+            plist_dict_set_item(resp, "DeviceList", list);
+            res = mux_send_plist(fd, tag, resp);
+            plist_free(resp);
+        } else if (strcmp(type, "Listen") == 0) {
+            __atomic_add_fetch(&listen_requests, 1, __ATOMIC_RELAXED);
+            plist_free(msg);
+            serve_listen(fd, tag);
+            break;
+        } else if (strcmp(type, "Connect") == 0) {
+            __atomic_add_fetch(&connect_requests, 1, __ATOMIC_RELAXED);
+            // PortNumber is sent in network byte order
+            uint32_t device_id = (uint32_t)dict_get_uint(msg, "DeviceID");
+            uint16_t port = ntohs((uint16_t)dict_get_uint(msg, "PortNumber"));
+            plist_free(msg);
+            serve_tunnel(fd, tag, device_id, port);
+            break;
+        } else if (strcmp(type, "ReadBUID") == 0) {
+            plist_t resp = plist_new_dict();
+            plist_dict_set_item(resp, "BUID", plist_new_string("00000000-0000-0000-0000-F1EE75100001"));
+            res = mux_send_plist(fd, tag, resp);
+            plist_free(resp);
+        } else if (strcmp(type, "ReadPairRecord") == 0) {
+            const char *udid = dict_get_string(msg, "PairRecordID");
+            sim_device_t *dev = NULL;
+            for (int i = 0; udid && i < num_devices; i++) {
+                if (strcmp(fleet[i].udid, udid) == 0) {
+                    dev = &fleet[i];
+                    break;
+                }
+            }
+            if (!dev) {
+                res = mux_send_result(fd, tag, USBMUXD_RESULT_BADDEV);
+            } else {
+                plist_t rec = pair_record();
+                char *xml = NULL;
+                uint32_t xml_len = 0;
+                plist_to_xml(rec, &xml, &xml_len);
+                plist_free(rec);
+                plist_t resp = plist_new_dict();
+                plist_dict_set_item(resp, "PairRecordData", plist_new_data(xml, xml_len));
+                plist_mem_free(xml);
+                res = mux_send_plist(fd, tag, resp);
+                plist_free(resp);
+            }
+        } else {
+            // SavePairRecord, DeletePairRecord and anything else just succeed
+            res = mux_send_result(fd, tag, USBMUXD_RESULT_OK);
+        }
+        plist_free(msg);
+        if (res < 0) {
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *accept_thread(void *arg) {
+    int listen_fd = (int)(intptr_t)arg;
+    while (!stop_requested) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        spawn_detached(client_thread, (void *)(intptr_t)fd);
+    }
+    return NULL;
+}
+
+static void *churn_thread(void *arg) {
+    (void)arg;
+    dist_t gap = { DIST_EXP, 1000.0 / churn_rate, 0 };
+    while (!stop_requested) {
+        sleep_ms(dist_sample(&gap));
+        sim_device_t *dev = &fleet[(int)(rng_uniform() * num_devices) % num_devices];
+        pthread_mutex_lock(&fleet_lock);
+        bool was_attached = dev->attached;
+        device_detach_locked(dev);
+        pthread_mutex_unlock(&fleet_lock);
+        if (was_attached) {
+            schedule_reattach(dev, dist_sample(&replug_time));
+        }
+    }
+    return NULL;
+}
+
+static int start_server(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1024) < 0) {
+        perror("bind/listen");
+        close(fd);
+        return -1;
+    }
+    spawn_detached(accept_thread, (void *)(intptr_t)fd);
+    return fd;
+}
+
+// Driver: one ideviceerase process per device
+
+typedef struct {
+    pid_t pid;
+    int out_fd;
+    int device;
+    uint64_t start_ns;
+    char out[8192];
+    size_t out_len;
+} child_t;
+
+typedef struct {
+    double *latency_ms;   // successful erases
+    int succeeded;
+    int failed;
+    int failed_by_phase[PHASE_COUNT + 1]; // last slot: no timing line
+    double *phase_ms[PHASE_COUNT];
+    int phase_samples[PHASE_COUNT];
+    // From the "Transport:" line: host cost per erase
+    double cpu_ms_sum;
+    double relay_syscalls_sum;
+    int transport_samples;
+} results_t;
+
+static int spawn_erase(child_t *c, int device, char **extra_args, int num_extra) {
+    int pipefd[2];
+    if (pipe(pipefd) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    char **argv = calloc(num_extra + 6, sizeof(char *));
+    if (!argv) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+    int argc = 0;
+    argv[argc++] = (char *)erase_binary;
+    argv[argc++] = "-u";
+    argv[argc++] = fleet[device].udid;
+    argv[argc++] = "--timing";
+    for (int i = 0; i < num_extra; i++) {
+        argv[argc++] = extra_args[i];
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+    posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+    int res = posix_spawn(&c->pid, erase_binary, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    free(argv);
+    close(pipefd[1]);
+    if (res != 0) {
+        fprintf(stderr, "Error: Could not start %s: %s\n", erase_binary, strerror(res));
+        close(pipefd[0]);
+        return -1;
+    }
+    c->out_fd = pipefd[0];
+    c->device = device;
+    c->start_ns = phase_now_ns();
+    c->out_len = 0;
+    return 0;
+}
+
+// Adds up the cpu= and relay_syscalls= fields of a "Transport:" line
+static void record_transport(results_t *r, const char *out) {
+    const char *line = strstr(out, "Transport:");
+    if (!line) {
+        return;
+    }
+    const char *end = strchr(line, '\n');
+    const char *cpu = strstr(line, " cpu=");
+    const char *syscalls = strstr(line, " relay_syscalls=");
+    if (cpu && (!end || cpu < end)) {
+        r->cpu_ms_sum += strtod(cpu + 5, NULL);
+        r->transport_samples++;
+    }
+    if (syscalls && (!end || syscalls < end)) {
+        r->relay_syscalls_sum += strtod(syscalls + 16, NULL);
+    }
+}
+
+// Picks the "Timing:" line out of the child's output and records it
+static void record_child(results_t *r, child_t *c, int status) {
+    double total_ms = (phase_now_ns() - c->start_ns) / 1e6;
+    c->out[c->out_len] = '\0';
+    record_transport(r, c->out);
+    char *line = strstr(c->out, "Timing:");
+    int failed_phase = -1;
+    bool have_timing = line != NULL;
+    bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (line) {
+        char *end = strchr(line, '\n');
+        if (end) {
+            *end = '\0';
+        }
+        char *save = NULL;
+        for (char *tok = strtok_r(line + 7, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+            char *eq = strchr(tok, '=');
+            if (!eq) {
+                continue;
+            }
+            *eq = '\0';
+            if (strcmp(tok, "status") == 0) {
+                if (strncmp(eq + 1, "failed:", 7) == 0) {
+                    failed_phase = phase_from_name(eq + 8);
+                }
+                continue;
+            }
+            int phase = phase_from_name(tok);
+            if (phase >= 0) {
+                r->phase_ms[phase][r->phase_samples[phase]++] = strtod(eq + 1, NULL);
+            }
+        }
+    }
+    if (success) {
+        r->latency_ms[r->succeeded++] = total_ms;
+    } else {
+        r->failed++;
+        r->failed_by_phase[(have_timing && failed_phase >= 0) ? failed_phase : PHASE_COUNT]++;
+    }
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *sorted, int n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    int idx = (int)ceil(p / 100.0 * n) - 1;
+    if (idx < 0) {
+        idx = 0;
+    }
+    return sorted[idx < n ? idx : n - 1];
+}
+
+static void print_report(results_t *r, double wall_s) {
+    printf("Fleet simulation: %d devices, concurrency %d\n", num_devices, concurrency);
+    printf("  Erases: %d succeeded, %d failed", r->succeeded, r->failed);
+    if (r->failed) {
+        printf(" (");
+        bool first = true;
+        for (int i = 0; i <= PHASE_COUNT; i++) {
+            if (r->failed_by_phase[i]) {
+                printf("%s%s %d", first ? "" : ", ", i < PHASE_COUNT ? phase_name(i) : "other", r->failed_by_phase[i]);
+                first = false;
+            }
+        }
+        printf(")");
+    }
+    printf("\n");
+    printf("  Wall time: %.3f s, throughput: %.2f erases/s\n", wall_s, wall_s > 0 ? r->succeeded / wall_s : 0);
+    qsort(r->latency_ms, r->succeeded, sizeof(double), cmp_double);
+    printf("  Erase latency (ms): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           percentile(r->latency_ms, r->succeeded, 50), percentile(r->latency_ms, r->succeeded, 90),
+           percentile(r->latency_ms, r->succeeded, 99), percentile(r->latency_ms, r->succeeded, 99.9),
+           percentile(r->latency_ms, r->succeeded, 100));
+    if (r->transport_samples) {
+        printf("  Host cost per erase: cpu %.3f ms, relay syscalls %.1f\n",
+               r->cpu_ms_sum / r->transport_samples, r->relay_syscalls_sum / r->transport_samples);
+    }
+    printf("  usbmuxd requests: ListDevices %llu, Listen %llu, Connect %llu\n",
+           (unsigned long long)__atomic_load_n(&list_requests, __ATOMIC_RELAXED),
+           (unsigned long long)__atomic_load_n(&listen_requests, __ATOMIC_RELAXED),
+           (unsigned long long)__atomic_load_n(&connect_requests, __ATOMIC_RELAXED));
+    printf("  Per-phase latency (ms):\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        int n = r->phase_samples[i];
+        if (n == 0) {
+            continue;
+        }
+        qsort(r->phase_ms[i], n, sizeof(double), cmp_double);
+        printf("    %-16s p50 %8.1f  p99 %8.1f  max %8.1f\n", phase_name(i),
+               percentile(r->phase_ms[i], n, 50), percentile(r->phase_ms[i], n, 99), percentile(r->phase_ms[i], n, 100));
+    }
+}
+
+static int drive_fleet(char **extra_args, int num_extra) {
+    results_t r;
+    memset(&r, 0, sizeof(r));
+    r.latency_ms = calloc(num_devices, sizeof(double));
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        r.phase_ms[i] = calloc(num_devices, sizeof(double));
+    }
+    child_t *children = calloc(concurrency, sizeof(child_t));
+    struct pollfd *fds = calloc(concurrency, sizeof(struct pollfd));
+    if (!r.latency_ms || !children || !fds) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 1;
+    }
+
+    uint64_t start_ns = phase_now_ns();
+    int next = 0, running = 0;
+    while ((next < num_devices || running > 0) && !stop_requested) {
+        while (running < concurrency && next < num_devices) {
+            if (spawn_erase(&children[running], next++, extra_args, num_extra) == 0) {
+                running++;
+            } else {
+                r.failed++;
+                r.failed_by_phase[PHASE_COUNT]++;
+            }
+        }
+        for (int i = 0; i < running; i++) {
+            fds[i].fd = children[i].out_fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, running, 100) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (int i = running - 1; i >= 0; i--) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            child_t *c = &children[i];
+            size_t room = sizeof(c->out) - 1 - c->out_len;
+            char scratch[4096];
+            ssize_t n = read(c->out_fd, room ? c->out + c->out_len : scratch, room ? room : sizeof(scratch));
+            if (n > 0) {
+                if (room) {
+                    c->out_len += n;
+                }
+                continue;
+            }
+            int status = 0;
+            close(c->out_fd);
+            waitpid(c->pid, &status, 0);
+            record_child(&r, c, status);
+            children[i] = children[--running];
+        }
+    }
+    print_report(&r, (phase_now_ns() - start_ns) / 1e9);
+    free(fds);
+    free(children);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        free(r.phase_ms[i]);
+    }
+    free(r.latency_ms);
+    return r.failed ? 2 : 0;
+}
+
+static void handle_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void print_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s [options] [-- <extra ideviceerase arguments>]\n", prog_name);
+    fprintf(stderr, "Simulates a fleet of devices behind a fake usbmuxd socket and erases them all with ideviceerase.\n\n");
+    fprintf(stderr, "  -n, --devices <count>         : Number of simulated devices (default 500).\n");
+    fprintf(stderr, "  -j, --concurrency <count>     : Concurrent ideviceerase processes (default 64).\n");
+    fprintf(stderr, "  -b, --binary <path>           : ideviceerase binary to drive (default ./ideviceerase).\n");
+    fprintf(stderr, "  -s, --socket <path>           : Path of the fake usbmuxd socket.\n");
+    fprintf(stderr, "      --hubs <count>            : Number of simulated hubs devices are spread over (default 16).\n");
+    fprintf(stderr, "      --bus-capacity <count>    : Tunnels a hub carries at full speed; more slow it down (default unlimited).\n");
+    fprintf(stderr, "      --ports-per-hub <count>   : USB ports per hub the devices take turns on (default one per device).\n");
+    fprintf(stderr, "      --slow-port <n>=<factor>  : Multiply every latency on device n's port by factor (repeatable).\n");
+    fprintf(stderr, "      --connect-latency <dist>  : usbmuxd Connect latency (default fixed:1).\n");
+    fprintf(stderr, "      --handshake-latency <dist>: Lockdown StartSession latency (default lognormal:40,0.5).\n");
+    fprintf(stderr, "      --service-latency <dist>  : Lockdown StartService latency (default lognormal:15,0.4).\n");
+    fprintf(stderr, "      --recv-latency <dist>     : MobileObliterator response latency (default lognormal:80,0.6).\n");
+    fprintf(stderr, "      --untrusted <share>       : Share of devices that start unpaired and need Trust tapped (default 0).\n");
+    fprintf(stderr, "      --find-my <share>         : Share of devices with Find My on, for --preflight findmy (default 0).\n");
+    fprintf(stderr, "      --trust-delay <dist>      : Time until Trust is tapped once the dialog shows (default uniform:2000,10000).\n");
+    fprintf(stderr, "      --reboot-time <dist>      : Time a device is gone after obliterate (default normal:30000,5000).\n");
+    fprintf(stderr, "      --churn <rate>            : Random unplug events per second across the fleet (default 0).\n");
+    fprintf(stderr, "      --replug-time <dist>      : Time before an unplugged device returns (default uniform:1000,5000).\n");
+    fprintf(stderr, "      --fail <phase>=<p>        : Failure probability for connect, handshake, start_service or recv.\n");
+    fprintf(stderr, "      --seed <n>                : Random seed (default 1).\n");
+    fprintf(stderr, "      --serve-only              : Only run the fake usbmuxd until interrupted.\n\n");
+    fprintf(stderr, "Distributions are given as fixed:MS, uniform:MIN,MAX, normal:MEAN,SD, lognormal:MEDIAN,SIGMA or exp:MEAN.\n");
+}
+
+int main(int argc, char *argv[]) {
+    enum {
+        OPT_HUBS = 256, OPT_CONNECT_LAT, OPT_HANDSHAKE_LAT, OPT_SERVICE_LAT, OPT_RECV_LAT,
+        OPT_REBOOT, OPT_CHURN, OPT_REPLUG, OPT_FAIL, OPT_SEED, OPT_SERVE_ONLY, OPT_BUS_CAPACITY, OPT_SLOW_PORT, OPT_PORTS_PER_HUB, OPT_UNTRUSTED, OPT_TRUST_DELAY, OPT_FIND_MY
+    };
+    static struct option long_options[] = {
+        {"devices",           required_argument, 0, 'n'},
+        {"concurrency",       required_argument, 0, 'j'},
+        {"binary",            required_argument, 0, 'b'},
+        {"socket",            required_argument, 0, 's'},
+        {"hubs",              required_argument, 0, OPT_HUBS},
+        {"bus-capacity",      required_argument, 0, OPT_BUS_CAPACITY},
+        {"slow-port",         required_argument, 0, OPT_SLOW_PORT},
+        {"ports-per-hub",     required_argument, 0, OPT_PORTS_PER_HUB},
+        {"untrusted",         required_argument, 0, OPT_UNTRUSTED},
+        {"trust-delay",       required_argument, 0, OPT_TRUST_DELAY},
+        {"find-my",           required_argument, 0, OPT_FIND_MY},
+        {"connect-latency",   required_argument, 0, OPT_CONNECT_LAT},
+        {"handshake-latency", required_argument, 0, OPT_HANDSHAKE_LAT},
+        {"service-latency",   required_argument, 0, OPT_SERVICE_LAT},
+        {"recv-latency",      required_argument, 0, OPT_RECV_LAT},
+        {"reboot-time",       required_argument, 0, OPT_REBOOT},
+        {"churn",             required_argument, 0, OPT_CHURN},
+        {"replug-time",       required_argument, 0, OPT_REPLUG},
+        {"fail",              required_argument, 0, OPT_FAIL},
+        {"seed",              required_argument, 0, OPT_SEED},
+        {"serve-only",        no_argument,       0, OPT_SERVE_ONLY},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:j:b:s:", long_options, NULL)) != -1) {
+        dist_t *dist = NULL;
+        switch (opt) {
+            case 'n':
+                num_devices = atoi(optarg);
+                break;
+            case 'j':
+                concurrency = atoi(optarg);
+                break;
+            case 'b':
+                erase_binary = optarg;
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case OPT_HUBS:
+                num_hubs = atoi(optarg);
+                break;
+            case OPT_BUS_CAPACITY:
+                bus_capacity = atoi(optarg);
+                break;
+            case OPT_PORTS_PER_HUB:
+                ports_per_hub = atoi(optarg);
+                break;
+            case OPT_SLOW_PORT: {
+                char *eq = strchr(optarg, '=');
+                if (!eq || num_slow_ports == MAX_SLOW_PORTS || atof(eq + 1) <= 0) {
+                    fprintf(stderr, "Error: Invalid --slow-port specification: %s\n", optarg);
+                    return 1;
+                }
+                slow_ports[num_slow_ports].device = atoi(optarg);
+                slow_ports[num_slow_ports++].factor = atof(eq + 1);
+                break;
+            }
+            case OPT_CONNECT_LAT:   dist = &connect_latency; break;
+            case OPT_HANDSHAKE_LAT: dist = &handshake_latency; break;
+            case OPT_SERVICE_LAT:   dist = &service_latency; break;
+            case OPT_RECV_LAT:      dist = &recv_latency; break;
+            case OPT_REBOOT:        dist = &reboot_time; break;
+            case OPT_TRUST_DELAY:   dist = &trust_delay; break;
+            case OPT_UNTRUSTED:
+                untrusted_share = atof(optarg);
+                break;
+            case OPT_FIND_MY:
+                find_my_share = atof(optarg);
+                break;
+            case OPT_REPLUG:        dist = &replug_time; break;
+            case OPT_CHURN:
+                churn_rate = atof(optarg);
+                break;
+            case OPT_FAIL: {
+                char *eq = strchr(optarg, '=');
+                int i;
+                for (i = 0; eq && i < FAIL_COUNT; i++) {
+                    if (strncmp(optarg, fail_names[i], eq - optarg) == 0 && fail_names[i][eq - optarg] == '\0') {
+                        fail_rate[i] = atof(eq + 1);
+                        break;
+                    }
+                }
+                if (!eq || i == FAIL_COUNT) {
+                    fprintf(stderr, "Error: Invalid --fail specification: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case OPT_SEED:
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case OPT_SERVE_ONLY:
+                serve_only = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+        if (dist && dist_parse(optarg, dist) < 0) {
+            fprintf(stderr, "Error: Invalid distribution: %s\n", optarg);
+            return 1;
+        }
+    }
+    if (num_devices <= 0 || concurrency <= 0 || num_hubs <= 0) {
+        fprintf(stderr, "Error: Device count, concurrency and hub count must be positive.\n");
+        return 1;
+    }
+
+    char default_socket[108];
+    if (!socket_path) {
+        snprintf(default_socket, sizeof(default_socket), "/tmp/ideviceerase-fleetsim.%d.sock", (int)getpid());
+        socket_path = default_socket;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    fleet = calloc(num_devices, sizeof(sim_device_t));
+    hub_active = calloc(num_hubs + 1, sizeof(int));
+    if (!fleet || !hub_active) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 1;
+    }
+    int devices_per_hub = (num_devices + num_hubs - 1) / num_hubs;
+    if (ports_per_hub <= 0 || ports_per_hub > devices_per_hub) {
+        ports_per_hub = devices_per_hub;
+    }
+    for (int i = 0; i < num_devices; i++) {
+        snprintf(fleet[i].udid, sizeof(fleet[i].udid), "00008030-F1EE7%011X", i);
+        fleet[i].location = ((uint32_t)(i / devices_per_hub + 1) << 16) | (uint32_t)(i % devices_per_hub % ports_per_hub + 1);
+        for (int j = 0; j < MAX_DEVICE_CONNS; j++) {
+            fleet[i].conns[j] = -1;
+        }
+        fleet[i].slowdown = 1.0;
+        fleet[i].battery = 15 + (i * 37) % 86;
+        fleet[i].untrusted = untrusted_share > 0 && rng_uniform() < untrusted_share;
+        fleet[i].find_my = find_my_share > 0 && rng_uniform() < find_my_share;
+        fleet[i].device_id = next_device_id++;
+        fleet[i].attached = true;
+    }
+
+    // A slow port slows down every device that is plugged into it
+    for (int j = 0; j < num_slow_ports; j++) {
+        if (slow_ports[j].device < 0 || slow_ports[j].device >= num_devices) {
+            continue;
+        }
+        uint32_t location = fleet[slow_ports[j].device].location;
+        for (int i = 0; i < num_devices; i++) {
+            if (fleet[i].location == location) {
+                fleet[i].slowdown = slow_ports[j].factor;
+            }
+        }
+    }
+
+    int listen_fd = start_server();
+    if (listen_fd < 0) {
+        return 1;
+    }
+    char address[128];
+    snprintf(address, sizeof(address), "UNIX:%s", socket_path);
+    setenv("USBMUXD_SOCKET_ADDRESS", address, 1);
+    if (churn_rate > 0) {
+        spawn_detached(churn_thread, NULL);
+    }
+
+    int result = 0;
+    if (serve_only) {
+        printf("Fake usbmuxd with %d devices listening; use USBMUXD_SOCKET_ADDRESS=%s\n", num_devices, address);
+        fflush(stdout);
+        while (!stop_requested) {
+            pause();
+        }
+    } else {
+        result = drive_fleet(argv + optind, argc - optind);
+    }
+    stop_requested = 1;
+    close(listen_fd);
+    unlink(socket_path);
+    return result;
+}
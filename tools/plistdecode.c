@@ -0,0 +1,125 @@
+// ideviceerase-plistdecode: renders a plist trace written by
+// `ideviceerase --plist-trace` as XML or JSON.
+//
+// Each plist is printed after a header line giving its time since the start
+// of the trace, the device, the phase and the direction:
+//
+//   # 12.345ms <udid> send sent 42 bytes
+//
+// Records can be picked by device and by phase.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <plist/plist.h>
+
+#include "phase.h"
+#include "plisttrace.h"
+
+static void print_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s -i <trace> [-u <udid>] [-p <phase>] [-f xml|json]\n", prog_name);
+    fprintf(stderr, "Prints the plists of a trace written by ideviceerase --plist-trace.\n\n");
+    fprintf(stderr, "  -i, --input <file>     : Trace to read (mandatory).\n");
+    fprintf(stderr, "  -u, --udid <udid>      : Only plists exchanged with this device.\n");
+    fprintf(stderr, "  -p, --phase <phase>    : Only plists of this phase, e.g. 'send' or 'recv'.\n");
+    fprintf(stderr, "  -f, --format <format>  : 'xml' (default) or 'json'.\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    const char *udid = NULL;
+    int phase = -1;
+    int json = 0;
+    static struct option long_options[] = {
+        {"input",  required_argument, 0, 'i'},
+        {"udid",   required_argument, 0, 'u'},
+        {"phase",  required_argument, 0, 'p'},
+        {"format", required_argument, 0, 'f'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:u:p:f:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                path = optarg;
+                break;
+            case 'u':
+                udid = optarg;
+                break;
+            case 'p':
+                phase = phase_from_name(optarg);
+                if (phase < 0) {
+                    fprintf(stderr, "Error: Unknown phase '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "xml") != 0 && strcmp(optarg, "json") != 0) {
+                    fprintf(stderr, "Error: Unknown format '%s'.\n", optarg);
+                    return 1;
+                }
+                json = strcmp(optarg, "json") == 0;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    plisttrace_reader_t *r = plisttrace_reader_open(path);
+    if (!r) {
+        fprintf(stderr, "Error: Could not read plist trace %s.\n", path);
+        return 1;
+    }
+
+    plisttrace_record_t rec;
+    int status;
+    unsigned long long shown = 0, total = 0;
+    while ((status = plisttrace_read(r, &rec)) > 0) {
+        total++;
+        if ((udid && strcmp(rec.udid, udid) != 0) || (phase >= 0 && rec.phase != phase)) {
+            continue;
+        }
+        shown++;
+        printf("# %.3fms %s %s %s %u bytes\n", rec.time_ns / 1e6, rec.udid,
+               rec.phase >= 0 ? phase_name(rec.phase) : "-",
+               rec.direction == PLISTTRACE_SENT ? "sent" : "received", rec.len);
+        plist_t plist = NULL;
+        if (rec.len >= 8 && memcmp(rec.data, "bplist00", 8) == 0) {
+            plist_from_bin(rec.data, rec.len, &plist);
+        } else {
+            plist_from_xml(rec.data, rec.len, &plist);
+        }
+        char *text = NULL;
+        uint32_t text_len = 0;
+        if (plist) {
+            if (json) {
+                plist_to_json(plist, &text, &text_len, 1);
+            } else {
+                plist_to_xml(plist, &text, &text_len);
+            }
+            plist_free(plist);
+        }
+        if (text) {
+            fwrite(text, 1, text_len, stdout);
+            if (text_len && text[text_len - 1] != '\n') {
+                putchar('\n');
+            }
+            plist_mem_free(text);
+        } else {
+            printf("(not a valid plist)\n");
+        }
+    }
+    plisttrace_reader_close(r);
+    if (status < 0) {
+        fprintf(stderr, "Error: Plist trace %s is corrupt after %llu records.\n", path, total);
+        return 1;
+    }
+    fprintf(stderr, "%llu of %llu plists shown.\n", shown, total);
+    return 0;
+}
@@ -0,0 +1,355 @@
+// ideviceerase-replay: plays a session captured with `ideviceerase --capture`
+// back to a client.
+//
+// The replay server listens on a UNIX socket standing in for usbmuxd. The
+// n-th connection a client opens is served from the n-th connection in the
+// capture: bytes the client sent originally are read (and compared), bytes
+// usbmuxd or the device sent are written back after the original think time,
+// optionally scaled. Sessions that used TLS cannot be replayed past the
+// handshake, since the keys differ on every run.
+
+#define _GNU_SOURCE // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "capture.h"
+#include "usbmux.h"
+
+typedef struct {
+    capture_type_t type;
+    uint64_t time_ns;
+    uint32_t len;
+    char *data;
+} replay_record_t;
+
+typedef struct {
+    uint32_t conn_id;
+    replay_record_t *records;
+    int num_records;
+    int cap_records;
+} replay_conn_t;
+
+typedef struct {
+    replay_conn_t *conn;
+    int fd;
+} replay_job_t;
+
+static replay_conn_t *conns = NULL;
+static int num_conns = 0;
+static double time_scale = 1.0;
+static bool loop_replay = false;
+static unsigned long long mismatched_bytes = 0;
+static int served = 0;
+static int truncated = 0;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t stop_requested = 0;
+
+static replay_conn_t *find_conn(uint32_t conn_id, bool create) {
+    for (int i = num_conns - 1; i >= 0; i--) {
+        if (conns[i].conn_id == conn_id) {
+            return &conns[i];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    replay_conn_t *grown = realloc(conns, (num_conns + 1) * sizeof(replay_conn_t));
+    if (!grown) {
+        return NULL;
+    }
+    conns = grown;
+    memset(&conns[num_conns], 0, sizeof(replay_conn_t));
+    conns[num_conns].conn_id = conn_id;
+    return &conns[num_conns++];
+}
+
+// Loads the capture into per-connection record lists, in OPEN order
+static int load_capture(const char *path) {
+    capture_reader_t *reader = capture_reader_open(path);
+    if (!reader) {
+        fprintf(stderr, "Error: Could not read capture file %s.\n", path);
+        return -1;
+    }
+    capture_record_t rec;
+    int res;
+    while ((res = capture_read(reader, &rec)) == 1) {
+        replay_conn_t *c = find_conn(rec.conn_id, rec.type == CAPTURE_OPEN);
+        if (!c) {
+            continue;
+        }
+        if (c->num_records == c->cap_records) {
+            int cap = c->cap_records ? c->cap_records * 2 : 16;
+            replay_record_t *grown = realloc(c->records, cap * sizeof(replay_record_t));
+            if (!grown) {
+                res = -1;
+                break;
+            }
+            c->records = grown;
+            c->cap_records = cap;
+        }
+        replay_record_t *r = &c->records[c->num_records++];
+        r->type = rec.type;
+        r->time_ns = rec.time_ns;
+        r->len = rec.len;
+        r->data = NULL;
+        if (rec.len) {
+            r->data = malloc(rec.len);
+            if (!r->data) {
+                res = -1;
+                break;
+            }
+            memcpy(r->data, rec.data, rec.len);
+        }
+    }
+    capture_reader_close(reader);
+    if (res < 0) {
+        fprintf(stderr, "Error: Capture file %s is corrupt.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+}
+
+static int read_full(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static bool is_usbmuxd_header(const char *data, uint32_t len, struct usbmuxd_header *hdr) {
+    if (len < sizeof(*hdr)) {
+        return false;
+    }
+    memcpy(hdr, data, sizeof(*hdr));
+    return hdr->version == 1 && hdr->message == 8 && hdr->length >= sizeof(*hdr);
+}
+
+static void *replay_thread(void *arg) {
+    replay_job_t *job = arg;
+    replay_conn_t *c = job->conn;
+    int fd = job->fd;
+    free(job);
+
+    char *scratch = NULL;
+    uint32_t scratch_size = 0;
+    unsigned long long mismatched = 0;
+    uint64_t prev_ns = c->num_records ? c->records[0].time_ns : 0;
+    // usbmuxd tags are per process; answer with whatever tag the client used
+    uint32_t client_tag = 0;
+    bool connect_sent = false, tunneled = false;
+    bool complete = true;
+
+    for (int i = 0; i < c->num_records && !stop_requested; i++) {
+        replay_record_t *r = &c->records[i];
+        if (r->type == CAPTURE_CLOSE) {
+            break;
+        }
+        if (r->type == CAPTURE_CLIENT) {
+            if (r->len > scratch_size) {
+                char *grown = realloc(scratch, r->len);
+                if (!grown) {
+                    complete = false;
+                    break;
+                }
+                scratch = grown;
+                scratch_size = r->len;
+            }
+            if (read_full(fd, scratch, r->len) < 0) {
+                complete = false;
+                break;
+            }
+            for (uint32_t j = 0; j < r->len; j++) {
+                mismatched += scratch[j] != r->data[j];
+            }
+            struct usbmuxd_header hdr;
+            if (!tunneled && is_usbmuxd_header(scratch, r->len, &hdr)) {
+                client_tag = hdr.tag;
+                connect_sent = memmem(scratch, r->len, "<string>Connect</string>", 24) != NULL;
+            }
+            prev_ns = r->time_ns;
+        } else if (r->type == CAPTURE_DEVICE) {
+            sleep_ns((uint64_t)((r->time_ns - prev_ns) * time_scale));
+            struct usbmuxd_header hdr;
+            if (!tunneled && is_usbmuxd_header(r->data, r->len, &hdr) && hdr.tag != 0) {
+                hdr.tag = client_tag;
+                memcpy(r->data, &hdr, sizeof(hdr));
+            }
+            if (write_full(fd, r->data, r->len) < 0) {
+                complete = false;
+                break;
+            }
+            if (connect_sent) {
+                // Everything after the Connect result is raw device traffic
+                tunneled = true;
+            }
+            prev_ns = r->time_ns;
+        }
+    }
+    close(fd);
+    free(scratch);
+
+    pthread_mutex_lock(&stats_lock);
+    mismatched_bytes += mismatched;
+    served++;
+    truncated += !complete;
+    pthread_mutex_unlock(&stats_lock);
+    return NULL;
+}
+
+static void handle_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void print_usage(const char *prog_name) {
+    fprintf(stderr, "Usage: %s -c <capture_file> -s <socket_path> [--time-scale <factor>] [--loop]\n", prog_name);
+    fprintf(stderr, "Replays a session recorded with 'ideviceerase --capture' to a client.\n\n");
+    fprintf(stderr, "  -c, --capture <file>       : Capture file to replay (mandatory).\n");
+    fprintf(stderr, "  -s, --socket <path>        : UNIX socket to serve on (mandatory).\n");
+    fprintf(stderr, "  -t, --time-scale <factor>  : Multiply recorded delays by this factor (default 1.0, 0 = no delay).\n");
+    fprintf(stderr, "  -l, --loop                 : Start over after the last recorded connection was served.\n\n");
+    fprintf(stderr, "Point the client at the server with USBMUXD_SOCKET_ADDRESS=UNIX:<socket_path>.\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *capture_path = NULL;
+    const char *socket_path = NULL;
+    static struct option long_options[] = {
+        {"capture",    required_argument, 0, 'c'},
+        {"socket",     required_argument, 0, 's'},
+        {"time-scale", required_argument, 0, 't'},
+        {"loop",       no_argument,       0, 'l'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:s:t:l", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                capture_path = optarg;
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 't':
+                time_scale = atof(optarg);
+                break;
+            case 'l':
+                loop_replay = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!capture_path || !socket_path || time_scale < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (load_capture(capture_path) < 0) {
+        return 1;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (listen_fd < 0 || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Could not create socket %s.\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0) {
+        fprintf(stderr, "Error: Could not listen on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal; // no SA_RESTART, so accept() returns
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Replaying %d connections from %s on %s (time scale %.2f)\n", num_conns, capture_path, socket_path, time_scale);
+    fflush(stdout);
+
+    pthread_t *threads = calloc(num_conns ? num_conns : 1, sizeof(pthread_t));
+    int next = 0, started = 0;
+    while (!stop_requested && threads) {
+        if (next == num_conns) {
+            if (!loop_replay) {
+                break;
+            }
+            for (int i = 0; i < started; i++) {
+                pthread_join(threads[i], NULL);
+            }
+            next = started = 0;
+        }
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        replay_job_t *job = malloc(sizeof(*job));
+        if (!job) {
+            close(fd);
+            continue;
+        }
+        job->conn = &conns[next++];
+        job->fd = fd;
+        if (pthread_create(&threads[started], NULL, replay_thread, job) == 0) {
+            started++;
+        } else {
+            close(fd);
+            free(job);
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+
+    printf("Served %d connections (%d ended early), %llu bytes differed from the capture.\n",
+           served, truncated, mismatched_bytes);
+    return (truncated || mismatched_bytes) ? 2 : 0;
+}